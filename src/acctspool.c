@@ -0,0 +1,1335 @@
+
+/*
+ * acctspool.c
+ *
+ * Durable spool for RADIUS accounting requests.
+ *
+ * Instead of a thread per accounting request, which piles up when the
+ * accounting servers are slow, requests are serialized into an append
+ * only ring kept in a memory mapped file. A single sender thread drains
+ * it, keeping a batch of requests in flight at a time and pacing them to
+ * a configured rate. Requests are removed from the spool only when a
+ * server has answered them, so whatever was not sent when the daemon
+ * exits (including the Stops of the shutdown itself) is sent after
+ * the next start.
+ *
+ * Records hold the data RadiusAccount() would take from the link, along
+ * with the RADIUS configuration of the link, so they can be sent long
+ * after the link is gone. Shared secrets are not written to the file,
+ * servers are recorded by name and port and their secrets are looked up
+ * in the configuration when the record is sent.
+ *
+ * A request a link has to send itself, the Start it depends on or one
+ * that did not fit, holds back the later records of its session until
+ * it is done, and waits for the earlier ones to be answered first.
+ */
+
+#include "ppp.h"
+#include "auth.h"
+#include "radius.h"
+#include "acctspool.h"
+#include "util.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define ACCTSPOOL_MAGIC	0x4d504453	/* "MPDS" */
+  #define ACCTSPOOL_VERSION	1
+  #define ACCTSPOOL_HDR_SIZE	64		/* Record area offset */
+  #define ACCTSPOOL_RETRY_MIN	5		/* Seconds after failure */
+  #define ACCTSPOOL_RETRY_MAX	60
+  #define ACCTSPOOL_WINDOW	10		/* Drain rate window */
+  #define ACCTSPOOL_WAITS	256		/* Records skipped per scan */
+
+  struct acctspool_header {
+    uint32_t	magic;
+    uint32_t	version;
+    uint64_t	size;		/* Size of the record area */
+    uint64_t	head;		/* Offset of the oldest record */
+    uint64_t	tail;		/* Offset past the newest record */
+    uint64_t	seq;		/* Number of the newest record */
+    uint64_t	count;		/* Records not answered yet */
+  };
+
+  /* Offsets grow forever, records live at offset modulo size */
+  struct acctspool_rec {
+    uint32_t	len;		/* Whole record, multiple of 8 */
+    uint32_t	flags;
+#define AS_F_ACKED	0x01		/* Answered by a server */
+#define AS_F_WRAP	0x02		/* Filler up to the end of area */
+    uint64_t	seq;
+    int64_t	when;		/* Time of the accounting event */
+  };
+
+  /* Record contents: tag, length, value */
+  enum {
+    AS_ACCT_TYPE = 1,
+    AS_AUTHNAME,
+    AS_AUTHENTIC,
+    AS_SESSION_ID,
+    AS_MSESSION_ID,
+    AS_LNKNAME,
+    AS_BUNDNAME,
+    AS_IFNAME,
+    AS_IFINDEX,
+    AS_PEER_IDENT,
+    AS_LINK_ID,
+    AS_N_LINKS,
+    AS_ORIGINATE,
+    AS_PHYS_TYPE,
+    AS_PEER_ADDR,
+    AS_PEER_ADDR6,
+    AS_STATS,
+    AS_LAST_UP,
+    AS_DOWN_REASON,
+    AS_NETMASK,
+    AS_STATE,
+    AS_CLASS,
+    AS_CALLINGNUM,
+    AS_CALLEDNUM,
+    AS_PEERIFACE,
+    AS_SELFADDR,
+    AS_PEERADDR,
+    AS_SELFNAME,
+    AS_PEERNAME,
+    AS_STD_ACCT_IN,
+    AS_STD_ACCT_OUT,
+    AS_SVC_IN,
+    AS_SVC_OUT,
+    AS_RAD_TIMEOUT,
+    AS_RAD_RETRIES,
+    AS_RAD_SRC_ADDR,
+    AS_RAD_ME,
+    AS_RAD_MEV6,
+    AS_RAD_IDENTIFIER,
+    AS_RAD_FILE,
+    AS_RAD_OPTIONS,
+    AS_RAD_SERVER,
+    AS_RAD_STRATEGY,
+    AS_RAD_HOLDDOWN,
+    AS_RAD_HOLDDOWN_FAILS
+  };
+
+  struct asbuf {
+    u_char	*buf;
+    size_t	len;
+    size_t	size;
+  };
+
+  /* Secret of a configured accounting server */
+  struct acctspool_secret {
+    char		*host;
+    in_port_t		port;
+    char		*secret;
+    SLIST_ENTRY(acctspool_secret) next;
+  };
+
+  /* Session whose request is sent by the link itself */
+  struct acctspool_hold {
+    char		session_id[AUTH_MAX_SESSIONID];
+    uint64_t		seq;		/* Newest record sent before it */
+    SLIST_ENTRY(acctspool_hold) next;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	AcctSpoolStart(void);
+  static void	AcctSpoolStop(void);
+  static void	*AcctSpoolMain(void *arg);
+  static struct acctspool_rec	*AcctSpoolRec(uint64_t off);
+  static int	AcctSpoolCheck(void);
+  static void	AcctSpoolAdvance(void);
+  static void	AcctSpoolPut(struct asbuf *b, int tag, const void *data, size_t len);
+  static void	AcctSpoolPutStr(struct asbuf *b, int tag, const char *str);
+  static void	AcctSpoolEncode(struct asbuf *b, AuthData auth);
+  static AuthData	AcctSpoolDecode(const struct acctspool_rec *r,
+			    int *unknown);
+  static void	AcctSpoolFree(AuthData auth);
+  static const char	*AcctSpoolSecret(const char *host, in_port_t port);
+  static int	AcctSpoolRecSession(const struct acctspool_rec *r,
+		    const char *session_id);
+  static int	AcctSpoolHeld(const char *session_id, uint64_t seq);
+  static int	AcctSpoolPending(const char *session_id, uint64_t seq);
+  static void	AcctSpoolUnlock(void *arg);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gAcctSpoolRate = ACCTSPOOL_DEFAULT_RATE;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct acctspool_header	*gAcctSpool;
+  static size_t			gAcctSpoolSize;
+  static char			gAcctSpoolPath[PATH_MAX];
+  static pthread_mutex_t	gAcctSpoolMutex = PTHREAD_MUTEX_INITIALIZER;
+  static pthread_cond_t		gAcctSpoolCond = PTHREAD_COND_INITIALIZER;
+  static pthread_cond_t		gAcctSpoolAckCond = PTHREAD_COND_INITIALIZER;
+  static SLIST_HEAD(, acctspool_secret)	gAcctSpoolSecrets =
+				    SLIST_HEAD_INITIALIZER(gAcctSpoolSecrets);
+  static SLIST_HEAD(, acctspool_hold)	gAcctSpoolHolds =
+				    SLIST_HEAD_INITIALIZER(gAcctSpoolHolds);
+  static pthread_t		gAcctSpoolThread;
+  static u_char			gAcctSpoolRunning;
+  static u_char			gAcctSpoolStopping;
+
+  static uint64_t		gAcctSpoolAppended;
+  static uint64_t		gAcctSpoolAcked;
+  static uint64_t		gAcctSpoolFailed;
+  static uint64_t		gAcctSpoolRetries;
+  static uint64_t		gAcctSpoolFull;
+  static uint64_t		gAcctSpoolBad;
+  static time_t			gAcctSpoolWinStart;
+  static uint64_t		gAcctSpoolWinAcked;
+  static uint64_t		gAcctSpoolDrainRate;
+
+/*
+ * AcctSpoolOpen()
+ *
+ * Map the spool file, creating it with a record area of the given
+ * size if needed. An existing spool is reused with its own size,
+ * so requests left by the previous run are not lost. A NULL path
+ * just closes the current spool.
+ */
+
+int
+AcctSpoolOpen(const char *path, int kbytes)
+{
+    struct acctspool_header	hdr, *h;
+    struct stat			st;
+    uint64_t			size = (uint64_t)kbytes * 1024;
+    int				fd, reuse = 0;
+
+    AcctSpoolClose();
+    if (path == NULL)
+	return (0);
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+	Perror("%s: can't open %s", __FUNCTION__, path);
+	return (-1);
+    }
+    (void)fcntl(fd, F_SETFD, 1);
+    if (fstat(fd, &st) == 0 && st.st_size > ACCTSPOOL_HDR_SIZE &&
+      pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+      hdr.magic == ACCTSPOOL_MAGIC && hdr.version == ACCTSPOOL_VERSION &&
+      hdr.size % 8 == 0 &&
+      (uint64_t)st.st_size == ACCTSPOOL_HDR_SIZE + hdr.size &&
+      hdr.head <= hdr.tail && hdr.tail - hdr.head <= hdr.size) {
+	if (hdr.size != size)
+	    Log(LG_ALWAYS, ("Keeping accounting spool %s of %ju KB",
+		path, (uintmax_t)(hdr.size / 1024)));
+	size = hdr.size;
+	reuse = 1;
+    } else if (st.st_size != 0) {
+	Log(LG_ERR, ("Accounting spool %s is not valid, recreating", path));
+    }
+    if (!reuse && (ftruncate(fd, 0) < 0 ||
+      ftruncate(fd, ACCTSPOOL_HDR_SIZE + size) < 0)) {
+	Perror("%s: can't resize %s", __FUNCTION__, path);
+	close(fd);
+	return (-1);
+    }
+    h = mmap(NULL, ACCTSPOOL_HDR_SIZE + size, PROT_READ | PROT_WRITE,
+	MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+	Perror("%s: can't map %s", __FUNCTION__, path);
+	return (-1);
+    }
+
+    if (!reuse) {
+	/* The file is zero filled, so the spool starts empty */
+	h->version = ACCTSPOOL_VERSION;
+	h->size = size;
+	atomic_thread_fence(memory_order_release);
+	h->magic = ACCTSPOOL_MAGIC;
+    }
+
+    gAcctSpool = h;
+    gAcctSpoolSize = ACCTSPOOL_HDR_SIZE + size;
+    strlcpy(gAcctSpoolPath, path, sizeof(gAcctSpoolPath));
+    if (reuse && AcctSpoolCheck() < 0) {
+	Log(LG_ERR, ("Accounting spool %s is damaged, %ju requests lost",
+	    path, (uintmax_t)h->count));
+	h->head = h->tail = h->count = 0;
+    }
+    gAcctSpoolWinStart = time(NULL);
+    gAcctSpoolWinAcked = gAcctSpoolAcked;
+    Log(LG_ALWAYS, ("Spooling RADIUS accounting into %s, %ju requests waiting",
+	path, (uintmax_t)h->count));
+    if (AcctSpoolStart() < 0) {
+	AcctSpoolClose();
+	return (-1);
+    }
+    return (0);
+}
+
+/*
+ * AcctSpoolClose()
+ *
+ * Stop the sender and unmap the spool. Requests not sent yet stay
+ * in the file.
+ */
+
+void
+AcctSpoolClose(void)
+{
+    struct acctspool_header	*h = gAcctSpool;
+
+    if (h == NULL)
+	return;
+    AcctSpoolStop();
+    /* Links waiting in AcctSpoolWait() look at it under the lock */
+    MUTEX_LOCK(gAcctSpoolMutex);
+    gAcctSpool = NULL;
+    pthread_cond_broadcast(&gAcctSpoolAckCond);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    (void)msync(h, gAcctSpoolSize, MS_SYNC);
+    munmap(h, gAcctSpoolSize);
+    gAcctSpoolSize = 0;
+}
+
+/*
+ * AcctSpoolShutdown()
+ *
+ * Stop the sender on daemon exit. The spool stays mapped, so
+ * accounting of links closed afterwards is still recorded.
+ */
+
+void
+AcctSpoolShutdown(void)
+{
+    if (gAcctSpool == NULL)
+	return;
+    AcctSpoolStop();
+    (void)msync(gAcctSpool, gAcctSpoolSize, MS_SYNC);
+}
+
+/*
+ * AcctSpoolActive()
+ */
+
+int
+AcctSpoolActive(void)
+{
+    return (gAcctSpool != NULL);
+}
+
+/*
+ * AcctSpoolShow()
+ *
+ * Describe the spool for "show globals".
+ */
+
+const char *
+AcctSpoolShow(char *buf, size_t len)
+{
+    if (gAcctSpool == NULL)
+	strlcpy(buf, "none", len);
+    else
+	snprintf(buf, len, "%s %ju", gAcctSpoolPath,
+	    (uintmax_t)(gAcctSpool->size / 1024));
+    return (buf);
+}
+
+/*
+ * AcctSpoolStart()
+ */
+
+static int
+AcctSpoolStart(void)
+{
+    int		ret;
+
+    gAcctSpoolStopping = 0;
+    if ((ret = pthread_create(&gAcctSpoolThread, NULL,
+      AcctSpoolMain, NULL)) != 0) {
+	Log(LG_ERR, ("Can't create accounting spool thread %d", ret));
+	return (-1);
+    }
+    gAcctSpoolRunning = 1;
+    return (0);
+}
+
+/*
+ * AcctSpoolStop()
+ *
+ * Wait for the sender to finish its batch and exit.
+ */
+
+static void
+AcctSpoolStop(void)
+{
+    if (!gAcctSpoolRunning)
+	return;
+    MUTEX_LOCK(gAcctSpoolMutex);
+    gAcctSpoolStopping = 1;
+    pthread_cond_signal(&gAcctSpoolCond);
+    pthread_cond_broadcast(&gAcctSpoolAckCond);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    pthread_join(gAcctSpoolThread, NULL);
+    gAcctSpoolRunning = 0;
+}
+
+/*
+ * AcctSpoolRec()
+ */
+
+static struct acctspool_rec *
+AcctSpoolRec(uint64_t off)
+{
+    return ((struct acctspool_rec *)((u_char *)gAcctSpool +
+	ACCTSPOOL_HDR_SIZE + off % gAcctSpool->size));
+}
+
+/*
+ * AcctSpoolCheck()
+ *
+ * Walk the records left by the previous run and count the ones
+ * still waiting, the counter may be stale after a crash.
+ */
+
+static int
+AcctSpoolCheck(void)
+{
+    struct acctspool_header	*const h = gAcctSpool;
+    struct acctspool_rec	*r;
+    uint64_t			off, count = 0;
+
+    for (off = h->head; off < h->tail; off += r->len) {
+	if (off % 8 != 0)
+	    return (-1);
+	r = AcctSpoolRec(off);
+	if (r->len < 8 || r->len % 8 != 0 ||
+	  r->len > h->size - off % h->size ||
+	  (!(r->flags & AS_F_WRAP) && r->len < sizeof(*r)))
+	    return (-1);
+	if ((r->flags & (AS_F_ACKED | AS_F_WRAP)) == 0)
+	    count++;
+    }
+    if (off != h->tail)
+	return (-1);
+    h->count = count;
+    return (0);
+}
+
+/*
+ * AcctSpoolAppend()
+ *
+ * Put an accounting request into the spool. Returns -1 if it
+ * does not fit, the caller has to send it itself then.
+ */
+
+int
+AcctSpoolAppend(AuthData auth)
+{
+    struct acctspool_header	*const h = gAcctSpool;
+    struct acctspool_rec	*r;
+    struct asbuf		b;
+    uint64_t			tail, skip, need;
+    uintptr_t			off;
+
+    if (h == NULL)
+	return (-1);
+    memset(&b, 0, sizeof(b));
+    AcctSpoolEncode(&b, auth);
+    need = (sizeof(*r) + b.len + 7) & ~(uint64_t)7;
+
+    MUTEX_LOCK(gAcctSpoolMutex);
+    tail = h->tail;
+    /* Records are never split at the end of the area */
+    skip = h->size - tail % h->size;
+    if (skip >= need)
+	skip = 0;
+    if (tail + skip + need - h->head > h->size) {
+	gAcctSpoolFull++;
+	MUTEX_UNLOCK(gAcctSpoolMutex);
+	Log(LG_ERR, ("[%s] ACCT: Accounting spool is full",
+	    auth->info.lnkname));
+	Freee(b.buf);
+	return (-1);
+    }
+    if (skip != 0) {
+	r = AcctSpoolRec(tail);
+	r->len = skip;
+	r->flags = AS_F_WRAP;
+	tail += skip;
+    }
+    r = AcctSpoolRec(tail);
+    r->len = need;
+    r->flags = 0;
+    r->seq = ++h->seq;
+    r->when = auth->info.acct_time;
+    memcpy(r + 1, b.buf, b.len);
+    memset((u_char *)(r + 1) + b.len, 0, need - sizeof(*r) - b.len);
+    /* The sender may look at the record once tail is moved */
+    atomic_thread_fence(memory_order_release);
+    h->tail = tail + need;
+    h->count++;
+    gAcctSpoolAppended++;
+    pthread_cond_signal(&gAcctSpoolCond);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    Freee(b.buf);
+
+    /* The page cache survives a crash of the daemon, just ask
+       for the record to be written out soon */
+    off = (uintptr_t)r & ~(uintptr_t)(getpagesize() - 1);
+    (void)msync((void *)off, (uintptr_t)r + need - off, MS_ASYNC);
+    (void)msync(h, sizeof(*h), MS_ASYNC);
+    return (0);
+}
+
+/*
+ * AcctSpoolAdvance()
+ *
+ * Release records answered at the head of the spool.
+ * Called with the spool mutex held.
+ */
+
+static void
+AcctSpoolAdvance(void)
+{
+    struct acctspool_header	*const h = gAcctSpool;
+    struct acctspool_rec	*r;
+
+    while (h->head < h->tail) {
+	r = AcctSpoolRec(h->head);
+	if ((r->flags & (AS_F_ACKED | AS_F_WRAP)) == 0)
+	    break;
+	h->head += r->len;
+    }
+}
+
+/*
+ * AcctSpoolMain()
+ *
+ * Sender thread. Sends requests of the spool in batches, keeping the
+ * order of requests of a session, and backs off when no server answers.
+ */
+
+static void *
+AcctSpoolMain(void *arg)
+{
+    struct acctspool_header	*const h = gAcctSpool;
+    struct acctspool_rec	*r;
+    AuthData			auths[ACCTSPOOL_BATCH];
+    char			*waits[ACCTSPOOL_WAITS];
+    uint64_t			offs[ACCTSPOOL_BATCH];
+    int				ok[ACCTSPOOL_BATCH];
+    struct timeval		start, now;
+    struct timespec		ts;
+    uint64_t			off, tail, usec;
+    time_t			retry = 0;
+    int				n, k, max, acked, bad, backoff = 0;
+    int				nwait, unknown, logged = 0;
+
+    (void)arg;
+    MUTEX_LOCK(gAcctSpoolMutex);
+    while (!gAcctSpoolStopping) {
+	now.tv_sec = time(NULL);
+	if (now.tv_sec - gAcctSpoolWinStart >= ACCTSPOOL_WINDOW) {
+	    gAcctSpoolDrainRate = (gAcctSpoolAcked - gAcctSpoolWinAcked) /
+		(now.tv_sec - gAcctSpoolWinStart);
+	    gAcctSpoolWinStart = now.tv_sec;
+	    gAcctSpoolWinAcked = gAcctSpoolAcked;
+	}
+	if (h->head == h->tail || now.tv_sec < retry) {
+	    ts.tv_sec = now.tv_sec + 1;
+	    ts.tv_nsec = 0;
+	    pthread_cond_timedwait(&gAcctSpoolCond, &gAcctSpoolMutex, &ts);
+	    continue;
+	}
+	/* Records up to tail are complete and only we change them */
+	tail = h->tail;
+	atomic_thread_fence(memory_order_acquire);
+	MUTEX_UNLOCK(gAcctSpoolMutex);
+
+	max = ACCTSPOOL_BATCH;
+	if (gAcctSpoolRate > 0 && gAcctSpoolRate < max)
+	    max = gAcctSpoolRate;
+	n = bad = nwait = 0;
+	for (off = h->head; off < tail && n < max; off += r->len) {
+	    r = AcctSpoolRec(off);
+	    if (r->flags & (AS_F_ACKED | AS_F_WRAP))
+		continue;
+	    if ((auths[n] = AcctSpoolDecode(r, &unknown)) == NULL) {
+		Log(LG_ERR, ("ACCT: Dropping broken spool record %ju",
+		    (uintmax_t)r->seq));
+		r->flags |= AS_F_ACKED;
+		bad++;
+		continue;
+	    }
+	    /* The link is sending a request of this session itself */
+	    if (AcctSpoolHeld(auths[n]->info.session_id, r->seq)) {
+		AcctSpoolFree(auths[n]);
+		continue;
+	    }
+	    /* Requests of a session must not overtake each other */
+	    for (k = 0; k < nwait; k++) {
+		if (strcmp(waits[k], auths[n]->info.session_id) == 0)
+		    break;
+	    }
+	    if (k < nwait) {
+		AcctSpoolFree(auths[n]);
+		continue;
+	    }
+	    for (k = 0; k < n; k++) {
+		if (strcmp(auths[k]->info.session_id,
+		  auths[n]->info.session_id) == 0)
+		    break;
+	    }
+	    if (k < n) {
+		AcctSpoolFree(auths[n]);
+		break;
+	    }
+	    /* Its servers are not configured (yet), keep it for later */
+	    if (unknown) {
+		waits[nwait++] = Mstrdup(MB_ACCTSPOOL,
+		    auths[n]->info.session_id);
+		AcctSpoolFree(auths[n]);
+		if (nwait == ACCTSPOOL_WAITS)
+		    break;
+		continue;
+	    }
+	    offs[n++] = off;
+	}
+	for (k = 0; k < nwait; k++)
+	    Freee(waits[k]);
+	if (nwait != logged && nwait > 0) {
+	    Log(LG_RADIUS, ("ACCT: %d spooled requests wait for their"
+		" RADIUS servers to be configured", nwait));
+	}
+	logged = nwait;
+
+	gettimeofday(&start, NULL);
+	acked = (n > 0) ? RadiusAccountBatch(auths, n, ok) : 0;
+	for (k = 0; k < n; k++) {
+	    if (ok[k])
+		AcctSpoolRec(offs[k])->flags |= AS_F_ACKED;
+	    AcctSpoolFree(auths[k]);
+	}
+
+	MUTEX_LOCK(gAcctSpoolMutex);
+	h->count -= acked + bad;
+	gAcctSpoolAcked += acked;
+	gAcctSpoolBad += bad;
+	gAcctSpoolFailed += n - acked;
+	AcctSpoolAdvance();
+	if (acked + bad > 0)
+	    pthread_cond_broadcast(&gAcctSpoolAckCond);
+
+	/* Everything waiting is held back, wait for a release */
+	if (n == 0 && bad == 0) {
+	    ts.tv_sec = time(NULL) + 1;
+	    ts.tv_nsec = 0;
+	    pthread_cond_timedwait(&gAcctSpoolCond, &gAcctSpoolMutex, &ts);
+	    continue;
+	}
+	if (acked < n) {
+	    backoff = backoff ? MIN(backoff * 2, ACCTSPOOL_RETRY_MAX) :
+		ACCTSPOOL_RETRY_MIN;
+	    retry = time(NULL) + backoff;
+	    gAcctSpoolRetries++;
+	    Log(LG_RADIUS, ("ACCT: %d of %d spooled requests not answered,"
+		" retrying in %d seconds", n - acked, n, backoff));
+	} else
+	    backoff = 0;
+
+	/* Pace requests to the configured rate */
+	if (gAcctSpoolRate > 0 && n > 0) {
+	    usec = (uint64_t)n * 1000000 / gAcctSpoolRate;
+	    ts.tv_sec = start.tv_sec + (start.tv_usec + usec) / 1000000;
+	    ts.tv_nsec = ((start.tv_usec + usec) % 1000000) * 1000;
+	    while (!gAcctSpoolStopping &&
+	      pthread_cond_timedwait(&gAcctSpoolCond, &gAcctSpoolMutex,
+	      &ts) != ETIMEDOUT)
+		;
+	}
+    }
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    return (NULL);
+}
+
+/*
+ * AcctSpoolPut()
+ */
+
+static void
+AcctSpoolPut(struct asbuf *b, int tag, const void *data, size_t len)
+{
+    uint16_t	hdr[2];
+    u_char	*buf;
+
+    if (len > UINT16_MAX)
+	len = UINT16_MAX;
+    if (b->len + sizeof(hdr) + len > b->size) {
+	b->size = MAX(b->size * 2, b->len + sizeof(hdr) + len + 1024);
+	buf = Malloc(MB_ACCTSPOOL, b->size);
+	if (b->buf != NULL)
+	    memcpy(buf, b->buf, b->len);
+	Freee(b->buf);
+	b->buf = buf;
+    }
+    hdr[0] = tag;
+    hdr[1] = len;
+    memcpy(b->buf + b->len, hdr, sizeof(hdr));
+    memcpy(b->buf + b->len + sizeof(hdr), data, len);
+    b->len += sizeof(hdr) + len;
+}
+
+/*
+ * AcctSpoolPutStr()
+ */
+
+static void
+AcctSpoolPutStr(struct asbuf *b, int tag, const char *str)
+{
+    AcctSpoolPut(b, tag, str, strlen(str));
+}
+
+/*
+ * AcctSpoolEncode()
+ *
+ * Serialize everything RadiusAccount() uses.
+ */
+
+static void
+AcctSpoolEncode(struct asbuf *b, AuthData auth)
+{
+    RadConf		const c = &auth->conf.radius;
+    RadServe_Conf	s;
+    char		*buf;
+    size_t		hlen;
+    u_char		v8;
+#ifdef USE_NG_BPF
+    struct svcstatrec	*ssr;
+    u_char		svc[ACL_NAME_LEN + 2 * sizeof(uint64_t)];
+    int			dir;
+#endif
+
+    v8 = auth->acct_type;
+    AcctSpoolPut(b, AS_ACCT_TYPE, &v8, sizeof(v8));
+    AcctSpoolPutStr(b, AS_AUTHNAME, auth->params.authname);
+    AcctSpoolPut(b, AS_AUTHENTIC, &auth->params.authentic,
+	sizeof(auth->params.authentic));
+    AcctSpoolPutStr(b, AS_SESSION_ID, auth->info.session_id);
+    AcctSpoolPutStr(b, AS_MSESSION_ID, auth->info.msession_id);
+    AcctSpoolPutStr(b, AS_LNKNAME, auth->info.lnkname);
+    AcctSpoolPutStr(b, AS_BUNDNAME, auth->info.bundname);
+    AcctSpoolPutStr(b, AS_IFNAME, auth->info.ifname);
+    AcctSpoolPut(b, AS_IFINDEX, &auth->info.ifindex,
+	sizeof(auth->info.ifindex));
+    AcctSpoolPutStr(b, AS_PEER_IDENT, auth->info.peer_ident);
+    AcctSpoolPut(b, AS_LINK_ID, &auth->info.linkID,
+	sizeof(auth->info.linkID));
+    AcctSpoolPut(b, AS_N_LINKS, &auth->info.n_links,
+	sizeof(auth->info.n_links));
+    AcctSpoolPut(b, AS_ORIGINATE, &auth->info.originate,
+	sizeof(auth->info.originate));
+    if (auth->info.phys_type != NULL)
+	AcctSpoolPutStr(b, AS_PHYS_TYPE, auth->info.phys_type->name);
+    AcctSpoolPut(b, AS_PEER_ADDR, &auth->info.peer_addr,
+	sizeof(auth->info.peer_addr));
+    AcctSpoolPut(b, AS_PEER_ADDR6, &auth->info.peer_addr6,
+	sizeof(auth->info.peer_addr6));
+    AcctSpoolPut(b, AS_STATS, &auth->info.stats, sizeof(auth->info.stats));
+    AcctSpoolPut(b, AS_LAST_UP, &auth->info.last_up,
+	sizeof(auth->info.last_up));
+    if (auth->info.downReason != NULL)
+	AcctSpoolPutStr(b, AS_DOWN_REASON, auth->info.downReason);
+    AcctSpoolPut(b, AS_NETMASK, &auth->params.netmask,
+	sizeof(auth->params.netmask));
+    if (auth->params.state != NULL)
+	AcctSpoolPut(b, AS_STATE, auth->params.state, auth->params.state_len);
+    if (auth->params.class != NULL)
+	AcctSpoolPut(b, AS_CLASS, auth->params.class, auth->params.class_len);
+    AcctSpoolPutStr(b, AS_CALLINGNUM, auth->params.callingnum);
+    AcctSpoolPutStr(b, AS_CALLEDNUM, auth->params.callednum);
+    AcctSpoolPutStr(b, AS_PEERIFACE, auth->params.peeriface);
+    AcctSpoolPutStr(b, AS_SELFADDR, auth->params.selfaddr);
+    AcctSpoolPutStr(b, AS_PEERADDR, auth->params.peeraddr);
+    AcctSpoolPutStr(b, AS_SELFNAME, auth->params.selfname);
+    AcctSpoolPutStr(b, AS_PEERNAME, auth->params.peername);
+#ifdef USE_NG_BPF
+    AcctSpoolPutStr(b, AS_STD_ACCT_IN, auth->params.std_acct[0]);
+    AcctSpoolPutStr(b, AS_STD_ACCT_OUT, auth->params.std_acct[1]);
+    for (dir = 0; dir < ACL_DIRS; dir++) {
+	SLIST_FOREACH(ssr, &auth->info.ss.stat[dir], next) {
+	    memcpy(svc, ssr->name, ACL_NAME_LEN);
+	    memcpy(svc + ACL_NAME_LEN, &ssr->Packets, sizeof(uint64_t));
+	    memcpy(svc + ACL_NAME_LEN + sizeof(uint64_t), &ssr->Octets,
+		sizeof(uint64_t));
+	    AcctSpoolPut(b, dir == 0 ? AS_SVC_IN : AS_SVC_OUT,
+		svc, sizeof(svc));
+	}
+    }
+#endif
+
+    AcctSpoolPut(b, AS_RAD_TIMEOUT, &c->radius_timeout,
+	sizeof(c->radius_timeout));
+    AcctSpoolPut(b, AS_RAD_RETRIES, &c->radius_retries,
+	sizeof(c->radius_retries));
+#ifdef HAVE_RAD_BIND
+    AcctSpoolPut(b, AS_RAD_SRC_ADDR, &c->src_addr, sizeof(c->src_addr));
+#endif
+    AcctSpoolPut(b, AS_RAD_ME, &c->radius_me, sizeof(c->radius_me));
+    AcctSpoolPut(b, AS_RAD_MEV6, &c->radius_mev6, sizeof(c->radius_mev6));
+    if (c->identifier != NULL)
+	AcctSpoolPutStr(b, AS_RAD_IDENTIFIER, c->identifier);
+    if (c->file != NULL)
+	AcctSpoolPutStr(b, AS_RAD_FILE, c->file);
+    AcctSpoolPut(b, AS_RAD_OPTIONS, &c->options, sizeof(c->options));
+    AcctSpoolPut(b, AS_RAD_STRATEGY, &c->strategy, sizeof(c->strategy));
+    AcctSpoolPut(b, AS_RAD_HOLDDOWN, &c->holddown, sizeof(c->holddown));
+    AcctSpoolPut(b, AS_RAD_HOLDDOWN_FAILS, &c->holddown_fails,
+	sizeof(c->holddown_fails));
+    for (s = c->server; s != NULL; s = s->next) {
+	if (s->acct_port == 0)
+	    continue;
+	AcctSpoolSetSecret(s->hostname, s->acct_port, s->sharedsecret);
+	/* Port and NUL terminated host name */
+	hlen = strlen(s->hostname) + 1;
+	buf = Malloc(MB_ACCTSPOOL, sizeof(in_port_t) + hlen);
+	memcpy(buf, &s->acct_port, sizeof(in_port_t));
+	memcpy(buf + sizeof(in_port_t), s->hostname, hlen);
+	AcctSpoolPut(b, AS_RAD_SERVER, buf, sizeof(in_port_t) + hlen);
+	Freee(buf);
+    }
+}
+
+/*
+ * AcctSpoolDecode()
+ *
+ * Rebuild the accounting request of a spool record.
+ * Returns NULL if the record is broken. Sets unknown if none of its
+ * servers is configured, so the record can't be sent yet.
+ */
+
+#define AS_GET(var)						\
+	do {							\
+	    if (len != sizeof(var))				\
+		goto fail;					\
+	    memcpy(&(var), data, len);				\
+	} while (0)
+
+#define AS_GETSTR(var)						\
+	do {							\
+	    size_t	_l = MIN(len, sizeof(var) - 1);		\
+	    memcpy((var), data, _l);				\
+	    (var)[_l] = 0;					\
+	} while (0)
+
+static AuthData
+AcctSpoolDecode(const struct acctspool_rec *r, int *unknown)
+{
+    AuthData		auth;
+    RadConf		c;
+    RadServe_Conf	s, *sp;
+    const u_char	*p, *end, *data;
+    const char		*secret;
+    char		name[32];
+    in_port_t		port;
+    uint16_t		hdr[2];
+    size_t		len, hlen;
+    u_char		v8;
+    int			k, servers = 0;
+#ifdef USE_NG_BPF
+    struct svcstatrec	*ssr, *last[ACL_DIRS] = { NULL, NULL };
+    int			dir;
+#endif
+
+    *unknown = 0;
+    if (r->len < sizeof(*r) || r->len > gAcctSpool->size)
+	return (NULL);
+    auth = Malloc(MB_AUTH, sizeof(*auth));
+    authparamsInit(&auth->params);
+    c = &auth->conf.radius;
+    sp = &c->server;
+    Enable(&auth->conf.options, AUTH_CONF_RADIUS_ACCT);
+    auth->info.acct_time = r->when;
+
+    p = (const u_char *)(r + 1);
+    end = (const u_char *)r + r->len;
+    while (p + sizeof(hdr) <= end) {
+	memcpy(hdr, p, sizeof(hdr));
+	data = p + sizeof(hdr);
+	len = hdr[1];
+	if (hdr[0] == 0)		/* Padding */
+	    break;
+	if (data + len > end)
+	    goto fail;
+	p = data + len;
+
+	switch (hdr[0]) {
+	case AS_ACCT_TYPE:
+	    AS_GET(v8);
+	    auth->acct_type = v8;
+	    break;
+	case AS_AUTHNAME:
+	    AS_GETSTR(auth->params.authname);
+	    break;
+	case AS_AUTHENTIC:
+	    AS_GET(auth->params.authentic);
+	    break;
+	case AS_SESSION_ID:
+	    AS_GETSTR(auth->info.session_id);
+	    break;
+	case AS_MSESSION_ID:
+	    AS_GETSTR(auth->info.msession_id);
+	    break;
+	case AS_LNKNAME:
+	    AS_GETSTR(auth->info.lnkname);
+	    break;
+	case AS_BUNDNAME:
+	    AS_GETSTR(auth->info.bundname);
+	    break;
+	case AS_IFNAME:
+	    AS_GETSTR(auth->info.ifname);
+	    break;
+	case AS_IFINDEX:
+	    AS_GET(auth->info.ifindex);
+	    break;
+	case AS_PEER_IDENT:
+	    AS_GETSTR(auth->info.peer_ident);
+	    break;
+	case AS_LINK_ID:
+	    AS_GET(auth->info.linkID);
+	    break;
+	case AS_N_LINKS:
+	    AS_GET(auth->info.n_links);
+	    break;
+	case AS_ORIGINATE:
+	    AS_GET(auth->info.originate);
+	    break;
+	case AS_PHYS_TYPE:
+	    AS_GETSTR(name);
+	    for (k = 0; gPhysTypes[k] != NULL; k++) {
+		if (strcmp(gPhysTypes[k]->name, name) == 0) {
+		    auth->info.phys_type = gPhysTypes[k];
+		    break;
+		}
+	    }
+	    break;
+	case AS_PEER_ADDR:
+	    AS_GET(auth->info.peer_addr);
+	    break;
+	case AS_PEER_ADDR6:
+	    AS_GET(auth->info.peer_addr6);
+	    break;
+	case AS_STATS:
+	    AS_GET(auth->info.stats);
+	    break;
+	case AS_LAST_UP:
+	    AS_GET(auth->info.last_up);
+	    break;
+	case AS_DOWN_REASON:
+	    Freee(auth->info.downReason);
+	    auth->info.downReason = Malloc(MB_AUTH, len + 1);
+	    memcpy(auth->info.downReason, data, len);
+	    break;
+	case AS_NETMASK:
+	    AS_GET(auth->params.netmask);
+	    break;
+	case AS_STATE:
+	    Freee(auth->params.state);
+	    auth->params.state = Mdup(MB_AUTH, data, len);
+	    auth->params.state_len = len;
+	    break;
+	case AS_CLASS:
+	    Freee(auth->params.class);
+	    auth->params.class = Mdup(MB_AUTH, data, len);
+	    auth->params.class_len = len;
+	    break;
+	case AS_CALLINGNUM:
+	    AS_GETSTR(auth->params.callingnum);
+	    break;
+	case AS_CALLEDNUM:
+	    AS_GETSTR(auth->params.callednum);
+	    break;
+	case AS_PEERIFACE:
+	    AS_GETSTR(auth->params.peeriface);
+	    break;
+	case AS_SELFADDR:
+	    AS_GETSTR(auth->params.selfaddr);
+	    break;
+	case AS_PEERADDR:
+	    AS_GETSTR(auth->params.peeraddr);
+	    break;
+	case AS_SELFNAME:
+	    AS_GETSTR(auth->params.selfname);
+	    break;
+	case AS_PEERNAME:
+	    AS_GETSTR(auth->params.peername);
+	    break;
+#ifdef USE_NG_BPF
+	case AS_STD_ACCT_IN:
+	    AS_GETSTR(auth->params.std_acct[0]);
+	    break;
+	case AS_STD_ACCT_OUT:
+	    AS_GETSTR(auth->params.std_acct[1]);
+	    break;
+	case AS_SVC_IN:
+	case AS_SVC_OUT:
+	    if (len != ACL_NAME_LEN + 2 * sizeof(uint64_t))
+		goto fail;
+	    dir = (hdr[0] == AS_SVC_IN) ? 0 : 1;
+	    ssr = Malloc(MB_AUTH, sizeof(*ssr));
+	    memcpy(ssr->name, data, ACL_NAME_LEN);
+	    ssr->name[ACL_NAME_LEN - 1] = 0;
+	    memcpy(&ssr->Packets, data + ACL_NAME_LEN, sizeof(uint64_t));
+	    memcpy(&ssr->Octets, data + ACL_NAME_LEN + sizeof(uint64_t),
+		sizeof(uint64_t));
+	    if (last[dir] == NULL)
+		SLIST_INSERT_HEAD(&auth->info.ss.stat[dir], ssr, next);
+	    else
+		SLIST_INSERT_AFTER(last[dir], ssr, next);
+	    last[dir] = ssr;
+	    break;
+#endif
+	case AS_RAD_TIMEOUT:
+	    AS_GET(c->radius_timeout);
+	    break;
+	case AS_RAD_RETRIES:
+	    AS_GET(c->radius_retries);
+	    break;
+#ifdef HAVE_RAD_BIND
+	case AS_RAD_SRC_ADDR:
+	    AS_GET(c->src_addr);
+	    break;
+#endif
+	case AS_RAD_ME:
+	    AS_GET(c->radius_me);
+	    break;
+	case AS_RAD_MEV6:
+	    AS_GET(c->radius_mev6);
+	    break;
+	case AS_RAD_IDENTIFIER:
+	    Freee(c->identifier);
+	    c->identifier = Malloc(MB_RADIUS, len + 1);
+	    memcpy(c->identifier, data, len);
+	    break;
+	case AS_RAD_FILE:
+	    Freee(c->file);
+	    c->file = Malloc(MB_RADIUS, len + 1);
+	    memcpy(c->file, data, len);
+	    break;
+	case AS_RAD_OPTIONS:
+	    AS_GET(c->options);
+	    break;
+	case AS_RAD_STRATEGY:
+	    AS_GET(c->strategy);
+	    if (c->strategy < 0 || c->strategy > RADIUS_STRATEGY_WEIGHTED)
+		c->strategy = RADIUS_STRATEGY_FAILOVER;
+	    break;
+	case AS_RAD_HOLDDOWN:
+	    AS_GET(c->holddown);
+	    break;
+	case AS_RAD_HOLDDOWN_FAILS:
+	    AS_GET(c->holddown_fails);
+	    break;
+	case AS_RAD_SERVER:
+	    if (len < sizeof(in_port_t) + 2)
+		goto fail;
+	    hlen = strnlen((const char *)data + sizeof(in_port_t),
+		len - sizeof(in_port_t));
+	    if (sizeof(in_port_t) + hlen + 1 != len)
+		goto fail;
+	    memcpy(&port, data, sizeof(in_port_t));
+	    servers++;
+	    MUTEX_LOCK(gAcctSpoolMutex);
+	    if ((secret = AcctSpoolSecret((const char *)data +
+	      sizeof(in_port_t), port)) != NULL) {
+		s = Malloc(MB_RADIUS, sizeof(*s));
+		s->acct_port = port;
+		s->hostname = Mstrdup(MB_RADIUS,
+		    (const char *)data + sizeof(in_port_t));
+		s->sharedsecret = Mstrdup(MB_RADIUS, secret);
+		*sp = s;
+		sp = &s->next;
+	    }
+	    MUTEX_UNLOCK(gAcctSpoolMutex);
+	    break;
+	default:
+	    /* Written by a later version, not needed here */
+	    break;
+	}
+    }
+    if (auth->info.session_id[0] == 0 || servers == 0)
+	goto fail;
+    if (c->server == NULL)
+	*unknown = 1;
+    return (auth);
+
+fail:
+    AcctSpoolFree(auth);
+    return (NULL);
+}
+
+/*
+ * AcctSpoolFree()
+ */
+
+static void
+AcctSpoolFree(AuthData auth)
+{
+    RadiusConfFree(&auth->conf.radius);
+    AuthDataDestroy(auth);
+}
+
+/*
+ * AcctSpoolSetSecret()
+ *
+ * Remember the secret of an accounting server for sending spooled
+ * requests. Called whenever a server is configured or used.
+ */
+
+void
+AcctSpoolSetSecret(const char *host, in_port_t port, const char *secret)
+{
+    struct acctspool_secret	*sc;
+
+    MUTEX_LOCK(gAcctSpoolMutex);
+    SLIST_FOREACH(sc, &gAcctSpoolSecrets, next) {
+	if (sc->port == port && strcmp(sc->host, host) == 0)
+	    break;
+    }
+    if (sc == NULL) {
+	sc = Malloc(MB_ACCTSPOOL, sizeof(*sc));
+	sc->host = Mstrdup(MB_ACCTSPOOL, host);
+	sc->port = port;
+	SLIST_INSERT_HEAD(&gAcctSpoolSecrets, sc, next);
+    } else if (strcmp(sc->secret, secret) == 0) {
+	MUTEX_UNLOCK(gAcctSpoolMutex);
+	return;
+    } else
+	Freee(sc->secret);
+    sc->secret = Mstrdup(MB_ACCTSPOOL, secret);
+    /* Records waiting for this server can be sent now */
+    pthread_cond_signal(&gAcctSpoolCond);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+}
+
+/*
+ * AcctSpoolSecret()
+ *
+ * Called with the spool mutex held.
+ */
+
+static const char *
+AcctSpoolSecret(const char *host, in_port_t port)
+{
+    struct acctspool_secret	*sc;
+
+    SLIST_FOREACH(sc, &gAcctSpoolSecrets, next) {
+	if (sc->port == port && strcmp(sc->host, host) == 0)
+	    return (sc->secret);
+    }
+    return (NULL);
+}
+
+/*
+ * AcctSpoolHold()
+ *
+ * The link sends this request itself. Spooled records of the session
+ * appended from now on are not sent until AcctSpoolRelease().
+ */
+
+void
+AcctSpoolHold(AuthData auth)
+{
+    struct acctspool_hold	*hd;
+
+    hd = Malloc(MB_ACCTSPOOL, sizeof(*hd));
+    strlcpy(hd->session_id, auth->info.session_id, sizeof(hd->session_id));
+    MUTEX_LOCK(gAcctSpoolMutex);
+    hd->seq = (gAcctSpool != NULL) ? gAcctSpool->seq : 0;
+    SLIST_INSERT_HEAD(&gAcctSpoolHolds, hd, next);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    auth->acct_hold = hd;
+}
+
+/*
+ * AcctSpoolRelease()
+ */
+
+void
+AcctSpoolRelease(AuthData auth)
+{
+    if (auth->acct_hold == NULL)
+	return;
+    MUTEX_LOCK(gAcctSpoolMutex);
+    SLIST_REMOVE(&gAcctSpoolHolds, (struct acctspool_hold *)auth->acct_hold,
+	acctspool_hold, next);
+    pthread_cond_signal(&gAcctSpoolCond);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    Freee(auth->acct_hold);
+    auth->acct_hold = NULL;
+}
+
+/*
+ * AcctSpoolWait()
+ *
+ * Wait until the records of a held session spooled before the hold
+ * are answered, so the request the link sends itself does not
+ * overtake them. Called from the accounting thread of the link.
+ */
+
+void
+AcctSpoolWait(AuthData auth)
+{
+    struct acctspool_hold	*const hd = auth->acct_hold;
+    struct timespec		ts;
+
+    if (hd == NULL)
+	return;
+    MUTEX_LOCK(gAcctSpoolMutex);
+    pthread_cleanup_push(AcctSpoolUnlock, NULL);
+    while (gAcctSpool != NULL && !gAcctSpoolStopping &&
+      AcctSpoolPending(hd->session_id, hd->seq)) {
+	ts.tv_sec = time(NULL) + 1;
+	ts.tv_nsec = 0;
+	pthread_cond_timedwait(&gAcctSpoolAckCond, &gAcctSpoolMutex, &ts);
+    }
+    pthread_cleanup_pop(1);
+}
+
+/*
+ * AcctSpoolUnlock()
+ *
+ * Cleanup of a canceled AcctSpoolWait().
+ */
+
+static void
+AcctSpoolUnlock(void *arg)
+{
+    (void)arg;
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+}
+
+/*
+ * AcctSpoolHeld()
+ *
+ * Tell whether a record must wait for the link to send a request of
+ * its session.
+ */
+
+static int
+AcctSpoolHeld(const char *session_id, uint64_t seq)
+{
+    struct acctspool_hold	*hd;
+
+    MUTEX_LOCK(gAcctSpoolMutex);
+    SLIST_FOREACH(hd, &gAcctSpoolHolds, next) {
+	if (seq > hd->seq && strcmp(hd->session_id, session_id) == 0)
+	    break;
+    }
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    return (hd != NULL);
+}
+
+/*
+ * AcctSpoolPending()
+ *
+ * Tell whether a record of the session up to the given number is not
+ * answered yet. Called with the spool mutex held.
+ */
+
+static int
+AcctSpoolPending(const char *session_id, uint64_t seq)
+{
+    struct acctspool_header	*const h = gAcctSpool;
+    struct acctspool_rec	*r;
+    uint64_t			off;
+
+    for (off = h->head; off < h->tail; off += r->len) {
+	r = AcctSpoolRec(off);
+	if (r->flags & (AS_F_ACKED | AS_F_WRAP))
+	    continue;
+	if (r->seq > seq)
+	    break;
+	if (AcctSpoolRecSession(r, session_id))
+	    return (1);
+    }
+    return (0);
+}
+
+/*
+ * AcctSpoolRecSession()
+ *
+ * Tell whether a record belongs to the session.
+ */
+
+static int
+AcctSpoolRecSession(const struct acctspool_rec *r, const char *session_id)
+{
+    const u_char	*p, *end;
+    uint16_t		hdr[2];
+
+    p = (const u_char *)(r + 1);
+    end = (const u_char *)r + r->len;
+    while (p + sizeof(hdr) <= end) {
+	memcpy(hdr, p, sizeof(hdr));
+	p += sizeof(hdr);
+	if (hdr[0] == 0 || p + hdr[1] > end)
+	    break;
+	if (hdr[0] == AS_SESSION_ID)
+	    return (hdr[1] == strlen(session_id) &&
+		memcmp(p, session_id, hdr[1]) == 0);
+	p += hdr[1];
+    }
+    return (0);
+}
+
+/*
+ * AcctSpoolStat()
+ *
+ * Spool section of "show radius".
+ */
+
+int
+AcctSpoolStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct acctspool_header	h;
+    time_t			now = time(NULL);
+    uint64_t			rate;
+
+    (void)ctx;
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Accounting spool:\r\n");
+    if (gAcctSpool == NULL) {
+	Printf("\tFile         : none\r\n");
+	return (0);
+    }
+    MUTEX_LOCK(gAcctSpoolMutex);
+    h = *gAcctSpool;
+    rate = (now - gAcctSpoolWinStart < 2 * ACCTSPOOL_WINDOW) ?
+	gAcctSpoolDrainRate : 0;
+    Printf("\tFile         : %s\r\n", gAcctSpoolPath);
+    Printf("\tSize         : %ju KB, %ju KB used\r\n",
+	(uintmax_t)(h.size / 1024), (uintmax_t)((h.tail - h.head) / 1024));
+    Printf("\tWaiting      : %ju requests\r\n", (uintmax_t)h.count);
+    Printf("\tRate limit   : %d requests/s\r\n", gAcctSpoolRate);
+    Printf("\tDrain rate   : %ju requests/s\r\n", (uintmax_t)rate);
+    Printf("\tSpooled      : %ju\r\n", (uintmax_t)gAcctSpoolAppended);
+    Printf("\tAnswered     : %ju\r\n", (uintmax_t)gAcctSpoolAcked);
+    Printf("\tFailed       : %ju, %ju retries\r\n",
+	(uintmax_t)gAcctSpoolFailed, (uintmax_t)gAcctSpoolRetries);
+    Printf("\tSpool full   : %ju\r\n", (uintmax_t)gAcctSpoolFull);
+    Printf("\tBroken       : %ju\r\n", (uintmax_t)gAcctSpoolBad);
+    MUTEX_UNLOCK(gAcctSpoolMutex);
+    return (0);
+}
+
@@ -0,0 +1,45 @@
+
+/*
+ * acctspool.h
+ *
+ * Durable spool for RADIUS accounting requests.
+ */
+
+#ifndef _ACCTSPOOL_H_
+#define _ACCTSPOOL_H_
+
+#include "auth.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define ACCTSPOOL_DEFAULT_SIZE	4096	/* Kilobytes */
+  #define ACCTSPOOL_DEFAULT_RATE	100	/* Requests per second */
+  #define ACCTSPOOL_BATCH		16	/* Requests in flight */
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gAcctSpoolRate;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern int	AcctSpoolOpen(const char *path, int kbytes);
+  extern void	AcctSpoolClose(void);
+  extern void	AcctSpoolShutdown(void);
+  extern int	AcctSpoolActive(void);
+  extern int	AcctSpoolAppend(AuthData auth);
+  extern void	AcctSpoolSetSecret(const char *host, in_port_t port,
+		    const char *secret);
+  extern void	AcctSpoolHold(AuthData auth);
+  extern void	AcctSpoolRelease(AuthData auth);
+  extern void	AcctSpoolWait(AuthData auth);
+  extern const char	*AcctSpoolShow(char *buf, size_t len);
+  extern int	AcctSpoolStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
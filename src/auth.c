@@ -16,6 +16,10 @@
 #include "ngfunc.h"
 #include "msoft.h"
 #include "util.h"
+#include "stats.h"
+#include "console.h"
+#include "extpool.h"
+#include "acctspool.h"
 
 #ifdef USE_PAM
 #include <security/pam_appl.h>
@@ -37,6 +41,17 @@
 #define OPIE_ALG_MD5	5
 #endif
 
+#define AUTH_REJECT_MAX_TTL	300	/* Default backoff limit, seconds */
+
+ /* Remembered rejection of a (name, calling station) pair */
+struct rejentry {
+	uint64_t hash;			/* Key, zero if the slot is free */
+	time_t	until;			/* Reject locally until this time */
+	time_t	last;			/* Last rejection by a backend */
+	u_int	fails;			/* Consecutive rejections */
+	u_int	hits;			/* Local rejections since the last one */
+};
+
 /*
  * INTERNAL FUNCTIONS
  */
@@ -48,11 +63,25 @@ AuthGetExternalPassword(const char *extcmd, char *authname,
 static void AuthAsync(void *arg);
 static void AuthAsyncFinish(void *arg, int was_canceled);
 static int AuthPreChecks(AuthData auth);
+static uint64_t AuthRejectHash(AuthData auth);
+static struct rejentry *AuthRejectFind(uint64_t hash, int create);
+static void AuthRejectUpdate(Link l, int ok);
+static void AuthAccountStart2(Link l, int type, int getstats);
+static int AuthAccountEnabled(struct optinfo *opt);
 static void AuthAccount(void *arg);
 static void AuthAccountFinish(void *arg, int was_canceled);
 static void AuthInternal(AuthData auth);
 static int AuthExternal(AuthData auth);
 static int AuthExternalAcct(AuthData auth);
+static FILE *AuthExtStart(const char *script, const char *authname,
+    const char *label, const char *what, int *pooled,
+    char **req, size_t *reqlen);
+static int AuthExtSend(FILE **fp, int pooled, char **req, size_t *reqlen,
+    const char *script, const char *label, char **reply);
+static void AuthExtAttr(FILE *fp, const char *attr, const char *fmt, ...)
+    __printflike(3, 4);
+static char *AuthExtGets(FILE *fp, char **rp, char *line, size_t size);
+static void AuthExtClose(FILE *fp, char *reply);
 
 #ifdef USE_SYSTEM
 static void AuthSystem(AuthData auth);
@@ -87,6 +116,7 @@ enum {
 	SET_EXTAUTH_SCRIPT,
 	SET_EXTACCT_SCRIPT,
 	SET_MAX_LOGINS,
+	SET_REJECT_CACHE,
 	SET_ACCT_UPDATE,
 	SET_ACCT_UPDATE_LIMIT_IN,
 	SET_ACCT_UPDATE_LIMIT_OUT,
@@ -100,6 +130,8 @@ enum {
 const struct cmdtab AuthSetCmds[] = {
 	{"max-logins {num} [CI]", "Max concurrent logins",
 	AuthSetCommand, NULL, 2, (void *)SET_MAX_LOGINS},
+	{"reject-cache {seconds} [{max-seconds}]", "Cache rejected logins",
+	AuthSetCommand, NULL, 2, (void *)SET_REJECT_CACHE},
 	{"authname {name}", "Authentication name",
 	AuthSetCommand, NULL, 2, (void *)SET_AUTHNAME},
 	{"password {pass}", "Authentication password",
@@ -135,11 +167,19 @@ const u_char gMsoftZeros[32];
 static unsigned	gMaxLogins = 0;			/* max number of concurrent logins per
 					 * user */
 static unsigned	gMaxLoginsCI = 0;
+static int	gRejectTtl = 0;			/* reject cache disabled */
+static int	gRejectMaxTtl = AUTH_REJECT_MAX_TTL;
 
 /*
  * INTERNAL VARIABLES
  */
 
+static struct rejentry *gRejCache;
+static uint64_t	gRejHits;
+static uint64_t	gRejStored;
+static uint64_t	gRejEvicted;
+static uint64_t	gRejCleared;
+
 static const struct confinfo gConfList[] = {
 	{0, AUTH_CONF_RADIUS_AUTH, "radius-auth"},
 	{0, AUTH_CONF_RADIUS_ACCT, "radius-acct"},
@@ -302,8 +342,10 @@ authparamsMove(struct authparams *src, struct authparams *dst)
 void
 AuthInit(Link l)
 {
-	AuthConf const ac = &l->lcp.auth.conf;
+	AuthConf const ac = Malloc(MB_AUTH, sizeof(*ac));
 
+	ac->refs = 1;
+	l->lcp.auth.conf = ac;
 	ac->timeout = 40;
 	Enable(&ac->options, AUTH_CONF_INTERNAL);
 	Enable(&ac->options, AUTH_CONF_ACCT_MANDATORY);
@@ -322,10 +364,80 @@ void
 AuthInst(Auth auth, Auth autht)
 {
 	memcpy(auth, autht, sizeof(*auth));
-	if (auth->conf.extauth_script)
-		autht->conf.extauth_script = Mstrdup(MB_AUTH, auth->conf.extauth_script);
-	if (auth->conf.extacct_script)
-		autht->conf.extacct_script = Mstrdup(MB_AUTH, auth->conf.extacct_script);
+	REF(auth->conf);
+}
+
+/*
+ * AuthConfWrite()
+ *
+ * Return link's auth config for modification, making a private copy
+ * first if it is still shared with the template or other instances.
+ */
+
+AuthConf
+AuthConfWrite(Link l)
+{
+	AuthConf c = l->lcp.auth.conf;
+
+	if (c->refs > 1) {
+		c->refs--;
+		c = Mdup(MB_AUTH, c, sizeof(*c));
+		c->refs = 1;
+		if (c->extauth_script)
+			c->extauth_script = Mstrdup(MB_AUTH, c->extauth_script);
+		if (c->extacct_script)
+			c->extacct_script = Mstrdup(MB_AUTH, c->extacct_script);
+		RadiusConfDup(&c->radius);
+		l->lcp.auth.conf = c;
+	}
+	return (c);
+}
+
+/*
+ * AuthConfSize()
+ *
+ * Heap bytes held by an auth config, including its strings and the
+ * RADIUS server list.
+ */
+
+size_t
+AuthConfSize(AuthConf c)
+{
+	RadServe_Conf s;
+	size_t	len = sizeof(*c);
+
+	if (c->extauth_script)
+		len += strlen(c->extauth_script) + 1;
+	if (c->extacct_script)
+		len += strlen(c->extacct_script) + 1;
+	if (c->radius.identifier)
+		len += strlen(c->radius.identifier) + 1;
+	if (c->radius.file)
+		len += strlen(c->radius.file) + 1;
+	if (c->radius.attrs)
+		len += c->radius.attrs_len;
+	for (s = c->radius.server; s != NULL; s = s->next) {
+		len += sizeof(*s) + strlen(s->hostname) + 1 +
+		    strlen(s->sharedsecret) + 1;
+	}
+	return (len);
+}
+
+/*
+ * AuthConfRelease()
+ *
+ * Drop a reference to auth config, freeing it with the last one.
+ */
+
+void
+AuthConfRelease(AuthConf c)
+{
+	if (c == NULL || --c->refs > 0)
+		return;
+	Freee(c->extauth_script);
+	Freee(c->extacct_script);
+	RadiusConfFree(&c->radius);
+	Freee(c);
 }
 
 /*
@@ -341,8 +453,8 @@ AuthShutdown(Link l)
 		paction_cancel(&a->thread);
 	if (a->acct_thread)
 		paction_cancel(&a->acct_thread);
-	Freee(a->conf.extauth_script);
-	Freee(a->conf.extacct_script);
+	AuthConfRelease(a->conf);
+	a->conf = NULL;
 }
 
 /*
@@ -407,7 +519,7 @@ AuthStart(Link l)
 	}
 	/* Start global auth timer */
 	TimerInit(&a->timer, "AuthTimer",
-	    l->lcp.auth.conf.timeout * SECONDS, AuthTimeout, l);
+	    l->lcp.auth.conf->timeout * SECONDS, AuthTimeout, l);
 	TimerStart(&a->timer);
 
 	/* Start my auth to him */
@@ -588,8 +700,16 @@ AuthFinish(Link l, int which, int ok)
 
 	if (which == AUTH_SELF_TO_PEER)
 		a->self_to_peer = 0;
-	else
+	else {
 		a->peer_to_self = 0;
+		if (a->rejpending) {
+			a->rejpending = 0;
+			AuthRejectUpdate(l, ok);
+		}
+	}
+	ConsoleEvent(CONS_EV_AUTH, l, NULL, "%s %s",
+	    which == AUTH_SELF_TO_PEER ? "self" : "peer",
+	    ok ? "success" : "failure");
 	/* Did auth fail (in either direction)? */
 	if (!ok) {
 		AuthStop(l);
@@ -638,11 +758,11 @@ AuthDataNew(Link l)
 	auth->reply_message = NULL;
 	auth->mschap_error = NULL;
 	auth->mschapv2resp = NULL;
-	auth->conf = l->lcp.auth.conf;
-	if (l->lcp.auth.conf.extauth_script)
-		auth->conf.extauth_script = Mstrdup(MB_AUTH, l->lcp.auth.conf.extauth_script);
-	if (l->lcp.auth.conf.extacct_script)
-		auth->conf.extacct_script = Mstrdup(MB_AUTH, l->lcp.auth.conf.extacct_script);
+	auth->conf = *a->conf;
+	if (a->conf->extauth_script)
+		auth->conf.extauth_script = Mstrdup(MB_AUTH, a->conf->extauth_script);
+	if (a->conf->extacct_script)
+		auth->conf.extacct_script = Mstrdup(MB_AUTH, a->conf->extacct_script);
 
 	strlcpy(auth->info.lnkname, l->name, sizeof(auth->info.lnkname));
 	strlcpy(auth->info.msession_id, l->msession_id, sizeof(auth->info.msession_id));
@@ -674,6 +794,7 @@ AuthDataNew(Link l)
 		auth->info.downReason = Mstrdup(MB_AUTH, l->downReason);
 
 	auth->info.last_up = l->last_up;
+	auth->info.acct_time = time(NULL);
 	auth->info.phys_type = l->type;
 	auth->info.linkID = l->id;
 
@@ -691,6 +812,7 @@ AuthDataNew(Link l)
 void
 AuthDataDestroy(AuthData auth)
 {
+	AcctSpoolRelease(auth);
 	authparamsDestroy(&auth->params);
 	Freee(auth->info.downReason);
 	Freee(auth->reply_message);
@@ -716,6 +838,7 @@ AuthStop(Link l)
 	Auth a = &l->lcp.auth;
 
 	TimerStop(&a->timer);
+	a->rejpending = 0;
 	PapStop(&a->pap);
 	ChapStop(&a->chap);
 	EapStop(&a->eap);
@@ -732,7 +855,7 @@ int
 AuthStat(Context ctx, int ac, const char *const av[], const void *arg)
 {
 	Auth const au = &ctx->lnk->lcp.auth;
-	AuthConf const conf = &au->conf;
+	AuthConf const conf = au->conf;
 	char buf[48], buf2[16];
 
 #if defined(USE_IPFW) || defined(USE_NG_BPF)
@@ -753,6 +876,10 @@ AuthStat(Context ctx, int ac, const char *const av[], const void *arg)
 	Printf("Configuration:\r\n");
 	Printf("\tMy authname     : %s\r\n", conf->authname);
 	Printf("\tMax-Logins      : %u%s\r\n", gMaxLogins, (gMaxLoginsCI ? " CI" : ""));
+	Printf("\tReject cache    : %d %d\r\n", gRejectTtl, gRejectMaxTtl);
+	Printf("\t   Counters     : %ju hits, %ju stored, %ju evicted, %ju cleared\r\n",
+	    (uintmax_t)gRejHits, (uintmax_t)gRejStored,
+	    (uintmax_t)gRejEvicted, (uintmax_t)gRejCleared);
 	Printf("\tAcct Update     : %d\r\n", conf->acct_update);
 	Printf("\t   Limit In     : %d\r\n", conf->acct_update_lim_recv);
 	Printf("\t   Limit Out    : %d\r\n", conf->acct_update_lim_xmit);
@@ -856,6 +983,12 @@ AuthStat(Context ctx, int ac, const char *const av[], const void *arg)
 
 void
 AuthAccountStart(Link l, int type)
+{
+	AuthAccountStart2(l, type, TRUE);
+}
+
+static void
+AuthAccountStart2(Link l, int type, int getstats)
 {
 	Auth const a = &l->lcp.auth;
 	AuthData auth;
@@ -870,7 +1003,9 @@ AuthAccountStart(Link l, int type)
 			return;
 		}
 	}
-	LinkUpdateStats(l);
+	/* Final counters of the session, otherwise collected ones */
+	if (getstats && type == AUTH_ACCT_STOP)
+		LinkUpdateStats(l);
 	if (type == AUTH_ACCT_STOP) {
 		Log(LG_AUTH2, ("[%s] ACCT: Accounting data for user '%s': %lu seconds, %llu octets in, %llu octets out",
 		    l->name, a->params.authname,
@@ -884,7 +1019,7 @@ AuthAccountStart(Link l, int type)
 		if (a->params.acct_update > 0)
 			updateInterval = a->params.acct_update;
 		else
-			updateInterval = a->conf.acct_update;
+			updateInterval = a->conf->acct_update;
 
 		if (updateInterval > 0) {
 			/* Save initial statistics. */
@@ -894,7 +1029,7 @@ AuthAccountStart(Link l, int type)
 			/* Start accounting update timer. */
 			TimerInit(&a->acct_timer, "AuthAccountTimer",
 			    updateInterval * SECONDS, AuthAccountTimeout, l);
-			TimerStartRecurring(&a->acct_timer);
+			TimerStartSpread(&a->acct_timer);
 		}
 	}
 	if (type == AUTH_ACCT_UPDATE) {
@@ -907,11 +1042,11 @@ AuthAccountStart(Link l, int type)
 		if (a->params.acct_update_lim_recv > 0)
 			lim_recv = a->params.acct_update_lim_recv;
 		else
-			lim_recv = a->conf.acct_update_lim_recv;
+			lim_recv = a->conf->acct_update_lim_recv;
 		if (a->params.acct_update_lim_xmit > 0)
 			lim_xmit = a->params.acct_update_lim_xmit;
 		else
-			lim_xmit = a->conf.acct_update_lim_xmit;
+			lim_xmit = a->conf->acct_update_lim_xmit;
 		if (lim_recv > 0 || lim_xmit > 0) {
 			if ((l->stats.recvOctets - a->prev_stats.recvOctets < lim_recv) &&
 			    (l->stats.xmitOctets - a->prev_stats.xmitOctets < lim_xmit)) {
@@ -927,18 +1062,30 @@ AuthAccountStart(Link l, int type)
 		/* Stop accounting update timer if running. */
 		TimerStop(&a->acct_timer);
 	}
-	if (Enabled(&a->conf.options, AUTH_CONF_RADIUS_ACCT) ||
-#ifdef USE_PAM
-	    Enabled(&a->conf.options, AUTH_CONF_PAM_ACCT) ||
-#endif
-#ifdef USE_SYSTEM
-	    Enabled(&a->conf.options, AUTH_CONF_SYSTEM_ACCT) ||
-#endif
-	    Enabled(&a->conf.options, AUTH_CONF_EXT_ACCT)) {
+	if (AuthAccountEnabled(&a->conf->options)) {
 
 		auth = AuthDataNew(l);
 		auth->acct_type = type;
 
+		/*
+		 * RADIUS requests go through the spool if there is one,
+		 * unless the link depends on the result of the Start.
+		 */
+		if (Enabled(&auth->conf.options, AUTH_CONF_RADIUS_ACCT) &&
+		    AcctSpoolActive() && (type != AUTH_ACCT_START ||
+		    !Enabled(&auth->conf.options, AUTH_CONF_ACCT_MANDATORY)) &&
+		    AcctSpoolAppend(auth) == 0) {
+			Disable(&auth->conf.options, AUTH_CONF_RADIUS_ACCT);
+			if (!AuthAccountEnabled(&auth->conf.options)) {
+				AuthDataDestroy(auth);
+				return;
+			}
+		}
+		/* Keep the spool from sending later records of the session
+		   before this one, which the link sends itself */
+		if (Enabled(&auth->conf.options, AUTH_CONF_RADIUS_ACCT) &&
+		    AcctSpoolActive())
+			AcctSpoolHold(auth);
 		if (paction_start(&a->acct_thread, &gGiantMutex, AuthAccount,
 		    AuthAccountFinish, auth) == -1) {
 			Perror("[%s] ACCT: Couldn't start thread", l->name);
@@ -947,6 +1094,25 @@ AuthAccountStart(Link l, int type)
 	}
 }
 
+/*
+ * AuthAccountEnabled()
+ *
+ * Tell whether any accounting backend is enabled
+ */
+
+static int
+AuthAccountEnabled(struct optinfo *opt)
+{
+	return (Enabled(opt, AUTH_CONF_RADIUS_ACCT) ||
+#ifdef USE_PAM
+	    Enabled(opt, AUTH_CONF_PAM_ACCT) ||
+#endif
+#ifdef USE_SYSTEM
+	    Enabled(opt, AUTH_CONF_SYSTEM_ACCT) ||
+#endif
+	    Enabled(opt, AUTH_CONF_EXT_ACCT));
+}
+
 /*
  * AuthAccountTimeout()
  *
@@ -961,7 +1127,12 @@ AuthAccountTimeout(void *arg)
 	Log(LG_AUTH2, ("[%s] ACCT: Time for Accounting Update",
 	    l->name));
 
-	AuthAccountStart(l, AUTH_ACCT_UPDATE);
+	/* Counters of the statistics collector are used as they are */
+	if (!StatsFresh(l->statsTime)) {
+		Log(LG_AUTH2, ("[%s] ACCT: Counters are %ld seconds old",
+		    l->name, (long)(time(NULL) - l->statsTime)));
+	}
+	AuthAccountStart2(l, AUTH_ACCT_UPDATE, FALSE);
 }
 
 /*
@@ -979,8 +1150,10 @@ AuthAccount(void *arg)
 
 	Log(LG_AUTH2, ("[%s] ACCT: Thread started", auth->info.lnkname));
 
-	if (Enabled(&auth->conf.options, AUTH_CONF_RADIUS_ACCT))
+	if (Enabled(&auth->conf.options, AUTH_CONF_RADIUS_ACCT)) {
+		AcctSpoolWait(auth);
 		err |= RadiusAccount(auth);
+	}
 #ifdef USE_PAM
 	if (Enabled(&auth->conf.options, AUTH_CONF_PAM_ACCT))
 		err |= AuthPAMAcct(auth);
@@ -1180,6 +1353,7 @@ AuthAsync(void *arg)
 		if (AuthExternal(auth)) {
 			Log(LG_ERR | LG_AUTH, ("[%s] AUTH: EXTERNAL returned error",
 			    auth->info.lnkname));
+			auth->backend_error = 1;
 		} else {
 			Log(LG_AUTH, ("[%s] AUTH: EXTERNAL returned: %s",
 			    auth->info.lnkname, AuthStatusText(auth->status)));
@@ -1198,6 +1372,7 @@ AuthAsync(void *arg)
 		if (RadiusAuthenticate(auth)) {
 			Log(LG_ERR | LG_AUTH, ("[%s] AUTH: RADIUS returned error",
 			    auth->info.lnkname));
+			auth->backend_error = 1;
 		} else {
 			Log(LG_AUTH, ("[%s] AUTH: RADIUS returned: %s",
 			    auth->info.lnkname, AuthStatusText(auth->status)));
@@ -1315,6 +1490,9 @@ AuthAsyncFinish(void *arg, int was_canceled)
 		AuthDataDestroy(auth);
 		return;
 	}
+	/* Let AuthFinish() remember the verdict, unless it was a guess */
+	l->lcp.auth.rejhash = auth->rejhash;
+	l->lcp.auth.rejpending = (gRejCache != NULL && !auth->backend_error);
 	auth->finish(l, auth);
 }
 
@@ -1734,9 +1912,125 @@ AuthPreChecks(AuthData auth)
 			return (-1);
 		}
 	}
+	/* check recently rejected logins */
+	if (gRejCache != NULL) {
+		struct rejentry *e;
+		time_t now = time(NULL);
+
+		auth->rejhash = AuthRejectHash(auth);
+		e = AuthRejectFind(auth->rejhash, FALSE);
+		if (e != NULL && now < e->until) {
+			e->hits++;
+			gRejHits++;
+			Log(LG_AUTH, ("[%s] AUTH: Name: \"%s\" rejected by cache for %ld more seconds",
+			    auth->info.lnkname, auth->params.authname,
+			    (long)(e->until - now)));
+			auth->status = AUTH_STATUS_FAIL;
+			auth->why_fail = AUTH_FAIL_INVALID_LOGIN;
+			return (-1);
+		}
+	}
 	return (0);
 }
 
+/*
+ * AuthRejectHash()
+ *
+ * Reject cache key: FNV-1a of the name and the calling station,
+ * or of the peer MAC address if the device reports no number.
+ */
+
+static uint64_t
+AuthRejectHash(AuthData auth)
+{
+	const char *station;
+	const u_char *p;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (p = (const u_char *)auth->params.authname; *p; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	h *= 0x100000001b3ULL;
+	station = auth->params.callingnum[0] ? auth->params.callingnum :
+	    auth->params.peermacaddr;
+	for (p = (const u_char *)station; *p; p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	return (h != 0 ? h : 1);
+}
+
+/*
+ * AuthRejectFind()
+ *
+ * Look the key up in its bucket. When asked to create a missing
+ * entry, take a free slot or the one rejected longest ago.
+ */
+
+static struct rejentry *
+AuthRejectFind(uint64_t hash, int create)
+{
+	struct rejentry *b, *victim;
+	int k;
+
+	b = &gRejCache[(hash % AUTH_REJECT_BUCKETS) * AUTH_REJECT_WAYS];
+	victim = b;
+	for (k = 0; k < AUTH_REJECT_WAYS; k++) {
+		if (b[k].hash == hash)
+			return (&b[k]);
+		if (victim->hash != 0 &&
+		    (b[k].hash == 0 || b[k].last < victim->last))
+			victim = &b[k];
+	}
+	if (!create)
+		return (NULL);
+	if (victim->hash != 0)
+		gRejEvicted++;
+	memset(victim, 0, sizeof(*victim));
+	victim->hash = hash;
+	return (victim);
+}
+
+/*
+ * AuthRejectUpdate()
+ *
+ * Remember the backend verdict on the last request of the link.
+ * Each further rejection doubles the time the pair is rejected
+ * locally, up to the configured limit; success forgets it.
+ */
+
+static void
+AuthRejectUpdate(Link l, int ok)
+{
+	Auth const a = &l->lcp.auth;
+	struct rejentry *e;
+	time_t now = time(NULL);
+	u_int k;
+	int ttl;
+
+	if (gRejCache == NULL)
+		return;
+	if (ok) {
+		if ((e = AuthRejectFind(a->rejhash, FALSE)) != NULL) {
+			memset(e, 0, sizeof(*e));
+			gRejCleared++;
+		}
+		return;
+	}
+	e = AuthRejectFind(a->rejhash, TRUE);
+	/* Start over if the peer kept quiet for a while */
+	if (now - e->last > 2 * gRejectMaxTtl)
+		e->fails = 0;
+	if (e->fails < 31)
+		e->fails++;
+	ttl = gRejectTtl;
+	for (k = 1; k < e->fails && ttl < gRejectMaxTtl; k++)
+		ttl = (ttl > gRejectMaxTtl / 2) ? gRejectMaxTtl : ttl * 2;
+	e->until = now + ttl;
+	e->last = now;
+	e->hits = 0;
+	gRejStored++;
+	Log(LG_AUTH2, ("[%s] AUTH: Name: \"%s\" cached as rejected for %d seconds",
+	    l->name, a->params.authname, ttl));
+}
+
 /*
  * AuthTimeout()
  *
@@ -1918,6 +2212,32 @@ AuthGetExternalPassword(const char *extcmd, char *authname, char *password, size
 	FILE *fp;
 	int len;
 
+	if (ExtPoolActive()) {
+		char *reply, *rp, *line;
+
+		/* Persistent helper gets the name and replies the password */
+		if (strchr(authname, '\n'))
+			return (-1);
+		snprintf(cmd, sizeof(cmd), "USER_NAME:%s\n\n", authname);
+		if ((reply = ExtPoolRequest(extcmd, cmd, strlen(cmd), authname)) == NULL) {
+			Log(LG_AUTH, ("External auth program failed for user \"%s\"",
+			    authname));
+			return (-1);
+		}
+		rp = reply;
+		while ((line = strsep(&rp, "\n")) != NULL) {
+			if (strncmp(line, "USER_PASSWORD:", 14) == 0) {
+				strlcpy(password, line + 14, passlen);
+				ok = (password[0] != '\0');
+			}
+		}
+		Freee(reply);
+		if (!ok)
+			Log(LG_AUTH, ("External auth program failed for user \"%s\"",
+			    authname));
+		return (ok ? 0 : -1);
+	}
+
 	snprintf(cmd, sizeof(cmd), "%s %s", extcmd, authname);
 	Log(LG_AUTH, ("Invoking external auth program: '%s'", cmd));
 	if ((fp = popen(cmd, "r")) == NULL) {
@@ -1971,11 +2291,12 @@ AuthCode(int proto, u_char code, char *buf, size_t len)
 static int
 AuthSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 {
-	AuthConf const autc = &ctx->lnk->lcp.auth.conf;
+	AuthConf autc;
 	int val;
 
 	if (ac == 0)
 		return (-1);
+	autc = AuthConfWrite(ctx->lnk);
 
 	switch ((intptr_t)arg) {
 
@@ -2006,6 +2327,26 @@ AuthSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 		}
 		break;
 
+	case SET_REJECT_CACHE:
+		val = atoi(av[0]);
+		if (val < 0)
+			Error("Reject cache time must not be negative.");
+		if (ac >= 2) {
+			if (atoi(av[1]) < val)
+				Error("Max time must not be less than the initial one.");
+			gRejectMaxTtl = atoi(av[1]);
+		} else if (gRejectMaxTtl < val)
+			gRejectMaxTtl = val;
+		gRejectTtl = val;
+		if (val == 0) {
+			Freee(gRejCache);
+			gRejCache = NULL;
+		} else if (gRejCache == NULL) {
+			gRejCache = Malloc(MB_AUTH, AUTH_REJECT_BUCKETS *
+			    AUTH_REJECT_WAYS * sizeof(*gRejCache));
+		}
+		break;
+
 	case SET_ACCT_UPDATE:
 		val = atoi(*av);
 		if (val < 0)
@@ -2077,8 +2418,9 @@ AuthExternal(AuthData auth)
 {
 	char line[256];
 	FILE *fp;
-	char *attr, *val;
-	int len;
+	char *attr, *val, *req, *reply, *rp;
+	size_t reqlen;
+	int len, pooled;
 
 	if (!auth->conf.extauth_script || !auth->conf.extauth_script[0]) {
 		Log(LG_ERR, ("[%s] Ext-auth: Script not specified!",
@@ -2091,16 +2433,11 @@ AuthExternal(AuthData auth)
 		    auth->info.lnkname));
 		return (-1);
 	}
-	snprintf(line, sizeof(line), "%s '%s'",
-	    auth->conf.extauth_script, auth->params.authname);
-	Log(LG_AUTH, ("[%s] Ext-auth: Invoking auth program: '%s'",
-	    auth->info.lnkname, line));
-	if ((fp = popen(line, "r+")) == NULL) {
-		Perror("Popen");
+	if ((fp = AuthExtStart(auth->conf.extauth_script, auth->params.authname,
+	    auth->info.lnkname, "auth", &pooled, &req, &reqlen)) == NULL)
 		return (-1);
-	}
 	/* SENDING REQUEST */
-	fprintf(fp, "USER_NAME:%s\n", auth->params.authname);
+	AuthExtAttr(fp, "USER_NAME", "%s", auth->params.authname);
 	fprintf(fp, "AUTH_TYPE:%s", ProtoName(auth->proto));
 	if (auth->proto == PROTO_CHAP) {
 		switch (auth->alg) {
@@ -2121,30 +2458,34 @@ AuthExternal(AuthData auth)
 		fprintf(fp, "\n");
 
 	if (auth->proto == PROTO_PAP)
-		fprintf(fp, "USER_PASSWORD:%s\n", auth->params.pap.peer_pass);
-
-	fprintf(fp, "ACCT_SESSION_ID:%s\n", auth->info.session_id);
-	fprintf(fp, "LINK:%s\n", auth->info.lnkname);
-	fprintf(fp, "NAS_PORT:%d\n", auth->info.linkID);
-	fprintf(fp, "NAS_PORT_TYPE:%s\n", auth->info.phys_type->name);
-	fprintf(fp, "CALLING_STATION_ID:%s\n", auth->params.callingnum);
-	fprintf(fp, "CALLED_STATION_ID:%s\n", auth->params.callednum);
-	fprintf(fp, "SELF_NAME:%s\n", auth->params.selfname);
-	fprintf(fp, "PEER_NAME:%s\n", auth->params.peername);
-	fprintf(fp, "SELF_ADDR:%s\n", auth->params.selfaddr);
-	fprintf(fp, "PEER_ADDR:%s\n", auth->params.peeraddr);
-	fprintf(fp, "PEER_PORT:%s\n", auth->params.peerport);
-	fprintf(fp, "PEER_MAC_ADDR:%s\n", auth->params.peermacaddr);
-	fprintf(fp, "PEER_IFACE:%s\n", auth->params.peeriface);
-	fprintf(fp, "PEER_IDENT:%s\n", auth->info.peer_ident);
+		AuthExtAttr(fp, "USER_PASSWORD", "%s", auth->params.pap.peer_pass);
+
+	AuthExtAttr(fp, "ACCT_SESSION_ID", "%s", auth->info.session_id);
+	AuthExtAttr(fp, "LINK", "%s", auth->info.lnkname);
+	AuthExtAttr(fp, "NAS_PORT", "%d", auth->info.linkID);
+	AuthExtAttr(fp, "NAS_PORT_TYPE", "%s", auth->info.phys_type->name);
+	AuthExtAttr(fp, "CALLING_STATION_ID", "%s", auth->params.callingnum);
+	AuthExtAttr(fp, "CALLED_STATION_ID", "%s", auth->params.callednum);
+	AuthExtAttr(fp, "SELF_NAME", "%s", auth->params.selfname);
+	AuthExtAttr(fp, "PEER_NAME", "%s", auth->params.peername);
+	AuthExtAttr(fp, "SELF_ADDR", "%s", auth->params.selfaddr);
+	AuthExtAttr(fp, "PEER_ADDR", "%s", auth->params.peeraddr);
+	AuthExtAttr(fp, "PEER_PORT", "%s", auth->params.peerport);
+	AuthExtAttr(fp, "PEER_MAC_ADDR", "%s", auth->params.peermacaddr);
+	AuthExtAttr(fp, "PEER_IFACE", "%s", auth->params.peeriface);
+	AuthExtAttr(fp, "PEER_IDENT", "%s", auth->info.peer_ident);
 
 
 	/* REQUEST DONE */
 	fprintf(fp, "\n");
+	if (AuthExtSend(&fp, pooled, &req, &reqlen, auth->conf.extauth_script,
+	    auth->info.lnkname, &reply) < 0)
+		return (-1);
+	rp = reply;
 
 	/* REPLY PROCESSING */
 	auth->status = AUTH_STATUS_FAIL;
-	while (fgets(line, sizeof(line), fp)) {
+	while (AuthExtGets(fp, &rp, line, sizeof(line))) {
 		/* trim trailing newline */
 		len = strlen(line);
 		if (len > 0 && line[len - 1] == '\n') {
@@ -2436,7 +2777,7 @@ AuthExternal(AuthData auth)
 		}
 	}
 
-	pclose(fp);
+	AuthExtClose(fp, reply);
 	return (0);
 }
 
@@ -2451,8 +2792,9 @@ AuthExternalAcct(AuthData auth)
 {
 	char line[256];
 	FILE *fp;
-	char *attr, *val;
-	int len;
+	char *attr, *val, *req, *reply, *rp;
+	size_t reqlen;
+	int len, pooled;
 
 	if (!auth->conf.extacct_script || !auth->conf.extacct_script[0]) {
 		Log(LG_ERR, ("[%s] Ext-acct: Script not specified!",
@@ -2465,82 +2807,81 @@ AuthExternalAcct(AuthData auth)
 		    auth->info.lnkname));
 		return (-1);
 	}
-	snprintf(line, sizeof(line), "%s '%s'",
-	    auth->conf.extacct_script, auth->params.authname);
-	Log(LG_AUTH, ("[%s] Ext-acct: Invoking acct program: '%s'",
-	    auth->info.lnkname, line));
-	if ((fp = popen(line, "r+")) == NULL) {
-		Perror("Popen");
+	if ((fp = AuthExtStart(auth->conf.extacct_script, auth->params.authname,
+	    auth->info.lnkname, "acct", &pooled, &req, &reqlen)) == NULL)
 		return (-1);
-	}
 	/* SENDING REQUEST */
-	fprintf(fp, "ACCT_STATUS_TYPE:%s\n",
+	AuthExtAttr(fp, "ACCT_STATUS_TYPE", "%s",
 	    (auth->acct_type == AUTH_ACCT_START) ?
 	    "START" : ((auth->acct_type == AUTH_ACCT_STOP) ?
 	    "STOP" : "UPDATE"));
 
-	fprintf(fp, "ACCT_SESSION_ID:%s\n", auth->info.session_id);
-	fprintf(fp, "ACCT_MULTI_SESSION_ID:%s\n", auth->info.msession_id);
-	fprintf(fp, "USER_NAME:%s\n", auth->params.authname);
-	fprintf(fp, "IFACE:%s\n", auth->info.ifname);
-	fprintf(fp, "IFACE_INDEX:%d\n", auth->info.ifindex);
-	fprintf(fp, "BUNDLE:%s\n", auth->info.bundname);
-	fprintf(fp, "LINK:%s\n", auth->info.lnkname);
-	fprintf(fp, "NAS_PORT:%d\n", auth->info.linkID);
-	fprintf(fp, "NAS_PORT_TYPE:%s\n", auth->info.phys_type->name);
-	fprintf(fp, "ACCT_LINK_COUNT:%d\n", auth->info.n_links);
-	fprintf(fp, "CALLING_STATION_ID:%s\n", auth->params.callingnum);
-	fprintf(fp, "CALLED_STATION_ID:%s\n", auth->params.callednum);
-	fprintf(fp, "SELF_NAME:%s\n", auth->params.selfname);
-	fprintf(fp, "PEER_NAME:%s\n", auth->params.peername);
-	fprintf(fp, "SELF_ADDR:%s\n", auth->params.selfaddr);
-	fprintf(fp, "PEER_ADDR:%s\n", auth->params.peeraddr);
-	fprintf(fp, "PEER_PORT:%s\n", auth->params.peerport);
-	fprintf(fp, "PEER_MAC_ADDR:%s\n", auth->params.peermacaddr);
-	fprintf(fp, "PEER_IFACE:%s\n", auth->params.peeriface);
-	fprintf(fp, "PEER_IDENT:%s\n", auth->info.peer_ident);
-
-	fprintf(fp, "FRAMED_IP_ADDRESS:%s\n",
+	AuthExtAttr(fp, "ACCT_SESSION_ID", "%s", auth->info.session_id);
+	AuthExtAttr(fp, "ACCT_MULTI_SESSION_ID", "%s", auth->info.msession_id);
+	AuthExtAttr(fp, "USER_NAME", "%s", auth->params.authname);
+	AuthExtAttr(fp, "IFACE", "%s", auth->info.ifname);
+	AuthExtAttr(fp, "IFACE_INDEX", "%d", auth->info.ifindex);
+	AuthExtAttr(fp, "BUNDLE", "%s", auth->info.bundname);
+	AuthExtAttr(fp, "LINK", "%s", auth->info.lnkname);
+	AuthExtAttr(fp, "NAS_PORT", "%d", auth->info.linkID);
+	AuthExtAttr(fp, "NAS_PORT_TYPE", "%s", auth->info.phys_type->name);
+	AuthExtAttr(fp, "ACCT_LINK_COUNT", "%d", auth->info.n_links);
+	AuthExtAttr(fp, "CALLING_STATION_ID", "%s", auth->params.callingnum);
+	AuthExtAttr(fp, "CALLED_STATION_ID", "%s", auth->params.callednum);
+	AuthExtAttr(fp, "SELF_NAME", "%s", auth->params.selfname);
+	AuthExtAttr(fp, "PEER_NAME", "%s", auth->params.peername);
+	AuthExtAttr(fp, "SELF_ADDR", "%s", auth->params.selfaddr);
+	AuthExtAttr(fp, "PEER_ADDR", "%s", auth->params.peeraddr);
+	AuthExtAttr(fp, "PEER_PORT", "%s", auth->params.peerport);
+	AuthExtAttr(fp, "PEER_MAC_ADDR", "%s", auth->params.peermacaddr);
+	AuthExtAttr(fp, "PEER_IFACE", "%s", auth->params.peeriface);
+	AuthExtAttr(fp, "PEER_IDENT", "%s", auth->info.peer_ident);
+
+	AuthExtAttr(fp, "FRAMED_IP_ADDRESS", "%s",
 	    inet_ntoa(auth->info.peer_addr));
 
 	if (auth->acct_type == AUTH_ACCT_STOP)
-		fprintf(fp, "ACCT_TERMINATE_CAUSE:%s\n", auth->info.downReason);
+		AuthExtAttr(fp, "ACCT_TERMINATE_CAUSE", "%s", auth->info.downReason);
 
 	if (auth->acct_type != AUTH_ACCT_START) {
 #ifdef USE_NG_BPF
 		struct svcstatrec *ssr;
 
 #endif
-		fprintf(fp, "ACCT_SESSION_TIME:%ld\n",
+		AuthExtAttr(fp, "ACCT_SESSION_TIME", "%ld",
 		    (long int)(time(NULL) - auth->info.last_up));
-		fprintf(fp, "ACCT_INPUT_OCTETS:%llu\n",
+		AuthExtAttr(fp, "ACCT_INPUT_OCTETS", "%llu",
 		    (long long unsigned)auth->info.stats.recvOctets);
-		fprintf(fp, "ACCT_INPUT_PACKETS:%llu\n",
+		AuthExtAttr(fp, "ACCT_INPUT_PACKETS", "%llu",
 		    (long long unsigned)auth->info.stats.recvFrames);
-		fprintf(fp, "ACCT_OUTPUT_OCTETS:%llu\n",
+		AuthExtAttr(fp, "ACCT_OUTPUT_OCTETS", "%llu",
 		    (long long unsigned)auth->info.stats.xmitOctets);
-		fprintf(fp, "ACCT_OUTPUT_PACKETS:%llu\n",
+		AuthExtAttr(fp, "ACCT_OUTPUT_PACKETS", "%llu",
 		    (long long unsigned)auth->info.stats.xmitFrames);
 #ifdef USE_NG_BPF
 		SLIST_FOREACH(ssr, &auth->info.ss.stat[0], next) {
-			fprintf(fp, "MPD_INPUT_OCTETS:%s:%llu\n",
+			AuthExtAttr(fp, "MPD_INPUT_OCTETS", "%s:%llu",
 			    ssr->name, (long long unsigned)ssr->Octets);
-			fprintf(fp, "MPD_INPUT_PACKETS:%s:%llu\n",
+			AuthExtAttr(fp, "MPD_INPUT_PACKETS", "%s:%llu",
 			    ssr->name, (long long unsigned)ssr->Packets);
 		}
 		SLIST_FOREACH(ssr, &auth->info.ss.stat[1], next) {
-			fprintf(fp, "MPD_OUTPUT_OCTETS:%s:%llu\n",
+			AuthExtAttr(fp, "MPD_OUTPUT_OCTETS", "%s:%llu",
 			    ssr->name, (long long unsigned)ssr->Octets);
-			fprintf(fp, "MPD_OUTPUT_PACKETS:%s:%llu\n",
+			AuthExtAttr(fp, "MPD_OUTPUT_PACKETS", "%s:%llu",
 			    ssr->name, (long long unsigned)ssr->Packets);
 		}
 #endif					/* USE_NG_BPF */
 	}
 	/* REQUEST DONE */
 	fprintf(fp, "\n");
+	if (AuthExtSend(&fp, pooled, &req, &reqlen, auth->conf.extacct_script,
+	    auth->info.lnkname, &reply) < 0)
+		return (-1);
+	rp = reply;
 
 	/* REPLY PROCESSING */
-	while (fgets(line, sizeof(line), fp)) {
+	while (AuthExtGets(fp, &rp, line, sizeof(line))) {
 		/* trim trailing newline */
 		len = strlen(line);
 		if (len > 0 && line[len - 1] == '\n') {
@@ -2567,6 +2908,122 @@ AuthExternalAcct(AuthData auth)
 		}
 	}
 
-	pclose(fp);
+	AuthExtClose(fp, reply);
 	return (0);
 }
+
+/*
+ * AuthExtStart()
+ *
+ * Get a stream to write an ext-auth or ext-acct request to. Normally
+ * that is the script started for this request alone; with persistent
+ * helpers the request is collected in memory and passed on to one of
+ * them by AuthExtSend().
+ */
+
+static FILE *
+AuthExtStart(const char *script, const char *authname, const char *label,
+    const char *what, int *pooled, char **req, size_t *reqlen)
+{
+	char line[256];
+	FILE *fp;
+
+	if ((*pooled = ExtPoolActive())) {
+		if ((fp = open_memstream(req, reqlen)) == NULL)
+			Perror("[%s] Ext-%s: open_memstream", label, what);
+		return (fp);
+	}
+	snprintf(line, sizeof(line), "%s '%s'", script, authname);
+	Log(LG_AUTH, ("[%s] Ext-%s: Invoking %s program: '%s'",
+	    label, what, what, line));
+	if ((fp = popen(line, "r+")) == NULL)
+		Perror("Popen");
+	return (fp);
+}
+
+/*
+ * AuthExtSend()
+ *
+ * Finish the request. For a persistent helper the request is sent and
+ * the reply returned in *reply, the stream is closed and set to NULL.
+ */
+
+static int
+AuthExtSend(FILE **fp, int pooled, char **req, size_t *reqlen,
+    const char *script, const char *label, char **reply)
+{
+	*reply = NULL;
+	if (!pooled)
+		return (0);
+	fclose(*fp);
+	*fp = NULL;
+	*reply = ExtPoolRequest(script, *req, *reqlen, label);
+	free(*req);
+	return (*reply != NULL ? 0 : -1);
+}
+
+/*
+ * AuthExtAttr()
+ *
+ * Write an ATTR:value request line. Line breaks in the value are
+ * replaced, so a value can't add lines or, with persistent helpers,
+ * end the request early and start another one.
+ */
+
+static void
+AuthExtAttr(FILE *fp, const char *attr, const char *fmt, ...)
+{
+	va_list args;
+	char *val, *p;
+
+	va_start(args, fmt);
+	if (vasprintf(&val, fmt, args) < 0)
+		val = NULL;
+	va_end(args);
+	if (val == NULL) {
+		fprintf(fp, "%s:\n", attr);
+		return;
+	}
+	for (p = val; (p = strpbrk(p, "\r\n")) != NULL; p++)
+		*p = ' ';
+	fprintf(fp, "%s:%s\n", attr, val);
+	free(val);
+}
+
+/*
+ * AuthExtGets()
+ *
+ * Get the next reply line like fgets() does, from the script or
+ * from a helper reply.
+ */
+
+static char *
+AuthExtGets(FILE *fp, char **rp, char *line, size_t size)
+{
+	size_t len;
+	char *nl;
+
+	if (fp != NULL)
+		return (fgets(line, size, fp));
+	if (*rp == NULL || **rp == 0)
+		return (NULL);
+	len = ((nl = strchr(*rp, '\n')) != NULL) ? (size_t)(nl - *rp + 1) : strlen(*rp);
+	if (len > size - 1)
+		len = size - 1;
+	memcpy(line, *rp, len);
+	line[len] = 0;
+	*rp += len;
+	return (line);
+}
+
+/*
+ * AuthExtClose()
+ */
+
+static void
+AuthExtClose(FILE *fp, char *reply)
+{
+	if (fp != NULL)
+		pclose(fp);
+	Freee(reply);
+}
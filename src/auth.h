@@ -30,6 +30,9 @@
 
 #define AUTH_RETRIES		5
 
+#define AUTH_REJECT_BUCKETS	1024	/* Reject cache size, in buckets */
+#define AUTH_REJECT_WAYS	4	/* Entries per bucket */
+
 #define AUTH_MSG_WELCOME	"Welcome"
 #define AUTH_MSG_INVALID	"Login incorrect"
 #define AUTH_MSG_BAD_PACKET	"Incorrectly formatted packet"
@@ -170,6 +173,7 @@ struct authparams {
 					 * address */
 	char	peeriface[IFNAMSIZ];	/* hr representation of the peer
 					 * interface */
+	struct radhealth *radserver;	/* RADIUS server of a challenge */
 
 	/* Iface stuff */
 	char	ifname[IFNAMSIZ];	/* Interface name */
@@ -204,6 +208,7 @@ struct authparams {
 };
 
 struct authconf {
+	int	refs;			/* Links sharing this config */
 	struct radiusconf radius;	/* RADIUS configuration */
 	char	authname[AUTH_MAX_AUTHNAME];	/* Configured username */
 	char	password[AUTH_MAX_PASSWORD];	/* Configured password */
@@ -234,9 +239,12 @@ struct auth {
 	struct eapinfo eap;		/* EAP state */
 	struct paction *thread;		/* async auth thread */
 	struct paction *acct_thread;	/* async accounting auth thread */
-	struct authconf conf;		/* Auth backends, RADIUS, etc. */
+	struct authconf *conf;		/* Auth backends, RADIUS, etc. (shared
+					 * with template, copy-on-write) */
 	struct authparams params;	/* params to pass to from auth backend */
 	struct ng_ppp_link_stat64 prev_stats;	/* Previous link statistics */
+	uint64_t rejhash;		/* Reject cache key of the last request */
+	u_char	rejpending;		/* Reject cache waits for the result */
 };
 typedef struct auth *Auth;
 
@@ -256,14 +264,21 @@ struct authdata {
 	u_char	eap_radius;
 	u_char	status;
 	u_char	why_fail;
+	u_char	backend_error;		/* Some backend could not answer */
+	uint64_t rejhash;		/* Reject cache key */
 	char   *reply_message;		/* Text wich may displayed to the user */
 	char   *mschap_error;		/* MSCHAP Error Message */
 	char   *mschapv2resp;		/* Response String for MSCHAPv2 */
 	void    (*finish) (Link l, struct authdata *auth);	/* Finish handler */
 	int	drop_user;		/* RAD_MPD_DROP_USER value sent by
 					 * RADIUS server */
+	void	*acct_hold;		/* Spooled records held back while
+					 * the link sends this one */
 	struct {
 		struct rad_handle *handle;	/* the RADIUS handle */
+		struct radhealth *server;	/* Server of the handle */
+		u_int	tried;			/* Servers tried, by index */
+		struct timespec sent;		/* When it was sent */
 	}	radius;
 #ifdef USE_OPIE
 	struct {
@@ -285,6 +300,7 @@ struct authdata {
 #endif
 		char   *downReason;	/* Reason for link going down */
 		time_t	last_up;	/* Time this link last got up */
+		time_t	acct_time;	/* Time of the accounting event */
 		const struct phystype *phys_type; /* Device type descriptor */
 		int	linkID;		/* Absolute link number */
 		char	peer_ident[64];	/* LCP ident received from peer */
@@ -313,6 +329,9 @@ extern const u_char gMsoftZeros[32];
 extern void AuthInit(Link l);
 extern void AuthInst(Auth auth, Auth autht);
 extern void AuthShutdown(Link l);
+extern AuthConf AuthConfWrite(Link l);
+extern void AuthConfRelease(AuthConf conf);
+extern size_t AuthConfSize(AuthConf conf);
 extern void AuthStart(Link l);
 extern void AuthStop(Link l);
 extern void AuthInput(Link l, int proto, Mbuf bp);
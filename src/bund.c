@@ -21,6 +21,8 @@
 #include "log.h"
 #include "util.h"
 #include "input.h"
+#include "stats.h"
+#include "console.h"
 
 #include <netgraph.h>
 #include <netgraph/ng_message.h>
@@ -41,6 +43,12 @@
 
   #define BUND_MIN_TOT_BW	9600
 
+  /* Outstanding asynchronous bundle statistics request */
+  struct bundstatsreq {
+    Bund		b;
+    struct timespec	sent;		/* When requested */
+  };
+
   /* Set menu options */
   enum {
     SET_PERIOD,
@@ -81,6 +89,10 @@
   static void	BundCloseLink(Link l);
 
   static void	BundMsg(int type, void *cookie);
+  static int	BundStatsLinkNum(Bund b);
+  static void	BundApplyStats(Bund b, const void *data,
+		    const struct timespec *sent);
+  static void	BundUpdateStatsReply(void *arg, struct ng_mesg *reply);
 
 /*
  * GLOBAL VARIABLES
@@ -303,6 +315,8 @@ BundJoin(Link l)
     b->n_up++;
 
     LinkResetStats(l);
+    StatsSessionEvent(l, STATS_EVENT_UP);
+    ConsoleEvent(CONS_EV_LINK_UP, l, b, "%s", l->type ? l->type->name : "");
 
     if (b->n_up == 1) {
 
@@ -400,6 +414,9 @@ BundLeave(Link l)
     Log(LG_LINK, ("[%s] Link: Leave bundle \"%s\"", l->name, b->name));
 
     AuthAccountStart(l, AUTH_ACCT_STOP);
+    StatsSessionEvent(l, STATS_EVENT_DOWN);
+    ConsoleEvent(CONS_EV_LINK_DOWN, l, b, "%s",
+	l->downReason ? l->downReason : "");
 
     /* Disable link */
     b->pppConfig.links[l->bundleIndex].enableLink = 0;
@@ -1386,33 +1403,128 @@ BundStat(Context ctx, int ac, const char *const av[], const void *arg)
 void
 BundUpdateStats(Bund b)
 {
+  struct timespec		sent;
 #ifndef NG_PPP_STATS64
   struct ng_ppp_link_stat	stats;
+
+  clock_gettime(CLOCK_MONOTONIC, &sent);
+  if (NgFuncGetStats(b, BundStatsLinkNum(b), &stats) != -1)
+    BundApplyStats(b, &stats, &sent);
+#else
+  struct ng_ppp_link_stat64	stats;
+
+  clock_gettime(CLOCK_MONOTONIC, &sent);
+  if (NgFuncGetStats64(b, BundStatsLinkNum(b), &stats) != -1)
+    BundApplyStats(b, &stats, &sent);
 #endif
+}
+
+/*
+ * BundUpdateStatsAsync()
+ *
+ * Request bundle statistics without waiting for the reply.
+ */
+
+int
+BundUpdateStatsAsync(Bund b)
+{
+  struct bundstatsreq	*r;
+  char		path[NG_PATHSIZ];
+  u_int16_t	linkNum = BundStatsLinkNum(b);
+
+  r = Malloc(MB_BUND, sizeof(*r));
+  r->b = b;
+  clock_gettime(CLOCK_MONOTONIC, &r->sent);
+  snprintf(path, sizeof(path), "[%x]:", b->nodeID);
+  REF(b);
+  if (NgFuncSendQueryAsync(path, NGM_PPP_COOKIE,
+#ifndef NG_PPP_STATS64
+    NGM_PPP_GET_LINK_STATS,
+#else
+    NGM_PPP_GET_LINK_STATS64,
+#endif
+    &linkNum, sizeof(linkNum), BundUpdateStatsReply, r) < 0) {
+    UNREF(b);
+    Freee(r);
+    return (-1);
+  }
+  return (0);
+}
+
+/*
+ * BundUpdateStatsReply()
+ */
+
+static void
+BundUpdateStatsReply(void *arg, struct ng_mesg *reply)
+{
+  struct bundstatsreq	*const r = arg;
+  Bund		const b = r->b;
+
+  if (reply != NULL && reply->header.arglen < NG_PPP_STATS_LEN) {
+    Log(LG_ERR, ("[%s] short bundle stats reply: %u bytes", b->name,
+      (u_int)reply->header.arglen));
+  } else if (reply != NULL && !b->dead)
+    BundApplyStats(b, reply->data, &r->sent);
+  UNREF(b);
+  Freee(r);
+}
+
+/*
+ * BundStatsLinkNum()
+ *
+ * Link number to query for whole bundle statistics.
+ */
+
+static int
+BundStatsLinkNum(Bund b)
+{
   int	l = NG_PPP_BUNDLE_LINKNUM;
 
 #if (__FreeBSD_version < 602104 || (__FreeBSD_version >= 700000 && __FreeBSD_version < 700029))
   /* Workaround for broken ng_ppp bundle stats */
   if (!b->peer_mrru)
     l = 0;
+#else
+  (void)b;
 #endif
+  return (l);
+}
+
+/*
+ * BundApplyStats()
+ *
+ * Update bundle statistics from ppp node counters requested at the
+ * given time, dropping samples older than the one already applied.
+ */
 
+static void
+BundApplyStats(Bund b, const void *data, const struct timespec *sent)
+{
 #ifndef NG_PPP_STATS64
-  if (NgFuncGetStats(b, l, &stats) != -1) {
-    b->stats.xmitFrames += abs(stats.xmitFrames - b->oldStats.xmitFrames);
-    b->stats.xmitOctets += abs(stats.xmitOctets - b->oldStats.xmitOctets);
-    b->stats.recvFrames += abs(stats.recvFrames - b->oldStats.recvFrames);
-    b->stats.recvOctets += abs(stats.recvOctets - b->oldStats.recvOctets);
-    b->stats.badProtos  += abs(stats.badProtos - b->oldStats.badProtos);
-    b->stats.runts	  += abs(stats.runts - b->oldStats.runts);
-    b->stats.dupFragments += abs(stats.dupFragments - b->oldStats.dupFragments);
-    b->stats.dropFragments += abs(stats.dropFragments - b->oldStats.dropFragments);
-    b->oldStats = stats;
-  }
+  struct ng_ppp_link_stat	stats;
+#endif
 
+  if (sent->tv_sec < b->statsSample.tv_sec ||
+    (sent->tv_sec == b->statsSample.tv_sec &&
+    sent->tv_nsec < b->statsSample.tv_nsec))
+    return;
+#ifndef NG_PPP_STATS64
+  memcpy(&stats, data, sizeof(stats));
+  b->stats.xmitFrames += abs(stats.xmitFrames - b->oldStats.xmitFrames);
+  b->stats.xmitOctets += abs(stats.xmitOctets - b->oldStats.xmitOctets);
+  b->stats.recvFrames += abs(stats.recvFrames - b->oldStats.recvFrames);
+  b->stats.recvOctets += abs(stats.recvOctets - b->oldStats.recvOctets);
+  b->stats.badProtos  += abs(stats.badProtos - b->oldStats.badProtos);
+  b->stats.runts	  += abs(stats.runts - b->oldStats.runts);
+  b->stats.dupFragments += abs(stats.dupFragments - b->oldStats.dupFragments);
+  b->stats.dropFragments += abs(stats.dropFragments - b->oldStats.dropFragments);
+  b->oldStats = stats;
 #else
-    NgFuncGetStats64(b, l, &b->stats);
+  memcpy(&b->stats, data, sizeof(b->stats));
 #endif
+  b->statsSample = *sent;
+  b->statsTime = time(NULL);
 }
 
 /* 
@@ -1425,9 +1537,12 @@ BundUpdateStatsTimer(void *cookie)
     Bund	b = (Bund)cookie;
     int		k;
   
-    BundUpdateStats(b);
+    /* Counters recently fetched by the collector can't have wrapped */
+    if (!StatsFresh(b->statsTime))
+	BundUpdateStats(b);
     for (k = 0; k < NG_PPP_MAX_LINKS; k++) {
-	if (b->links[k] && b->links[k]->joined_bund)
+	if (b->links[k] && b->links[k]->joined_bund &&
+	  !StatsFresh(b->links[k]->statsTime))
 	    LinkUpdateStats(b->links[k]);
     }
 }
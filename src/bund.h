@@ -129,6 +129,8 @@
     char		hook[NG_HOOKSIZ];	/* session hook name */
     MsgHandler		msgs;			/* Bundle events */
     int			refs;			/* Number of references */
+    u_int		frameDumps;		/* Frame dump sampling counter */
+    int			dpJobs;			/* Frames in the worker pool */
 
     /* PPP node config */
     struct ng_ppp_node_conf	pppConfig;
@@ -140,6 +142,8 @@
     struct bundbm	bm;		/* Bandwidth management state */
     struct bundconf	conf;		/* Configuration for this bundle */
     struct ng_ppp_link_stat64	stats;	/* Statistics for this bundle */
+    time_t		statsTime;	/* When stats were last fetched */
+    struct timespec	statsSample;	/* When the applied sample was requested */
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat oldStats;	/* Previous stats for 64bit emulation */
     struct pppTimer     statsUpdateTimer;       /* update Timer */
@@ -189,6 +193,7 @@
   extern Bund	BundFind(const char *name);
   extern void	BundShutdown(Bund b);
   extern void   BundUpdateStats(Bund b);
+  extern int	BundUpdateStatsAsync(Bund b);
   extern void	BundUpdateStatsTimer(void *cookie);
   extern void	BundResetStats(Bund b);
 
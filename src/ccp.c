@@ -12,6 +12,7 @@
 #include "ccp.h"
 #include "fsm.h"
 #include "ngfunc.h"
+#include "dpool.h"
 
 #include <netgraph/ng_message.h>
 #include <netgraph/ng_socket.h>
@@ -423,15 +424,15 @@ CcpNgDataEvent(int type, void *cookie)
 		
 	b = gBundles[id];
 
-	/* Packet requiring compression */
-	if (bundname[0] == 'c') {
-	    bp = CcpDataOutput(b, bp);
-	} else {
-	    /* Packet requiring decompression */
-	    bp = CcpDataInput(b, bp);
+	/* Workers may only use compressor state of an opened layer */
+	if (b->ccp.fsm.state != ST_OPENED) {
+	    mbfree(bp);
+	    continue;
 	}
-	if (bp)
-	    NgFuncWriteFrame(gCcpDsock, naddr.sg_data, b->name, bp);
+
+	/* Packet requiring compression or decompression */
+	DpoolSubmit(b, naddr.sg_data[0] == 'c' ? CcpDataOutput : CcpDataInput,
+	    gCcpDsock, naddr.sg_data, bp);
     }
 }
 
@@ -621,6 +622,10 @@ CcpSendResetReq(Bund b)
   Fsm		const fp = &ccp->fsm;
   Mbuf		bp = NULL;
 
+  /* Decompressor running in a data path worker */
+  if (DpoolDefer(CcpSendResetReq, b))
+    return;
+
   if (ct == NULL) {
     Log(LG_ERR, ("[%s] %s: CcpSendResetReq() call from undefined decompressor!", 
 	Pref(fp), Fsm(fp)));
@@ -647,6 +652,7 @@ CcpRecvResetReq(Fsm fp, int id, Mbuf bp)
   CompType	const ct = ccp->xmit;
   int		noAck = 0;
 
+  DpoolSync(b);
   ccp->xmit_resets++;
   bp = (ct && ct->RecvResetReq) ? (*ct->RecvResetReq)(b, id, bp, &noAck) : NULL;
   if (!noAck) {
@@ -667,6 +673,7 @@ CcpRecvResetAck(Fsm fp, int id, Mbuf bp)
   CcpState	const ccp = &b->ccp;
   CompType	const ct = ccp->recv;
 
+  DpoolSync(b);
   if (ct && ct->RecvResetAck)
     (*ct->RecvResetAck)(b, id, bp);
 }
@@ -692,8 +699,10 @@ CcpDataOutput(Bund b, Mbuf plain)
 {
   CcpState	const ccp = &b->ccp;
   Mbuf		comp;
+  const int	dump = LogWantSampled(LG_FRAME, &ccp->frameDumps);
 
-  LogDumpBp(LG_FRAME, plain, "[%s] %s: xmit plain", Pref(&ccp->fsm), Fsm(&ccp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, plain, "[%s] %s: xmit plain", Pref(&ccp->fsm), Fsm(&ccp->fsm));
 
 /* Compress packet */
 
@@ -704,7 +713,8 @@ CcpDataOutput(Bund b, Mbuf plain)
     return(NULL);
   }
   comp = (*ccp->xmit->Compress)(b, plain);
-  LogDumpBp(LG_FRAME, comp, "[%s] %s: xmit comp", Pref(&ccp->fsm), Fsm(&ccp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, comp, "[%s] %s: xmit comp", Pref(&ccp->fsm), Fsm(&ccp->fsm));
 
   return(comp);
 }
@@ -721,8 +731,10 @@ CcpDataInput(Bund b, Mbuf comp)
 {
   CcpState	const ccp = &b->ccp;
   Mbuf		plain;
+  const int	dump = LogWantSampled(LG_FRAME, &ccp->frameDumps);
 
-  LogDumpBp(LG_FRAME, comp, "[%s] %s: recv comp", Pref(&ccp->fsm), Fsm(&ccp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, comp, "[%s] %s: recv comp", Pref(&ccp->fsm), Fsm(&ccp->fsm));
 
 /* Decompress packet */
 
@@ -742,7 +754,8 @@ CcpDataInput(Bund b, Mbuf comp)
     Log(LG_CCP, ("[%s] %s: decompression failed", Pref(&ccp->fsm), Fsm(&ccp->fsm)));
     return(NULL);
   }
-  LogDumpBp(LG_FRAME, plain, "[%s] %s: recv plain", Pref(&ccp->fsm), Fsm(&ccp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, plain, "[%s] %s: recv plain", Pref(&ccp->fsm), Fsm(&ccp->fsm));
 
   return(plain);
 }
@@ -799,6 +812,7 @@ CcpLayerUp(Fsm fp)
   }
 
   /* Initialize each direction */
+  DpoolSync(b);
   if (ccp->xmit != NULL && ccp->xmit->Init != NULL
       && (*ccp->xmit->Init)(b, COMP_DIR_XMIT) < 0) {
     Log(LG_CCP, ("[%s] %s: compression init failed", Pref(fp), Fsm(fp)));
@@ -882,6 +896,7 @@ CcpLayerDown(Fsm fp)
     snprintf(hook, sizeof(hook), "d%d", b->id);
     NgFuncDisconnect(gCcpCsock, b->name, ".:", hook);
   }
+  DpoolSync(b);
   if (ccp->recv && ccp->recv->Cleanup)
     (*ccp->recv->Cleanup)(b, COMP_DIR_RECV);
   if (ccp->xmit && ccp->xmit->Cleanup)
@@ -75,6 +75,7 @@
     uint32_t		recv_resets;	/* Number of ResetReq we have got from other side */
     uint32_t		xmit_resets;	/* Number of ResetReq we have sent to other side */
     u_char		crypt_check;	/* We checked for required encryption */
+    u_int		frameDumps;	/* Frame dump sampling counter */
   };
   typedef struct ccpstate	*CcpState;
 
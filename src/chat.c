@@ -20,6 +20,7 @@
 
   #define CHAT_MAX_ARGS		10
   #define CHAT_MAX_VARNAME	100
+  #define CHAT_READ_CHUNK	256
 
 /* Keywords */
 
@@ -98,11 +99,10 @@
     char		*set;
     char		*label;
     u_char		exact:1;	/* true if this is an exact match */
+    u_char		eol:1;		/* regex can only match a whole line */
     union {
       struct cm_exact {
 	char *pat;			/* exact string to match */
-	u_short	*fail;			/* failure function */
-	u_int	matched;		/* number of chars matched so far */
       }		exact;
       regex_t	regex;			/* regular expression to match */
     }			u;
@@ -151,6 +151,14 @@
     char		lineBuf[CHAT_MAX_LINE];		/* line buffer */
     char		readBuf[CHAT_READBUF_SIZE];	/* read buffer */
     int			readBufLen;
+    int			*acNext;	/* Aho-Corasick transitions, 256 per state */
+    short		*acOut;		/* first match completed in each state */
+    int			*acNeed;	/* bytes until a match can complete */
+    ChatMatch		*acMatches;	/* matches in list order */
+    int			acNum;		/* number of matches */
+    int			acState;	/* current automaton state */
+    u_char		acDirty;	/* match list changed */
+    u_char		acRegex;	/* some matches are regular expressions */
     chatbaudfunc_t	setBaudrate;
     chatresultfunc_t	result;
   };
@@ -216,10 +224,12 @@
 
   static void	ChatFreeMatch(ChatMatch match);
   static void	ChatFreeTimer(ChatTimer timer);
-  static int	ChatMatchChar(struct cm_exact *ex, char ch);
+  static void	ChatBuildMatcher(ChatInfo c);
+  static void	ChatFreeMatcher(ChatInfo c);
+  static ChatMatch ChatMatchByte(ChatInfo c, char ch, size_t lineBufLen);
   static int	ChatMatchRegex(ChatInfo c, regex_t *reg, const char *input);
   static void	ChatSetMatchVars(ChatInfo c, int exact, const char *input, ...);
-  static void	ChatComputeFailure(struct cm_exact *ex);
+  static int	ChatRegexAtEol(const char *pat);
 
   static int	ChatDecodeTime(ChatInfo c, const char *string, u_int *secsp);
   static int	ChatSetBaudrate(ChatInfo c, const char *new);
@@ -353,15 +363,21 @@ ChatAbort(ChatInfo c)
 
 /*
  * ChatRead()
+ *
+ * Read input in chunks and feed it to the matcher. A chunk never goes
+ * past the first byte where a pattern could complete, so input following
+ * a match (e.g. the first PPP frames after the script succeeds) is left
+ * in the device for whoever reads it next.
  */
 
 static void
 ChatRead(int type, void *cookie)
 {
   ChatInfo	const c = (ChatInfo) cookie;
-  ChatMatch	match;
+  ChatMatch	match = NULL;
   size_t	lineBufLen;
-  int		nread;
+  int		nread, want, k;
+  char		buf[CHAT_READ_CHUNK];
   char		ch;
   Link		const l = (Link) c->arg;
 
@@ -370,14 +386,31 @@ ChatRead(int type, void *cookie)
   assert(c->state == CHAT_WAIT);
   (void)type;
 
-/* Process one byte at a time */
+/* Process a chunk at a time */
 
   for (lineBufLen = strlen(c->lineBuf); 1; )
   {
 
-  /* Input next character */
+  /* Compile patterns if they have changed */
+
+    if (c->acDirty)
+      ChatBuildMatcher(c);
+
+  /* Regular expressions may match on any byte, exact strings not so soon */
+
+    if (c->acRegex || c->acNum == 0)
+      want = c->acRegex ? 1 : sizeof(buf);
+    else {
+      want = c->acNeed[c->acState];
+      if (want < 1)
+	want = 1;
+      else if (want > (int)sizeof(buf))
+	want = sizeof(buf);
+    }
 
-    if ((nread = read(c->fd, &ch, 1)) < 0)
+  /* Input next chunk */
+
+    if ((nread = read(c->fd, buf, want)) < 0)
     {
       if (errno == EAGAIN)
 	break;
@@ -392,68 +425,33 @@ die:
       return;
     }
 
-  /* Add to "bytes read" buffer for later debugging display */
-
-    if (c->readBufLen == sizeof(c->readBuf) || ch == '\n')
-      ChatDumpReadBuf(c);
-    c->readBuf[c->readBufLen++] = ch;
+    for (k = 0; k < nread && match == NULL; k++) {
+      ch = buf[k];
 
-  /* Add to current line buffer */
+    /* Add to "bytes read" buffer for later debugging display */
 
-    if (lineBufLen < sizeof(c->lineBuf) - 1) {
-      c->lineBuf[lineBufLen++] = ch;
-    } else {
-      Log(LG_CHAT, ("[%s] CHAT: warning: line buffer overflow", l->name));
-    }
+      if (c->readBufLen == sizeof(c->readBuf) || ch == '\n')
+	ChatDumpReadBuf(c);
+      c->readBuf[c->readBufLen++] = ch;
 
-  /* Try to match a match pattern */
+    /* Add to current line buffer */
 
-    for (match = c->matches; match; match = match->next) {
-      if (match->exact) {
-	if (ChatMatchChar(&match->u.exact, ch)) {
-	  ChatSetMatchVars(c, 1, match->u.exact.pat);
-	  break;
-	}
+      if (lineBufLen < sizeof(c->lineBuf) - 1) {
+	c->lineBuf[lineBufLen++] = ch;
       } else {
-	const int	nmatch = match->u.regex.re_nsub + 1;
-	regmatch_t	*pmatch;
-	int		r, flags = (REG_STARTEND | REG_NOTEOL);
-
-      /* Check for end of line */
-
-	pmatch = Malloc(MB_CHAT, nmatch * sizeof(*pmatch));
-	pmatch[0].rm_so = 0;
-	pmatch[0].rm_eo = lineBufLen;
-	if (pmatch[0].rm_eo > 0 && c->lineBuf[pmatch[0].rm_eo - 1] == '\n') {
-	  pmatch[0].rm_eo--;
-	  flags &= ~REG_NOTEOL;		/* this is a complete line */
-	  if (pmatch[0].rm_eo > 0 && c->lineBuf[pmatch[0].rm_eo - 1] == '\r')
-	    pmatch[0].rm_eo--;		/* elide the CR byte too */
-	}
-
-      /* Do comparison */
-
-	switch ((r = regexec(&match->u.regex,
-		c->lineBuf, nmatch, pmatch, flags))) {
-	  default:
-	    Log(LG_ERR, ("[%s] CHAT: regexec() returned %d?", l->name, r));
-	    /* fall through */
-	  case REG_NOMATCH:
-	    Freee(pmatch);
-	    continue;
-	  case 0:
-	    ChatSetMatchVars(c, 0, c->lineBuf, nmatch, pmatch);
-	    Freee(pmatch);
-	    break;
-	}
-	break;
+	Log(LG_CHAT, ("[%s] CHAT: warning: line buffer overflow", l->name));
       }
-    }
+
+    /* Try to match a match pattern */
+
+      match = ChatMatchByte(c, ch, lineBufLen);
 
     /* Reset line buffer after a newline */
-    if (ch == '\n') {
-      memset(&c->lineBuf, 0, sizeof(c->lineBuf));
-      lineBufLen = 0;
+
+      if (ch == '\n') {
+	memset(&c->lineBuf, 0, sizeof(c->lineBuf));
+	lineBufLen = 0;
+      }
     }
 
     /* Log match, pop the stack, and jump to target label */
@@ -461,6 +459,7 @@ die:
       char	label[CHAT_MAX_LABEL];
       int	numPop;
 
+      assert(k == nread);
       ChatDumpReadBuf(c);
       Log(LG_CHAT2, ("[%s] CHAT: matched set \"%s\", goto label \"%s\"",
          l->name, match->set, match->label));
@@ -480,6 +479,74 @@ die:
   EventRegister(&c->rdEvent, EVENT_READ, c->fd, 0, ChatRead, c);
 }
 
+/*
+ * ChatMatchByte()
+ *
+ * Advance the matcher by the next input byte, already appended to
+ * the line buffer. Returns the match that fired, if any. When several
+ * fire on the same byte the first one defined wins.
+ */
+
+static ChatMatch
+ChatMatchByte(ChatInfo c, char ch, size_t lineBufLen)
+{
+  ChatMatch	match;
+  int		best, k;
+  Link		const l = (Link) c->arg;
+
+  if (c->acNum == 0)
+    return (NULL);
+
+  /* All exact strings at once */
+  c->acState = c->acNext[c->acState * 256 + (u_char)ch];
+  best = c->acOut[c->acState];
+
+  /* Regular expressions defined before the best exact match */
+  for (k = 0; c->acRegex && k < (best >= 0 ? best : c->acNum); k++) {
+    regmatch_t	*pmatch;
+    int		nmatch, r, flags = (REG_STARTEND | REG_NOTEOL);
+
+    match = c->acMatches[k];
+    if (match->exact || (match->eol && ch != '\n'))
+      continue;
+    nmatch = match->u.regex.re_nsub + 1;
+
+  /* Check for end of line */
+
+    pmatch = Malloc(MB_CHAT, nmatch * sizeof(*pmatch));
+    pmatch[0].rm_so = 0;
+    pmatch[0].rm_eo = lineBufLen;
+    if (pmatch[0].rm_eo > 0 && c->lineBuf[pmatch[0].rm_eo - 1] == '\n') {
+      pmatch[0].rm_eo--;
+      flags &= ~REG_NOTEOL;		/* this is a complete line */
+      if (pmatch[0].rm_eo > 0 && c->lineBuf[pmatch[0].rm_eo - 1] == '\r')
+	pmatch[0].rm_eo--;		/* elide the CR byte too */
+    }
+
+  /* Do comparison */
+
+    switch ((r = regexec(&match->u.regex,
+	    c->lineBuf, nmatch, pmatch, flags))) {
+      default:
+	Log(LG_ERR, ("[%s] CHAT: regexec() returned %d?", l->name, r));
+	/* fall through */
+      case REG_NOMATCH:
+	Freee(pmatch);
+	continue;
+      case 0:
+	ChatSetMatchVars(c, 0, c->lineBuf, nmatch, pmatch);
+	Freee(pmatch);
+	return (match);
+    }
+  }
+
+  if (best < 0)
+    return (NULL);
+  match = c->acMatches[best];
+  ChatSetMatchVars(c, 1, match->u.exact.pat);
+  return (match);
+}
+
 /*
  * ChatTimeout()
  *
@@ -868,6 +935,7 @@ ChatStop(ChatInfo c)
 /* Cancel all sets */
 
   ChatCancel(c, CHAT_KEYWORD_ALL);
+  ChatFreeMatcher(c);
 
 /* Cancel all input and output */
 
@@ -917,25 +985,25 @@ ChatAddMatch(ChatInfo c, int exact, const char *set,
   match->exact = !!exact;
   if (exact) {
     match->u.exact.pat = pat;
-    match->u.exact.matched = 0;
-    ChatComputeFailure(&match->u.exact);
   } else {
     int		errcode;
     char	errbuf[100];
 
     /* Convert pattern into compiled regular expression */
     errcode = regcomp(&match->u.regex, pat, REG_EXTENDED);
-    Freee(pat);
 
     /* Check for error */
     if (errcode != 0) {
       regerror(errcode, &match->u.regex, errbuf, sizeof(errbuf));
       Log(LG_ERR, ("[%s] CHAT: line %d: invalid regular expression \"%s\": %s",
         l->name, c->lineNum, pat, errbuf));
+      Freee(pat);
       ChatFailure(c);
       Freee(match);
       return;
     }
+    match->eol = ChatRegexAtEol(pat);
+    Freee(pat);
   }
   match->set = ChatExpandString(c, set);
   match->label = ChatExpandString(c, label);
@@ -945,6 +1013,7 @@ ChatAddMatch(ChatInfo c, int exact, const char *set,
   for (mp = &c->matches; *mp; mp = &(*mp)->next);
   *mp = match;
   match->next = NULL;
+  c->acDirty = 1;
 }
 
 /*
@@ -994,6 +1063,7 @@ ChatCancel(ChatInfo c, const char *set0)
     if (all || !strcmp(match->set, set)) {
       *mp = match->next;
       ChatFreeMatch(match);
+      c->acDirty = 1;
     } else
       mp = &match->next;
   }
@@ -1128,6 +1198,7 @@ ChatReturn(ChatInfo c, int seek)
     if (--match->frameDepth < 0) {
       *mp = match->next;
       ChatFreeMatch(match);
+      c->acDirty = 1;
     } else
       mp = &match->next;
   }
@@ -1384,7 +1455,6 @@ ChatFreeMatch(ChatMatch match)
   Freee(match->label);
   if (match->exact) {
     Freee(match->u.exact.pat);
-    Freee(match->u.exact.fail);
   } else {
     regfree(&match->u.regex);
   }
@@ -1573,33 +1643,6 @@ ChatSetMatchVars(ChatInfo c, int exact, const char *input, ...)
   va_end(args);
 }
 
-/*
- * ChatMatchChar()
- *
- * Update "ex" given that "ch" is the next character.
- * Returns 1 if target has become fully matched.
- */
-
-static int
-ChatMatchChar(struct cm_exact *ex, char ch)
-{
-  const u_int	len = strlen(ex->pat);
-
-  /* Account for zero length pattern string -- match on next input char */
-  if (len == 0)
-    return 1;
-
-  /* Update longest-matched-prefix-length based on next char */
-  assert(ex->matched < len);
-  while (1) {
-    if (ch == ex->pat[ex->matched])
-      return ++ex->matched == len;
-    if (ex->matched == 0)
-      return 0;
-    ex->matched = ex->fail[ex->matched];
-  }
-}
-
 /*
  * ChatMatchRegex()
  *
@@ -1632,32 +1675,146 @@ ChatMatchRegex(ChatInfo c, regex_t *reg, const char *input)
 }
 
 /*
- * ChatComputeFailure()
+ * ChatBuildMatcher()
  *
- * Compute the failure function for the exact match pattern string.
- * That is, for each character position i=0..n-1, compute fail(i) =
- * 0 if i==0, else fail(i) = the greatest j < i such that characters
- * 0..j match characters (i - j)..(i - 1).
- *
- * There are linear time ways to compute this, but we're lazy.
+ * Compile all exact match strings into a single Aho-Corasick automaton,
+ * so each input byte costs one table lookup however many strings are
+ * pending. For every state we also compute the least number of input
+ * bytes that can complete a match, which bounds how much ChatRead()
+ * may read ahead.
  */
 
 static void
-ChatComputeFailure(struct cm_exact *ex)
+ChatBuildMatcher(ChatInfo c)
 {
-  const int	len = strlen(ex->pat);
-  int		i, j, k;
-
-  ex->fail = (u_short *) Malloc(MB_CHAT, len * sizeof(*ex->fail));
-  for (i = 1; i < len; i++) {
-    for (j = i - 1; j > 0; j--) {
-      for (k = 0; k < j && ex->pat[k] == ex->pat[i - j + k]; k++);
-      if (k == j) {
-	ex->fail[i] = j;
-	break;
+  ChatMatch	match;
+  int		*fail, *parent, *queue;
+  int		nodes, maxNodes, head, tail, node, k, j;
+  const u_char	*p;
+
+  ChatFreeMatcher(c);
+  c->acDirty = 0;
+  c->acState = 0;
+
+  /* Count matches and bound the number of states */
+  maxNodes = 1;
+  for (match = c->matches; match; match = match->next) {
+    c->acNum++;
+    if (match->exact)
+      maxNodes += strlen(match->u.exact.pat);
+    else
+      c->acRegex = 1;
+  }
+  if (c->acNum == 0)
+    return;
+
+  c->acMatches = Malloc(MB_CHAT, c->acNum * sizeof(*c->acMatches));
+  c->acNext = Malloc(MB_CHAT, maxNodes * 256 * sizeof(*c->acNext));
+  c->acOut = Malloc(MB_CHAT, maxNodes * sizeof(*c->acOut));
+  c->acNeed = Malloc(MB_CHAT, maxNodes * sizeof(*c->acNeed));
+  fail = Malloc(MB_CHAT, maxNodes * sizeof(*fail));
+  parent = Malloc(MB_CHAT, maxNodes * sizeof(*parent));
+  queue = Malloc(MB_CHAT, maxNodes * sizeof(*queue));
+  for (k = 0; k < maxNodes; k++) {
+    c->acOut[k] = -1;
+    c->acNeed[k] = INT_MAX;
+  }
+
+  /* Build the trie; node zero is the root and never a child */
+  nodes = 1;
+  for (k = 0, match = c->matches; match; k++, match = match->next) {
+    c->acMatches[k] = match;
+    if (!match->exact)
+      continue;
+    for (node = 0, p = (const u_char *)match->u.exact.pat; *p; p++) {
+      if (c->acNext[node * 256 + *p] == 0) {
+	parent[nodes] = node;
+	c->acNext[node * 256 + *p] = nodes++;
       }
+      node = c->acNext[node * 256 + *p];
     }
+    if (c->acOut[node] < 0)
+      c->acOut[node] = k;
+  }
+
+  /* Distance to the nearest string end below each node */
+  for (node = 0; node < nodes; node++) {
+    if (c->acOut[node] >= 0)
+      c->acNeed[node] = 0;
   }
+  for (node = nodes - 1; node > 0; node--) {
+    if (c->acNeed[node] != INT_MAX && c->acNeed[node] + 1 < c->acNeed[parent[node]])
+      c->acNeed[parent[node]] = c->acNeed[node] + 1;
+  }
+
+  /* Breadth first: failure links, inherited outputs and full transitions */
+  head = tail = 0;
+  for (j = 0; j < 256; j++) {
+    if ((node = c->acNext[j]) != 0) {
+      fail[node] = 0;
+      queue[tail++] = node;
+    }
+  }
+  while (head < tail) {
+    const int	u = queue[head++];
+    const int	f = fail[u];
+
+    if (c->acOut[f] >= 0 && (c->acOut[u] < 0 || c->acOut[f] < c->acOut[u]))
+      c->acOut[u] = c->acOut[f];
+    if (c->acNeed[f] < c->acNeed[u])
+      c->acNeed[u] = c->acNeed[f];
+    for (j = 0; j < 256; j++) {
+      if ((node = c->acNext[u * 256 + j]) != 0) {
+	fail[node] = c->acNext[f * 256 + j];
+	queue[tail++] = node;
+      } else
+	c->acNext[u * 256 + j] = c->acNext[f * 256 + j];
+    }
+  }
+
+  Freee(fail);
+  Freee(parent);
+  Freee(queue);
+}
+
+/*
+ * ChatFreeMatcher()
+ */
+
+static void
+ChatFreeMatcher(ChatInfo c)
+{
+  Freee(c->acNext);
+  Freee(c->acOut);
+  Freee(c->acNeed);
+  Freee(c->acMatches);
+  c->acNext = NULL;
+  c->acOut = NULL;
+  c->acNeed = NULL;
+  c->acMatches = NULL;
+  c->acNum = 0;
+  c->acState = 0;
+  c->acRegex = 0;
+}
+
+/*
+ * ChatRegexAtEol()
+ *
+ * Tell whether a regular expression is anchored to the end of line,
+ * so it can only match once a whole line has been received. Patterns
+ * with alternatives are never treated so.
+ */
+
+static int
+ChatRegexAtEol(const char *pat)
+{
+  const size_t	len = strlen(pat);
+  size_t	k;
+
+  if (len == 0 || pat[len - 1] != '$' || strchr(pat, '|') != NULL)
+    return (0);
+  for (k = len - 1; k > 0 && pat[k - 1] == '\\'; k--);
+  return ((len - 1 - k) % 2 == 0);
 }
 
 /*
@@ -38,6 +38,10 @@
 #include "ccp_mppc.h"
 #endif
 #include "util.h"
+#include "stats.h"
+#include "dpool.h"
+#include "extpool.h"
+#include "acctspool.h"
 #ifdef USE_FETCH
 #include <fetch.h>
 #endif
@@ -80,6 +84,15 @@
 #endif
     SET_MAX_CHILDREN,
     SET_QTHRESHOLD,
+    SET_FRAMESAMPLE,
+    SET_STATSINTERVAL,
+    SET_STATSEXPORT,
+    SET_DPOOLWORKERS,
+    SET_EXTHELPERS,
+    SET_EXTTIMEOUT,
+    SET_ACCTSPOOL,
+    SET_ACCTSPOOLRATE,
+    SET_TIMERSPREAD,
 #ifdef USE_NG_BPF
     SET_FILTER
 #endif
@@ -155,6 +168,24 @@
 	GlobalSetCommand, NULL, 2, (void *) SET_MAX_CHILDREN },
     { "qthreshold {min} {max}",		"Message queue limit thresholds",
         GlobalSetCommand, NULL, 2, (void *) SET_QTHRESHOLD },
+    { "frame-sample {num}",		"Dump one of every num frames",
+	GlobalSetCommand, NULL, 2, (void *) SET_FRAMESAMPLE },
+    { "stats-interval {seconds}",	"Statistics collector sweep period",
+	GlobalSetCommand, NULL, 2, (void *) SET_STATSINTERVAL },
+    { "stats-export {file}|none [{links}]",	"Memory mapped statistics file",
+	GlobalSetCommand, NULL, 2, (void *) SET_STATSEXPORT },
+    { "dpool-workers {num}",		"Userland data path threads",
+	GlobalSetCommand, NULL, 2, (void *) SET_DPOOLWORKERS },
+    { "ext-helpers {num}",		"Persistent ext-auth/ext-acct helpers",
+	GlobalSetCommand, NULL, 2, (void *) SET_EXTHELPERS },
+    { "ext-timeout {seconds}",		"Ext-auth/ext-acct helper timeout",
+	GlobalSetCommand, NULL, 2, (void *) SET_EXTTIMEOUT },
+    { "acct-spool {file}|none [{kbytes}]",	"RADIUS accounting spool file",
+	GlobalSetCommand, NULL, 2, (void *) SET_ACCTSPOOL },
+    { "acct-spool-rate {num}",		"Spooled accounting requests per second",
+	GlobalSetCommand, NULL, 2, (void *) SET_ACCTSPOOLRATE },
+    { "timer-spread {percent}",		"Phase spreading of periodic timers",
+	GlobalSetCommand, NULL, 2, (void *) SET_TIMERSPREAD },
 #ifdef USE_NG_BPF
     { "filter {num} add|clear [\"{flt}\"]",	"Global traffic filters management",
 	GlobalSetCommand, NULL, 2, (void *) SET_FILTER },
@@ -267,6 +298,12 @@
 #endif
     { "mem",				"Memory map",
 	MemStat, NULL, 0, NULL },
+    { "ngmsg",				"Netgraph query statistics",
+	NgFuncShowMsgs, NULL, 0, NULL },
+    { "dpool",				"Data path workers status",
+	DpoolStat, NULL, 0, NULL },
+    { "ext-helpers",			"External script helpers status",
+	ExtPoolStat, NULL, 0, NULL },
     { "console",			"Console status",
 	ConsoleStat, NULL, 0, NULL },
 #ifndef NOWEB
@@ -397,6 +434,10 @@
 	CMD_SUBMENU, NULL, 0, UnSetCommands },
     { "show ...",			"Show status",
 	CMD_SUBMENU, NULL, 0, ShowCommands },
+    { "subscribe [json|text] [{event} ...]", "Receive session events",
+	SubscribeCommand, NULL, 1, (void *) 1 },
+    { "unsubscribe",			"Stop session events",
+	SubscribeCommand, NULL, 1, NULL },
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
 
@@ -707,6 +748,88 @@ GlobalSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	    gMaxChildren = val;
       break;
 
+    case SET_FRAMESAMPLE:
+	val = atoi(*av);
+	if (val < 1 || val > 1000000)
+	    Error("Incorrect frame sampling rate");
+	else
+	    gLogFrameSample = (u_int)val;
+      break;
+
+    case SET_STATSINTERVAL:
+	val = atoi(*av);
+	if (val < 1 || val > 3600)
+	    Error("Incorrect statistics interval");
+	else
+	    StatsSetInterval(val);
+      break;
+
+    case SET_STATSEXPORT:
+	if (ac < 1 || ac > 2)
+	    return(-1);
+	val = STATS_EXPORT_DEFAULT;
+	if (ac == 2) {
+	    val = atoi(av[1]);
+	    if (val < 1 || val > 1000000)
+		Error("Incorrect number of links");
+	}
+	if (strcasecmp(av[0], "none") == 0)
+	    StatsExportOpen(NULL, 0);
+	else if (StatsExportOpen(av[0], val) < 0)
+	    Error("Can't create statistics file %s", av[0]);
+      break;
+
+    case SET_DPOOLWORKERS:
+	val = atoi(*av);
+	if (val < 0 || val > DPOOL_MAX_WORKERS)
+	    Error("Incorrect number of workers");
+	else if (DpoolSetWorkers(val) < 0)
+	    Error("Started only %d workers", gDpoolWorkers);
+      break;
+
+    case SET_EXTHELPERS:
+	val = atoi(*av);
+	if (val < 0 || val > EXTPOOL_MAX_HELPERS)
+	    Error("Incorrect number of helpers");
+	ExtPoolSetHelpers(val);
+      break;
+
+    case SET_EXTTIMEOUT:
+	val = atoi(*av);
+	if (val <= 0)
+	    Error("Incorrect timeout");
+	gExtTimeout = val;
+      break;
+
+    case SET_ACCTSPOOL:
+	if (ac < 1 || ac > 2)
+	    return(-1);
+	val = ACCTSPOOL_DEFAULT_SIZE;
+	if (ac == 2) {
+	    val = atoi(av[1]);
+	    if (val < 64 || val > 4 * 1024 * 1024)
+		Error("Incorrect spool size");
+	}
+	if (strcasecmp(av[0], "none") == 0)
+	    AcctSpoolOpen(NULL, 0);
+	else if (AcctSpoolOpen(av[0], val) < 0)
+	    Error("Can't open accounting spool %s", av[0]);
+      break;
+
+    case SET_ACCTSPOOLRATE:
+	val = atoi(*av);
+	if (val < 0)
+	    Error("Incorrect rate");
+	gAcctSpoolRate = val;
+      break;
+
+    case SET_TIMERSPREAD:
+	val = atoi(*av);
+	if (val < 0 || val > 100)
+	    Error("Incorrect percentage");
+	gTimerSpread = val;
+      break;
+
 #ifdef USE_NG_BPF
     case SET_FILTER:
 	if (ac == 4 && strcasecmp(av[1], "add") == 0) {
@@ -973,6 +1096,7 @@ ShowEvents(Context ctx, int ac, const char *const av[], const void *arg)
   (void)arg;
 
   EventDump(ctx);
+  TimerSpreadDump(ctx);
   return(0);
 }
 
@@ -986,6 +1110,7 @@ ShowGlobal(Context ctx, int ac, const char *const av[], const void *arg)
 #ifdef USE_NG_BPF
     int	k;
 #endif
+    char	buf[PATH_MAX + 16];
 
     (void)ac;
     (void)av;
@@ -1008,6 +1133,15 @@ ShowGlobal(Context ctx, int ac, const char *const av[], const void *arg)
 #endif
     Printf("	max-children	: %d\r\n", gMaxChildren);
     Printf("	qthreshold	: %d %d\r\n", gQThresMin, gQThresMax);
+    Printf("	frame-sample	: %u\r\n", gLogFrameSample);
+    Printf("	stats-interval	: %d\r\n", gStatsInterval);
+    Printf("	stats-export	: %s\r\n", StatsExportShow(buf, sizeof(buf)));
+    Printf("	dpool-workers	: %d\r\n", gDpoolWorkers);
+    Printf("	ext-helpers	: %d\r\n", gExtHelpers);
+    Printf("	ext-timeout	: %d\r\n", gExtTimeout);
+    Printf("	acct-spool	: %s\r\n", AcctSpoolShow(buf, sizeof(buf)));
+    Printf("	acct-spool-rate	: %d\r\n", gAcctSpoolRate);
+    Printf("	timer-spread	: %d%%\r\n", gTimerSpread);
     Printf("Global options:\r\n");
     OptStat(ctx, &gGlobalConf.options, gGlobalConfList);
 #ifdef USE_NG_BPF
@@ -1572,7 +1706,8 @@ ShowCustomer(Context ctx, int ac, const char *const av[], const void *arg)
 
 	if (!b->tmpl) {
 	    /* Show stats */
-	    BundUpdateStats(b);
+	    if (!StatsFresh(b->statsTime))
+		BundUpdateStats(b);
 	    Printf("\tTraffic stats:\r\n");
 
 	    Printf("\t\tInput octets   : %llu\r\n", (unsigned long long)b->stats.recvOctets);
@@ -1617,7 +1752,8 @@ ShowCustomer(Context ctx, int ac, const char *const av[], const void *arg)
 	    Printf("\tCalled          : %s\r\n", buf);
 
 	    if (l->bund) {
-		LinkUpdateStats(l);
+		if (!StatsFresh(l->statsTime))
+		    LinkUpdateStats(l);
 		Printf("\tTraffic stats:\r\n");
 		Printf("\t\tInput octets   : %llu\r\n", (unsigned long long)l->stats.recvOctets);
 		Printf("\t\tInput frames   : %llu\r\n", (unsigned long long)l->stats.recvFrames);
@@ -47,9 +47,19 @@
   static void	ConsoleConnect(int type, void *cookie);
   static void	ConsoleSessionClose(ConsoleSession cs);
   static void	ConsoleSessionReadEvent(int type, void *cookie);
+  static int	ConsoleSessionPipeline(ConsoleSession cs);
+  static void	ConsoleSessionFlush(ConsoleSession cs);
   static void	ConsoleSessionWrite(ConsoleSession cs, const char *fmt, ...);
   static void	ConsoleSessionWriteV(ConsoleSession cs, const char *fmt, va_list vl);
   static void	ConsoleSessionShowPrompt(ConsoleSession cs);
+  static void	ConsoleSessionQueueWrite(ConsoleSession cs, const char *fmt, ...);
+  static void	ConsoleSessionQueueWriteV(ConsoleSession cs, const char *fmt, va_list vl);
+  static int	ConsoleSessionQueue(ConsoleSession cs, const char *buf, int len);
+  static void	ConsoleSessionDrain(ConsoleSession cs);
+  static void	ConsoleSessionWriteEvent(int type, void *cookie);
+  static int	ConsoleEventFormat(int format, char *buf, size_t size,
+		    uint64_t seq, int type, Link l, Bund b, const char *detail);
+  static const char	*ConsoleJSONString(char *dst, size_t size, const char *s);
 
   static void	StdConsoleSessionClose(ConsoleSession cs);
   static void	StdConsoleSessionWrite(ConsoleSession cs, const char *fmt, ...);
@@ -93,9 +103,22 @@
 
   static const struct confinfo	sConfList[] = {
     { 0,	CONSOLE_LOGGING,	"logging"	},
+    { 0,	CONSOLE_PIPELINE,	"pipeline"	},
     { 0,	0,			NULL		},
   };
 
+  static const char	*gConsEvNames[CONS_EV_MAX] = {
+    "link-up",
+    "link-down",
+    "auth",
+    "ip",
+    "coa",
+    "rate",
+  };
+
+  static int		gConsSubscribers;	/* sessions with events */
+  static uint64_t	gConsEvSeq;
+
 static struct termios	gOrigTermiosAttrs;
 static int		gOrigFlags;
 
@@ -211,6 +234,10 @@ ConsoleStat(Context ctx, int ac, const char *const av[], const void *arg)
   SLIST_FOREACH(s, &c->sessions, next) {
     Printf("\tUsername: %s\tFrom: %s\r\n",
 	s->user.username, u_addrtoa(&s->peer_addr,addrstr,sizeof(addrstr)));
+    if (s->evmask)
+      Printf("\t\tEvents: %s, sent %ju, dropped %ju, queued %d bytes\r\n",
+	s->evformat == CONS_EVF_TEXT ? "text" : "json",
+	(uintmax_t)s->evsent, (uintmax_t)s->evdrops, s->qlen);
   }
   pthread_cleanup_pop(1);
 
@@ -247,9 +274,14 @@ ConsoleConnect(int type, void *cookie)
     goto cleanup;
   sockaddrtou_addr(&ss, &cs->peer_addr, &cs->peer_port);
 
+  if (pthread_mutex_init(&cs->olock, NULL) != 0)
+    goto fail;
+
   if (EventRegister(&cs->readEvent, EVENT_READ, cs->fd, 
-	EVENT_RECURRING, ConsoleSessionReadEvent, cs) < 0)
+	EVENT_RECURRING, ConsoleSessionReadEvent, cs) < 0) {
+    pthread_mutex_destroy(&cs->olock);
     goto fail;
+  }
 
   cs->console = c;
   cs->close = ConsoleSessionClose;
@@ -322,6 +354,12 @@ StdConsoleConnect(Console c)
       return(NULL);
     }
 
+    if (pthread_mutex_init(&cs->olock, NULL) != 0) {
+      Perror("%s: pthread_mutex_init", __FUNCTION__);
+      Freee(cs);
+      return(NULL);
+    }
+
     Enable(&cs->options, CONSOLE_LOGGING);
     cs->console = c;
     cs->close = StdConsoleSessionClose;
@@ -359,6 +397,18 @@ ConsoleSessionClose(ConsoleSession cs)
     SLIST_REMOVE(&cs->console->sessions, cs, console_session, next);
     RWLOCK_UNLOCK(cs->console->lock);
     EventUnRegister(&cs->readEvent);
+    ConsoleSessionFlush(cs);
+    if (cs->qbuf != NULL) {
+	if (cs->evmask)
+	    gConsSubscribers--;
+	/* Give the queue a last chance, the peer may be gone anyway */
+	MUTEX_LOCK(cs->olock);
+	EventUnRegister(&cs->writeEvent);
+	(void)write(cs->fd, cs->qbuf, cs->qlen);
+	MUTEX_UNLOCK(cs->olock);
+	Freee(cs->qbuf);
+    }
+    pthread_mutex_destroy(&cs->olock);
     close(cs->fd);
     Freee(cs);
     return;
@@ -384,6 +434,10 @@ StdConsoleSessionClose(ConsoleSession cs)
 
 /*
  * ConsoleSessionReadEvent()
+ *
+ * Input is read in chunks and processed character by character for
+ * interactive sessions, or line by line in pipeline mode. Output
+ * produced meanwhile is buffered and written once the input is consumed.
  */
 
 static void
@@ -399,18 +453,23 @@ ConsoleSessionReadEvent(int type, void *cookie)
   char                  addrstr[INET6_ADDRSTRLEN];
 
   (void)type;
+  cs->batch = TRUE;
   while(1) {
-    if ((n = read(cs->fd, &c, 1)) <= 0) {
-      if (n < 0) {
-	if (errno == EAGAIN)
-	  goto out;
-	Perror("CONSOLE: Error while reading");
-      } else {
-        if (cs->fd == 0 && isatty(cs->fd))
-	  goto out;
-	Log(LG_ERR, ("CONSOLE: Connection closed by peer"));
+    if (cs->rpos >= cs->rlen) {
+      if ((n = read(cs->fd, cs->rbuf, sizeof(cs->rbuf))) <= 0) {
+	if (n < 0) {
+	  if (errno == EAGAIN)
+	    goto out;
+	  Perror("CONSOLE: Error while reading");
+	} else {
+	  if (cs->fd == 0 && isatty(cs->fd))
+	    goto out;
+	  Log(LG_ERR, ("CONSOLE: Connection closed by peer"));
+	}
+	goto abort;
       }
-      goto abort;
+      cs->rlen = n;
+      cs->rpos = 0;
     }
     
     if (cs->context.lnk && cs->context.lnk->dead) {
@@ -426,6 +485,14 @@ ConsoleSessionReadEvent(int type, void *cookie)
 	cs->context.rep = NULL;
     }
 
+    if (cs->state == STATE_AUTHENTIC &&
+	Enabled(&cs->options, CONSOLE_PIPELINE)) {
+      if (ConsoleSessionPipeline(cs) < 0)
+	goto abort;
+      continue;
+    }
+    c = cs->rbuf[cs->rpos++];
+
     /* deal with escapes, map cursors */
     if (cs->escaped) {
       if (cs->escaped == '[') {
@@ -666,14 +733,61 @@ success:
   }
 
 abort:
+    cs->batch = FALSE;
     if (cs->close) {
 	RESETREF(cs->context.lnk, NULL);
         RESETREF(cs->context.bund, NULL);
         RESETREF(cs->context.rep, NULL);
 	cs->close(cs);
     }
+    return;
 out:
-  return;
+  cs->batch = FALSE;
+  ConsoleSessionFlush(cs);
+}
+
+/*
+ * ConsoleSessionPipeline()
+ *
+ * Consume buffered input of a non-interactive session up to and
+ * including the next line end and execute the line as a command.
+ * There is no echo, prompt, history or line editing in this mode.
+ * Returns -1 if the session should be closed.
+ */
+
+static int
+ConsoleSessionPipeline(ConsoleSession cs)
+{
+  char		line[MAX_CONSOLE_LINE];
+  char		*av[MAX_CONSOLE_ARGS], *av_copy[MAX_CONSOLE_ARGS];
+  u_char	c;
+  int		ac;
+
+  while (cs->rpos < cs->rlen) {
+    c = cs->rbuf[cs->rpos++];
+    if (c == '\r' || c == '\n')
+      break;
+    if (c >= 32 && (cs->cmd_len + 2) < MAX_CONSOLE_LINE)
+      cs->cmd[cs->cmd_len++] = c;
+    if (cs->rpos == cs->rlen)
+      return (0);			/* incomplete line */
+  }
+  cs->cmd[cs->cmd_len] = 0;
+  if (cs->cmd_len == 0)
+    return (0);
+
+  memcpy(line, cs->cmd, sizeof(line));
+  ac = ParseLine(line, av, sizeof(av) / sizeof(*av), 1);
+  memcpy(av_copy, av, sizeof(av));
+  Log2(LG_CONSOLE, ("[%s] CONSOLE: %s: %s", 
+    cs->context.lnk ? cs->context.lnk->name :
+	(cs->context.bund? cs->context.bund->name : ""), 
+    cs->user.username, cs->cmd));
+  DoCommand(&cs->context, ac, (const char *const *)av, NULL, 0);
+  FreeArgs(ac, av_copy);
+  memset(cs->cmd, 0, MAX_CONSOLE_LINE);
+  cs->cmd_len = 0;
+  return (cs->exit ? -1 : 0);
 }
 
 /*
@@ -698,13 +812,142 @@ static void
 ConsoleSessionWriteV(ConsoleSession cs, const char *fmt, va_list vl)
 {
     char	*buf;
-    size_t	len;
+    int		len;
     
-    len = vasprintf(&buf, fmt, vl);
-    write(cs->fd, buf, len);
+    if ((len = vasprintf(&buf, fmt, vl)) < 0)
+	return;
+    MUTEX_LOCK(cs->olock);
+    if (cs->olen + len > (int)sizeof(cs->obuf)) {
+	write(cs->fd, cs->obuf, cs->olen);
+	cs->olen = 0;
+    }
+    if (cs->batch && len <= (int)sizeof(cs->obuf)) {
+	memcpy(cs->obuf + cs->olen, buf, len);
+	cs->olen += len;
+    } else
+	write(cs->fd, buf, len);
+    MUTEX_UNLOCK(cs->olock);
     free(buf);
 }
 
+/*
+ * ConsoleSessionFlush()
+ *
+ * Write out output buffered while processing input.
+ */
+
+static void
+ConsoleSessionFlush(ConsoleSession cs)
+{
+    MUTEX_LOCK(cs->olock);
+    if (cs->olen > 0) {
+	write(cs->fd, cs->obuf, cs->olen);
+	cs->olen = 0;
+    }
+    MUTEX_UNLOCK(cs->olock);
+}
+
+/*
+ * ConsoleSessionQueueWrite()
+ */
+
+static void 
+ConsoleSessionQueueWrite(ConsoleSession cs, const char *fmt, ...)
+{
+  va_list vl;
+
+  va_start(vl, fmt);
+  ConsoleSessionQueueWriteV(cs, fmt, vl);
+  va_end(vl);
+}
+
+/*
+ * ConsoleSessionQueueWriteV()
+ *
+ * Output of sessions subscribed to events never blocks, it is
+ * queued and written when the socket becomes writable.
+ */
+
+static void 
+ConsoleSessionQueueWriteV(ConsoleSession cs, const char *fmt, va_list vl)
+{
+    char	*buf;
+    int		len;
+    
+    if ((len = vasprintf(&buf, fmt, vl)) < 0)
+	return;
+    MUTEX_LOCK(cs->olock);
+    (void)ConsoleSessionQueue(cs, buf, len);
+    MUTEX_UNLOCK(cs->olock);
+    free(buf);
+}
+
+/*
+ * ConsoleSessionQueue()
+ *
+ * Append data to the output queue as a whole, or not at all if it
+ * does not fit. Must be called with the output lock held.
+ */
+
+static int
+ConsoleSessionQueue(ConsoleSession cs, const char *buf, int len)
+{
+    if (cs->qlen + len > MAX_CONSOLE_QUEUE)
+	return (-1);
+    memcpy(cs->qbuf + cs->qlen, buf, len);
+    cs->qlen += len;
+    /* Let the event loop collect more data before writing */
+    if (!EventIsRegistered(&cs->writeEvent))
+	EventRegister(&cs->writeEvent, EVENT_WRITE, cs->fd, 0,
+	    ConsoleSessionWriteEvent, cs);
+    return (0);
+}
+
+/*
+ * ConsoleSessionDrain()
+ *
+ * Write out as much of the output queue as the socket takes.
+ * Must be called with the output lock held.
+ */
+
+static void
+ConsoleSessionDrain(ConsoleSession cs)
+{
+    int		n;
+
+    while (cs->qlen > 0) {
+	if ((n = write(cs->fd, cs->qbuf, cs->qlen)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN)
+		break;
+	    /* The read event will notice the peer is gone */
+	    cs->qlen = 0;
+	    return;
+	}
+	memmove(cs->qbuf, cs->qbuf + n, cs->qlen - n);
+	cs->qlen -= n;
+    }
+    if (cs->qlen > 0 && !EventIsRegistered(&cs->writeEvent))
+	EventRegister(&cs->writeEvent, EVENT_WRITE, cs->fd, 0,
+	    ConsoleSessionWriteEvent, cs);
+}
+
+/*
+ * ConsoleSessionWriteEvent()
+ */
+
+static void
+ConsoleSessionWriteEvent(int type, void *cookie)
+{
+    ConsoleSession	cs = cookie;
+
+    (void)type;
+    MUTEX_LOCK(cs->olock);
+    ConsoleSessionDrain(cs);
+    MUTEX_UNLOCK(cs->olock);
+}
+
 /*
  * StdConsoleSessionWrite()
  */
@@ -738,6 +981,8 @@ StdConsoleSessionWriteV(ConsoleSession cs, const char *fmt, va_list vl)
 static void
 ConsoleSessionShowPrompt(ConsoleSession cs)
 {
+  if (cs->state == STATE_AUTHENTIC && Enabled(&cs->options, CONSOLE_PIPELINE))
+    return;
   switch(cs->state) {
   case STATE_USERNAME:
     cs->write(cs, "Username: ");
@@ -864,6 +1109,197 @@ ConsoleSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
   return 0;
 }
 
+/*
+ * SubscribeCommand()
+ *
+ * Start or stop delivering session events to this console session.
+ * A subscribed session is switched to pipeline mode and its output
+ * becomes non-blocking, so a slow reader only loses its own events.
+ */
+
+int
+SubscribeCommand(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    ConsoleSession	cs = ctx->cs;
+    u_int		mask = 0;
+    int			format = CONS_EVF_JSON;
+    int			k = 0, i, fl;
+
+    if (cs == NULL || cs->close != ConsoleSessionClose)
+	Error("Events are delivered to TCP console sessions only");
+
+    if (arg == NULL) {
+	if (cs->evmask != 0)
+	    gConsSubscribers--;
+	cs->evmask = 0;
+	return (0);
+    }
+
+    if (ac > 0 && strcasecmp(av[0], "json") == 0)
+	k++;
+    else if (ac > 0 && strcasecmp(av[0], "text") == 0) {
+	format = CONS_EVF_TEXT;
+	k++;
+    }
+    for (; k < ac; k++) {
+	if (strcasecmp(av[k], "all") == 0) {
+	    mask = (1 << CONS_EV_MAX) - 1;
+	    continue;
+	}
+	for (i = 0; i < CONS_EV_MAX; i++) {
+	    if (strcasecmp(av[k], gConsEvNames[i]) == 0)
+		break;
+	}
+	if (i == CONS_EV_MAX)
+	    Error("Unknown event \"%s\"", av[k]);
+	mask |= 1 << i;
+    }
+    if (mask == 0)
+	mask = (1 << CONS_EV_MAX) - 1;
+
+    if (cs->qbuf == NULL) {
+	if ((fl = fcntl(cs->fd, F_GETFL, 0)) < 0 ||
+	    fcntl(cs->fd, F_SETFL, fl | O_NONBLOCK) < 0)
+	    Error("Can't make session non-blocking: %s", strerror(errno));
+	cs->qbuf = Malloc(MB_CONS, MAX_CONSOLE_QUEUE);
+	/* Output batched so far goes first */
+	MUTEX_LOCK(cs->olock);
+	memcpy(cs->qbuf, cs->obuf, cs->olen);
+	cs->qlen = cs->olen;
+	cs->olen = 0;
+	cs->write = ConsoleSessionQueueWrite;
+	cs->writev = ConsoleSessionQueueWriteV;
+	ConsoleSessionDrain(cs);
+	MUTEX_UNLOCK(cs->olock);
+	Enable(&cs->options, CONSOLE_PIPELINE);
+    }
+    if (cs->evmask == 0)
+	gConsSubscribers++;
+    cs->evmask = mask;
+    cs->evformat = format;
+    return (0);
+}
+
+/*
+ * ConsoleEvent()
+ *
+ * Deliver a session event to subscribed console sessions. Bundle is
+ * taken from the link if not given. Records are formatted at most once
+ * per format and dropped, and counted, for sessions with a full queue.
+ */
+
+void
+ConsoleEvent(int type, Link l, Bund b, const char *fmt, ...)
+{
+    Console		c = &gConsole;
+    ConsoleSession	s;
+    char		detail[256];
+    char		rec[2][1536];
+    int			len[2] = { -1, -1 };
+    uint64_t		seq;
+    va_list		vl;
+
+    if (gConsSubscribers == 0)
+	return;
+
+    va_start(vl, fmt);
+    vsnprintf(detail, sizeof(detail), fmt, vl);
+    va_end(vl);
+    if (b == NULL && l != NULL && l->joined_bund)
+	b = l->bund;
+    seq = ++gConsEvSeq;
+
+    RWLOCK_RDLOCK(c->lock);
+    SLIST_FOREACH(s, &c->sessions, next) {
+	if ((s->evmask & (1 << type)) == 0)
+	    continue;
+	if (len[s->evformat] < 0) {
+	    len[s->evformat] = ConsoleEventFormat(s->evformat,
+		rec[s->evformat], sizeof(rec[s->evformat]),
+		seq, type, l, b, detail);
+	}
+	MUTEX_LOCK(s->olock);
+	if (ConsoleSessionQueue(s, rec[s->evformat], len[s->evformat]) == 0)
+	    s->evsent++;
+	else
+	    s->evdrops++;
+	MUTEX_UNLOCK(s->olock);
+    }
+    RWLOCK_UNLOCK(c->lock);
+}
+
+/*
+ * ConsoleEventFormat()
+ *
+ * Build an event record, returns its length.
+ */
+
+static int
+ConsoleEventFormat(int format, char *buf, size_t size, uint64_t seq,
+	int type, Link l, Bund b, const char *detail)
+{
+    const char	*link, *bund, *iface, *user, *sess;
+    char	e[6][192];
+    int		len;
+
+    link = l ? l->name : "";
+    bund = b ? b->name : "";
+    iface = b ? b->iface.ifname : "";
+    user = l ? l->lcp.auth.params.authname : (b ? b->params.authname : "");
+    sess = l ? l->session_id : (b ? b->msession_id : "");
+
+    if (format == CONS_EVF_TEXT) {
+	len = snprintf(buf, size, "%ju %jd %s %s %s %s %s %s %s\r\n",
+	    (uintmax_t)seq, (intmax_t)time(NULL), gConsEvNames[type],
+	    *link ? link : "-", *bund ? bund : "-", *iface ? iface : "-",
+	    *user ? user : "-", *sess ? sess : "-", detail);
+    } else {
+	len = snprintf(buf, size, "{\"seq\":%ju,\"time\":%jd,\"event\":\"%s\","
+	    "\"link\":\"%s\",\"bundle\":\"%s\",\"iface\":\"%s\","
+	    "\"user\":\"%s\",\"session\":\"%s\",\"detail\":\"%s\"}\r\n",
+	    (uintmax_t)seq, (intmax_t)time(NULL), gConsEvNames[type],
+	    ConsoleJSONString(e[0], sizeof(e[0]), link),
+	    ConsoleJSONString(e[1], sizeof(e[1]), bund),
+	    ConsoleJSONString(e[2], sizeof(e[2]), iface),
+	    ConsoleJSONString(e[3], sizeof(e[3]), user),
+	    ConsoleJSONString(e[4], sizeof(e[4]), sess),
+	    ConsoleJSONString(e[5], sizeof(e[5]), detail));
+    }
+    return (len < (int)size ? len : (int)size - 1);
+}
+
+/*
+ * ConsoleJSONString()
+ *
+ * Escape a string for use inside JSON quotes, truncating it to fit.
+ */
+
+static const char *
+ConsoleJSONString(char *dst, size_t size, const char *s)
+{
+    size_t	k = 0;
+    u_char	c;
+
+    for (; (c = *s) != 0; s++) {
+	if (c == '"' || c == '\\') {
+	    if (k + 2 >= size)
+		break;
+	    dst[k++] = '\\';
+	    dst[k++] = c;
+	} else if (c < 0x20) {
+	    if (k + 6 >= size)
+		break;
+	    k += snprintf(dst + k, size - k, "\\u%04x", c);
+	} else {
+	    if (k + 1 >= size)
+		break;
+	    dst[k++] = c;
+	}
+    }
+    dst[k] = 0;
+    return (dst);
+}
+
 /*
  * ConsoleShutdown()
  */
@@ -19,6 +19,8 @@
   #define MAX_CONSOLE_ARGS	50
   #define MAX_CONSOLE_LINE	400
   #define MAX_CONSOLE_HIST	10
+  #define MAX_CONSOLE_BUF	4096
+  #define MAX_CONSOLE_QUEUE	65536	/* Output queue of subscribed sessions */
 
   #define Printf(fmt, args...)	do { 						\
 	  			  if (ctx->cs)	 				\
@@ -38,7 +40,25 @@
 
   /* Configuration options */
   enum {
-    CONSOLE_LOGGING	/* enable logging */
+    CONSOLE_LOGGING,	/* enable logging */
+    CONSOLE_PIPELINE	/* non-interactive command stream */
+  };
+
+  /* Session events delivered to subscribed sessions */
+  enum {
+    CONS_EV_LINK_UP = 0,	/* link joined a bundle */
+    CONS_EV_LINK_DOWN,		/* link left a bundle */
+    CONS_EV_AUTH,		/* authentication result */
+    CONS_EV_IP,			/* peer IP address assigned */
+    CONS_EV_COA,		/* RADIUS CoA request applied */
+    CONS_EV_RATE,		/* traffic limits installed */
+    CONS_EV_MAX
+  };
+
+  /* Event record formats */
+  enum {
+    CONS_EVF_JSON = 0,		/* one JSON object per line */
+    CONS_EVF_TEXT		/* space separated fields */
   };
 
   struct console {
@@ -93,10 +113,24 @@
     u_char		telnet;
     u_char		escaped;
     u_char		exit;
+    u_char		batch;		/* buffer output until flushed */
+    pthread_mutex_t	olock;		/* output buffer lock */
+    int			olen;
+    char		obuf[MAX_CONSOLE_BUF];	/* pending output */
+    int			rlen;
+    int			rpos;
+    u_char		rbuf[MAX_CONSOLE_BUF];	/* unprocessed input */
     int			cmd_len;
     char		cmd[MAX_CONSOLE_LINE];
     int			currhist;
     char		history[MAX_CONSOLE_HIST][MAX_CONSOLE_LINE];	/* last command */
+    u_char		evformat;	/* CONS_EVF_* */
+    u_int		evmask;		/* subscribed events, 1 << CONS_EV_* */
+    char		*qbuf;		/* non-blocking output queue */
+    int			qlen;
+    EventRef		writeEvent;	/* queue drain event */
+    uint64_t		evsent;		/* events queued */
+    uint64_t		evdrops;	/* events dropped on full queue */
     SLIST_ENTRY(console_session)	next;
   };
 
@@ -120,6 +154,10 @@
   extern Context	StdConsoleConnect(Console c);
   extern void	ConsoleShutdown(Console c);
   extern void	ConsoleCancelCleanup(void *rwlock);
+  extern void	ConsoleEvent(int type, Link l, Bund b, const char *fmt, ...)
+			__printflike(4, 5);
+
+  extern int	SubscribeCommand(Context ctx, int ac, const char *const av[], const void *arg);
 
   extern int	UserCommand(Context ctx, int ac, const char *const av[], const void *arg);
   extern int	UserStat(Context ctx, int ac, const char *const av[], const void *arg);
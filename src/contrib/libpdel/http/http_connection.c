@@ -178,6 +178,28 @@ _http_connection_free(struct http_connection **connp)
  	FREE("http_connection", conn);
 }
 
+/*
+ * Determine if input has already been read from the socket but not
+ * consumed yet, either by the stdio stream or inside the SSL layer.
+ * A poll(2) on the socket can't see such data.
+ */
+int
+_http_connection_input_pending(struct http_connection *conn)
+{
+	FILE *const fp = conn->fp;
+
+#if defined(__GLIBC__)
+	if (fp->_IO_read_ptr < fp->_IO_read_end)
+		return (1);
+#else
+	if (fp->_r > 0 || (fp->_ub._base != NULL && fp->_ur > 0))
+		return (1);
+#endif
+	if (conn->ssl != NULL && ssl_fdpending(fp) > 0)
+		return (1);
+	return (0);
+}
+
 /*
  * Logging callback for SSL code.
  */
@@ -63,6 +63,11 @@ struct http_connection {
 	u_char			proxy;		/* proxy request/response */
 	u_char			started;	/* conn. thread has started */
 	LIST_ENTRY(http_connection) next;	/* next in connection list */
+	TAILQ_ENTRY(http_connection) ready_next; /* next waiting for worker */
+	struct pevent		*idle_event;	/* waiting for next request */
+	time_t			idle_since;	/* when it became idle */
+	int			idle_limit;	/* max seconds to stay idle */
+	u_int			requests;	/* requests served */
 	http_logger_t		*logger;	/* error logging routine */
 	SSL_CTX			*ssl;		/* ssl context, if doing ssl */
 	int			sock;		/* socket cached */
@@ -186,6 +191,7 @@ extern struct	http_connection *_http_connection_create(FILE *fp, int sock,
 			int server, struct in_addr ip, u_int16_t port,
 			SSL_CTX *ssl, http_logger_t *logger, u_int timeout);
 extern void	_http_connection_free(struct http_connection **connp);
+extern int	_http_connection_input_pending(struct http_connection *conn);
 
 /*
  * Client connection caching functions
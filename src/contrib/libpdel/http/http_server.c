@@ -43,6 +43,7 @@
 #include <sys/socket.h>
 #include <sys/syslog.h>
 #include <sys/queue.h>
+#include <sys/time.h>
 
 #include <stdlib.h>
 #include <stdarg.h>
@@ -82,7 +83,11 @@
  */
 
 #define MAX_CONNECTIONS		1024
+#define MAX_WORKERS		64
 #define HTTP_SERVER_TIMEOUT	90
+#define HTTP_SERVER_WORKERS	4	/* default worker threads */
+#define HTTP_SERVER_KEEPALIVE	15	/* default idle keep-alive timeout */
+#define HTTP_SERVER_HEADER_TIMEOUT 10	/* wait for first request data */
 
 /* HTTP server */
 struct http_server {
@@ -97,8 +102,16 @@ struct http_server {
 	void			*proxy_arg;	/* proxy handler cookie */
 	LIST_HEAD(,http_connection)
 				conn_list;	/* active connections */
+	TAILQ_HEAD(,http_connection)
+				ready;		/* waiting for a worker */
+	pthread_cond_t		ready_cond;	/* signaled when ready */
+	struct pevent		*idle_timer;	/* keep-alive expiry timer */
+	pthread_t		workers[MAX_WORKERS]; /* worker threads */
+	int			num_workers;	/* number of workers */
 	int			max_conn;	/* max number of connections */
 	int			num_conn;	/* number of connections */
+	int			keepalive;	/* idle keep-alive timeout */
+	struct http_server_stats stats;		/* statistics */
 	http_logger_t		*logger;	/* error logging routine */
 	pthread_mutex_t		mutex;		/* mutex */
 	u_char			stopping;	/* server being stopped */
@@ -139,7 +152,12 @@ struct http_servlet_hook {
 /*
  * Internal functions
  */
-static void	*http_server_connection_main(void *arg);
+static void	*http_server_worker_main(void *arg);
+static int	http_server_start_workers(struct http_server *serv, int num);
+static int	http_server_connection_serve(struct http_connection *conn);
+static void	http_server_connection_idle(struct http_connection *conn,
+			int limit);
+static void	http_server_connection_close(struct http_connection *conn);
 static void	http_server_connection_cleanup(void *arg);
 static void	http_server_dispatch(struct http_request *req,
 			struct http_response *resp);
@@ -147,6 +165,8 @@ static int	http_server_ssl_pem_password_cb(char *buf, int size,
 			int rwflag, void *udata);
 
 static pevent_handler_t		http_server_accept;
+static pevent_handler_t		http_server_connection_ready;
+static pevent_handler_t		http_server_idle_expire;
 
 static ghash_equal_t		http_server_virthost_equal;
 static ghash_hash_t		http_server_virthost_hash;
@@ -177,10 +197,12 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 	}
 	memset(serv, 0, sizeof(*serv));
 	LIST_INIT(&serv->conn_list);
+	TAILQ_INIT(&serv->ready);
 	serv->ctx = ctx;
 	serv->logger = logger;
 	serv->sock = -1;
-	serv->max_conn = MAX_CONNECTIONS;	/* XXX make configurable */
+	serv->max_conn = MAX_CONNECTIONS;
+	serv->keepalive = HTTP_SERVER_KEEPALIVE;
 
 	/* Copy server name */
 	if ((serv->server_name
@@ -276,8 +298,32 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 		    "pthread_mutex_init", strerror(errno));
 		goto fail;
 	}
+	if ((errno = pthread_cond_init(&serv->ready_cond, NULL)) != 0) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pthread_cond_init", strerror(errno));
+		pthread_mutex_destroy(&serv->mutex);
+		goto fail;
+	}
 	got_mutex = 1;
 
+	/* Start worker threads */
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	if (http_server_start_workers(serv, HTTP_SERVER_WORKERS) == -1) {
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		goto fail;
+	}
+
+	/* Start expiring idle keep-alive connections */
+	if (pevent_register(serv->ctx, &serv->idle_timer, PEVENT_RECURRING,
+	    &serv->mutex, http_server_idle_expire, serv, PEVENT_TIME, 1000)
+	    == -1) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pevent_register", strerror(errno));
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		goto fail;
+	}
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+
 	/* Start accepting connections */
 	if (pevent_register(serv->ctx, &serv->conn_event, PEVENT_RECURRING,
 	    &serv->mutex, http_server_accept, serv, PEVENT_READ, serv->sock)
@@ -293,8 +339,19 @@ http_server_start(struct pevent_ctx *ctx, struct in_addr ip,
 
 fail:
 	/* Cleanup after failure */
-	if (got_mutex)
+	if (got_mutex) {
+		int i;
+
+		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+		pevent_unregister(&serv->idle_timer);
+		serv->stopping = 1;
+		pthread_cond_broadcast(&serv->ready_cond);
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		for (i = 0; i < serv->num_workers; i++)
+			pthread_join(serv->workers[i], NULL);
+		pthread_cond_destroy(&serv->ready_cond);
 		pthread_mutex_destroy(&serv->mutex);
+	}
 	if (serv->pkey_pw != NULL) {
 		memset(serv->pkey_pw, 0, strlen(serv->pkey_pw));
 		FREE("http_server.pkey_pw", serv->pkey_pw);
@@ -317,6 +374,8 @@ http_server_stop(struct http_server **sp)
 {
 	struct http_server *const serv = *sp;
 	struct http_connection *conn;
+	struct http_connection *next;
+	int i;
 
 	/* Already stopped? */
 	if (serv == NULL)
@@ -362,6 +421,18 @@ http_server_stop(struct http_server **sp)
 		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
 	}
 
+	/* Stop expiring idle connections and tell workers to quit */
+	pevent_unregister(&serv->idle_timer);
+	pthread_cond_broadcast(&serv->ready_cond);
+
+	/* Close connections not being served by any worker */
+	TAILQ_INIT(&serv->ready);
+	for (conn = LIST_FIRST(&serv->conn_list); conn != NULL; conn = next) {
+		next = LIST_NEXT(conn, next);
+		if (conn->tid == 0)
+			http_server_connection_close(conn);
+	}
+
 	/* Kill any remaining connections */
 	while (!LIST_EMPTY(&serv->conn_list)) {
 
@@ -400,8 +471,13 @@ http_server_stop(struct http_server **sp)
 	assert(ghash_size(serv->vhosts) == 0);
 	ghash_destroy(&serv->vhosts);
 
-	/* Free server structure itself */
+	/* Wait for workers to exit */
 	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	for (i = 0; i < serv->num_workers; i++)
+		pthread_join(serv->workers[i], NULL);
+
+	/* Free server structure itself */
+	pthread_cond_destroy(&serv->ready_cond);
 	pthread_mutex_destroy(&serv->mutex);
 	DBG(HTTP, "freeing server %p", serv);
 	FREE("http_server", serv);
@@ -655,45 +731,160 @@ http_server_accept(void *arg)
 	/* Add to server's list of active connections */
 	LIST_INSERT_HEAD(&serv->conn_list, conn, next);
 	serv->num_conn++;
+	serv->stats.conn_total++;
 
-	/* Spawn a new thread to handle request */
-	if ((errno = pthread_create(&conn->tid, NULL,
-	    http_server_connection_main, conn)) != 0) {
-		(*serv->logger)(LOG_ERR, "%s: %s",
-		    "pthread_create", strerror(errno));
-		conn->tid = 0;
-		LIST_REMOVE(conn, next);
-		serv->num_conn--;
-		_http_connection_free(&conn);
-	}
-
-	/* Detach thread */
-	pthread_detach(conn->tid);
-	DBG(HTTP, "spawning %p for connection %p from %s:%u",
-	    conn->tid, conn, inet_ntoa(conn->remote_ip), conn->remote_port);
+	/* Hand it over to a worker once the client starts talking */
+	DBG(HTTP, "new connection %p from %s:%u",
+	    conn, inet_ntoa(conn->remote_ip), conn->remote_port);
+	http_server_connection_idle(conn, HTTP_SERVER_HEADER_TIMEOUT);
 
 	/* If maximum number of connections reached, stop accepting new ones */
 	if (serv->num_conn >= serv->max_conn)
 		pevent_unregister(&serv->conn_event);
 }
 
+/*
+ * Change connection limit, number of worker threads and idle keep-alive
+ * timeout. Zero or negative values leave the setting unchanged. Workers
+ * can only be added; the pool shrinks when the server is restarted.
+ */
+int
+http_server_set_limits(struct http_server *serv,
+	int max_conn, int workers, int keepalive)
+{
+	int r = 0;
+
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	if (max_conn > 0) {
+		serv->max_conn = max_conn;
+		if (serv->num_conn >= serv->max_conn)
+			pevent_unregister(&serv->conn_event);
+		else if (serv->conn_event == NULL && !serv->stopping
+		    && pevent_register(serv->ctx, &serv->conn_event,
+		      PEVENT_RECURRING, &serv->mutex, http_server_accept,
+		      serv, PEVENT_READ, serv->sock) == -1) {
+			(*serv->logger)(LOG_ERR, "%s: %s",
+			    "pevent_register", strerror(errno));
+			r = -1;
+		}
+	}
+	if (workers > serv->num_workers
+	    && http_server_start_workers(serv, workers) == -1)
+		r = -1;
+	if (keepalive > 0)
+		serv->keepalive = keepalive;
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	return (r);
+}
+
+/*
+ * Get server connection and request statistics.
+ */
+void
+http_server_get_stats(struct http_server *serv, struct http_server_stats *st)
+{
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	*st = serv->stats;
+	st->max_conn = serv->max_conn;
+	st->workers = serv->num_workers;
+	st->keepalive = serv->keepalive;
+	st->conn_active = serv->num_conn;
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+}
+
+/*
+ * Grow the worker pool up to "num" threads.
+ *
+ * The mutex must be locked when this is called.
+ */
+static int
+http_server_start_workers(struct http_server *serv, int num)
+{
+	if (num > MAX_WORKERS)
+		num = MAX_WORKERS;
+	while (serv->num_workers < num) {
+		if ((errno = pthread_create(&serv->workers[serv->num_workers],
+		    NULL, http_server_worker_main, serv)) != 0) {
+			(*serv->logger)(LOG_ERR, "%s: %s",
+			    "pthread_create", strerror(errno));
+			return (-1);
+		}
+		serv->num_workers++;
+	}
+	return (0);
+}
+
 /*********************************************************************
-		    SERVER CONNECTION MAIN THREAD
+		    SERVER CONNECTION WORKER THREADS
 *********************************************************************/
 
 /*
- * HTTP connection thread main routine.
+ * Worker thread main routine.
+ *
+ * Takes connections with a request pending from the ready queue. New
+ * connections only get here once the client has sent something, and
+ * connections are served one request at a time and then parked in the
+ * event loop until the next request arrives, so idle or silent clients
+ * don't hold a thread.
+ *
+ * Cancellation is enabled only while serving a connection; the cleanup
+ * handler closes it then.
  */
 static void *
-http_server_connection_main(void *arg)
+http_server_worker_main(void *arg)
+{
+	struct http_server *const serv = arg;
+	struct http_connection *conn;
+	int keep;
+
+	(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	while (1) {
+
+		/* Wait for a connection */
+		while (TAILQ_EMPTY(&serv->ready) && !serv->stopping)
+			pthread_cond_wait(&serv->ready_cond, &serv->mutex);
+		if (serv->stopping)
+			break;
+		conn = TAILQ_FIRST(&serv->ready);
+		TAILQ_REMOVE(&serv->ready, conn, ready_next);
+		conn->tid = pthread_self();
+		conn->started = 1;
+		serv->stats.workers_busy++;
+		MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+
+		/* Serve it */
+		pthread_cleanup_push(http_server_connection_cleanup, conn);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		keep = http_server_connection_serve(conn);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(0);
+
+		/* Park it until the next request, or close it */
+		MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+		serv->stats.workers_busy--;
+		conn->tid = 0;
+		if (keep && !serv->stopping)
+			http_server_connection_idle(conn, serv->keepalive);
+		else
+			http_server_connection_close(conn);
+	}
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+	return (NULL);
+}
+
+/*
+ * Serve requests on a connection.
+ *
+ * Returns non-zero if the connection should be kept alive and is ready
+ * for the next request.
+ */
+static int
+http_server_connection_serve(struct http_connection *conn)
 {
-	struct http_connection *const conn = arg;
 	struct http_server *const serv = conn->owner;
 
-	/* Add shutdown cleanup hook */
-	pthread_cleanup_push(http_server_connection_cleanup, conn);
-	conn->started = 1;		/* avoids pthread_cancel() race */
-	DBG(HTTP, "connection %p started", conn);
+	DBG(HTTP, "connection %p serving", conn);
 
 	/* Read requests as long as connection is kept alive */
 	conn->keep_alive = 1;
@@ -703,15 +894,19 @@ http_server_connection_main(void *arg)
 		const char *hval;
 		char dbuf[64];
 		struct tm tm;
+		struct timeval t0, t1;
+		u_int64_t usec;
 		time_t now;
 
 		/* Read in request */
+		timerclear(&t0);
 		if (_http_request_read(conn) == -1) {
 			if (errno == ENOTCONN)	/* remote side disconnected */
-				break;
+				return (0);
 			conn->keep_alive = 0;
 			goto send_response;
 		}
+		gettimeofday(&t0, NULL);
 
 		/* Set default response headers */
 		now = time(NULL);
@@ -765,6 +960,22 @@ send_response:
 		/* Send back body (if it was buffered) */
 		_http_message_send_body(resp->msg);
 
+		/* Account request service time */
+		if (timerisset(&t0)) {
+			gettimeofday(&t1, NULL);
+			timersub(&t1, &t0, &t1);
+			usec = (u_int64_t)t1.tv_sec * 1000000 + t1.tv_usec;
+			MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+			serv->stats.requests++;
+			if (conn->requests > 0)
+				serv->stats.requests_reused++;
+			serv->stats.req_time_total += usec;
+			if (usec > serv->stats.req_time_max)
+				serv->stats.req_time_max = usec;
+			MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+		}
+		conn->requests++;
+
 		/* Determine if we can still keep this connection alive */
 		if (!resp->msg->no_body
 		    && (http_response_get_header(resp,
@@ -776,34 +987,97 @@ send_response:
 
 		/* Close connection unless keeping it alive */
 		if (!conn->keep_alive)
-			break;
+			return (0);
 
 		/* Reset request & response for next time */
 		_http_request_free(&conn->req);
 		_http_response_free(&conn->resp);
 		if (_http_request_new(conn) == -1
 		    || _http_response_new(conn) == -1)
-			break;
+			return (0);
+
+		/*
+		 * Wait for the next request in event loop, unless stdio or
+		 * the SSL layer already holds some of it where poll(2)
+		 * can't see it; pipelined requests are served right away.
+		 */
+		if (!_http_connection_input_pending(conn))
+			return (1);
 	}
+}
 
-	/* Done with this connection */
-	DBG(HTTP, "done with connection %p", conn);
-	pthread_cleanup_pop(1);
-	return (NULL);
+/*
+ * Wait for the next request on a new or kept alive connection,
+ * closing it if nothing arrives within "limit" seconds.
+ *
+ * The mutex must be locked when this is called.
+ */
+static void
+http_server_connection_idle(struct http_connection *conn, int limit)
+{
+	struct http_server *const serv = conn->owner;
+
+	conn->idle_since = time(NULL);
+	conn->idle_limit = limit;
+	if (pevent_register(serv->ctx, &conn->idle_event, 0, &serv->mutex,
+	    http_server_connection_ready, conn, PEVENT_READ, conn->sock)
+	    == -1) {
+		(*serv->logger)(LOG_ERR, "%s: %s",
+		    "pevent_register", strerror(errno));
+		http_server_connection_close(conn);
+		return;
+	}
+	serv->stats.conn_idle++;
 }
 
 /*
- * Cleanup when shutting down an HTTP server connection.
+ * Next request (or EOF) arrived on an idle connection.
+ *
+ * The mutex will be locked when this is called.
  */
 static void
-http_server_connection_cleanup(void *arg)
+http_server_connection_ready(void *arg)
 {
-	struct http_connection *conn = arg;
+	struct http_connection *const conn = arg;
 	struct http_server *const serv = conn->owner;
 
-	/* Lock server */
-	DBG(HTTP, "connection %p cleaning up", conn);
-	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	serv->stats.conn_idle--;
+	TAILQ_INSERT_TAIL(&serv->ready, conn, ready_next);
+	pthread_cond_signal(&serv->ready_cond);
+}
+
+/*
+ * Close idle connections whose header or keep-alive timeout has expired.
+ *
+ * The mutex will be locked when this is called.
+ */
+static void
+http_server_idle_expire(void *arg)
+{
+	struct http_server *const serv = arg;
+	struct http_connection *conn;
+	struct http_connection *next;
+	const time_t now = time(NULL);
+
+	for (conn = LIST_FIRST(&serv->conn_list); conn != NULL; conn = next) {
+		next = LIST_NEXT(conn, next);
+		if (conn->idle_event != NULL
+		    && now - conn->idle_since >= conn->idle_limit) {
+			DBG(HTTP, "connection %p idle timeout", conn);
+			http_server_connection_close(conn);
+		}
+	}
+}
+
+/*
+ * Close and free a connection that is not being served.
+ *
+ * The mutex must be locked when this is called.
+ */
+static void
+http_server_connection_close(struct http_connection *conn)
+{
+	struct http_server *const serv = conn->owner;
 
 	/* Restart accepting new connections if needed */
 	if (serv->conn_event == NULL && !serv->stopping) {
@@ -815,17 +1089,36 @@ http_server_connection_cleanup(void *arg)
 		}
 	}
 
+	/* Stop waiting for the next request */
+	if (conn->idle_event != NULL) {
+		pevent_unregister(&conn->idle_event);
+		serv->stats.conn_idle--;
+	}
+
 	/* Remove this connection from the list of connections */
 	LIST_REMOVE(conn, next);
 	serv->num_conn--;
 
-	/* Unlock server */
-	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
-
 	/* Free connection */
 	_http_connection_free(&conn);
 }
 
+/*
+ * Cleanup when a worker is canceled while serving a connection.
+ */
+static void
+http_server_connection_cleanup(void *arg)
+{
+	struct http_connection *conn = arg;
+	struct http_server *const serv = conn->owner;
+
+	DBG(HTTP, "connection %p cleaning up", conn);
+	MUTEX_LOCK(&serv->mutex, serv->mutex_count);
+	serv->stats.workers_busy--;
+	http_server_connection_close(conn);
+	MUTEX_UNLOCK(&serv->mutex, serv->mutex_count);
+}
+
 /*
  * Dispatch a request
  */
@@ -62,6 +62,23 @@ struct http_server_ssl {
 	const char	*pkey_password;	/* private key password, if needed */
 };
 
+/*
+ * Server connection statistics
+ */
+struct http_server_stats {
+	u_int		max_conn;	/* connection limit */
+	u_int		workers;	/* worker threads */
+	u_int		keepalive;	/* idle keep-alive timeout, seconds */
+	u_int		conn_active;	/* open connections */
+	u_int		conn_idle;	/* waiting for a request */
+	u_int		workers_busy;	/* workers serving a connection */
+	u_int64_t	conn_total;	/* accepted connections */
+	u_int64_t	requests;	/* served requests */
+	u_int64_t	requests_reused; /* requests on kept alive connections */
+	u_int64_t	req_time_total;	/* total request service time, usec */
+	u_int64_t	req_time_max;	/* longest request service time, usec */
+};
+
 /*
  * Special "headers" from the first line
  * of an HTTP request or HTTP response.
@@ -97,6 +114,10 @@ extern struct	http_server *http_server_start(struct pevent_ctx *ctx,
 			const struct http_server_ssl *ssl,
 			const char *server_name, http_logger_t *logger);
 extern void	http_server_stop(struct http_server **serverp);
+extern int	http_server_set_limits(struct http_server *serv,
+			int max_conn, int workers, int keepalive);
+extern void	http_server_get_stats(struct http_server *serv,
+			struct http_server_stats *stats);
 extern int	http_server_register_servlet(struct http_server *serv,
 			struct http_servlet *servlet, const char *vhost,
 			const char *urlpat, int order);
@@ -39,6 +39,7 @@
  */
 
 #include <sys/param.h>
+#include <sys/queue.h>
 #include <sys/syslog.h>
 
 #include <stdio.h>
@@ -61,6 +62,8 @@
 #include "io/ssl_fp.h"
 
 struct ssl_info {
+	FILE			*fp;
+	LIST_ENTRY(ssl_info)	next;
 	int			fd;
 	SSL			*ssl;
 	SSL_CTX			*ssl_ctx;
@@ -83,6 +86,12 @@ static int	ssl_err(struct ssl_info *s, int ret);
 
 static ssl_logger_t	null_logger;
 
+/*
+ * Internal variables
+ */
+static LIST_HEAD(, ssl_info)	ssl_list = LIST_HEAD_INITIALIZER(ssl_list);
+static pthread_mutex_t		ssl_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Create a FILE * from an SSL connection.
  */
@@ -126,10 +135,37 @@ ssl_fdopen(SSL_CTX *ssl_ctx, int fd, int server, const char *mtype,
 		return (NULL);
 	}
 
+	/* Remember stream so ssl_fdpending() can find it */
+	s->fp = fp;
+	pthread_mutex_lock(&ssl_list_mutex);
+	LIST_INSERT_HEAD(&ssl_list, s, next);
+	pthread_mutex_unlock(&ssl_list_mutex);
+
 	/* Done */
 	return (fp);
 }
 
+/*
+ * Get number of decrypted bytes buffered in the SSL layer.
+ */
+int
+ssl_fdpending(FILE *fp)
+{
+	struct ssl_info *s;
+	int ret = 0;
+
+	pthread_mutex_lock(&ssl_list_mutex);
+	LIST_FOREACH(s, &ssl_list, next) {
+		if (s->fp == fp) {
+			if (s->ssl != NULL)
+				ret = SSL_pending(s->ssl);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ssl_list_mutex);
+	return (ret);
+}
+
 /*
  * Read from an SSL connection.
  */
@@ -185,6 +221,16 @@ ssl_close(void *cookie)
 	struct ssl_info *const s = cookie;
 	int ret;
 
+	pthread_mutex_lock(&ssl_list_mutex);
+	LIST_REMOVE(s, next);
+	pthread_mutex_unlock(&ssl_list_mutex);
+
+	/* Never used, e.g. closed while waiting for the first request */
+	if (s->ssl == NULL) {
+		(void)close(s->fd);
+		FREE(s->mtype, s);
+		return (0);
+	}
 	while ((ret = SSL_shutdown(s->ssl)) <= 0) {
 		if (ret == -1 && ssl_err(s, ret) == -1) {
 			(void)close(s->fd);
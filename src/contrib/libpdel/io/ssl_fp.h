@@ -60,6 +60,13 @@ extern FILE	*ssl_fdopen(SSL_CTX *ssl_ctx, int fd, int server,
 			const char *mtype, ssl_logger_t *logger,
 			void *logarg, u_int timeout);
 
+/*
+ * Returns the number of decrypted bytes buffered inside the SSL layer
+ * of a stream returned by ssl_fdopen(). Such data is not visible to
+ * poll(2) on the underlying file descriptor.
+ */
+extern int	ssl_fdpending(FILE *fp);
+
 /*
  * Routine for logging any error from OpenSSL.
  */
@@ -0,0 +1,423 @@
+
+/*
+ * dpool.c
+ *
+ * Worker pool for the userland compression and encryption data path.
+ *
+ * Frames read from the CCP and ECP netgraph sockets are queued to worker
+ * threads instead of being transformed under the giant mutex. Every
+ * bundle is bound to one worker, which keeps its frames in order and its
+ * compressor and cipher state used by one thread at a time. Workers write
+ * results straight to the netgraph socket; whatever has to be done in the
+ * event loop afterwards (reset requests, dropping bundle references) is
+ * handed back through a completion queue.
+ *
+ * Workers only touch a bundle while its layer is opened. Code changing
+ * that state calls DpoolSync() first to wait for frames in flight.
+ */
+
+#include "ppp.h"
+#include "bund.h"
+#include "ngfunc.h"
+#include "dpool.h"
+#include "util.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  struct dpjob {
+    Bund		b;		/* Referenced bundle */
+    DpoolFunc		func;
+    Mbuf		bp;
+    int			dsock;		/* Where to write the result */
+    void		(*defer)(Bund b);	/* Event loop action */
+    char		hook[NG_HOOKSIZ];
+    STAILQ_ENTRY(dpjob)	next;
+  };
+
+  struct dpstats {
+    uint64_t		frames;		/* Frames transformed */
+    uint64_t		octets_in;
+    uint64_t		octets_out;
+    uint64_t		failed;		/* Frames transformed to nothing */
+    uint64_t		drops;		/* Frames dropped on full queue */
+    uint64_t		busy;		/* Microseconds spent on frames */
+  };
+
+  struct dpworker {
+    pthread_t		tid;
+    pthread_mutex_t	mutex;
+    pthread_cond_t	cond;		/* Frame queued or stop requested */
+    pthread_cond_t	idle;		/* Frame done */
+    STAILQ_HEAD(, dpjob) queue;
+    int			qlen;
+    u_char		stop;
+    struct dpstats	stats;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	DpoolStart(int num);
+  static void	DpoolStop(void);
+  static void	*DpoolWorkerMain(void *arg);
+  static void	DpoolDone(int type, void *cookie);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gDpoolWorkers = DPOOL_DEFAULT_WORKERS;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct dpworker	*gDpool;
+  static int			gDpoolNum;	/* Running workers */
+  static pthread_mutex_t	gDpoolDoneMutex;
+  static STAILQ_HEAD(, dpjob)	gDpoolDone = STAILQ_HEAD_INITIALIZER(gDpoolDone);
+  static int			gDpoolPipe[2] = { -1, -1 };
+  static EventRef		gDpoolEvent;
+  static __thread struct dpjob	*tDpoolJob;	/* Frame of this worker */
+
+/*
+ * DpoolInit()
+ */
+
+void
+DpoolInit(void)
+{
+    int		k;
+
+    if (pthread_mutex_init(&gDpoolDoneMutex, NULL) != 0 ||
+      pipe(gDpoolPipe) < 0) {
+	Perror("DPOOL: can't initialize, frames will be processed inline");
+	gDpoolWorkers = 0;
+	return;
+    }
+    for (k = 0; k < 2; k++) {
+	(void)fcntl(gDpoolPipe[k], F_SETFD, 1);
+	(void)fcntl(gDpoolPipe[k], F_SETFL, O_NONBLOCK);
+    }
+    if (EventRegister(&gDpoolEvent, EVENT_READ, gDpoolPipe[0],
+      EVENT_RECURRING, DpoolDone, NULL) < 0) {
+	gDpoolWorkers = 0;
+	return;
+    }
+    gDpoolWorkers = DpoolStart(gDpoolWorkers);
+}
+
+/*
+ * DpoolShutdown()
+ */
+
+void
+DpoolShutdown(void)
+{
+    DpoolStop();
+    EventUnRegister(&gDpoolEvent);
+}
+
+/*
+ * DpoolSetWorkers()
+ *
+ * Restart the pool with the given number of workers, zero makes
+ * frames be processed inline in the event loop.
+ */
+
+int
+DpoolSetWorkers(int num)
+{
+    if (gDpoolPipe[0] < 0)
+	return (-1);
+    DpoolStop();
+    gDpoolWorkers = DpoolStart(num);
+    return (gDpoolWorkers == num ? 0 : -1);
+}
+
+/*
+ * DpoolStart()
+ *
+ * Returns the number of workers actually started.
+ */
+
+static int
+DpoolStart(int num)
+{
+    struct dpworker	*w;
+    int			k, ret;
+
+    if (num <= 0)
+	return (0);
+    gDpool = Malloc(MB_DPOOL, num * sizeof(*gDpool));
+    for (k = 0; k < num; k++) {
+	w = &gDpool[k];
+	STAILQ_INIT(&w->queue);
+	if (pthread_mutex_init(&w->mutex, NULL) != 0)
+	    break;
+	if (pthread_cond_init(&w->cond, NULL) != 0) {
+	    pthread_mutex_destroy(&w->mutex);
+	    break;
+	}
+	if (pthread_cond_init(&w->idle, NULL) != 0) {
+	    pthread_cond_destroy(&w->cond);
+	    pthread_mutex_destroy(&w->mutex);
+	    break;
+	}
+	if ((ret = pthread_create(&w->tid, NULL, DpoolWorkerMain, w)) != 0) {
+	    Log(LG_ERR, ("DPOOL: can't create worker thread %d", ret));
+	    pthread_cond_destroy(&w->idle);
+	    pthread_cond_destroy(&w->cond);
+	    pthread_mutex_destroy(&w->mutex);
+	    break;
+	}
+    }
+    gDpoolNum = k;
+    if (k == 0) {
+	Freee(gDpool);
+	gDpool = NULL;
+    }
+    return (k);
+}
+
+/*
+ * DpoolStop()
+ *
+ * Let workers finish their queues and exit.
+ */
+
+static void
+DpoolStop(void)
+{
+    struct dpworker	*w;
+    int			k;
+
+    for (k = 0; k < gDpoolNum; k++) {
+	w = &gDpool[k];
+	MUTEX_LOCK(w->mutex);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	MUTEX_UNLOCK(w->mutex);
+    }
+    for (k = 0; k < gDpoolNum; k++) {
+	w = &gDpool[k];
+	pthread_join(w->tid, NULL);
+	pthread_cond_destroy(&w->idle);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+    }
+    Freee(gDpool);
+    gDpool = NULL;
+    gDpoolNum = 0;
+    DpoolDone(0, NULL);
+}
+
+/*
+ * DpoolSubmit()
+ *
+ * Transform a frame with func and write the result to the given
+ * netgraph socket hook. The frame is consumed.
+ */
+
+void
+DpoolSubmit(Bund b, DpoolFunc func, int dsock, const char *hook, Mbuf bp)
+{
+    struct dpworker	*w;
+    struct dpjob	*job;
+
+    if (gDpoolNum == 0) {
+	if ((bp = (*func)(b, bp)) != NULL)
+	    NgFuncWriteFrame(dsock, hook, b->name, bp);
+	return;
+    }
+
+    w = &gDpool[b->id % gDpoolNum];
+    job = Malloc(MB_DPOOL, sizeof(*job));
+    job->b = b;
+    job->func = func;
+    job->bp = bp;
+    job->dsock = dsock;
+    strlcpy(job->hook, hook, sizeof(job->hook));
+
+    MUTEX_LOCK(w->mutex);
+    if (w->qlen >= DPOOL_QUEUE_MAX) {
+	w->stats.drops++;
+	MUTEX_UNLOCK(w->mutex);
+	mbfree(bp);
+	Freee(job);
+	return;
+    }
+    REF(b);
+    b->dpJobs++;
+    STAILQ_INSERT_TAIL(&w->queue, job, next);
+    w->qlen++;
+    pthread_cond_signal(&w->cond);
+    MUTEX_UNLOCK(w->mutex);
+}
+
+/*
+ * DpoolSync()
+ *
+ * Wait until the worker is done with all frames of the bundle.
+ */
+
+void
+DpoolSync(Bund b)
+{
+    struct dpworker	*w;
+
+    if (gDpoolNum == 0)
+	return;
+    w = &gDpool[b->id % gDpoolNum];
+    MUTEX_LOCK(w->mutex);
+    while (b->dpJobs > 0)
+	pthread_cond_wait(&w->idle, &w->mutex);
+    MUTEX_UNLOCK(w->mutex);
+}
+
+/*
+ * DpoolDefer()
+ *
+ * When called by a worker, arrange for func to be called from the
+ * event loop once the current frame is done and return 1.
+ * Returns 0 if the caller is not a worker and should go ahead itself.
+ */
+
+int
+DpoolDefer(void (*func)(Bund b), Bund b)
+{
+    if (tDpoolJob == NULL || tDpoolJob->b != b)
+	return (0);
+    tDpoolJob->defer = func;
+    return (1);
+}
+
+/*
+ * DpoolWorkerMain()
+ */
+
+static void *
+DpoolWorkerMain(void *arg)
+{
+    struct dpworker	*w = arg;
+    struct dpjob	*job;
+    struct timeval	t0, t1;
+    size_t		in, out;
+    int			empty;
+    Mbuf		bp;
+
+    for (;;) {
+	MUTEX_LOCK(w->mutex);
+	while (STAILQ_EMPTY(&w->queue) && !w->stop)
+	    pthread_cond_wait(&w->cond, &w->mutex);
+	if ((job = STAILQ_FIRST(&w->queue)) == NULL) {
+	    MUTEX_UNLOCK(w->mutex);
+	    break;
+	}
+	STAILQ_REMOVE_HEAD(&w->queue, next);
+	w->qlen--;
+	MUTEX_UNLOCK(w->mutex);
+
+	gettimeofday(&t0, NULL);
+	in = MBLEN(job->bp);
+	tDpoolJob = job;
+	bp = (*job->func)(job->b, job->bp);
+	tDpoolJob = NULL;
+	job->bp = NULL;
+	out = MBLEN(bp);
+	if (bp != NULL)
+	    NgFuncWriteFrame(job->dsock, job->hook, job->b->name, bp);
+	gettimeofday(&t1, NULL);
+
+	MUTEX_LOCK(w->mutex);
+	w->stats.frames++;
+	w->stats.octets_in += in;
+	w->stats.octets_out += out;
+	if (bp == NULL)
+	    w->stats.failed++;
+	w->stats.busy += (t1.tv_sec - t0.tv_sec) * 1000000 +
+	    (t1.tv_usec - t0.tv_usec);
+	job->b->dpJobs--;
+	pthread_cond_broadcast(&w->idle);
+	MUTEX_UNLOCK(w->mutex);
+
+	/* The rest is up to the event loop */
+	MUTEX_LOCK(gDpoolDoneMutex);
+	empty = STAILQ_EMPTY(&gDpoolDone);
+	STAILQ_INSERT_TAIL(&gDpoolDone, job, next);
+	MUTEX_UNLOCK(gDpoolDoneMutex);
+	if (empty)
+	    (void)write(gDpoolPipe[1], "", 1);
+    }
+    return (NULL);
+}
+
+/*
+ * DpoolDone()
+ *
+ * Finish frames handed back by workers: run deferred actions
+ * and release bundle references.
+ */
+
+static void
+DpoolDone(int type, void *cookie)
+{
+    STAILQ_HEAD(, dpjob)	done = STAILQ_HEAD_INITIALIZER(done);
+    struct dpjob		*job;
+    char			buf[64];
+
+    (void)type;
+    (void)cookie;
+    while (read(gDpoolPipe[0], buf, sizeof(buf)) > 0)
+	;
+    MUTEX_LOCK(gDpoolDoneMutex);
+    STAILQ_CONCAT(&done, &gDpoolDone);
+    MUTEX_UNLOCK(gDpoolDoneMutex);
+
+    while ((job = STAILQ_FIRST(&done)) != NULL) {
+	STAILQ_REMOVE_HEAD(&done, next);
+	if (job->defer != NULL && !job->b->dead)
+	    (*job->defer)(job->b);
+	UNREF(job->b);
+	Freee(job);
+    }
+}
+
+/*
+ * DpoolStat()
+ */
+
+int
+DpoolStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct dpstats	st;
+    int			k, qlen;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Data path workers: %d, queue limit %d frames\r\n",
+	gDpoolNum, DPOOL_QUEUE_MAX);
+    if (gDpoolNum == 0)
+	return (0);
+    Printf("Worker  Queued       Frames    Octets in   Octets out"
+	"   Failed  Dropped  Busy ms  KB/s busy\r\n");
+    for (k = 0; k < gDpoolNum; k++) {
+	MUTEX_LOCK(gDpool[k].mutex);
+	st = gDpool[k].stats;
+	qlen = gDpool[k].qlen;
+	MUTEX_UNLOCK(gDpool[k].mutex);
+	Printf("%6d %7d %12ju %12ju %12ju %8ju %8ju %8ju %10ju\r\n",
+	    k, qlen, (uintmax_t)st.frames,
+	    (uintmax_t)st.octets_in, (uintmax_t)st.octets_out,
+	    (uintmax_t)st.failed, (uintmax_t)st.drops,
+	    (uintmax_t)(st.busy / 1000),
+	    (uintmax_t)(st.busy ? st.octets_in * 1000 / st.busy : 0));
+    }
+    return (0);
+}
+
@@ -0,0 +1,42 @@
+
+/*
+ * dpool.h
+ *
+ * Worker pool for the userland compression and encryption data path.
+ */
+
+#ifndef _DPOOL_H_
+#define _DPOOL_H_
+
+/*
+ * DEFINITIONS
+ */
+
+  #define DPOOL_DEFAULT_WORKERS	4
+  #define DPOOL_MAX_WORKERS	64
+  #define DPOOL_QUEUE_MAX	1024	/* Frames waiting per worker */
+
+  /* Frame transformation, consumes the frame and returns the result */
+  typedef Mbuf	(*DpoolFunc)(Bund b, Mbuf bp);
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gDpoolWorkers;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	DpoolInit(void);
+  extern void	DpoolShutdown(void);
+  extern int	DpoolSetWorkers(int num);
+  extern void	DpoolSubmit(Bund b, DpoolFunc func, int dsock,
+		    const char *hook, Mbuf bp);
+  extern void	DpoolSync(Bund b);
+  extern int	DpoolDefer(void (*func)(Bund b), Bund b);
+  extern int	DpoolStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
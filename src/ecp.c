@@ -12,6 +12,7 @@
 #include "ecp.h"
 #include "fsm.h"
 #include "ngfunc.h"
+#include "dpool.h"
 
 #include <netgraph/ng_message.h>
 #include <netgraph/ng_socket.h>
@@ -351,15 +352,15 @@ EcpNgDataEvent(int type, void *cookie)
 		
 	b = gBundles[id];
 
-	/* Packet requiring compression */
-	if (b1[0] == 'e') {
-	    bp = EcpDataOutput(b, bp);
-	} else {
-	    /* Packet requiring decompression */
-	    bp = EcpDataInput(b, bp);
+	/* Workers may only use cipher state of an opened layer */
+	if (b->ecp.fsm.state != ST_OPENED) {
+	    mbfree(bp);
+	    continue;
 	}
-	if (bp)
-	    NgFuncWriteFrame(gEcpDsock, naddr.sg_data, b->name, bp);
+
+	/* Packet requiring encryption or decryption */
+	DpoolSubmit(b, b1[0] == 'e' ? EcpDataOutput : EcpDataInput,
+	    gEcpDsock, naddr.sg_data, bp);
     }
 }
 
@@ -375,8 +376,10 @@ EcpDataOutput(Bund b, Mbuf plain)
 {
   EcpState	const ecp = &b->ecp;
   Mbuf		cypher;
+  const int	dump = LogWantSampled(LG_FRAME, &ecp->frameDumps);
 
-  LogDumpBp(LG_FRAME, plain, "[%s] %s: xmit plain", Pref(&ecp->fsm), Fsm(&ecp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, plain, "[%s] %s: xmit plain", Pref(&ecp->fsm), Fsm(&ecp->fsm));
 
 /* Encrypt packet */
 
@@ -387,7 +390,8 @@ EcpDataOutput(Bund b, Mbuf plain)
     return(NULL);
   }
   cypher = (*ecp->xmit->Encrypt)(b, plain);
-  LogDumpBp(LG_FRAME, cypher, "[%s] %s: xmit cypher", Pref(&ecp->fsm), Fsm(&ecp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, cypher, "[%s] %s: xmit cypher", Pref(&ecp->fsm), Fsm(&ecp->fsm));
 
 /* Return result, with new protocol number */
 
@@ -406,8 +410,10 @@ EcpDataInput(Bund b, Mbuf cypher)
 {
   EcpState	const ecp = &b->ecp;
   Mbuf		plain;
+  const int	dump = LogWantSampled(LG_FRAME, &ecp->frameDumps);
 
-  LogDumpBp(LG_FRAME, cypher, "[%s] %s: recv cypher", Pref(&ecp->fsm), Fsm(&ecp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, cypher, "[%s] %s: recv cypher", Pref(&ecp->fsm), Fsm(&ecp->fsm));
 
 /* Decrypt packet */
 
@@ -428,7 +434,8 @@ EcpDataInput(Bund b, Mbuf cypher)
     return(NULL);
   }
 
-  LogDumpBp(LG_FRAME, plain, "[%s] %s: recv plain", Pref(&ecp->fsm), Fsm(&ecp->fsm));
+  if (dump)
+    LogDumpBp(LG_FRAME, plain, "[%s] %s: recv plain", Pref(&ecp->fsm), Fsm(&ecp->fsm));
 /* Done */
 
   return(plain);
@@ -578,6 +585,7 @@ EcpRecvResetReq(Fsm fp, int id, Mbuf bp)
   EcpState	const ecp = &b->ecp;
   EncType	const et = ecp->xmit;
 
+  DpoolSync(b);
   ecp->xmit_resets++;
   bp = (et && et->RecvResetReq) ? (*et->RecvResetReq)(b, id, bp) : NULL;
   Log(fp->log, ("[%s] %s: SendResetAck", Pref(fp), Fsm(fp)));
@@ -595,6 +603,7 @@ EcpRecvResetAck(Fsm fp, int id, Mbuf bp)
   EcpState	const ecp = &b->ecp;
   EncType	const et = ecp->recv;
 
+  DpoolSync(b);
   if (et && et->RecvResetAck)
     (*et->RecvResetAck)(b, id, bp);
 }
@@ -650,6 +659,7 @@ EcpLayerUp(Fsm fp)
   struct ngm_connect    cn;
 
   /* Initialize */
+  DpoolSync(b);
   if (ecp->xmit && ecp->xmit->Init)
     (*ecp->xmit->Init)(b, ECP_DIR_XMIT);
   if (ecp->recv && ecp->recv->Init)
@@ -726,6 +736,7 @@ EcpLayerDown(Fsm fp)
     NgFuncDisconnect(gEcpCsock, b->name, ".:", hook);
   }
 
+  DpoolSync(b);
   if (ecp->xmit && ecp->xmit->Cleanup)
     (ecp->xmit->Cleanup)(b, ECP_DIR_XMIT);
   if (ecp->recv && ecp->recv->Cleanup)
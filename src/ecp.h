@@ -56,6 +56,7 @@
 #endif
     uint32_t		xmit_resets;	/* Number of ResetReq we have got from other side */
     uint32_t		recv_resets;	/* Number of ResetReq we have sent to other side */
+    u_int		frameDumps;	/* Frame dump sampling counter */
   };
   typedef struct ecpstate	*EcpState;
 
@@ -0,0 +1,634 @@
+
+/*
+ * extpool.c
+ *
+ * Persistent helper processes for external authentication and accounting.
+ *
+ * Instead of starting the ext-auth or ext-acct script for every request,
+ * a pool of long running copies is kept per script. A helper reads
+ * requests from its standard input and writes replies to its standard
+ * output, both in the usual ATTR:value form and each terminated with an
+ * empty line. Replies must come in request order, which lets several
+ * requests be written to the same helper before the first reply arrives.
+ *
+ * Requests are made from authentication and accounting threads. One
+ * thread at a time writes a request, the thread whose reply is next in
+ * line reads it, others wait for their turn. Neither blocks on the pipes
+ * with the helper locked.
+ * A helper that dies, stops answering in time or breaks the framing is
+ * killed, requests in flight on it fail, and a new one is started for
+ * the next request. Pools not used for a while, e.g. after the script
+ * was changed in the configuration, are removed with their helpers.
+ */
+
+#include "ppp.h"
+#include "extpool.h"
+#include "util.h"
+
+#include <paths.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  struct extstats {
+    uint64_t		requests;	/* Replies received */
+    uint64_t		errors;		/* Requests failed */
+    uint64_t		restarts;	/* Helper processes started */
+    uint64_t		latency;	/* Microseconds spent on replies */
+    uint64_t		maxlat;
+  };
+
+  struct exthelper {
+    pthread_mutex_t	mutex;
+    pthread_cond_t	cond;		/* Reply read or helper killed */
+    pid_t		pid;		/* Zero when not running */
+    int			wfd;		/* Helper standard input */
+    int			rfd;		/* Helper standard output */
+    u_int		gen;		/* Bumped when the helper is killed */
+    u_int		sent;		/* Requests written to this process */
+    u_int		done;		/* Replies read from this process */
+    u_char		writing;	/* Some thread is writing a request */
+    u_char		reading;	/* Some thread is reading a reply */
+    char		*rbuf;		/* Replies read ahead */
+    int			rlen;
+    struct extstats	stats;
+  };
+
+  struct extpool {
+    char		*cmd;
+    int			refs;		/* Requests using the pool */
+    time_t		used;		/* Last request */
+    struct exthelper	helpers[EXTPOOL_MAX_HELPERS];
+    SLIST_ENTRY(extpool) next;
+  };
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static struct extpool	*ExtPoolGet(const char *cmd, const char *label);
+  static void	ExtPoolPut(struct extpool *p);
+  static void	ExtPoolRetire(void);
+  static int	ExtHelperStart(struct extpool *p, struct exthelper *h,
+		    const char *label);
+  static void	ExtHelperKill(struct exthelper *h, const char *label,
+		    const char *why);
+  static int	ExtWrite(int fd, const char *buf, size_t len,
+		    const struct timespec *deadline);
+  static char	*ExtRead(struct exthelper *h, int fd,
+		    const struct timespec *deadline);
+  static int	ExtRemaining(const struct timespec *deadline);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gExtHelpers = 0;
+  int		gExtTimeout = EXTPOOL_DEFAULT_TIMEOUT;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static pthread_mutex_t	gExtPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+  static SLIST_HEAD(, extpool)	gExtPools = SLIST_HEAD_INITIALIZER(gExtPools);
+
+/*
+ * ExtPoolShutdown()
+ *
+ * Kill all helpers.
+ */
+
+void
+ExtPoolShutdown(void)
+{
+    struct extpool	*p;
+    struct exthelper	*h;
+    int			k;
+
+    MUTEX_LOCK(gExtPoolMutex);
+    SLIST_FOREACH(p, &gExtPools, next) {
+	for (k = 0; k < EXTPOOL_MAX_HELPERS; k++) {
+	    h = &p->helpers[k];
+	    MUTEX_LOCK(h->mutex);
+	    if (h->pid != 0)
+		ExtHelperKill(h, "-", "shutdown");
+	    MUTEX_UNLOCK(h->mutex);
+	}
+    }
+    MUTEX_UNLOCK(gExtPoolMutex);
+}
+
+/*
+ * ExtPoolActive()
+ *
+ * Tell whether external scripts are run as persistent helpers.
+ */
+
+int
+ExtPoolActive(void)
+{
+    return (gExtHelpers > 0);
+}
+
+/*
+ * ExtPoolSetHelpers()
+ *
+ * Change the number of helpers per script. Idle helpers beyond the new
+ * number are stopped now, busy ones after their last reply.
+ */
+
+void
+ExtPoolSetHelpers(int num)
+{
+    struct extpool	*p;
+    struct exthelper	*h;
+    int			k;
+
+    gExtHelpers = num;
+    MUTEX_LOCK(gExtPoolMutex);
+    SLIST_FOREACH(p, &gExtPools, next) {
+	for (k = num; k < EXTPOOL_MAX_HELPERS; k++) {
+	    h = &p->helpers[k];
+	    MUTEX_LOCK(h->mutex);
+	    if (h->pid != 0 && h->sent == h->done && !h->reading)
+		ExtHelperKill(h, "-", "no longer needed");
+	    MUTEX_UNLOCK(h->mutex);
+	}
+    }
+    MUTEX_UNLOCK(gExtPoolMutex);
+}
+
+/*
+ * ExtPoolRequest()
+ *
+ * Pass a request, terminated by an empty line, to a helper running
+ * the command and wait for the reply. Returns the reply without its
+ * terminating empty line, which caller must free, or NULL on error.
+ */
+
+char *
+ExtPoolRequest(const char *cmd, const char *req, size_t len, const char *label)
+{
+    struct extpool	*p;
+    struct exthelper	*h;
+    struct timeval	start, now;
+    struct timespec	deadline;
+    char		*reply;
+    uint64_t		lat;
+    u_int		gen, ticket, q, bestq;
+    int			k, num, best, rfd, wfd, cstate;
+
+    /* The only empty line must be the terminating one */
+    if (len < 2 || req[0] == '\n' || memcmp(req + len - 2, "\n\n", 2) != 0 ||
+      memmem(req, len, "\n\n", 2) != req + len - 2) {
+	Log(LG_ERR, ("[%s] Ext-helper: malformed request", label));
+	return (NULL);
+    }
+
+    /* Requests are bounded in time, don't leave a helper half used */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cstate);
+
+    if ((p = ExtPoolGet(cmd, label)) == NULL) {
+	pthread_setcancelstate(cstate, NULL);
+	return (NULL);
+    }
+    num = gExtHelpers;
+    if (num < 1)
+	num = 1;
+
+    /* Pick the helper with the fewest requests in flight */
+    best = 0;
+    bestq = UINT_MAX;
+    for (k = 0; k < num && bestq > 0; k++) {
+	h = &p->helpers[k];
+	MUTEX_LOCK(h->mutex);
+	q = (h->pid != 0) ? h->sent - h->done : 0;
+	MUTEX_UNLOCK(h->mutex);
+	if (q < bestq) {
+	    best = k;
+	    bestq = q;
+	}
+    }
+    h = &p->helpers[best];
+
+    gettimeofday(&start, NULL);
+    deadline.tv_sec = start.tv_sec + gExtTimeout;
+    deadline.tv_nsec = start.tv_usec * 1000;
+
+    MUTEX_LOCK(h->mutex);
+
+    /* Limit pipelining, and let the reader of a killed helper finish */
+    while ((h->pid != 0 && (h->sent - h->done >= EXTPOOL_PIPELINE ||
+      h->writing)) || (h->pid == 0 && (h->reading || h->writing))) {
+	if (pthread_cond_timedwait(&h->cond, &h->mutex, &deadline) == ETIMEDOUT) {
+	    Log(LG_ERR, ("[%s] Ext-helper: all helpers busy", label));
+	    goto fail;
+	}
+    }
+    if (h->pid == 0 && ExtHelperStart(p, h, label) < 0)
+	goto fail;
+
+    /* Send request without blocking readers, then wait for our turn */
+    gen = h->gen;
+    ticket = h->sent++;
+    h->writing = 1;
+    wfd = h->wfd;
+    MUTEX_UNLOCK(h->mutex);
+    k = ExtWrite(wfd, req, len, &deadline);
+    MUTEX_LOCK(h->mutex);
+    h->writing = 0;
+    pthread_cond_broadcast(&h->cond);
+    if (h->gen != gen) {
+	/* Killed meanwhile, closing its input was left to us */
+	close(wfd);
+	goto fail;
+    }
+    if (k < 0) {
+	ExtHelperKill(h, label, "can't write request");
+	goto fail;
+    }
+    while (h->gen == gen && h->done != ticket) {
+	if (pthread_cond_timedwait(&h->cond, &h->mutex, &deadline) == ETIMEDOUT) {
+	    if (h->gen == gen)
+		ExtHelperKill(h, label, "request timed out");
+	    goto fail;
+	}
+    }
+    if (h->gen != gen)
+	goto fail;
+
+    /* Read reply without blocking others from sending */
+    h->reading = 1;
+    rfd = h->rfd;
+    MUTEX_UNLOCK(h->mutex);
+    reply = ExtRead(h, rfd, &deadline);
+    MUTEX_LOCK(h->mutex);
+    h->reading = 0;
+    pthread_cond_broadcast(&h->cond);
+    if (h->gen != gen) {
+	/* Killed meanwhile, closing its output was left to us */
+	close(rfd);
+	Freee(reply);
+	goto fail;
+    }
+    if (reply == NULL) {
+	ExtHelperKill(h, label, "no reply");
+	goto fail;
+    }
+    h->done++;
+
+    gettimeofday(&now, NULL);
+    lat = (now.tv_sec - start.tv_sec) * 1000000 + now.tv_usec - start.tv_usec;
+    h->stats.requests++;
+    h->stats.latency += lat;
+    if (lat > h->stats.maxlat)
+	h->stats.maxlat = lat;
+
+    /* Retire helpers left over after the pool was shrunk */
+    if (best >= gExtHelpers && h->sent == h->done)
+	ExtHelperKill(h, label, "no longer needed");
+
+    MUTEX_UNLOCK(h->mutex);
+    ExtPoolPut(p);
+    pthread_setcancelstate(cstate, NULL);
+    return (reply);
+
+fail:
+    h->stats.errors++;
+    MUTEX_UNLOCK(h->mutex);
+    ExtPoolPut(p);
+    pthread_setcancelstate(cstate, NULL);
+    return (NULL);
+}
+
+/*
+ * ExtPoolGet()
+ *
+ * Find or create the pool for a command and hold it until ExtPoolPut().
+ */
+
+static struct extpool *
+ExtPoolGet(const char *cmd, const char *label)
+{
+    struct extpool	*p;
+    int			k, err;
+
+    MUTEX_LOCK(gExtPoolMutex);
+    ExtPoolRetire();
+    SLIST_FOREACH(p, &gExtPools, next) {
+	if (strcmp(p->cmd, cmd) == 0)
+	    break;
+    }
+    if (p == NULL) {
+	p = Malloc(MB_EXTPOOL, sizeof(*p));
+	for (k = 0; k < EXTPOOL_MAX_HELPERS; k++) {
+	    if ((err = pthread_mutex_init(&p->helpers[k].mutex, NULL)) != 0) {
+		Log(LG_ERR, ("[%s] Ext-helper: can't init mutex: %s",
+		    label, strerror(err)));
+		break;
+	    }
+	    if ((err = pthread_cond_init(&p->helpers[k].cond, NULL)) != 0) {
+		Log(LG_ERR, ("[%s] Ext-helper: can't init condition: %s",
+		    label, strerror(err)));
+		pthread_mutex_destroy(&p->helpers[k].mutex);
+		break;
+	    }
+	}
+	if (k < EXTPOOL_MAX_HELPERS) {
+	    while (k-- > 0) {
+		pthread_cond_destroy(&p->helpers[k].cond);
+		pthread_mutex_destroy(&p->helpers[k].mutex);
+	    }
+	    Freee(p);
+	    MUTEX_UNLOCK(gExtPoolMutex);
+	    return (NULL);
+	}
+	p->cmd = Mstrdup(MB_EXTPOOL, cmd);
+	SLIST_INSERT_HEAD(&gExtPools, p, next);
+    }
+    p->refs++;
+    p->used = time(NULL);
+    MUTEX_UNLOCK(gExtPoolMutex);
+    return (p);
+}
+
+/*
+ * ExtPoolPut()
+ *
+ * Release a pool held by ExtPoolGet().
+ */
+
+static void
+ExtPoolPut(struct extpool *p)
+{
+    MUTEX_LOCK(gExtPoolMutex);
+    p->refs--;
+    p->used = time(NULL);
+    MUTEX_UNLOCK(gExtPoolMutex);
+}
+
+/*
+ * ExtPoolRetire()
+ *
+ * Remove pools unused for EXTPOOL_RETIRE seconds, stopping their
+ * helpers. Called with the pool list locked.
+ */
+
+static void
+ExtPoolRetire(void)
+{
+    struct extpool	*p, *np;
+    struct exthelper	*h;
+    const time_t	now = time(NULL);
+    int			k;
+
+    SLIST_FOREACH_SAFE(p, &gExtPools, next, np) {
+	if (p->refs > 0 || now - p->used < EXTPOOL_RETIRE)
+	    continue;
+	for (k = 0; k < EXTPOOL_MAX_HELPERS; k++) {
+	    h = &p->helpers[k];
+	    if (h->pid != 0)
+		ExtHelperKill(h, "-", "script no longer used");
+	    Freee(h->rbuf);
+	    pthread_cond_destroy(&h->cond);
+	    pthread_mutex_destroy(&h->mutex);
+	}
+	Log(LG_AUTH, ("Ext-helper: removed pool for '%s'", p->cmd));
+	SLIST_REMOVE(&gExtPools, p, extpool, next);
+	Freee(p->cmd);
+	Freee(p);
+    }
+}
+
+/*
+ * ExtHelperStart()
+ *
+ * Start a helper process. Called with the helper locked.
+ */
+
+static int
+ExtHelperStart(struct extpool *p, struct exthelper *h, const char *label)
+{
+    int		in[2], out[2], k;
+    pid_t	pid;
+
+    if (pipe(in) < 0) {
+	Perror("[%s] Ext-helper: can't create pipe", label);
+	return (-1);
+    }
+    if (pipe(out) < 0) {
+	Perror("[%s] Ext-helper: can't create pipe", label);
+	close(in[0]);
+	close(in[1]);
+	return (-1);
+    }
+    for (k = 0; k < 2; k++) {
+	(void)fcntl(in[k], F_SETFD, 1);
+	(void)fcntl(out[k], F_SETFD, 1);
+    }
+
+    switch ((pid = fork())) {
+	case -1:
+	    Perror("[%s] Ext-helper: can't fork", label);
+	    close(in[0]);
+	    close(in[1]);
+	    close(out[0]);
+	    close(out[1]);
+	    return (-1);
+	case 0:
+	    dup2(in[0], STDIN_FILENO);
+	    dup2(out[1], STDOUT_FILENO);
+	    execl(_PATH_BSHELL, "sh", "-c", p->cmd, (char *)NULL);
+	    _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    (void)fcntl(in[1], F_SETFL, O_NONBLOCK);
+    (void)fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+    if (h->rbuf == NULL)
+	h->rbuf = Malloc(MB_EXTPOOL, EXTPOOL_REPLY_MAX);
+    h->rlen = 0;
+    h->pid = pid;
+    h->wfd = in[1];
+    h->rfd = out[0];
+    h->sent = h->done = 0;
+    h->stats.restarts++;
+    Log(LG_AUTH, ("[%s] Ext-helper: started '%s', pid %d",
+	label, p->cmd, (int)pid));
+    return (0);
+}
+
+/*
+ * ExtHelperKill()
+ *
+ * Stop a helper, failing requests in flight. Called with the helper
+ * locked. If some thread is writing to or reading from it, that thread
+ * closes the pipe it uses once it notices.
+ */
+
+static void
+ExtHelperKill(struct exthelper *h, const char *label, const char *why)
+{
+    Log(LG_AUTH, ("[%s] Ext-helper: stopping pid %d: %s",
+	label, (int)h->pid, why));
+    (void)kill(h->pid, SIGKILL);
+    while (waitpid(h->pid, NULL, 0) < 0 && errno == EINTR);
+    if (!h->writing)
+	close(h->wfd);
+    if (!h->reading)
+	close(h->rfd);
+    h->pid = 0;
+    h->wfd = h->rfd = -1;
+    h->gen++;
+    pthread_cond_broadcast(&h->cond);
+}
+
+/*
+ * ExtWrite()
+ */
+
+static int
+ExtWrite(int fd, const char *buf, size_t len, const struct timespec *deadline)
+{
+    struct pollfd	pfd;
+    ssize_t		n;
+    int			ms;
+
+    while (len > 0) {
+	if ((n = write(fd, buf, len)) > 0) {
+	    buf += n;
+	    len -= n;
+	    continue;
+	}
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && errno != EAGAIN)
+	    return (-1);
+	if ((ms = ExtRemaining(deadline)) == 0)
+	    return (-1);
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, ms) < 0 && errno != EINTR)
+	    return (-1);
+    }
+    return (0);
+}
+
+/*
+ * ExtRead()
+ *
+ * Read the next reply, which ends with an empty line. Data following
+ * it belongs to the next reply and is kept in the helper buffer.
+ */
+
+static char *
+ExtRead(struct exthelper *h, int fd, const struct timespec *deadline)
+{
+    struct pollfd	pfd;
+    char		*reply, *end;
+    ssize_t		n;
+    int			len, skip, ms;
+
+    for (;;) {
+	len = -1;
+	if (h->rlen > 0 && h->rbuf[0] == '\n') {
+	    len = 0;
+	    skip = 1;
+	} else if ((end = memmem(h->rbuf, h->rlen, "\n\n", 2)) != NULL) {
+	    len = end - h->rbuf + 1;
+	    skip = len + 1;
+	}
+	if (len >= 0) {
+	    reply = Malloc(MB_EXTPOOL, len + 1);
+	    memcpy(reply, h->rbuf, len);
+	    h->rlen -= skip;
+	    memmove(h->rbuf, h->rbuf + skip, h->rlen);
+	    return (reply);
+	}
+	if (h->rlen == EXTPOOL_REPLY_MAX)
+	    return (NULL);
+
+	if ((ms = ExtRemaining(deadline)) == 0)
+	    return (NULL);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, ms) < 0 && errno != EINTR)
+	    return (NULL);
+	if ((n = read(fd, h->rbuf + h->rlen, EXTPOOL_REPLY_MAX - h->rlen)) < 0) {
+	    if (errno == EAGAIN || errno == EINTR)
+		continue;
+	    return (NULL);
+	}
+	if (n == 0)
+	    return (NULL);
+	h->rlen += n;
+    }
+}
+
+/*
+ * ExtRemaining()
+ *
+ * Milliseconds left until the deadline.
+ */
+
+static int
+ExtRemaining(const struct timespec *deadline)
+{
+    struct timeval	now;
+    int64_t		ms;
+
+    gettimeofday(&now, NULL);
+    ms = (int64_t)(deadline->tv_sec - now.tv_sec) * 1000 +
+	(deadline->tv_nsec / 1000 - now.tv_usec) / 1000;
+    return (ms > 0 ? (int)ms : 0);
+}
+
+/*
+ * ExtPoolStat()
+ */
+
+int
+ExtPoolStat(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct extpool	*p;
+    struct exthelper	*h;
+    struct extstats	st;
+    pid_t		pid;
+    u_int		q;
+    int			k;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("External script helpers: %d per script, timeout %d s\r\n",
+	gExtHelpers, gExtTimeout);
+    MUTEX_LOCK(gExtPoolMutex);
+    SLIST_FOREACH(p, &gExtPools, next) {
+	Printf("%s\r\n", p->cmd);
+	Printf("Helper    Pid Queued     Requests   Errors Restarts"
+	    "  Avg ms  Max ms\r\n");
+	for (k = 0; k < EXTPOOL_MAX_HELPERS; k++) {
+	    h = &p->helpers[k];
+	    MUTEX_LOCK(h->mutex);
+	    st = h->stats;
+	    pid = h->pid;
+	    q = pid ? h->sent - h->done : 0;
+	    MUTEX_UNLOCK(h->mutex);
+	    if (k >= gExtHelpers && st.restarts == 0)
+		continue;
+	    Printf("%6d %6d %6u %12ju %8ju %8ju %7ju %7ju\r\n",
+		k, (int)pid, q, (uintmax_t)st.requests,
+		(uintmax_t)st.errors, (uintmax_t)st.restarts,
+		(uintmax_t)(st.requests ? st.latency / st.requests / 1000 : 0),
+		(uintmax_t)(st.maxlat / 1000));
+	}
+    }
+    MUTEX_UNLOCK(gExtPoolMutex);
+    return (0);
+}
@@ -0,0 +1,40 @@
+
+/*
+ * extpool.h
+ *
+ * Persistent helper processes for external authentication and accounting.
+ */
+
+#ifndef _EXTPOOL_H_
+#define _EXTPOOL_H_
+
+/*
+ * DEFINITIONS
+ */
+
+  #define EXTPOOL_MAX_HELPERS	64
+  #define EXTPOOL_DEFAULT_TIMEOUT	10	/* Seconds per request */
+  #define EXTPOOL_PIPELINE	16	/* Requests in flight per helper */
+  #define EXTPOOL_REPLY_MAX	65536
+  #define EXTPOOL_RETIRE	600	/* Remove pools unused this long */
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gExtHelpers;
+  extern int	gExtTimeout;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	ExtPoolShutdown(void);
+  extern int	ExtPoolActive(void);
+  extern void	ExtPoolSetHelpers(int num);
+  extern char	*ExtPoolRequest(const char *cmd, const char *req, size_t len,
+			const char *label);
+  extern int	ExtPoolStat(Context ctx, int ac, const char *const av[], const void *arg);
+
+#endif
+
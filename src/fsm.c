@@ -15,6 +15,7 @@
 #include "fsm.h"
 #include "ngfunc.h"
 #include "util.h"
+#include "stats.h"
 
 /*
  * DEFINITIONS
@@ -194,10 +195,10 @@ FsmNewState(Fsm fp, enum fsm_state new)
     TimerStop(&fp->echoTimer);
   if (new == ST_OPENED && fp->conf.echo_int != 0) {
     fp->quietCount = 0;
-    memset(&fp->idleStats, 0, sizeof(fp->idleStats));
+    fp->idleFrames = 0;
     TimerInit(&fp->echoTimer, "FsmKeepAlive",
       fp->conf.echo_int * SECONDS, FsmEchoTimeout, fp);
-    TimerStartRecurring(&fp->echoTimer);
+    TimerStartSpread(&fp->echoTimer);
   }
 }
 
@@ -1220,6 +1221,7 @@ FsmRecvEchoRep(Fsm fp, FsmHeader lhp, Mbuf bp)
   (void)lhp;
   bp = FsmCheckMagic(fp, bp);
   mbfree(bp);
+  fp->quietCount = 0;
 }
 
 /*
@@ -1398,11 +1400,8 @@ FsmEchoTimeout(void *arg)
     Fsm			const fp = (Fsm) arg;
     Bund		b;
     Link		l;
-#ifndef NG_PPP_STATS64
-    struct ng_ppp_link_stat	oldStats;
-#else
-    struct ng_ppp_link_stat64	oldStats;
-#endif
+    uint64_t		frames;
+    time_t		when;
 
     if (fp->type->link_layer) {
 	l = (Link)fp->arg;
@@ -1417,19 +1416,21 @@ FsmEchoTimeout(void *arg)
 	return;
     }
 
-    /* See if there was any traffic since last time */
-    oldStats = fp->idleStats;
-#ifndef NG_PPP_STATS64
-    NgFuncGetStats(b, l ?
-	l->bundleIndex : NG_PPP_BUNDLE_LINKNUM, &fp->idleStats);
-#else
-    NgFuncGetStats64(b, l ?
-	l->bundleIndex : NG_PPP_BUNDLE_LINKNUM, &fp->idleStats);
-#endif
-    if (fp->idleStats.recvFrames > oldStats.recvFrames)
+    /* See if the collected counters show traffic since last time.
+       Without a recent sample an echo request is sent instead, and
+       its reply resets the quiet count. */
+    if (l) {
+	frames = l->stats.recvFrames;
+	when = l->statsTime;
+    } else {
+	frames = b->stats.recvFrames;
+	when = b->statsTime;
+    }
+    if (StatsFresh(when) && frames > fp->idleFrames)
 	fp->quietCount = 0;
     else
 	fp->quietCount++;
+    fp->idleFrames = frames;
 
     /* See if peer hasn't responded for too many requests */
     switch (fp->quietCount) {
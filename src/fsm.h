@@ -141,13 +141,7 @@
     short		quietCount;	/* How long peer has been silent */
     struct pppTimer	timer;		/* Restart Timer */
     struct pppTimer	echoTimer;	/* Keep-alive timer */
-#ifndef NG_PPP_STATS64
-    struct ng_ppp_link_stat
-			idleStats;	/* Stats for echo timeout */
-#else
-    struct ng_ppp_link_stat64
-			idleStats;	/* Stats for echo timeout */
-#endif
+    uint64_t		idleFrames;	/* Frames seen at last echo timeout */
   };
 
   /* Packet header */
@@ -18,6 +18,8 @@
 #include "ngfunc.h"
 #include "netgraph.h"
 #include "util.h"
+#include "stats.h"
+#include "console.h"
 
 #include <sys/limits.h>
 #include <sys/types.h>
@@ -1331,11 +1333,11 @@ IfaceIdleTimeout(void *arg)
   IfaceState			const iface = &b->iface;
   int				k;
 
-  /* Get updated bpf node traffic statistics */
-  BundUpdateStats(b);
-
-  /* Mark current traffic period if there was traffic */
-  if (iface->idleStats.recvFrames + iface->idleStats.xmitFrames < 
+  /* Mark current traffic period if there was traffic. Collected
+     counters that are not recent can't prove idleness, so count
+     such a period as busy. */
+  if (!StatsFresh(b->statsTime) ||
+      iface->idleStats.recvFrames + iface->idleStats.xmitFrames < 
 	b->stats.recvFrames + b->stats.xmitFrames) {
     iface->traffic[0] = TRUE;
   } else {		/* no demand traffic for a whole idle timeout period? */
@@ -3248,6 +3250,7 @@ IfaceSetupLimits(Bund b)
 
     if (b->params.acl_limits[0] || b->params.acl_limits[1]) {
 	char		path[NG_PATHSIZ];
+	char		descr[256];
 	int		num, dir;
 
 	snprintf(path, sizeof(path), "mpd%d-%s-lim:", gPid, b->name);
@@ -3604,6 +3607,19 @@ IfaceSetupLimits(Bund b)
 		}
 	    }
 	}
+
+	/* Tell subscribers what limits the session got */
+	descr[0] = 0;
+	for (dir = 0; dir < 2; dir++) {
+	    struct acl	*l;
+
+	    for (l = b->params.acl_limits[dir]; l; l = l->next) {
+		snprintf(descr + strlen(descr), sizeof(descr) - strlen(descr),
+		    "%s%s#%d '%s'", descr[0] ? ", " : "", (dir ? "out" : "in"),
+		    l->number, l->rule);
+	    }
+	}
+	ConsoleEvent(CONS_EV_RATE, NULL, b, "%s", descr);
     }
     Freee(hpu);
 }
@@ -3982,7 +3998,7 @@ IfaceSetDescr(Bund b, const char * template)
 	    break;
 	  /* self auth name */
 	  case 'u':
-	    DST_COPY(b->links[0] ? b->links[0]->lcp.auth.conf.authname : NULL);
+	    DST_COPY(b->links[0] ? b->links[0]->lcp.auth.conf->authname : NULL);
 	    break;
 	  /* peer auth name */
 	  case 'U':
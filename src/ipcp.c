@@ -20,6 +20,7 @@
 #include "ngfunc.h"
 #include "ippool.h"
 #include "util.h"
+#include "console.h"
 
 #include <netgraph.h>
 #include <sys/mbuf.h>
@@ -537,6 +538,7 @@ IpcpLayerUp(Fsm fp)
     /* Report */
     strlcpy(ipbuf, inet_ntoa(ipcp->peer_addr), sizeof(ipbuf));
     Log(LG_IPCP, ("[%s]   %s -> %s", b->name, inet_ntoa(ipcp->want_addr), ipbuf));
+    ConsoleEvent(CONS_EV_IP, NULL, b, "%s", ipbuf);
 
 #ifdef USE_NG_VJC
     memset(&vjc, 0, sizeof(vjc));
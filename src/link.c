@@ -16,6 +16,7 @@
 #include "input.h"
 #include "ngfunc.h"
 #include "util.h"
+#include "stats.h"
 
 #include <netgraph.h>
 #include <netgraph/ng_message.h>
@@ -26,6 +27,15 @@
  * DEFINITIONS
  */
 
+  /* Outstanding asynchronous link statistics request */
+  struct linkstatsreq {
+    Link		l;
+    Bund		bund;		/* Bundle and link number queried */
+    int			linkNum;
+    struct timespec	sent;		/* When requested */
+    void		(*done)(Link l);
+  };
+
   /* Set menu options */
   enum {
     SET_BUNDLE,
@@ -62,6 +72,12 @@
   static void	LinkMsg(int type, void *cookie);
   static void	LinkNgDataEvent(int type, void *cookie);
   static void	LinkReopenTimeout(void *arg);
+  static void	LinkApplyStats(Link l, const void *data,
+		    const struct timespec *sent);
+  static void	LinkUpdateStatsReply(void *arg, struct ng_mesg *reply);
+  static int	LinkActionsAdd(Link l, int action, const char *arg,
+		    const char *regex);
+  static void	LinkActionsRelease(struct linkactions *t);
 
 /*
  * GLOBAL VARIABLES
@@ -413,7 +429,6 @@ LinkCreate(Context ctx, int ac, const char *const av[], const void *arg)
 	l->tmpl = tmpl;
 	l->stay = stay;
 	l->parent = -1;
-	SLIST_INIT(&l->actions);
 
 	/* Initialize link configuration with defaults */
 	l->conf.mru = LCP_DEFAULT_MRU;
@@ -534,23 +549,13 @@ LinkInst(Link lt, const char *name, int tmpl, int stay)
 {
     Link 	l;
     int		k;
-    struct linkaction	*a, *ap, *at;
 
     /* Create and initialize new link */
     l = Mdup(MB_LINK, lt, sizeof(*l));
     
-    ap = NULL;
-    SLIST_INIT(&l->actions);
-    SLIST_FOREACH(at, &lt->actions, next) {
-	a = Mdup(MB_AUTH, at, sizeof(*a));
-	if (a->regex[0])
-	    regcomp(&a->regexp, a->regex, REG_EXTENDED);
-	if (!ap)
-	    SLIST_INSERT_HEAD(&l->actions, a, next);
-	else
-	    SLIST_INSERT_AFTER(ap, a, next);
-	ap = a;
-    }
+    /* Actions are compiled once and shared with the template */
+    if (l->actions)
+	REF(l->actions);
     l->tmpl = tmpl;
     l->stay = stay;
     /* Count link as one more child of parent. */
@@ -598,8 +603,6 @@ LinkShutdownCheck(Link l, short state)
 void
 LinkShutdown(Link l)
 {
-    struct linkaction	*a;
-
     Log(LG_LINK, ("[%s] Link: Shutdown", l->name));
 
     /* Late divorce for DoD case */
@@ -628,12 +631,8 @@ LinkShutdown(Link l)
     PhysShutdown(l);
     LcpShutdown(l);
     l->dead = 1;
-    while ((a = SLIST_FIRST(&l->actions)) != NULL) {
-	SLIST_REMOVE_HEAD(&l->actions, next);
-	if (a->regex[0])
-	    regfree(&a->regexp);
-	Freee(a);
-    }
+    LinkActionsRelease(l->actions);
+    l->actions = NULL;
     if (l->upReason)
 	Freee(l->upReason);
     if (l->downReason)
@@ -879,7 +878,7 @@ LinkNgDataEvent(int type, void *cookie)
 	    }
 
 	    /* Debugging */
-	    LogDumpBp(LG_FRAME, bp,
+	    LogDumpBpSampled(LG_FRAME, &l->frameDumps, bp,
     		"[%s] rec'd %zu bytes frame from link proto=0x%04x",
     		l->name, MBLEN(bp), proto);
       
@@ -927,7 +926,7 @@ LinkNgDataEvent(int type, void *cookie)
 		lproto = ntohs(lproto);
 
 		/* Debugging */
-		LogDumpBp(LG_FRAME, bp,
+		LogDumpBpSampled(LG_FRAME, &b->frameDumps, bp,
     		    "[%s] rec'd %zu bytes bypass frame link=%d proto=0x%04x",
     		    b->name, MBLEN(bp), (int16_t)linkNum, lproto);
 
@@ -944,7 +943,7 @@ LinkNgDataEvent(int type, void *cookie)
 	    }
 
 	    /* Debugging */
-	    LogDumpBp(LG_FRAME, bp,
+	    LogDumpBpSampled(LG_FRAME, &b->frameDumps, bp,
 		"[%s] rec'd %zu bytes frame on %s hook", b->name, MBLEN(bp), naddr.sg_data);
 
 #ifndef USE_NG_TCPMSS
@@ -1222,15 +1221,17 @@ RecordLinkUpDownReason(Bund b, Link l, int up, const char *key, const char *fmt,
 const char *
 LinkMatchAction(Link l, int stage, char *login)
 {
-    struct linkaction *a;
+    struct linkactions	*const t = l->actions;
+    struct linkaction	*a;
+    int			k;
 
-    a = SLIST_FIRST(&l->actions);
-    if (!a) {
+    if (!t || t->num == 0) {
 	Log(LG_LINK, ("[%s] Link: No actions defined", l->name));
 	return (NULL);
     }
+    a = &t->list[0];
     if (stage == 1) {
-	if (SLIST_NEXT(a, next) == NULL && a->regex[0] == 0) {
+	if (t->num == 1 && a->regex[0] == 0) {
 	    if (a->action == LINK_ACTION_FORWARD) {
 		    Log(LG_LINK, ("[%s] Link: Matched action 'forward \"%s\"'",
 			l->name, a->arg));
@@ -1244,11 +1245,12 @@ LinkMatchAction(Link l, int stage, char *login)
 	}
 	return (NULL);
     }
-    SLIST_FOREACH(a, &l->actions, next) {
+    for (k = 0; k < t->num; k++) {
+	a = &t->list[k];
 	if (!a->regex[0] || !regexec(&a->regexp, login, 0, NULL, 0))
 	    break;
     }
-    if (a) {
+    if (k < t->num) {
 	if (a->action == LINK_ACTION_DROP) {
 	    Log(LG_LINK, ("[%s] Link: Matched action 'drop'",
 		l->name));
@@ -1274,6 +1276,7 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
 {
     Link 	l = ctx->lnk;
     struct linkaction *a;
+    int		k;
 
     (void)ac;
     (void)av;
@@ -1307,7 +1310,8 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
     if (l->tmpl)
 	Printf("\tMax children   : %d\r\n", l->conf.max_children);
     Printf("Link incoming actions:\r\n");
-    SLIST_FOREACH(a, &l->actions, next) {
+    for (k = 0; l->actions && k < l->actions->num; k++) {
+	a = &l->actions->list[k];
 	Printf("\t%s\t%s\t%s\r\n", 
 	    (a->action == LINK_ACTION_FORWARD)?"Forward":
 	    (a->action == LINK_ACTION_BUNDLE)?"Bundle":"Drop",
@@ -1336,7 +1340,8 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
 	    Printf("\tDown Reason    : %s\r\n", l->downReason);
   
 	if (l->bund) {
-	    LinkUpdateStats(l);
+	    if (!StatsFresh(l->statsTime))
+		LinkUpdateStats(l);
 	    Printf("Traffic stats:\r\n");
 
 	    Printf("\tInput octets   : %llu\r\n", (unsigned long long)l->stats.recvOctets);
@@ -1359,24 +1364,185 @@ LinkStat(Context ctx, int ac, const char *const av[], const void *arg)
 void
 LinkUpdateStats(Link l)
 {
+    struct timespec		sent;
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat	stats;
 
-    if (NgFuncGetStats(l->bund, l->bundleIndex, &stats) != -1) {
-	l->stats.xmitFrames += abs(stats.xmitFrames - l->oldStats.xmitFrames);
-	l->stats.xmitOctets += abs(stats.xmitOctets - l->oldStats.xmitOctets);
-	l->stats.recvFrames += abs(stats.recvFrames - l->oldStats.recvFrames);
-	l->stats.recvOctets += abs(stats.recvOctets - l->oldStats.recvOctets);
-        l->stats.badProtos  += abs(stats.badProtos - l->oldStats.badProtos);
-        l->stats.runts	  += abs(stats.runts - l->oldStats.runts);
-        l->stats.dupFragments += abs(stats.dupFragments - l->oldStats.dupFragments);
-        l->stats.dropFragments += abs(stats.dropFragments - l->oldStats.dropFragments);
-	l->oldStats = stats;
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    if (NgFuncGetStats(l->bund, l->bundleIndex, &stats) != -1)
+	LinkApplyStats(l, &stats, &sent);
+#else
+    struct ng_ppp_link_stat64	stats;
+
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    if (NgFuncGetStats64(l->bund, l->bundleIndex, &stats) != -1)
+	LinkApplyStats(l, &stats, &sent);
+#endif
+}
+
+/*
+ * LinkUpdateStatsAsync()
+ *
+ * Request link statistics from the ppp node and call done(), if any, once
+ * they are updated or could not be fetched. The link is referenced meanwhile.
+ */
+
+int
+LinkUpdateStatsAsync(Link l, void (*done)(Link l))
+{
+    struct linkstatsreq	*r;
+    char		path[NG_PATHSIZ];
+    u_int16_t		linkNum;
+
+    if (l->bund == NULL)
+	return (-1);
+    r = Malloc(MB_LINK, sizeof(*r));
+    r->l = l;
+    r->bund = l->bund;
+    r->linkNum = l->bundleIndex;
+    r->done = done;
+    clock_gettime(CLOCK_MONOTONIC, &r->sent);
+    linkNum = l->bundleIndex;
+    snprintf(path, sizeof(path), "[%x]:", l->bund->nodeID);
+    REF(l);
+    if (NgFuncSendQueryAsync(path, NGM_PPP_COOKIE,
+#ifndef NG_PPP_STATS64
+      NGM_PPP_GET_LINK_STATS,
+#else
+      NGM_PPP_GET_LINK_STATS64,
+#endif
+      &linkNum, sizeof(linkNum), LinkUpdateStatsReply, r) < 0) {
+	UNREF(l);
+	Freee(r);
+	return (-1);
     }
+    return (0);
+}
+
+/*
+ * LinkUpdateStatsReply()
+ */
+
+static void
+LinkUpdateStatsReply(void *arg, struct ng_mesg *reply)
+{
+    struct linkstatsreq	*const r = arg;
+    Link		const l = r->l;
+
+    if (!l->dead) {
+	if (reply != NULL && reply->header.arglen < NG_PPP_STATS_LEN) {
+	    Log(LG_ERR, ("[%s] short link stats reply: %u bytes", l->name,
+		(u_int)reply->header.arglen));
+	} else if (reply != NULL && l->bund == r->bund &&
+	  l->bundleIndex == r->linkNum)
+	    LinkApplyStats(l, reply->data, &r->sent);
+	if (r->done)
+	    (*r->done)(l);
+    }
+    UNREF(l);
+    Freee(r);
+}
+
+/*
+ * LinkApplyStats()
+ *
+ * Update link statistics from ppp node counters requested at the
+ * given time. Samples older than the one already applied are dropped,
+ * so a late reply can't roll counters back or count a delta twice.
+ */
+
+static void
+LinkApplyStats(Link l, const void *data, const struct timespec *sent)
+{
+#ifndef NG_PPP_STATS64
+    struct ng_ppp_link_stat	stats;
+#endif
 
+    if (sent->tv_sec < l->statsSample.tv_sec ||
+      (sent->tv_sec == l->statsSample.tv_sec &&
+      sent->tv_nsec < l->statsSample.tv_nsec))
+	return;
+#ifndef NG_PPP_STATS64
+    memcpy(&stats, data, sizeof(stats));
+    l->stats.xmitFrames += abs(stats.xmitFrames - l->oldStats.xmitFrames);
+    l->stats.xmitOctets += abs(stats.xmitOctets - l->oldStats.xmitOctets);
+    l->stats.recvFrames += abs(stats.recvFrames - l->oldStats.recvFrames);
+    l->stats.recvOctets += abs(stats.recvOctets - l->oldStats.recvOctets);
+    l->stats.badProtos  += abs(stats.badProtos - l->oldStats.badProtos);
+    l->stats.runts	  += abs(stats.runts - l->oldStats.runts);
+    l->stats.dupFragments += abs(stats.dupFragments - l->oldStats.dupFragments);
+    l->stats.dropFragments += abs(stats.dropFragments - l->oldStats.dropFragments);
+    l->oldStats = stats;
 #else
-    NgFuncGetStats64(l->bund, l->bundleIndex, &l->stats);
+    memcpy(&l->stats, data, sizeof(l->stats));
 #endif
+    l->statsSample = *sent;
+    l->statsTime = time(NULL);
+    StatsExportLink(l);
+}
+
+/*
+ * LinkActionsAdd()
+ *
+ * Append an action to the link's action list. The list may be shared
+ * with instances, so a new one is built and compiled, and the old one
+ * is released. Returns -1 if the regex fails to compile.
+ */
+
+static int
+LinkActionsAdd(Link l, int action, const char *arg, const char *regex)
+{
+    struct linkactions	*t, *const o = l->actions;
+    struct linkaction	*a;
+    int			k;
+
+    t = Malloc(MB_LINK, sizeof(*t));
+    t->num = (o ? o->num : 0) + 1;
+    t->list = Malloc(MB_LINK, t->num * sizeof(*t->list));
+    for (k = 0; k < t->num; k++) {
+	a = &t->list[k];
+	if (k < t->num - 1) {
+	    a->action = o->list[k].action;
+	    strlcpy(a->arg, o->list[k].arg, sizeof(a->arg));
+	    strlcpy(a->regex, o->list[k].regex, sizeof(a->regex));
+	} else {
+	    a->action = action;
+	    strlcpy(a->arg, arg, sizeof(a->arg));
+	    strlcpy(a->regex, regex, sizeof(a->regex));
+	}
+	if (a->regex[0] && regcomp(&a->regexp, a->regex, REG_EXTENDED)) {
+	    a->regex[0] = 0;
+	    t->num = k;
+	    t->refs = 1;
+	    LinkActionsRelease(t);
+	    return (-1);
+	}
+    }
+    t->refs = 1;
+    LinkActionsRelease(o);
+    l->actions = t;
+    return (0);
+}
+
+/*
+ * LinkActionsRelease()
+ *
+ * Drop a reference to an action list, freeing it with the last one.
+ */
+
+static void
+LinkActionsRelease(struct linkactions *t)
+{
+    int		k;
+
+    if (t == NULL || --t->refs > 0)
+	return;
+    for (k = 0; k < t->num; k++) {
+	if (t->list[k].regex[0])
+	    regfree(&t->list[k].regexp);
+    }
+    Freee(t->list);
+    Freee(t);
 }
 
 /*
@@ -1463,61 +1629,27 @@ LinkSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 
 	case SET_BUNDLE:
 	case SET_FORWARD:
+	    if (ac < 1 || ac > 2)
+		return(-1);
+	    if (LinkActionsAdd(l, ((intptr_t)arg == SET_BUNDLE) ?
+		    LINK_ACTION_BUNDLE : LINK_ACTION_FORWARD,
+		    av[0], (ac == 2) ? av[1] : ""))
+		Error("regexp \"%s\" compilation error", av[1]);
+    	    break;
+
 	case SET_DROP:
-	    {
-		struct linkaction	*n, *a;
-	    
-		if ((ac < 1 && (intptr_t)arg != SET_DROP) || ac > 2)
-		    return(-1);
-
-		n = Malloc(MB_LINK, sizeof(struct linkaction));
-		if ((intptr_t)arg != SET_DROP) {
-		    n->action = ((intptr_t)arg == SET_BUNDLE)?
-		        LINK_ACTION_BUNDLE:LINK_ACTION_FORWARD;
-		    strlcpy(n->arg, av[0], sizeof(n->arg));
-		    if (ac == 2 && av[1][0]) {
-		        strlcpy(n->regex, av[1], sizeof(n->regex));
-		        if (regcomp(&n->regexp, n->regex, REG_EXTENDED)) {
-		    	    Freee(n);
-			    Error("regexp \"%s\" compilation error", av[1]);
-			}
-		    }
-		} else {
-		    n->action = LINK_ACTION_DROP;
-		    if (ac == 1 && av[0][0]) {
-		        strlcpy(n->regex, av[0], sizeof(n->regex));
-		        if (regcomp(&n->regexp, n->regex, REG_EXTENDED)) {
-		    	    Freee(n);
-		    	    Error("regexp \"%s\" compilation error", av[0]);
-			}
-		    }
-		}
-	    
-		a = SLIST_FIRST(&ctx->lnk->actions);
-		if (a) {
-		    while (SLIST_NEXT(a, next))
-			a = SLIST_NEXT(a, next);
-		    SLIST_INSERT_AFTER(a, n, next);
-		} else {
-		    SLIST_INSERT_HEAD(&ctx->lnk->actions, n, next);
-		}
-	    }
+	    if (ac > 1)
+		return(-1);
+	    if (LinkActionsAdd(l, LINK_ACTION_DROP, "",
+		    (ac == 1) ? av[0] : ""))
+		Error("regexp \"%s\" compilation error", av[0]);
     	    break;
 
 	case SET_CLEAR:
-	    {
-		struct linkaction	*a;
-	    
-		if (ac != 0)
-		    return(-1);
-
-	        while ((a = SLIST_FIRST(&l->actions)) != NULL) {
-	    	    SLIST_REMOVE_HEAD(&l->actions, next);
-    		    if (a->regex[0])
-			regfree(&a->regexp);
-		    Freee(a);
-		}
-	    }
+	    if (ac != 0)
+		return(-1);
+	    LinkActionsRelease(l->actions);
+	    l->actions = NULL;
     	    break;
 
 	case SET_MRU:
@@ -47,7 +47,13 @@
     char		regex[128];
     regex_t		regexp;
     char		arg[LINK_MAX_NAME];	/* Link/Bundle template name */
-    SLIST_ENTRY(linkaction) next;
+  };
+
+  /* Compiled action list, shared read-only by a template and its instances */
+  struct linkactions {
+    int			refs;			/* Number of references */
+    int			num;			/* Number of actions */
+    struct linkaction	*list;			/* Actions in match order */
   };
 
   /* Configuration options */
@@ -126,16 +132,19 @@
     int			parent;			/* Index of the parent in gLinks */
     int			children;		/* Number of children */
     int			refs;			/* Number of references */
+    u_int		frameDumps;		/* Frame dump sampling counter */
     char		hook[NG_HOOKSIZ];	/* session hook name */
     ng_ID_t		nodeID;			/* ID of the tee node */
     MsgHandler		msgs;			/* Link events */
-    SLIST_HEAD(, linkaction) actions;
+    struct linkactions	*actions;		/* Incoming call actions */
 
     /* State info */
     struct linkconf	conf;		/* Link configuration */
     struct lcpstate	lcp;		/* LCP state info */
     struct linkbm	bm;		/* Link bandwidth mgmt info */
     struct ng_ppp_link_stat64	stats;	/* Link statistics */
+    time_t		statsTime;	/* When stats were last fetched */
+    struct timespec	statsSample;	/* When the applied sample was requested */
 #ifndef NG_PPP_STATS64
     struct ng_ppp_link_stat oldStats;	/* Previous stats for 64bit emulation */
 #endif
@@ -195,6 +204,7 @@
   extern int	LinkNuke(Link link);
   extern int	LinkStat(Context ctx, int ac, const char *const av[], const void *arg);
   extern void	LinkUpdateStats(Link l);
+  extern int	LinkUpdateStatsAsync(Link l, void (*done)(Link l));
   extern void	LinkResetStats(Link l);
   extern Link	LinkFind(const char *name);
   extern int	LinkCommand(Context ctx, int ac, const char *const av[], const void *arg);
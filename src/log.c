@@ -12,6 +12,8 @@
  */
 
 #include "ppp.h"
+#include <semaphore.h>
+#include <stdatomic.h>
 #ifdef SYSLOG_FACILITY
 #include <syslog.h>
 #endif
@@ -21,9 +23,21 @@
  */
 
   #define DUMP_BYTES_PER_LINE	16
-  #define ROUNDUP(x,r)		(((x)%(r))?((x)+((r)-((x)%(r)))):(x))
+  #define DUMP_LINE_SIZE	(1 + 3 + 4 * DUMP_BYTES_PER_LINE + 2 + 1)
   #define MAX_LOG_LINE		500
 
+  #define LOG_RING_SIZE		1024	/* must be a power of two */
+  #define LOG_REC_SIZE		1000
+
+/* Preformatted log record, queued for the logger thread */
+
+  struct logrec
+  {
+    atomic_uint	seq;		/* ring sequence number of this slot */
+    u_char	console;	/* copy to console sessions too */
+    char	text[LOG_REC_SIZE];
+  };
+
 /* Log option descriptor */
 
   struct logopt
@@ -38,10 +52,25 @@
  */
 
   int	gLogOptions = LG_DEFAULT_OPT | LG_ALWAYS;
+  __thread int	gLogLevel;
+  u_int	gLogFrameSample = 1;	/* Dump one of every N frames */
 #ifdef SYSLOG_FACILITY
   char	gSysLogIdent[32];
 #endif
 
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	vLogEnqueue(int console, const char *fmt, va_list args);
+  static struct logrec	*LogRingClaim(u_int *posp);
+  static void	LogWrite(int console, const char *buf);
+  static void	LogDrain(void);
+  static void	*LogThread(void *arg);
+  static u_long	LogDroppedTotal(void);
+  static void	LogDumpData(const u_char *data, int count,
+			const char *fmt, va_list ap);
+
 /*
  * INTERNAL VARIABLES
  */
@@ -144,6 +173,21 @@
 
   #define NUM_LOG_LEVELS (sizeof(LogOptionList) / sizeof(*LogOptionList))
 
+  /* Multi-producer, single-consumer ring of records for the logger thread.
+     Producers claim a slot by advancing gLogHead, format into it and
+     publish it by storing its sequence number; see LogRingClaim(). */
+  static struct logrec	gLogRing[LOG_RING_SIZE];
+  static atomic_uint	gLogHead;
+  static u_int		gLogTail;
+  static atomic_int	gLogRunning;
+  static atomic_int	gLogStop;
+  static sem_t		gLogSem;
+  static pthread_t	gLogThread;
+
+  /* Records dropped because the ring was full, per log option */
+  static atomic_ulong	gLogDropped[LG_I_EVENTS + 1];
+  static u_long		gLogDropReported;
+
 /*
  * LogOpen()
  */
@@ -151,21 +195,48 @@
 int
 LogOpen(void)
 {
+    u_int	k;
+    int		ret;
+
 #ifdef SYSLOG_FACILITY
     if (!*gSysLogIdent)
 	strcpy(gSysLogIdent, "mpd");
     openlog(gSysLogIdent, 0, LOG_DAEMON);
 #endif
+
+    /* Start logger thread; until then everything is logged directly */
+    for (k = 0; k < LOG_RING_SIZE; k++)
+	atomic_init(&gLogRing[k].seq, k);
+    if (sem_init(&gLogSem, 0, 0) < 0) {
+	Perror("LOG: sem_init");
+	return(0);
+    }
+    if ((ret = pthread_create(&gLogThread, NULL, LogThread, NULL)) != 0) {
+	Log(LG_ERR, ("LOG: Could not create logger thread %d", ret));
+	sem_destroy(&gLogSem);
+	return(0);
+    }
+    atomic_store(&gLogRunning, 1);
+    atexit(LogClose);
     return(0);
 }
 
 /*
  * LogClose()
+ *
+ * Stop the logger thread after it has written out everything queued.
  */
 
 void
 LogClose(void)
 {
+    if (atomic_exchange(&gLogRunning, 0)) {
+	atomic_store(&gLogStop, 1);
+	sem_post(&gLogSem);
+	if (!pthread_equal(pthread_self(), gLogThread))
+	    pthread_join(gLogThread, NULL);
+	LogDrain();
+    }
 #ifdef SYSLOG_FACILITY
     closelog();
 #endif
@@ -184,15 +255,20 @@ LogCommand(Context ctx, int ac, const char *const av[], const void *arg)
 
     (void)arg;
     if (ac == 0) {
-#define LG_FMT	"    %-12s  %-10s  %s\r\n"
+#define LG_FMT	"    %-12s  %-10s  %-10s  %s\r\n"
 
-	Printf(LG_FMT, "Log Option", "Enabled", "Description");
-	Printf(LG_FMT, "----------", "-------", "-----------");
+	Printf(LG_FMT, "Log Option", "Enabled", "Dropped", "Description");
+	Printf(LG_FMT, "----------", "-------", "-------", "-----------");
 	for (k = 0; k < NUM_LOG_LEVELS; k++) {
+	    char	dropped[16];
+
+	    snprintf(dropped, sizeof(dropped), "%lu",
+		atomic_load(&gLogDropped[ffs(LogOptionList[k].mask) - 1]));
     	    Printf("  " LG_FMT, LogOptionList[k].name,
 		(gLogOptions & LogOptionList[k].mask) ? "Yes" : "No",
-		LogOptionList[k].desc);
+		dropped, LogOptionList[k].desc);
 	}
+	Printf("Total messages dropped: %lu\r\n", LogDroppedTotal());
 	return(0);
     }
 
@@ -249,28 +325,9 @@ LogPrintf(const char *fmt, ...)
 }
 
 void
-vLogPrintf(const char *fmt, va_list args) NO_THREAD_SAFETY_ANALYSIS
+vLogPrintf(const char *fmt, va_list args)
 {
-    if (!SLIST_EMPTY(&gConsole.sessions)) {
-	char		buf[1000];
-	ConsoleSession	s;
-
-        vsnprintf(buf, sizeof(buf), fmt, args);
-#ifdef SYSLOG_FACILITY
-        syslog(LOG_INFO, "%s", buf);
-#endif
-	pthread_cleanup_push(ConsoleCancelCleanup, gConsole.lock);
-	RWLOCK_RDLOCK(gConsole.lock);
-	SLIST_FOREACH(s, &gConsole.sessions, next) {
-	    if (Enabled(&s->options, CONSOLE_LOGGING))
-		s->write(s, "%s\r\n", buf);
-	}
-	pthread_cleanup_pop(1);
-#ifdef SYSLOG_FACILITY
-    } else {
-        vsyslog(LOG_INFO, fmt, args);
-#endif
-    }
+    vLogEnqueue(TRUE, fmt, args);
 }
 
 /*
@@ -285,12 +342,170 @@ LogPrintf2(const char *fmt, ...)
     va_list       args;
 
     va_start(args, fmt);
-#ifdef SYSLOG_FACILITY
-    vsyslog(LOG_INFO, fmt, args);
-#endif
+    vLogEnqueue(FALSE, fmt, args);
     va_end(args);
 }
 
+/*
+ * vLogEnqueue()
+ *
+ * Format the message straight into a free ring slot and wake up the
+ * logger thread. Never blocks: if the ring is full, the message is
+ * dropped and counted against the log option it was logged under.
+ */
+
+static void
+vLogEnqueue(int console, const char *fmt, va_list args)
+{
+    struct logrec	*r;
+    u_int		pos;
+    const int		lev = gLogLevel;
+
+    gLogLevel = 0;
+    if (!atomic_load_explicit(&gLogRunning, memory_order_acquire)) {
+	char	buf[LOG_REC_SIZE];
+
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	LogWrite(console, buf);
+	return;
+    }
+    if ((r = LogRingClaim(&pos)) == NULL) {
+	atomic_fetch_add_explicit(&gLogDropped[lev ? ffs(lev) - 1 : LG_I_ALWAYS],
+	    1, memory_order_relaxed);
+	return;
+    }
+    r->console = console;
+    vsnprintf(r->text, sizeof(r->text), fmt, args);
+    atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+    sem_post(&gLogSem);
+}
+
+/*
+ * LogRingClaim()
+ *
+ * Reserve the next ring slot for writing. Returns NULL if the ring is full.
+ */
+
+static struct logrec *
+LogRingClaim(u_int *posp)
+{
+    struct logrec	*r;
+    u_int		pos, seq;
+
+    pos = atomic_load_explicit(&gLogHead, memory_order_relaxed);
+    for (;;) {
+	r = &gLogRing[pos & (LOG_RING_SIZE - 1)];
+	seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+	if (seq == pos) {
+	    if (atomic_compare_exchange_weak_explicit(&gLogHead, &pos, pos + 1,
+		memory_order_relaxed, memory_order_relaxed))
+		break;
+	} else if ((int)(seq - pos) < 0)
+	    return(NULL);
+	else
+	    pos = atomic_load_explicit(&gLogHead, memory_order_relaxed);
+    }
+    *posp = pos;
+    return(r);
+}
+
+/*
+ * LogThread()
+ *
+ * Logger thread: write out queued records until told to stop.
+ */
+
+static void *
+LogThread(void *arg)
+{
+    (void)arg;
+    while (1) {
+	if (sem_wait(&gLogSem) < 0 && errno == EINTR)
+	    continue;
+	LogDrain();
+	if (atomic_load(&gLogStop))
+	    break;
+    }
+    return(NULL);
+}
+
+/*
+ * LogDrain()
+ *
+ * Write out all records published so far, then report drops if any.
+ */
+
+static void
+LogDrain(void)
+{
+    struct logrec	*r;
+    u_long		dropped;
+    char		buf[64];
+
+    while (1) {
+	r = &gLogRing[gLogTail & (LOG_RING_SIZE - 1)];
+	if (atomic_load_explicit(&r->seq, memory_order_acquire) != gLogTail + 1)
+	    break;
+	LogWrite(r->console, r->text);
+	atomic_store_explicit(&r->seq, gLogTail + LOG_RING_SIZE,
+	    memory_order_release);
+	gLogTail++;
+    }
+    if ((dropped = LogDroppedTotal()) != gLogDropReported) {
+	snprintf(buf, sizeof(buf), "LOG: %lu messages dropped",
+	    dropped - gLogDropReported);
+	gLogDropReported = dropped;
+	LogWrite(TRUE, buf);
+    }
+}
+
+/*
+ * LogWrite()
+ *
+ * Send a record to syslog and, if asked, to console sessions with logging.
+ * A record may hold several newline separated lines (packet dumps).
+ */
+
+static void
+LogWrite(int console, const char *buf) NO_THREAD_SAFETY_ANALYSIS
+{
+    ConsoleSession	s;
+    const char		*p, *e;
+
+#ifdef SYSLOG_FACILITY
+    for (p = buf; (e = strchr(p, '\n')) != NULL; p = e + 1)
+	syslog(LOG_INFO, "%.*s", (int)(e - p), p);
+    syslog(LOG_INFO, "%s", p);
+#endif
+    if (!console || SLIST_EMPTY(&gConsole.sessions))
+	return;
+    pthread_cleanup_push(ConsoleCancelCleanup, gConsole.lock);
+    RWLOCK_RDLOCK(gConsole.lock);
+    SLIST_FOREACH(s, &gConsole.sessions, next) {
+	if (!Enabled(&s->options, CONSOLE_LOGGING))
+	    continue;
+	for (p = buf; (e = strchr(p, '\n')) != NULL; p = e + 1)
+	    s->write(s, "%.*s\r\n", (int)(e - p), p);
+	s->write(s, "%s\r\n", p);
+    }
+    pthread_cleanup_pop(1);
+}
+
+/*
+ * LogDroppedTotal()
+ */
+
+static u_long
+LogDroppedTotal(void)
+{
+    u_long	total = 0;
+    int		k;
+
+    for (k = 0; k <= LG_I_EVENTS; k++)
+	total += atomic_load_explicit(&gLogDropped[k], memory_order_relaxed);
+    return(total);
+}
+
 /*
  * LogDumpBp2()
  *
@@ -300,60 +515,11 @@ LogPrintf2(const char *fmt, ...)
 void
 LogDumpBp2(Mbuf bp, const char *fmt, ...)
 {
-    int		k;
-    unsigned	total;
-    u_char	bytes[DUMP_BYTES_PER_LINE];
-    char	line[128];
-    int		linelen;
     va_list	ap;
 
-	/* Do header */
-	va_start(ap, fmt);
-	vLogPrintf(fmt, ap);
-	va_end(ap);
-
-	/* Do data */
-	line[0]=' ';
-	line[1]=' ';
-        line[2]=' ';
-        line[3]=0;
-        linelen=3;
-  
-        total = 0;
-	if (bp) {
-    	    int	start, last = 0;
-    	    unsigned stop;
-
-    	    stop = ROUNDUP(total + MBLEN(bp), DUMP_BYTES_PER_LINE);
-    	    for (start = total; total < stop; ) {
-    		u_int	const byte = (MBDATAU(bp))[total - start];
-
-    		if (total < start + MBLEN(bp)) {
-		    sprintf(line+linelen, " %02x", byte);
-		    last = total % DUMP_BYTES_PER_LINE;
-    		} else
-		    sprintf(line+linelen, "   ");
-    		linelen+=3;
-      
-    		bytes[total % DUMP_BYTES_PER_LINE] = byte;
-    		total++;
-      
-    		if (total % DUMP_BYTES_PER_LINE == 0) {
-		    snprintf(line+linelen, sizeof(line), "  ");
-        	    linelen+=2;
-		    for (k = 0; k <= last; k++) {
-			line[linelen++] = isgraph(bytes[k]) ? bytes[k] : '.';
-			line[linelen] = 0;
-		    }
-		    LogPrintf("%s",line);
-		    line[0]=' ';
-		    line[1]=' ';
-		    line[2]=' ';
-		    line[3]=0;
-		    linelen=3;
-    		}
-    	    }
-	}
+    va_start(ap, fmt);
+    LogDumpData(bp ? MBDATAU(bp) : NULL, bp ? (int)MBLEN(bp) : 0, fmt, ap);
+    va_end(ap);
 }
 
 /*
@@ -365,46 +531,65 @@ LogDumpBp2(Mbuf bp, const char *fmt, ...)
 void
 LogDumpBuf2(const u_char *buf, int count, const char *fmt, ...)
 {
-    int		k, stop, total;
-    char	line[128];
-    int		linelen;
     va_list	ap;
 
-	/* Do header */
-	va_start(ap, fmt);
-        vLogPrintf(fmt, ap);
-        va_end(ap);
-
-	/* Do data */
-        line[0]=' ';
-        line[1]=' ';
-        line[2]=' ';
-        line[3]=0;
-        linelen=3;
-
-        stop = ROUNDUP(count, DUMP_BYTES_PER_LINE);
-        for (total = 0; total < stop; ) {
-	    if (total < count)
-		sprintf(line+linelen, " %02x", buf[total]);
-	    else
-		sprintf(line+linelen, "   ");
-            linelen+=3;
-    	    total++;
-	    if (total % DUMP_BYTES_PER_LINE == 0) {
-		snprintf(line+linelen, sizeof(line), "  ");
-    		linelen+=2;
-    		for (k = total - DUMP_BYTES_PER_LINE; k < total && k < count; k++) {
-		    line[linelen++] = isgraph(buf[k]) ? buf[k] : '.';
-		    line[linelen] = 0;
-		}
-		LogPrintf("%s",line);
-		line[0]=' ';
-		line[1]=' ';
-		line[2]=' ';
-		line[3]=0;
-		linelen=3;
-	    }
+    va_start(ap, fmt);
+    LogDumpData(buf, count, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * LogDumpData()
+ *
+ * Format the header and a hex/ASCII dump of the data into as few log
+ * records as possible: lines are packed into one record, separated by
+ * newlines, and a new record is started only when the current one is full.
+ */
+
+static void
+LogDumpData(const u_char *data, int count, const char *fmt, va_list ap)
+{
+    static const char	hex[] = "0123456789abcdef";
+    char		buf[LOG_REC_SIZE];
+    char		*p;
+    int			len, k, n, i;
+    const int		lev = gLogLevel;
+
+    /* Do header */
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    if (len < 0)
+	len = 0;
+    else if (len >= (int)sizeof(buf))
+	len = sizeof(buf) - 1;
+
+    /* Do data */
+    for (k = 0; k < count; k += DUMP_BYTES_PER_LINE) {
+	n = count - k;
+	if (n > DUMP_BYTES_PER_LINE)
+	    n = DUMP_BYTES_PER_LINE;
+	if (len + DUMP_LINE_SIZE >= (int)sizeof(buf)) {
+	    gLogLevel = lev;
+	    LogPrintf("%s", buf);
+	    len = 0;
+	}
+	p = buf + len;
+	if (len > 0)
+	    *p++ = '\n';
+	memset(p, ' ', 3 + 3 * DUMP_BYTES_PER_LINE + 2);
+	p += 3;
+	for (i = 0; i < n; i++) {
+	    p[1] = hex[data[k + i] >> 4];
+	    p[2] = hex[data[k + i] & 0x0f];
+	    p += 3;
 	}
+	p += 3 * (DUMP_BYTES_PER_LINE - n) + 2;
+	for (i = 0; i < n; i++)
+	    *p++ = isgraph(data[k + i]) ? data[k + i] : '.';
+	*p = 0;
+	len = p - buf;
+    }
+    gLogLevel = lev;
+    LogPrintf("%s", buf);
 }
 
 /*
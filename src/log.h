@@ -113,24 +113,48 @@
 			        | LG_PHYS		\
 				)
 
+  /* gLogLevel tells the logger which option a message was logged under */
   #define Log(lev, args)	do {				\
-				  if (gLogOptions & (lev))	\
+				  if (gLogOptions & (lev)) {	\
+				    gLogLevel = (lev);		\
 				    LogPrintf args;		\
+				  }				\
 				} while (0)
 
   #define Log2(lev, args)	do {				\
-				  if (gLogOptions & (lev))	\
+				  if (gLogOptions & (lev)) {	\
+				    gLogLevel = (lev);		\
 				    LogPrintf2 args;		\
+				  }				\
 				} while (0)
 
   #define LogDumpBuf(lev, buf, len, fmt, args...) do {		\
-				  if (gLogOptions & (lev))	\
+				  if (gLogOptions & (lev)) {	\
+				    gLogLevel = (lev);		\
 				    LogDumpBuf2(buf, len, fmt, ##args);	\
+				  }				\
 				} while (0)
 
   #define LogDumpBp(lev, bp, fmt, args...) do {			\
-				  if (gLogOptions & (lev))	\
+				  if (gLogOptions & (lev)) {	\
+				    gLogLevel = (lev);		\
 				    LogDumpBp2(bp, fmt, ##args);\
+				  }				\
+				} while (0)
+
+  /* Dump only every gLogFrameSample'th frame counted by *cnt */
+  #define LogSampled(cnt)	(gLogFrameSample <= 1			\
+				  || (*(cnt))++ % gLogFrameSample == 0)
+
+  /* As above, not counting frames while lev is not logged */
+  #define LogWantSampled(lev, cnt)	((gLogOptions & (lev))	\
+				  && LogSampled(cnt))
+
+  #define LogDumpBpSampled(lev, cnt, bp, fmt, args...) do {	\
+				  if ((gLogOptions & (lev)) && LogSampled(cnt)) { \
+				    gLogLevel = (lev);		\
+				    LogDumpBp2(bp, fmt, ##args);\
+				  }				\
 				} while (0)
 
 /*
@@ -138,6 +162,8 @@
  */
 
   extern int	gLogOptions;
+  extern __thread int	gLogLevel;
+  extern u_int	gLogFrameSample;
 #ifdef SYSLOG_FACILITY
   extern char	gSysLogIdent[32];
 #endif
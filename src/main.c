@@ -22,6 +22,10 @@
 #include "ngfunc.h"
 #include "util.h"
 #include "ippool.h"
+#include "stats.h"
+#include "dpool.h"
+#include "extpool.h"
+#include "acctspool.h"
 #ifdef CCP_MPPC
 #include "ccp_mppc.h"
 #endif
@@ -247,6 +251,8 @@ main(int ac, char *av[])
     /* Do some initialization */
     MpSetDiscrim();
     IPPoolInit();
+    StatsInit();
+    DpoolInit();
 #ifdef CCP_MPPC
     MppcTestCap();
 #endif
@@ -388,6 +394,9 @@ DoExit(int code)
 	CloseIfaces();
 
     NgFuncShutdownGlobal();
+    DpoolShutdown();
+    ExtPoolShutdown();
+    AcctSpoolShutdown();
 
     /* Blow away all netgraph nodes */
     for (k = 0; k < gNumBundles; k++) {
@@ -414,6 +423,7 @@ DoExit(int code)
     EcpsShutdown();
     CcpsShutdown();
     LinksShutdown();
+    StatsExportClose();
 
     /* Remove our PID file and exit */
     ConsoleShutdown(&gConsole);
@@ -108,9 +108,9 @@ mballoc(int size)
     if (size == 0) {
 	osize = 64 - sizeof(*bp);
     } else if (size < 512)
-	osize = ((size - 1) / 32 + 1) * 64 - sizeof(*bp);
+	osize = ((size + MB_HEADROOM - 1) / 32 + 1) * 64 - sizeof(*bp);
     else
-	osize = ((size - 1) / 64 + 1) * 64 + 512 - sizeof(*bp);
+	osize = ((size + MB_HEADROOM - 1) / 64 + 1) * 64 + 512 - sizeof(*bp);
     amount = sizeof(*bp) + osize;
 
     if ((memory = MALLOC(MB_MBUF, amount)) == NULL) {
@@ -118,10 +118,12 @@ mballoc(int size)
 	DoExit(EX_ERRDEAD);
     }
 
-    /* Put mbuf at front of memory region */
+    /* Put mbuf at front of memory region, keep headroom for prepends */
     bp = (Mbuf)(void *)memory;
     bp->size = osize;
     bp->offset = (osize - size) / 2;
+    if (bp->offset < MB_HEADROOM)
+	bp->offset = MB_HEADROOM;
     bp->cnt = 0;
 
     return (bp);
@@ -232,6 +234,8 @@ mbcopyback(Mbuf bp, int offset, const void *buf, int cnt)
 	bp = nbp;
     } else if ((b > bp->offset) || (bp->offset + bp->cnt + e > bp->size)) {
 	int	noff = (bp->size - (b + bp->cnt + e)) / 2;
+	if (noff < MB_HEADROOM && bp->size - (b + bp->cnt + e) >= MB_HEADROOM)
+	    noff = MB_HEADROOM;
 	memmove(MBDATAU(bp) - bp->offset + noff + b, MBDATAU(bp), bp->cnt);
 	bp->offset = noff;
     } else {
@@ -324,6 +328,19 @@ mbsplit(Mbuf bp, int cnt)
     return(nbp);
 }
 
+/*
+ * MemPtrCmp()
+ */
+
+static int
+MemPtrCmp(const void *a, const void *b)
+{
+    const void	*const pa = *(const void *const *)a;
+    const void	*const pb = *(const void *const *)b;
+
+    return (pa < pb ? -1 : (pa > pb));
+}
+
 /*
  * MemStat()
  */
@@ -335,6 +352,9 @@ MemStat(Context ctx, int ac, const char *const av[], const void *arg)
     u_int	i;
     u_int	total_allocs = 0;
     u_int	total_bytes = 0;
+    int		k, links = 0, shared = 0, bunds = 0, nconfs = 0, ncopy;
+    AuthConf	*confs;
+    size_t	conf_bytes, bund_conf;
 
     (void)ac;
     (void)av;
@@ -360,6 +380,50 @@ MemStat(Context ctx, int ac, const char *const av[], const void *arg)
     Printf("   %-28s %10lu %10lu\r\n",
         "Totals", total_allocs, total_bytes);
 
+    /* Session structures and auth configs, each config counted once */
+    confs = Malloc(MB_UTIL, (gNumLinks + 1) * sizeof(*confs));
+    for (k = 0; k < gNumLinks; k++) {
+	if (gLinks[k] == NULL)
+	    continue;
+	if (!gLinks[k]->tmpl) {
+	    links++;
+	    if (gLinks[k]->lcp.auth.conf->refs > 1)
+		shared++;
+	}
+	confs[nconfs++] = gLinks[k]->lcp.auth.conf;
+    }
+    for (k = 0; k < gNumBundles; k++) {
+	if (gBundles[k] != NULL && !gBundles[k]->tmpl)
+	    bunds++;
+    }
+    qsort(confs, nconfs, sizeof(*confs), MemPtrCmp);
+    for (k = 0, ncopy = 0, conf_bytes = 0; k < nconfs; k++) {
+	if (k > 0 && confs[k] == confs[k - 1])
+	    continue;
+	ncopy++;
+	conf_bytes += AuthConfSize(confs[k]);
+    }
+    Freee(confs);
+    Printf("Links, bundles and auth configs:\r\n");
+    Printf("   %-28s %10d %10zu\r\n", "Links", links,
+	links * sizeof(struct linkst));
+    Printf("   %-28s %10d %10zu\r\n", "Bundles", bunds,
+	bunds * sizeof(struct bundle));
+    Printf("   %-28s %10d %10zu\r\n", "Auth configs", ncopy, conf_bytes);
+    Printf("   %-28s %10d %10s\r\n", "Links sharing auth config",
+	shared, "");
+    /* Layer configs are not shared and are copied into each instance */
+    bund_conf = sizeof(struct bundconf) + sizeof(struct ifaceconf) +
+	sizeof(struct ipcpconf) + sizeof(struct ipv6cpconf) +
+	2 * sizeof(struct optinfo);		/* CCP and ECP options */
+#ifdef USE_NG_NAT
+    bund_conf += sizeof(struct natstate);
+#endif
+    Printf("   %-28s %10d %10zu\r\n", "Copied link configs", links,
+	links * sizeof(struct linkconf));
+    Printf("   %-28s %10d %10zu\r\n", "Copied bundle configs", bunds,
+	bunds * bund_conf);
+
     structs_free(&typed_mem_stats_type, NULL, &stats);
     return(0);
 }
@@ -26,6 +26,10 @@
 
   typedef struct mpdmbuf	*Mbuf;
 
+  /* Space kept in front of new data for headers prepended on output:
+     FSM header, LCP magic, and protocol field with room to spare */
+  #define MB_HEADROOM	16
+
   /* Macros */
   #define MBDATAU(bp)	((u_char *)(bp) + sizeof(struct mpdmbuf) + (bp)->offset)
   #define MBDATA(bp)	((bp) ? MBDATAU(bp) : NULL)
@@ -60,6 +64,10 @@
   #define MB_UTIL	"UTIL"
   #define MB_VJCOMP	"VJCOMP"
   #define MB_IPPOOL	"IPPOOL"
+  #define MB_STATS	"STATS"
+  #define MB_DPOOL	"DPOOL"
+  #define MB_EXTPOOL	"EXTPOOL"
+  #define MB_ACCTSPOOL	"ACCTSPOOL"
 
 #ifndef __malloc_like
 #define __malloc_like
@@ -285,10 +285,10 @@ fail:
 
     /* Preset some special chat variables */
     ChatPresetVar(m->chat, CHAT_VAR_DEVICE, m->device);
-    ChatPresetVar(m->chat, CHAT_VAR_LOGIN, l->lcp.auth.conf.authname);
-    if (l->lcp.auth.conf.password[0] != 0) {
-	ChatPresetVar(m->chat, CHAT_VAR_PASSWORD, l->lcp.auth.conf.password);
-    } else if (AuthGetData(l->lcp.auth.conf.authname,
+    ChatPresetVar(m->chat, CHAT_VAR_LOGIN, l->lcp.auth.conf->authname);
+    if (l->lcp.auth.conf->password[0] != 0) {
+	ChatPresetVar(m->chat, CHAT_VAR_PASSWORD, l->lcp.auth.conf->password);
+    } else if (AuthGetData(l->lcp.auth.conf->authname,
 	password, sizeof(password), NULL, NULL) >= 0) {
 	    ChatPresetVar(m->chat, CHAT_VAR_PASSWORD, password);
     }
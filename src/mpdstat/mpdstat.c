@@ -0,0 +1,126 @@
+
+/*
+ * mpdstat.c
+ *
+ * Sample dumper of the mpd memory mapped statistics file.
+ */
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "statshm.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define DEFAULT_FILE	"/var/run/mpd5.stats"
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	Dump(const struct statshm_map *m, int all);
+  static void	Usage(void) __dead2;
+
+/*
+ * main()
+ */
+
+int
+main(int ac, char *av[])
+{
+    struct statshm_map	m;
+    const char		*path = DEFAULT_FILE;
+    int			all = 0, wait = 0, ch;
+
+    while ((ch = getopt(ac, av, "af:w:")) != -1) {
+	switch (ch) {
+	    case 'a':
+		all = 1;
+		break;
+	    case 'f':
+		path = optarg;
+		break;
+	    case 'w':
+		if ((wait = atoi(optarg)) <= 0)
+		    Usage();
+		break;
+	    default:
+		Usage();
+	}
+    }
+    if (optind != ac)
+	Usage();
+
+    if (StatShmOpen(path, &m) < 0)
+	err(EX_NOINPUT, "%s", path);
+    for (;;) {
+	Dump(&m, all);
+	if (wait == 0)
+	    break;
+	sleep(wait);
+	printf("\n");
+    }
+    StatShmClose(&m);
+    return (EX_OK);
+}
+
+/*
+ * Dump()
+ */
+
+static void
+Dump(const struct statshm_map *m, int all)
+{
+    struct statshm_global	g;
+    struct statshm_session	s;
+    struct in_addr		a;
+    u_int			k;
+
+    if (StatShmReadGlobal(m, &g) < 0)
+	err(EX_TEMPFAIL, "global counters");
+    if (g.pid == 0)
+	errx(EX_UNAVAILABLE, "mpd is not running");
+    printf("pid %u, up %jd s, updated %jd s ago, %u links, %u bundles"
+	", %u children, %u not exported\n",
+	g.pid, (intmax_t)(time(NULL) - g.started),
+	(intmax_t)(time(NULL) - g.updated),
+	g.links, g.bundles, g.children, g.overflow);
+    printf("%-12s %-10s %-16s %-15s %8s %14s %14s %12s %12s\n",
+	"Link", "Iface", "User", "IP", "Time", "In octets", "Out octets",
+	"In frames", "Out frames");
+
+    for (k = 0; k < m->hdr->max_sessions; k++) {
+	if (StatShmReadSession(m, k, &s) < 0)
+	    continue;
+	if (!all && (s.flags & STATSHM_F_UP) == 0)
+	    continue;
+	a.s_addr = s.ipcp_addr;
+	printf("%-12s %-10s %-16s %-15s %8jd %14" PRIu64 " %14" PRIu64
+	    " %12" PRIu64 " %12" PRIu64 "\n",
+	    s.link, s.iface, s.authname, s.ipcp_addr ? inet_ntoa(a) : "-",
+	    (s.flags & STATSHM_F_UP) ? (intmax_t)(time(NULL) - s.up_since) : 0,
+	    s.recvOctets, s.xmitOctets, s.recvFrames, s.xmitFrames);
+    }
+}
+
+/*
+ * Usage()
+ */
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: mpdstat [-a] [-f file] [-w seconds]\n");
+    exit(EX_USAGE);
+}
+
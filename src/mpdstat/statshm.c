@@ -0,0 +1,158 @@
+
+/*
+ * statshm.c
+ *
+ * Reader side of the mpd memory mapped statistics file. Nothing here
+ * talks to the daemon or takes its locks; records are copied out using
+ * their sequence counters.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "statshm.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define STATSHM_RETRIES	1000	/* Give up on a busy record */
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static int	StatShmCopy(const void *src, volatile const uint32_t *seq,
+			void *dst, size_t len);
+
+/*
+ * StatShmOpen()
+ *
+ * Map the statistics file read-only and check its layout.
+ */
+
+int
+StatShmOpen(const char *path, struct statshm_map *m)
+{
+    const struct statshm_header	*h;
+    struct stat			st;
+    int				fd;
+
+    memset(m, 0, sizeof(*m));
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return (-1);
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return (-1);
+    }
+    if ((size_t)st.st_size < sizeof(*h)) {
+	close(fd);
+	errno = EINVAL;
+	return (-1);
+    }
+    h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+	return (-1);
+
+    if (h->magic != STATSHM_MAGIC || h->version != STATSHM_VERSION ||
+      h->header_size != sizeof(struct statshm_header) ||
+      h->record_size != sizeof(struct statshm_session) ||
+      STATSHM_SIZE(h->max_sessions) > (size_t)st.st_size) {
+	munmap((void *)h, st.st_size);
+	errno = EFTYPE;
+	return (-1);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    m->hdr = h;
+    m->size = st.st_size;
+    return (0);
+}
+
+/*
+ * StatShmClose()
+ */
+
+void
+StatShmClose(struct statshm_map *m)
+{
+    if (m->hdr != NULL)
+	munmap((void *)m->hdr, m->size);
+    m->hdr = NULL;
+    m->size = 0;
+}
+
+/*
+ * StatShmReadGlobal()
+ *
+ * Take a consistent copy of the global counters.
+ */
+
+int
+StatShmReadGlobal(const struct statshm_map *m, struct statshm_global *g)
+{
+    return (StatShmCopy(&m->hdr->global, &m->hdr->global.seq,
+	g, sizeof(*g)));
+}
+
+/*
+ * StatShmReadSession()
+ *
+ * Take a consistent copy of session record idx.
+ * Returns -1 if the record is unused or out of range.
+ */
+
+int
+StatShmReadSession(const struct statshm_map *m, u_int idx,
+	struct statshm_session *s)
+{
+    const struct statshm_session	*r;
+
+    if (idx >= m->hdr->max_sessions) {
+	errno = ENOENT;
+	return (-1);
+    }
+    r = STATSHM_SESSION(m->hdr, idx);
+    if (StatShmCopy(r, &r->seq, s, sizeof(*s)) < 0)
+	return (-1);
+    if ((s->flags & STATSHM_F_USED) == 0) {
+	errno = ENOENT;
+	return (-1);
+    }
+    return (0);
+}
+
+/*
+ * StatShmCopy()
+ *
+ * Copy seqlock protected data, retrying while the writer is active.
+ */
+
+static int
+StatShmCopy(const void *src, volatile const uint32_t *seq,
+	void *dst, size_t len)
+{
+    uint32_t	s1, s2;
+    int		k;
+
+    for (k = 0; k < STATSHM_RETRIES; k++) {
+	s1 = *seq;
+	if (s1 & 1)
+	    continue;
+	atomic_thread_fence(memory_order_acquire);
+	memcpy(dst, src, len);
+	atomic_thread_fence(memory_order_acquire);
+	s2 = *seq;
+	if (s1 == s2)
+	    return (0);
+    }
+    errno = EAGAIN;
+    return (-1);
+}
+
@@ -63,6 +63,32 @@
   #define TEMPHOOK		"temphook"
   #define MAX_IFACE_CREATE	128
 
+  #define NG_ASYNC_TIMEOUT	5	/* Seconds to wait for a reply */
+  #define NG_ASYNC_MAX_REPLY	4096	/* Largest reply we accept */
+  #define NG_ASYNC_TYPES	32	/* Message types with own statistics */
+  #define NG_ASYNC_HIST		8	/* Latency buckets, 64us * 4^n */
+
+  /* Outstanding asynchronous netgraph request */
+  struct ngasync {
+    int			token;		/* Message token */
+    struct ngasyncstat	*stat;		/* Statistics for this message type */
+    struct timeval	when;		/* When request was sent */
+    NgAsyncHandler	handler;	/* Completion handler */
+    void		*arg;
+    TAILQ_ENTRY(ngasync) next;
+  };
+
+  /* Reply latency statistics per message type */
+  struct ngasyncstat {
+    uint32_t		cookie;
+    uint32_t		cmd;
+    u_int		replies;
+    u_int		errors;		/* Error replies and timeouts */
+    u_int		hist[NG_ASYNC_HIST];
+    uint64_t		total;		/* Sum of latencies, usec */
+    u_int		max;		/* Max latency, usec */
+  };
+
   /* Set menu options */
   enum {
     SET_PEER,
@@ -84,6 +110,10 @@
 #ifdef USE_NG_NETFLOW
   static int	NetflowSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
 #endif
+  static int	NgAsyncInit(void);
+  static void	NgAsyncEvent(int type, void *cookie);
+  static void	NgAsyncTimeout(void *arg);
+  static void	NgAsyncComplete(struct ngasync *q, struct ng_mesg *reply);
 
 /*
  * GLOBAL VARIABLES
@@ -140,6 +170,15 @@
   
   static int	gNgStatSock=0;
 
+  static int	gNgAsyncSock = -1;
+  static EventRef	gNgAsyncEvent;
+  static struct pppTimer	gNgAsyncTimer;
+  static TAILQ_HEAD(, ngasync) gNgAsyncQueue =
+	TAILQ_HEAD_INITIALIZER(gNgAsyncQueue);
+  static int	gNgAsyncPending;
+  static struct ngasyncstat	gNgAsyncStats[NG_ASYNC_TYPES];
+  static int	gNgAsyncNumStats;
+
 
 #ifdef USE_NG_NETFLOW
 int
@@ -480,6 +519,226 @@ NgFuncSendQuery(const char *path, int cookie, int cmd, const void *args,
     return (0);
 }
 
+/*
+ * NgFuncSendQueryAsync()
+ *
+ * Send a netgraph query without waiting for the reply. Replies come back
+ * on a dedicated socket node and are matched to requests by token, so
+ * any number of requests may be in flight. The handler is called from
+ * the event loop with the reply, or with NULL on error or timeout.
+ */
+
+int
+NgFuncSendQueryAsync(const char *path, int cookie, int cmd, const void *args,
+	size_t arglen, NgAsyncHandler handler, void *arg)
+{
+    struct ngasync	*q;
+    struct ngasyncstat	*st;
+    int			token, k;
+
+    if (gNgAsyncSock < 0 && NgAsyncInit() < 0)
+	return (-1);
+
+    /* Find statistics slot; the last one collects everything else */
+    for (k = 0; k < gNgAsyncNumStats; k++) {
+	st = &gNgAsyncStats[k];
+	if (st->cookie == (uint32_t)cookie && st->cmd == (uint32_t)cmd)
+	    break;
+    }
+    if (k == gNgAsyncNumStats) {
+	if (k < NG_ASYNC_TYPES)
+	    gNgAsyncNumStats++;
+	else
+	    k = NG_ASYNC_TYPES - 1;
+	st = &gNgAsyncStats[k];
+	if (st->replies == 0 && st->errors == 0) {
+	    st->cookie = cookie;
+	    st->cmd = cmd;
+	}
+    }
+
+    if ((token = NgSendMsg(gNgAsyncSock, path, cookie, cmd, args, arglen)) < 0) {
+	Perror("NgFuncSendQueryAsync: can't send message to %s", path);
+	st->errors++;
+	return (-1);
+    }
+
+    q = Malloc(MB_UTIL, sizeof(*q));
+    q->token = token;
+    q->stat = st;
+    gettimeofday(&q->when, NULL);
+    q->handler = handler;
+    q->arg = arg;
+    TAILQ_INSERT_TAIL(&gNgAsyncQueue, q, next);
+    gNgAsyncPending++;
+    if (!TimerStarted(&gNgAsyncTimer))
+	TimerStart(&gNgAsyncTimer);
+    return (0);
+}
+
+/*
+ * NgAsyncInit()
+ *
+ * Create the socket node used for asynchronous queries.
+ */
+
+static int
+NgAsyncInit(void)
+{
+    char	name[NG_NODESIZ];
+
+    snprintf(name, sizeof(name), "mpd%d-async", gPid);
+    if (NgMkSockNode(name, &gNgAsyncSock, NULL) < 0) {
+	Perror("NgAsyncInit: can't create %s node", NG_SOCKET_NODE_TYPE);
+	gNgAsyncSock = -1;
+	return (-1);
+    }
+    (void) fcntl(gNgAsyncSock, F_SETFD, 1);
+    (void) fcntl(gNgAsyncSock, F_SETFL, O_NONBLOCK);
+    EventRegister(&gNgAsyncEvent, EVENT_READ, gNgAsyncSock,
+	EVENT_RECURRING, NgAsyncEvent, NULL);
+    TimerInit(&gNgAsyncTimer, "NgAsync", SECONDS, NgAsyncTimeout, NULL);
+    return (0);
+}
+
+/*
+ * NgAsyncEvent()
+ *
+ * Read all available replies and dispatch them to their requests.
+ */
+
+static void
+NgAsyncEvent(int type, void *cookie)
+{
+    union {
+        u_char		buf[NG_ASYNC_MAX_REPLY];
+        struct ng_mesg	reply;
+    }			u;
+    struct ngasync	*q;
+
+    (void)type;
+    (void)cookie;
+    while (NgRecvMsg(gNgAsyncSock, &u.reply, sizeof(u), NULL) >= 0) {
+	TAILQ_FOREACH(q, &gNgAsyncQueue, next) {
+	    if (q->token == (int)u.reply.header.token)
+		break;
+	}
+	if (q == NULL) {
+	    Log(LG_ERR, ("NgAsyncEvent: unexpected reply, token %u",
+		u.reply.header.token));
+	    continue;
+	}
+	NgAsyncComplete(q, &u.reply);
+    }
+    if (errno != EAGAIN)
+	Perror("NgAsyncEvent: can't read reply");
+}
+
+/*
+ * NgAsyncTimeout()
+ *
+ * Fail requests that have waited too long for the reply. Requests are
+ * queued in send order, so only the head of the queue needs checking.
+ */
+
+static void
+NgAsyncTimeout(void *arg)
+{
+    struct ngasync	*q;
+    struct timeval	now;
+
+    (void)arg;
+    gettimeofday(&now, NULL);
+    while ((q = TAILQ_FIRST(&gNgAsyncQueue)) != NULL &&
+      now.tv_sec - q->when.tv_sec >= NG_ASYNC_TIMEOUT) {
+	Log(LG_ERR, ("NgAsyncTimeout: no reply for token %d, cookie %u cmd %u",
+	    q->token, q->stat->cookie, q->stat->cmd));
+	NgAsyncComplete(q, NULL);
+    }
+    if (!TAILQ_EMPTY(&gNgAsyncQueue))
+	TimerStart(&gNgAsyncTimer);
+}
+
+/*
+ * NgAsyncComplete()
+ *
+ * Account reply latency, dequeue the request and call its handler.
+ */
+
+static void
+NgAsyncComplete(struct ngasync *q, struct ng_mesg *reply)
+{
+    struct ngasyncstat	*const st = q->stat;
+    struct timeval	now;
+    u_int		usec;
+    int			k;
+
+    if (reply == NULL)
+	st->errors++;
+    else {
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - q->when.tv_sec) * 1000000 +
+	    (now.tv_usec - q->when.tv_usec);
+	for (k = 0; k < NG_ASYNC_HIST - 1 && usec >= (64U << (2 * k)); k++);
+	st->hist[k]++;
+	st->replies++;
+	st->total += usec;
+	if (usec > st->max)
+	    st->max = usec;
+    }
+    TAILQ_REMOVE(&gNgAsyncQueue, q, next);
+    gNgAsyncPending--;
+    (*q->handler)(q->arg, reply);
+    Freee(q);
+}
+
+/*
+ * NgFuncAsyncPending()
+ *
+ * Number of asynchronous queries still waiting for a reply.
+ */
+
+int
+NgFuncAsyncPending(void)
+{
+    return (gNgAsyncPending);
+}
+
+/*
+ * NgFuncShowMsgs()
+ *
+ * Show asynchronous netgraph query statistics.
+ */
+
+int
+NgFuncShowMsgs(Context ctx, int ac, const char *const av[], const void *arg)
+{
+    struct ngasyncstat	*st;
+    int			k, j;
+
+    (void)ac;
+    (void)av;
+    (void)arg;
+
+    Printf("Asynchronous netgraph queries:\r\n");
+    Printf("\tPending        : %d\r\n", gNgAsyncPending);
+    Printf("Reply latency by message type (cookie/cmd):\r\n");
+    Printf("\t%-16s %8s %6s %8s %8s  %s\r\n", "Type", "Replies", "Errors",
+	"Avg, us", "Max, us", "<64us <256us <1ms <4ms <16ms <64ms <256ms more");
+    for (k = 0; k < gNgAsyncNumStats; k++) {
+	char	buf[32];
+
+	st = &gNgAsyncStats[k];
+	snprintf(buf, sizeof(buf), "%u/%u", st->cookie, st->cmd);
+	Printf("\t%-16s %8u %6u %8u %8u ", buf, st->replies, st->errors,
+	    st->replies ? (u_int)(st->total / st->replies) : 0, st->max);
+	for (j = 0; j < NG_ASYNC_HIST; j++)
+	    Printf(" %u", st->hist[j]);
+	Printf("\r\n");
+    }
+    return (0);
+}
+
 /*
  * NgFuncConnect()
  */
@@ -541,16 +800,14 @@ retry:
 int
 NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp)
 {
-    u_int16_t	temp;
+    u_int16_t	hdr[2];
 
-    /* Prepend ppp node bypass header */
-    temp = htons(linkNum);
-    bp = mbcopyback(bp, -4, &temp, 2);
-    temp = htons(proto);
-    bp = mbcopyback(bp, 2, &temp, 2);
+    /* The ppp node bypass header is sent from here, not prepended */
+    hdr[0] = htons(linkNum);
+    hdr[1] = htons(proto);
 
     /* Debugging */
-    LogDumpBp(LG_FRAME, bp,
+    LogDumpBpSampled(LG_FRAME, &b->frameDumps, bp,
 	"[%s] xmit bypass frame link=%d proto=0x%04x",
 	b->name, (int16_t)linkNum, proto);
 
@@ -564,7 +821,8 @@ NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp)
     }
 
     /* Write frame */
-    return NgFuncWriteFrame(gLinksDsock, b->hook, b->name, bp);
+    return NgFuncWriteFrameHdr(gLinksDsock, b->hook, b->name,
+	hdr, sizeof(hdr), bp);
 }
 
 /*
@@ -576,20 +834,18 @@ NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp)
 int
 NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp)
 {
-    u_int16_t	temp;
+    u_int16_t	hdr[2];
 
     if (l->joined_bund) {
 	return (NgFuncWritePppFrame(l->bund, l->bundleIndex, proto, bp));
     }
 
-    /* Prepend framing */
-    temp = htons(0xff03);
-    bp = mbcopyback(bp, -4, &temp, 2);
-    temp = htons(proto);
-    bp = mbcopyback(bp, 2, &temp, 2);
+    /* Framing is sent from here, not prepended */
+    hdr[0] = htons(0xff03);
+    hdr[1] = htons(proto);
 
     /* Debugging */
-    LogDumpBp(LG_FRAME, bp,
+    LogDumpBpSampled(LG_FRAME, &l->frameDumps, bp,
 	"[%s] xmit frame to link proto=0x%04x",
 	l->name, proto);
 
@@ -600,7 +856,8 @@ NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp)
     }
 
     /* Write frame */
-    return NgFuncWriteFrame(gLinksDsock, l->hook, l->name, bp);
+    return NgFuncWriteFrameHdr(gLinksDsock, l->hook, l->name,
+	hdr, sizeof(hdr), bp);
 }
 
 /*
@@ -611,16 +868,33 @@ NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp)
 
 int
 NgFuncWriteFrame(int dsock, const char *hookname, const char *label, Mbuf bp)
+{
+    return (NgFuncWriteFrameHdr(dsock, hookname, label, NULL, 0, bp));
+}
+
+/*
+ * NgFuncWriteFrameHdr()
+ *
+ * Write a frame made of a header and the mbuf contents with a single
+ * gather write, so the header never has to be copied in front of
+ * the data. Consumes the mbuf.
+ */
+
+int
+NgFuncWriteFrameHdr(int dsock, const char *hookname, const char *label,
+	const void *hdr, size_t hlen, Mbuf bp)
 {
     union {
         u_char          buf[sizeof(struct sockaddr_ng) + NG_HOOKSIZ];
 	struct sockaddr_ng sa_ng;
     }                   u;
     struct sockaddr_ng	*ng = &u.sa_ng;
-    int			rtn;
+    struct iovec	iov[2];
+    struct msghdr	msg;
+    int			rtn, niov = 0;
 
     /* Write frame */
-    if (bp == NULL)  
+    if (bp == NULL && hlen == 0)
 	return (-1);
 
     /* Set dest address */
@@ -629,13 +903,28 @@ NgFuncWriteFrame(int dsock, const char *hookname, const char *label, Mbuf bp)
     ng->sg_family = AF_NETGRAPH;
     ng->sg_len = 3 + strlen(ng->sg_data);
 
-    rtn = sendto(dsock, MBDATAU(bp), MBLEN(bp),
-	0, (struct sockaddr *)ng, ng->sg_len);
+    /* Gather header and data */
+    if (hlen > 0) {
+	iov[niov].iov_base = (void *)(uintptr_t)hdr;
+	iov[niov].iov_len = hlen;
+	niov++;
+    }
+    if (MBLEN(bp) > 0) {
+	iov[niov].iov_base = MBDATAU(bp);
+	iov[niov].iov_len = MBLEN(bp);
+	niov++;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = ng;
+    msg.msg_namelen = ng->sg_len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    rtn = sendmsg(dsock, &msg, 0);
 
     /* ENOBUFS can be expected on some links, e.g., ng_pptpgre(4) */
     if (rtn < 0 && errno != ENOBUFS) {
 	Perror("[%s] error writing len %d frame to %s",
-	    label, (int)MBLEN(bp), hookname);
+	    label, (int)(hlen + MBLEN(bp)), hookname);
     }
     mbfree(bp);
     return (rtn);
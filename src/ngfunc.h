@@ -41,6 +41,13 @@
   #define BPF_MODE_MSSFIX_IN	4	/* redirect incoming TCP SYN packets */
   #define BPF_MODE_MSSFIX_OUT	5	/* redirect outgoing TCP SYN packets */
 
+  /* Size of the ng_ppp link statistics reply */
+  #ifdef NG_PPP_STATS64
+  #define NG_PPP_STATS_LEN	sizeof(struct ng_ppp_link_stat64)
+  #else
+  #define NG_PPP_STATS_LEN	sizeof(struct ng_ppp_link_stat)
+  #endif
+
 /*
  * VARIABLES
  */
@@ -62,6 +69,9 @@
   extern uint32_t gNetflowActive;
   #endif
   
+  /* Completion handler for NgFuncSendQueryAsync(); reply is NULL on error */
+  typedef void	(*NgAsyncHandler)(void *arg, struct ng_mesg *reply);
+
 /*
  * FUNCTIONS
  */
@@ -71,6 +81,8 @@
   extern int	NgFuncWritePppFrame(Bund b, int linkNum, int proto, Mbuf bp);
   extern int	NgFuncWritePppFrameLink(Link l, int proto, Mbuf bp);
   extern int	NgFuncWriteFrame(int dsock, const char *hookname, const char *label, Mbuf bp);
+  extern int	NgFuncWriteFrameHdr(int dsock, const char *hookname, const char *label,
+			const void *hdr, size_t hlen, Mbuf bp);
   extern int	NgFuncClrStats(Bund b, u_int16_t linkNum);
 #ifndef NG_PPP_STATS64
   extern int	NgFuncGetStats(Bund b, u_int16_t linkNum,
@@ -82,6 +94,11 @@
   extern int	NgFuncSendQuery(const char *path, int cookie, int cmd,
 			const void *args, size_t arglen, struct ng_mesg *rbuf,
 			size_t replen, char *raddr);
+  extern int	NgFuncSendQueryAsync(const char *path, int cookie, int cmd,
+			const void *args, size_t arglen,
+			NgAsyncHandler handler, void *arg);
+  extern int	NgFuncAsyncPending(void);
+  extern int	NgFuncShowMsgs(Context ctx, int ac, const char *const av[], const void *arg);
 
   extern int	NgFuncConnect(int csock, char *label, const char *path, const char *hook,
 			const char *path2, const char *hook2);
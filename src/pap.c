@@ -80,22 +80,22 @@ PapSendRequest(Link l)
 
     /* Get password corresponding to my authname */
     Log(LG_AUTH, ("[%s] PAP: using authname \"%s\"", 
-	l->name, l->lcp.auth.conf.authname));
-    if (l->lcp.auth.conf.password[0] != 0) {
-	strlcpy(password, l->lcp.auth.conf.password, sizeof(password));
-    } else if (AuthGetData(l->lcp.auth.conf.authname, password, 
+	l->name, l->lcp.auth.conf->authname));
+    if (l->lcp.auth.conf->password[0] != 0) {
+	strlcpy(password, l->lcp.auth.conf->password, sizeof(password));
+    } else if (AuthGetData(l->lcp.auth.conf->authname, password, 
 	    sizeof(password), NULL, NULL) < 0) {
 	Log(LG_AUTH, ("[%s] PAP: Warning: no secret for \"%s\" found", 
-	    l->name, l->lcp.auth.conf.authname));
+	    l->name, l->lcp.auth.conf->authname));
     }
 
     /* Build response packet */
-    name_len = strlen(l->lcp.auth.conf.authname);
+    name_len = strlen(l->lcp.auth.conf->authname);
     pass_len = strlen(password);
 
     pkt = Malloc(MB_AUTH, 1 + name_len + 1 + pass_len);
     pkt[0] = name_len;
-    memcpy(pkt + 1, l->lcp.auth.conf.authname, name_len);
+    memcpy(pkt + 1, l->lcp.auth.conf->authname, name_len);
     pkt[1 + name_len] = pass_len;
     memcpy(pkt + 1 + name_len + 1, password, pass_len);
 
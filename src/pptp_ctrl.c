@@ -70,6 +70,23 @@
   /* Packet processing delay XXX */
   #define PPTP_PPD			1
 
+  /* Control connection buffer sizes */
+  #define PPTP_CTRL_RBUF_SIZE		(8 * PPTP_CTRL_MAX_FRAME)
+  #define PPTP_CTRL_SBUF_SIZE		(8 * PPTP_CTRL_MAX_FRAME)
+
+  /* Lookup hash sizes (must be powers of two) */
+  #define PPTP_CTRL_HASH_SIZE		4096
+  #define PPTP_CID_HASH_SIZE		64
+
+  #define PPTP_CTRL_HASH(a)	(u_addrtoid(a) & (PPTP_CTRL_HASH_SIZE - 1))
+  #define PPTP_CID_HASH(cid)	((cid) & (PPTP_CID_HASH_SIZE - 1))
+
+  /* Free slot list for a pointer array (gPptpCtrl, c->channels) */
+  struct pptpslots {
+    int			*free;		/* stack of free array indices */
+    int			numFree;	/* depth of the stack */
+  };
+
   /* Channel state */
   struct pptpchan {
     uint16_t		id;		/* channel index */
@@ -91,6 +108,7 @@
     char		calledNum[PPTP_PHONE_LEN + 1];	/* called number */
     char		subAddress[PPTP_SUBADDR_LEN + 1];/* sub-address */
     struct pppTimer	killTimer;	/* kill timer */
+    struct pptpchan	*peerNext;	/* next in ctrl peer cid hash */
   };
   typedef struct pptpchan	*PptpChan;
 
@@ -104,8 +122,12 @@
     union {
 	u_char			buf[PPTP_CTRL_MAX_FRAME];
 	struct pptpMsgHead	hdr;
-    }			frame;
-    u_int16_t		flen;		/* length of partial frame */
+    }			frame;		/* message being processed */
+    u_char		rbuf[PPTP_CTRL_RBUF_SIZE];	/* received data */
+    u_int16_t		rlen;		/* length of received data */
+    u_char		sbuf[PPTP_CTRL_SBUF_SIZE];	/* unsent data */
+    u_int16_t		slen;		/* length of unsent data */
+    u_char		corked;		/* batch writes until flushed */
     int			csock;		/* peer control messages */
     struct u_addr	self_addr;	/* local IP address */
     struct u_addr	peer_addr;	/* peer we're talking to */
@@ -113,12 +135,16 @@
     in_port_t		peer_port;
     EventRef		connEvent;	/* connection event */
     EventRef		ctrlEvent;	/* control connection input */
+    EventRef		writeEvent;	/* control connection output */
     struct pppTimer	idleTimer;	/* idle timer */
     struct pppTimer	killTimer;	/* kill timer */
     u_int32_t		echoId;		/* last echo id # sent */
     PptpPendRep		reps;		/* pending replies to msgs */
     PptpChan		*channels;	/* array of channels */
     int			numChannels;	/* length of channels array */
+    struct pptpslots	chanSlots;	/* free slots in channels array */
+    PptpChan		peerCids[PPTP_CID_HASH_SIZE]; /* by peer cid */
+    struct pptpctrl	*next;		/* next in gPptpCtrlHash chain */
     u_int		active_sessions;	/* # non-dying sessns */
     char 		self_name[MAXHOSTNAMELEN]; /* local hostname */
     char		peer_name[MAXHOSTNAMELEN]; /* remote hostname */
@@ -194,6 +220,7 @@
   static void	PptpCtrlListenRetry(int type, void *cookie);
   static void	PptpCtrlConnEvent(int type, void *cookie);
   static void	PptpCtrlReadCtrl(int type, void *cookie);
+  static void	PptpCtrlWriteCtrl(int type, void *cookie);
 
   /* Shutdown routines */
   static void	PptpCtrlCloseCtrl(PptpCtrl c);
@@ -209,6 +236,7 @@
   static void	PptpCtrlInitCtrl(PptpCtrl c, int orig);
   static void	PptpCtrlMsg(PptpCtrl c, int type, void *msg);
   static int	PptpCtrlWriteMsg(PptpCtrl c, int type, void *msg);
+  static int	PptpCtrlFlush(PptpCtrl c);
 
   static void	PptpCtrlSwap(int type, void *buf);
   static void	PptpCtrlDump(int level, int type, void *msg);
@@ -234,6 +262,13 @@
 			  const char *calledNum, const char *subAddress);
   static PptpChan	PptpCtrlFindChan(PptpCtrl c, int type,
 			  void *msg, int incoming);
+  static void		PptpCtrlSetPeerCid(PptpChan ch, u_int16_t cid);
+  static void		PptpCtrlUnhashChan(PptpChan ch);
+  static void		PptpCtrlHashCtrl(PptpCtrl c);
+  static void		PptpCtrlUnhashCtrl(PptpCtrl c);
+  static int		PptpCtrlSlotAlloc(void *array, int *alenp,
+			  struct pptpslots *s);
+  static void		PptpCtrlSlotFree(struct pptpslots *s, int k);
   static void		PptpCtrlCheckConn(PptpCtrl c);
 
 /*
@@ -242,12 +277,14 @@
 
   static u_char			gInitialized = 0;
   static u_int16_t		gLastCallId;
-  static u_char			gCallIds[65536];
+  static PptpChan		gCallIds[65536];	/* channels by my cid */
   static PptpGetInLink_t	gGetInLink;
   static PptpGetOutLink_t	gGetOutLink;
 
   static PptpCtrl		*gPptpCtrl;	/* array of control channels */
   static int			gNumPptpCtrl;	/* length of gPptpCtrl array */
+  static struct pptpslots	gPptpCtrlSlots;	/* free slots in gPptpCtrl */
+  static PptpCtrl		gPptpCtrlHash[PPTP_CTRL_HASH_SIZE]; /* by peer */
 
   static PptpLis		*gPptpLis;	/* array of listeners */
   static int			gNumPptpLis;	/* length of gPptpLis array */
@@ -903,7 +940,8 @@ PptpCtrlInitCtrl(PptpCtrl c, int orig)
   /* Initialize control state */
   c->orig = orig;
   c->echoId = 0;
-  c->flen = 0;
+  c->rlen = 0;
+  c->slen = 0;
 
   /* Get local IP address */
   addrLen = sizeof(self);
@@ -921,7 +959,9 @@ abort:
     Log(LG_PHYS2, ("pptp%d: %s: %s", c->id, "getpeername", strerror(errno)));
     goto abort;
   }
+  PptpCtrlUnhashCtrl(c);
   sockaddrtou_addr(&peer, &c->peer_addr, &c->peer_port);
+  PptpCtrlHashCtrl(c);
 
   /* Log which control block */
   Log(LG_PHYS2, ("pptp%d: attached to connection with %s %u",
@@ -963,6 +1003,9 @@ abort:
 
 /*
  * PptpCtrlReadCtrl()
+ *
+ * Read as much control data as is available and process every complete
+ * message in it. Replies generated meanwhile are written out together.
  */
 
 static void
@@ -970,13 +1013,15 @@ PptpCtrlReadCtrl(int type, void *cookie)
 {
   PptpCtrl	const c = (PptpCtrl) cookie;
   PptpMsgHead	const hdr = &c->frame.hdr;
-  int		nread;
+  void		*const msg = c->frame.buf + sizeof(*hdr);
+  u_char	*p;
+  int		nread, avail, len;
 
   (void)type;
 
-  /* Figure how much to read and read it */
-  nread = (c->flen < sizeof(*hdr) ? sizeof(*hdr) : hdr->length) - c->flen;
-  if ((nread = read(c->csock, c->frame.buf + c->flen, nread)) <= 0) {
+  /* Read whatever fits into the receive buffer */
+  nread = sizeof(c->rbuf) - c->rlen;
+  if ((nread = read(c->csock, c->rbuf + c->rlen, nread)) <= 0) {
     if (nread < 0) {
       if (errno == EAGAIN)
 	return;
@@ -985,17 +1030,18 @@ PptpCtrlReadCtrl(int type, void *cookie)
       Log(LG_PHYS2, ("pptp%d: ctrl connection closed by peer", c->id));
     goto abort;
   }
-  LogDumpBuf(LG_FRAME, c->frame.buf + c->flen, nread,
+  LogDumpBuf(LG_FRAME, c->rbuf + c->rlen, nread,
     "pptp%d: read %d bytes ctrl data", c->id, nread);
-  c->flen += nread;
+  c->rlen += nread;
 
-  /* Do whatever with what we got */
-  if (c->flen < sizeof(*hdr))			/* incomplete header */
-    return;
-  if (c->flen == sizeof(*hdr)) {		/* complete header */
-    PptpCtrlSwap(0, hdr);		/* byte swap header */
-    Log(LG_FRAME, ("pptp%d: got hdr", c->id));
-    PptpCtrlDump(LG_FRAME, 0, hdr);
+  /* Handle all complete messages */
+  c->corked = TRUE;
+  for (p = c->rbuf; c->state != PPTP_CTRL_ST_DYING; p += len) {
+    avail = c->rbuf + c->rlen - p;
+    if (avail < (int)sizeof(*hdr))		/* incomplete header */
+      break;
+    memcpy(hdr, p, sizeof(*hdr));
+    PptpCtrlSwap(0, hdr);			/* byte swap header */
     if (hdr->msgType != PPTP_CTRL_MSG_TYPE) {
       Log(LG_PHYS2, ("pptp%d: invalid msg type %d", c->id, hdr->msgType));
       goto abort;
@@ -1008,31 +1054,44 @@ PptpCtrlReadCtrl(int type, void *cookie)
       Log(LG_PHYS2, ("pptp%d: invalid ctrl type %d", c->id, hdr->type));
       goto abort;
     }
+    if (hdr->length != sizeof(*hdr) + gPptpMsgInfo[hdr->type].length) {
+      Log(LG_PHYS2, ("pptp%d: invalid length %d for type %d",
+	c->id, hdr->length, hdr->type));
+      goto abort;
+    }
+    len = hdr->length;
+    if (avail < len)				/* incomplete message */
+      break;
+    Log(LG_FRAME, ("pptp%d: got hdr", c->id));
+    PptpCtrlDump(LG_FRAME, 0, hdr);
     if (hdr->resv0 != 0) {
       Log(LG_PHYS2, ("pptp%d: non-zero reserved field in header", c->id));
 #if 0
       goto abort;
 #endif
     }
-    if (hdr->length != sizeof(*hdr) + gPptpMsgInfo[hdr->type].length) {
-      Log(LG_PHYS2, ("pptp%d: invalid length %d for type %d",
-	c->id, hdr->length, hdr->type));
-abort:
-      PptpCtrlKillCtrl(c);
-      return;
-    }
-    return;
-  }
-  if (c->flen == hdr->length) {			/* complete message */
-    void	*const msg = ((u_char *) hdr) + sizeof(*hdr);
-
+    memcpy(msg, p + sizeof(*hdr), len - sizeof(*hdr));
     PptpCtrlSwap(hdr->type, msg);		/* byte swap message */
     Log(LG_PHYS3, ("pptp%d: recv %s", c->id, gPptpMsgInfo[hdr->type].name));
     PptpCtrlDump(LG_PHYS3, hdr->type, msg);
-    c->flen = 0;
     PptpCtrlResetIdleTimer(c);
     PptpCtrlMsg(c, hdr->type, msg);
   }
+  c->corked = FALSE;
+  if (c->state == PPTP_CTRL_ST_DYING)
+    return;
+
+  /* Keep partial message for the next time */
+  c->rlen -= p - c->rbuf;
+  memmove(c->rbuf, p, c->rlen);
+
+  /* Send out any replies */
+  PptpCtrlFlush(c);
+  return;
+
+abort:
+  c->corked = FALSE;
+  PptpCtrlKillCtrl(c);
 }
 
 /*
@@ -1111,7 +1170,8 @@ PptpCtrlMsg(PptpCtrl c, int type, void *msg)
  * PptpCtrlWriteMsg()
  *
  * Write out a control message. If we should expect a reply,
- * register a matching pending reply for it.
+ * register a matching pending reply for it. While processing
+ * received messages, the write is delayed and batched with others.
  *
  * NOTE: calling this function can result in the connection being shutdown!
  */
@@ -1127,7 +1187,6 @@ PptpCtrlWriteMsg(PptpCtrl c, int type, void *msg)
   PptpMsgHead		const hdr = &frame.hdr;
   u_char		*const payload = (u_char *) (hdr + 1);
   const int		totlen = sizeof(*hdr) + gPptpMsgInfo[type].length;
-  int			nwrote;
 
   /* Build message */
   assert(PPTP_VALID_CTRL_TYPE(type));
@@ -1145,16 +1204,24 @@ PptpCtrlWriteMsg(PptpCtrl c, int type, void *msg)
   PptpCtrlSwap(0, hdr);
   PptpCtrlSwap(type, payload);
 
-  /* Send it; if TCP buffer is full, we abort the connection */
-  if ((nwrote = write(c->csock, frame.buf, totlen)) != totlen) {
-    if (nwrote < 0)
-      Log(LG_PHYS2, ("pptp%d: %s: %s", c->id, "write", strerror(errno)));
-    else
-      Log(LG_PHYS2, ("pptp%d: only wrote %d/%d", c->id, nwrote, totlen));
+  /* Queue it; if TCP buffer is full, we abort the connection */
+  if (c->csock < 0) {
+    Log(LG_PHYS2, ("pptp%d: %s: %s", c->id, "write", "connection closed"));
+    return -1;
+  }
+  if (c->slen + totlen > sizeof(c->sbuf) && PptpCtrlFlush(c) < 0)
+    return -1;
+  if (c->slen + totlen > sizeof(c->sbuf)) {
+    Log(LG_PHYS2, ("pptp%d: send buffer full, %d bytes unsent",
+      c->id, c->slen));
     PptpCtrlKillCtrl(c);
     return -1;
   }
+  memcpy(c->sbuf + c->slen, frame.buf, totlen);
+  c->slen += totlen;
   LogDumpBuf(LG_FRAME, frame.buf, totlen, "pptp%d: wrote %d bytes ctrl data", c->id, totlen);
+  if (!c->corked && PptpCtrlFlush(c) < 0)
+    return -1;
 
   /* If we expect a reply to this message, start expecting it now */
   if (PPTP_VALID_CTRL_TYPE(mi->reqrep.reply)) {
@@ -1174,6 +1241,51 @@ PptpCtrlWriteMsg(PptpCtrl c, int type, void *msg)
   return 0;
 }
 
+/*
+ * PptpCtrlFlush()
+ *
+ * Write as much of the queued control data as the socket accepts
+ * in a single call, and wait for writability to send the rest.
+ * Returns -1 and kills the connection on error.
+ */
+
+static int
+PptpCtrlFlush(PptpCtrl c)
+{
+  int	nwrote;
+
+  if (c->slen == 0 || EventIsRegistered(&c->writeEvent))
+    return 0;
+  if ((nwrote = write(c->csock, c->sbuf, c->slen)) < 0) {
+    if (errno != EAGAIN) {
+      Log(LG_PHYS2, ("pptp%d: %s: %s", c->id, "write", strerror(errno)));
+      PptpCtrlKillCtrl(c);
+      return -1;
+    }
+    nwrote = 0;
+  }
+  c->slen -= nwrote;
+  if (c->slen > 0) {
+    memmove(c->sbuf, c->sbuf + nwrote, c->slen);
+    EventRegister(&c->writeEvent, EVENT_WRITE, c->csock,
+      0, PptpCtrlWriteCtrl, c);
+  }
+  return 0;
+}
+
+/*
+ * PptpCtrlWriteCtrl()
+ *
+ * Control socket became writable again; send what is left queued.
+ */
+
+static void
+PptpCtrlWriteCtrl(int type, void *cookie)
+{
+  (void)type;
+  PptpCtrlFlush((PptpCtrl) cookie);
+}
+
 /*************************************************************************
 		CONTROL AND CHANNEL ALLOCATION FUNCTIONS
 *************************************************************************/
@@ -1202,24 +1314,19 @@ PptpCtrlGetCtrl(int orig, struct u_addr *self_addr,
     /* For incoming any control is new! */
     if (orig) {
 	/* See if we're already have a control block matching this address and port */
-	  for (k = 0; k < gNumPptpCtrl; k++) {
-		PptpCtrl	const d = gPptpCtrl[k];
-	
-		if (d != NULL
-		    && (d->active_sessions < gPPTPtunlimit)
-		    && (u_addrcompare(&d->peer_addr, peer_addr) == 0)
-		    && (d->peer_port == peer_port || d->orig != orig)
-		    && (u_addrempty(self_addr) || 
-		      (u_addrcompare(&d->self_addr, self_addr) == 0))) {
-			return(d);
-		}
-	  }
+	for (c = gPptpCtrlHash[PPTP_CTRL_HASH(peer_addr)]; c; c = c->next) {
+	    if ((c->active_sessions < gPPTPtunlimit)
+		&& (u_addrcompare(&c->peer_addr, peer_addr) == 0)
+		&& (c->peer_port == peer_port || c->orig != orig)
+		&& (u_addrempty(self_addr) || 
+		  (u_addrcompare(&c->self_addr, self_addr) == 0))) {
+		    return(c);
+	    }
+	}
     }
 
     /* Find/create a free one */
-    for (k = 0; k < gNumPptpCtrl && gPptpCtrl[k] != NULL; k++);
-    if (k == gNumPptpCtrl)
-	LengthenArray(&gPptpCtrl, sizeof(*gPptpCtrl), &gNumPptpCtrl, MB_PPTP);
+    k = PptpCtrlSlotAlloc(&gPptpCtrl, &gNumPptpCtrl, &gPptpCtrlSlots);
     c = Malloc(MB_PPTP, sizeof(*c));
     gPptpCtrl[k] = c;
 
@@ -1230,6 +1337,7 @@ PptpCtrlGetCtrl(int orig, struct u_addr *self_addr,
   c->self_addr = *self_addr;
   c->peer_addr = *peer_addr;
   c->peer_port = peer_port;
+  PptpCtrlHashCtrl(c);
   PptpCtrlNewCtrlState(c, PPTP_CTRL_ST_IDLE);
 
   /* If not doing the connecting, return here */
@@ -1239,6 +1347,8 @@ PptpCtrlGetCtrl(int orig, struct u_addr *self_addr,
   /* Connect to peer */
   if ((c->csock = GetInetSocket(SOCK_STREAM, self_addr, 0, FALSE, buf, bsiz)) < 0) {
     gPptpCtrl[k] = NULL;
+    PptpCtrlSlotFree(&gPptpCtrlSlots, k);
+    PptpCtrlUnhashCtrl(c);
     PptpCtrlFreeCtrl(c);
     return(NULL);
   }
@@ -1250,6 +1360,8 @@ PptpCtrlGetCtrl(int orig, struct u_addr *self_addr,
     snprintf(buf, bsiz, "pptp: connect to %s %u failed: %s",
       u_addrtoa(&c->peer_addr,buf1,sizeof(buf1)), c->peer_port, strerror(errno));
     gPptpCtrl[k] = NULL;
+    PptpCtrlSlotFree(&gPptpCtrlSlots, k);
+    PptpCtrlUnhashCtrl(c);
     PptpCtrlFreeCtrl(c);
     return(NULL);
   }
@@ -1279,18 +1391,18 @@ PptpCtrlGetChan(PptpCtrl c, int chanState, int orig, int incoming,
     TimerStop(&c->killTimer);
 
     /* Get a free data channel */
-    for (k = 0; k < c->numChannels && c->channels[k] != NULL; k++);
-    if (k == c->numChannels)
-	LengthenArray(&c->channels, sizeof(*c->channels), &c->numChannels, MB_PPTP);
+    k = PptpCtrlSlotAlloc(&c->channels, &c->numChannels, &c->chanSlots);
     ch = Malloc(MB_PPTP, sizeof(*ch));
     c->channels[k] = ch;
     c->active_sessions++;
     ch->id = k;
     while (gCallIds[gLastCallId])
 	gLastCallId++;
-    gCallIds[gLastCallId] = 1;
+    gCallIds[gLastCallId] = ch;
     ch->cid = gLastCallId;
     ch->ctrl = c;
+    ch->peerNext = c->peerCids[PPTP_CID_HASH(ch->peerCid)];
+    c->peerCids[PPTP_CID_HASH(ch->peerCid)] = ch;
     ch->orig = orig;
     ch->incoming = incoming;
     ch->minBps = minBps;
@@ -1443,7 +1555,15 @@ PptpCtrlKillCtrl(PptpCtrl c)
     if (ch != NULL)
       PptpCtrlKillChan(ch, "control channel shutdown");
   }
+  EventUnRegister(&c->writeEvent);
+  if (c->csock >= 0 && c->slen > 0) {
+    /* Last chance for what is queued; don't care if it fails */
+    (void)write(c->csock, c->sbuf, c->slen);
+  }
+  c->slen = 0;
   gPptpCtrl[c->id] = NULL;
+  PptpCtrlSlotFree(&gPptpCtrlSlots, c->id);
+  PptpCtrlUnhashCtrl(c);
   if (c->csock >= 0) {
     close(c->csock);
     c->csock = -1;
@@ -1468,6 +1588,7 @@ static void
 PptpCtrlFreeCtrl(PptpCtrl c)
 {
     Freee(c->channels);
+    Freee(c->chanSlots.free);
     memset(c, 0, sizeof(*c));
     Freee(c);
 }
@@ -1595,8 +1716,10 @@ PptpCtrlKillChan(PptpChan ch, const char *errmsg)
   }
 
     /* Free channel */
-    gCallIds[ch->cid] = 0;
+    gCallIds[ch->cid] = NULL;
+    PptpCtrlUnhashChan(ch);
     c->channels[ch->id] = NULL;
+    PptpCtrlSlotFree(&c->chanSlots, ch->id);
     c->active_sessions--;
     /* Delay Free call to avoid "Modify after free" case */
     TimerInit(&ch->killTimer, "PptpKillCh", 0, (void (*)(void *))PptpCtrlFreeChan, ch);
@@ -1774,8 +1897,9 @@ PptpCtrlFindChan(PptpCtrl c, int type, void *msg, int incoming)
   PptpMsgInfo	const mi = &gPptpMsgInfo[type];
   const char	*fname = incoming ? mi->match.inField : mi->match.outField;
   const int	how = incoming ? mi->match.findIn : mi->match.findOut;
+  PptpChan	ch;
   u_int16_t	cid;
-  int		k;
+  int		pns;
   u_int		off = 0;
 
   /* Get the identifying CID field */
@@ -1784,31 +1908,33 @@ PptpCtrlFindChan(PptpCtrl c, int type, void *msg, int incoming)
   (void) PptpCtrlFindField(type, fname, &off);		/* we know len == 2 */
   cid = *((u_int16_t *)(void *)((u_char *) msg + off));
 
-  /* Match the CID against our list of active channels */
-  for (k = 0; k < c->numChannels; k++) {
-    PptpChan	const ch = c->channels[k];
-    u_int16_t	tryCid = 0;
-
-    if (ch == NULL)
-      continue;
-    switch (how) {
-      case PPTP_FIND_CHAN_MY_CID:
-	tryCid = ch->cid;
-	break;
-      case PPTP_FIND_CHAN_PEER_CID:
-	tryCid = ch->peerCid;
-	break;
-      case PPTP_FIND_CHAN_PNS_CID:
-	tryCid = PPTP_CHAN_IS_PNS(ch) ? ch->cid : ch->peerCid;
-	break;
-      case PPTP_FIND_CHAN_PAC_CID:
-	tryCid = !PPTP_CHAN_IS_PNS(ch) ? ch->cid : ch->peerCid;
-	break;
-      default:
-	assert(0);
-    }
-    if (cid == tryCid)
-      return(ch);
+  /* Match the CID against our active channels. My CIDs are globally
+     unique and indexed directly, peer CIDs are hashed per control. */
+  switch (how) {
+    case PPTP_FIND_CHAN_MY_CID:
+      if ((ch = gCallIds[cid]) != NULL && ch->ctrl == c)
+	return(ch);
+      break;
+    case PPTP_FIND_CHAN_PEER_CID:
+      for (ch = c->peerCids[PPTP_CID_HASH(cid)]; ch; ch = ch->peerNext) {
+	if (ch->peerCid == cid)
+	  return(ch);
+      }
+      break;
+    case PPTP_FIND_CHAN_PNS_CID:
+    case PPTP_FIND_CHAN_PAC_CID:
+      /* PNS CID is my cid if I am the PNS, peer's otherwise; vice versa */
+      pns = (how == PPTP_FIND_CHAN_PNS_CID);
+      if ((ch = gCallIds[cid]) != NULL && ch->ctrl == c
+	  && PPTP_CHAN_IS_PNS(ch) == pns)
+	return(ch);
+      for (ch = c->peerCids[PPTP_CID_HASH(cid)]; ch; ch = ch->peerNext) {
+	if (ch->peerCid == cid && PPTP_CHAN_IS_PNS(ch) != pns)
+	  return(ch);
+      }
+      break;
+    default:
+      assert(0);
   }
 
   /* Not found */
@@ -1816,6 +1942,119 @@ PptpCtrlFindChan(PptpCtrl c, int type, void *msg, int incoming)
   return(NULL);
 }
 
+/*
+ * PptpCtrlSetPeerCid()
+ *
+ * Set the peer's call ID for a channel and rehash it accordingly.
+ */
+
+static void
+PptpCtrlSetPeerCid(PptpChan ch, u_int16_t cid)
+{
+  PptpCtrl	const c = ch->ctrl;
+
+  PptpCtrlUnhashChan(ch);
+  ch->peerCid = cid;
+  ch->peerNext = c->peerCids[PPTP_CID_HASH(cid)];
+  c->peerCids[PPTP_CID_HASH(cid)] = ch;
+}
+
+/*
+ * PptpCtrlUnhashChan()
+ *
+ * Remove channel from its control's peer call ID hash.
+ */
+
+static void
+PptpCtrlUnhashChan(PptpChan ch)
+{
+  PptpChan	*pp;
+
+  for (pp = &ch->ctrl->peerCids[PPTP_CID_HASH(ch->peerCid)];
+      *pp != ch; pp = &(*pp)->peerNext)
+    assert(*pp);
+  *pp = ch->peerNext;
+  ch->peerNext = NULL;
+}
+
+/*
+ * PptpCtrlHashCtrl()
+ *
+ * Add control block to the peer address hash.
+ */
+
+static void
+PptpCtrlHashCtrl(PptpCtrl c)
+{
+  PptpCtrl	*const head = &gPptpCtrlHash[PPTP_CTRL_HASH(&c->peer_addr)];
+
+  c->next = *head;
+  *head = c;
+}
+
+/*
+ * PptpCtrlUnhashCtrl()
+ *
+ * Remove control block from the peer address hash.
+ */
+
+static void
+PptpCtrlUnhashCtrl(PptpCtrl c)
+{
+  PptpCtrl	*pp;
+
+  for (pp = &gPptpCtrlHash[PPTP_CTRL_HASH(&c->peer_addr)];
+      *pp != c; pp = &(*pp)->next)
+    assert(*pp);
+  *pp = c->next;
+  c->next = NULL;
+}
+
+/*
+ * PptpCtrlSlotAlloc()
+ *
+ * Get a free index in a pointer array, growing the array (by doubling)
+ * when no free slots are left. Freed indices are reused first.
+ */
+
+static int
+PptpCtrlSlotAlloc(void *array, int *alenp, struct pptpslots *s)
+{
+  void	**const arrayp = (void **)array;
+  void	**newa;
+  int	*newf;
+  int	k, nlen;
+
+  if (s->numFree == 0) {
+    nlen = *alenp ? *alenp * 2 : 8;
+    newa = Malloc(MB_PPTP, nlen * sizeof(*newa));
+    newf = Malloc(MB_PPTP, nlen * sizeof(*newf));
+    if (*arrayp != NULL) {
+      memcpy(newa, *arrayp, *alenp * sizeof(*newa));
+      Freee(*arrayp);
+    }
+    Freee(s->free);
+    for (k = nlen - 1; k >= *alenp; k--)
+      newf[s->numFree++] = k;
+    *arrayp = newa;
+    s->free = newf;
+    *alenp = nlen;
+  }
+  return(s->free[--s->numFree]);
+}
+
+/*
+ * PptpCtrlSlotFree()
+ *
+ * Return an array index to the free list.
+ */
+
+static void
+PptpCtrlSlotFree(struct pptpslots *s, int k)
+{
+  s->free[s->numFree++] = k;
+}
+
 /*************************************************************************
 			  MISC FUNCTIONS
 *************************************************************************/
@@ -2185,7 +2424,7 @@ PptpOutCallRequest(PptpCtrl c, struct pptpOutCallRequest *req)
 
   /* Link layer says it's OK; wait for link layer to report back later */
   ch->serno = req->serno;
-  ch->peerCid = req->cid;
+  PptpCtrlSetPeerCid(ch, req->cid);
   ch->peerPpd = req->ppd;
   ch->recvWin = req->recvWin;
   ch->linfo = linfo;
@@ -2229,7 +2468,7 @@ PptpOutCallReply(PptpChan ch, struct pptpOutCallReply *reply)
   /* Call succeeded */
   ch->peerPpd = reply->ppd;
   ch->recvWin = reply->recvWin;
-  ch->peerCid = reply->cid;
+  PptpCtrlSetPeerCid(ch, reply->cid);
   Log(LG_PHYS2, ("pptp%d-%d: outgoing call connected at %d bps",
     c->id, ch->id, reply->speed));
   PptpCtrlNewChanState(ch, PPTP_CHAN_ST_ESTABLISHED);
@@ -2304,7 +2543,7 @@ PptpInCallRequest(PptpCtrl c, struct pptpInCallRequest *req)
     c->id, ch->id, calledNum, callingNum));
   reply.result = PPTP_ICR_RESL_OK;
   ch->serno = req->serno;
-  ch->peerCid = req->cid;
+  PptpCtrlSetPeerCid(ch, req->cid);
   ch->bearType = req->bearType;
   strncpy(ch->callingNum, req->dialing, sizeof(ch->callingNum));
   strncpy(ch->calledNum, req->dialed, sizeof(ch->calledNum));
@@ -2343,7 +2582,7 @@ PptpInCallReply(PptpChan ch, struct pptpInCallReply *reply)
 
   /* Call succeeded */
   Log(LG_PHYS2, ("pptp%d-%d: incoming call accepted by peer", c->id, ch->id));
-  ch->peerCid = reply->cid;
+  PptpCtrlSetPeerCid(ch, reply->cid);
   ch->peerPpd = reply->ppd;
   ch->recvWin = reply->recvWin;
   PptpCtrlNewChanState(ch, PPTP_CHAN_ST_ESTABLISHED);
@@ -28,8 +28,10 @@
 #include "ng.h"
 #endif
 #include "util.h"
+#include "acctspool.h"
 
 #include <sys/types.h>
+#include <stdatomic.h>
 
 #include <radlib.h>
 #include <radlib_vs.h>
@@ -39,8 +41,19 @@
 
   static int	RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
   static int	RadiusAddServer(AuthData auth, short request_type);
+  static RadServe_Conf	RadiusSelectServer(AuthData auth, short request_type);
+  static int	RadiusAccountBatchSend(AuthData auth, const struct timeval *now,
+		    int *fd, struct timeval *tv);
+  static struct radhealth	*RadiusHealthGet(const char *hostname,
+			    in_port_t port, int create);
+  static void	RadiusServerDone(AuthData auth, int result);
+  static void	RadiusHealthShow(Context ctx, const char *label,
+			    const char *hostname, in_port_t port);
   static int	RadiusOpen(AuthData auth, short request_type);
   static int	RadiusStart(AuthData auth, short request_type);  
+  static int	RadiusEncodeAttrs(RadConf conf, u_char *buf);
+  static void	RadiusConfAttrs(RadConf conf);
+  static void	RadiusBuildTime(short request_type, const struct timespec *start);
   static int	RadiusPutAuth(AuthData auth);
   static int	RadiusPutAcct(AuthData auth);
   static int	RadiusGetParams(AuthData auth, int eap_proxy);
@@ -61,6 +74,8 @@
     SET_TIMEOUT,
     SET_RETRIES,
     SET_CONFIG,
+    SET_STRATEGY,
+    SET_HOLDDOWN,
     SET_ENABLE,
     SET_DISABLE
   };
@@ -93,6 +108,10 @@
 	RadiusSetCommand, NULL, 2, (void *) SET_RETRIES },
     { "config {path to radius.conf}",	"set path to config file for libradius",
 	RadiusSetCommand, NULL, 2, (void *) SET_CONFIG },
+    { "strategy {strategy}",		"Server selection strategy",
+	RadiusSetCommand, NULL, 2, (void *) SET_STRATEGY },
+    { "hold-down {seconds} [{failures}]",	"Dead server hold-down",
+	RadiusSetCommand, NULL, 2, (void *) SET_HOLDDOWN },
     { "enable [opt ...]",		"Enable option",
 	RadiusSetCommand, NULL, 2, (void *) SET_ENABLE },
     { "disable [opt ...]",		"Disable option",
@@ -111,6 +130,81 @@
 
   #define RAD_NACK		0
   #define RAD_ACK		1
+  #define RAD_RETRY		2	/* Try the next server */
+
+  static const char	*gRadStrategies[] = {
+    "failover",
+    "round-robin",
+    "least-outstanding",
+    "weighted",
+  };
+  #define RAD_STRATEGIES_NUM	(sizeof(gRadStrategies) / sizeof(*gRadStrategies))
+
+  /* Server health, entries live as long as the daemon */
+  static struct radhealth	*gRadHealth;
+  static pthread_mutex_t	gRadHealthMutex = PTHREAD_MUTEX_INITIALIZER;
+  static u_int			gRadRoundRobin;
+
+/*
+ * Reply attribute decoding
+ */
+
+  struct raddecode;
+  struct radattrdec;
+
+  typedef int	(*RadDecodeFunc)(struct raddecode *rd,
+			const struct radattrdec *d, const void *data, size_t len);
+
+  /* Decoder of one attribute */
+  struct radattrdec {
+    u_int32_t		vendor;		/* Zero for standard attributes */
+    int			type;
+    const char		*name;
+    RadDecodeFunc	func;
+    size_t		off;		/* Destination in struct authdata */
+    size_t		aux;		/* Handler specific argument */
+    u_char		eap;		/* Decoded when proxying EAP too */
+  };
+
+  /* Vendors having decoders */
+  #define RAD_DEC_STD		0
+  #define RAD_DEC_MICROSOFT	1
+  #define RAD_DEC_MPD		2
+  #define RAD_DEC_VENDORS	3
+
+  /* Kinds of ACL attributes */
+  #define RAD_ACL_PLAIN		0
+  #define RAD_ACL_TABLE		1
+  #define RAD_ACL_TABLE_STATIC	2
+  #define RAD_ACL_FILTER	3
+  #define RAD_ACL_LIMIT		4
+
+  #define RAD_ACL_HINTS		(4 + ACL_FILTERS + ACL_DIRS)
+
+  /* State of decoding one reply */
+  struct raddecode {
+    AuthData		auth;
+    char		str[RAD_MAX_ATTR_LEN + 1];	/* String value */
+#if defined(USE_NG_BPF) || defined(USE_IPFW)
+    struct {
+	struct acl	**head;
+	struct acl	**pos;		/* Link to the last inserted ACL */
+    }			hint[RAD_ACL_HINTS];
+    int			nhints;
+#endif
+  };
+
+  #define RAD_DEC_FIELD(rd, d, type)	\
+	((type *)(void *)((char *)(rd)->auth + (d)->off))
+  #define RAD_DEC_OFF(field)		offsetof(struct authdata, field)
+
+  /* Request build time, per request type */
+  #define RAD_BUILD_AUTH	0
+  #define RAD_BUILD_ACCT	1
+
+  static _Atomic uint64_t	gRadBuildNum[2];
+  static _Atomic uint64_t	gRadBuildNs[2];
+  static _Atomic uint64_t	gRadBuildMax[2];
 
 static int
 rad_put_string_tag(struct rad_handle *h, int type, u_char tag, const char *str);
@@ -143,24 +237,184 @@ rad_put_string_tag(struct rad_handle *h, int type, u_char tag, const char *str)
 void
 RadiusInit(Link l)
 {
-    RadConf       const conf = &l->lcp.auth.conf.radius;
+    RadConf       const conf = &l->lcp.auth.conf->radius;
 
     memset(conf, 0, sizeof(*conf));
     conf->radius_retries = 3;
     conf->radius_timeout = 5;
+    conf->holddown = RADIUS_HOLDDOWN;
+    conf->holddown_fails = RADIUS_HOLDDOWN_FAILS;
+    RadiusConfAttrs(conf);
+}
+
+/*
+ * RadiusConfDup()
+ *
+ * Replace strings and server list referenced by a just copied config
+ * with private copies.
+ */
+
+void
+RadiusConfDup(RadConf conf)
+{
+    RadServe_Conf	s, *sp;
+
+    if (conf->identifier)
+	conf->identifier = Mstrdup(MB_RADIUS, conf->identifier);
+    if (conf->file)
+	conf->file = Mstrdup(MB_RADIUS, conf->file);
+    if (conf->attrs)
+	conf->attrs = Mdup(MB_RADIUS, conf->attrs, conf->attrs_len);
+    for (sp = &conf->server; *sp != NULL; sp = &s->next) {
+	s = Mdup(MB_RADIUS, *sp, sizeof(*s));
+	s->hostname = Mstrdup(MB_RADIUS, s->hostname);
+	s->sharedsecret = Mstrdup(MB_RADIUS, s->sharedsecret);
+	*sp = s;
+    }
+}
+
+/*
+ * RadiusConfFree()
+ */
+
+void
+RadiusConfFree(RadConf conf)
+{
+    RadServe_Conf	s;
+
+    while ((s = conf->server) != NULL) {
+	conf->server = s->next;
+	Freee(s->hostname);
+	Freee(s->sharedsecret);
+	Freee(s);
+    }
+    Freee(conf->identifier);
+    Freee(conf->file);
+    Freee(conf->attrs);
+    conf->attrs = NULL;
+    conf->attrs_len = 0;
+}
+
+/*
+ * RadiusEncodeAttrs()
+ *
+ * Encode the attributes depending only on the configuration
+ * (NAS-Identifier if configured, NAS-IP-Address, NAS-IPv6-Address,
+ * Service-Type and Framed-Protocol) in wire format. They are the same
+ * for access and accounting requests. Returns length.
+ */
+
+static int
+RadiusEncodeAttrs(RadConf conf, u_char *buf)
+{
+    uint32_t	val;
+    int		len = 0, k;
+
+    /* The host name may change, RadiusStart() adds it */
+    if (conf->identifier) {
+	k = strlen(conf->identifier);
+	if (k > RAD_MAX_ATTR_LEN)
+	    k = RAD_MAX_ATTR_LEN;
+	buf[len++] = RAD_NAS_IDENTIFIER;
+	buf[len++] = k + 2;
+	memcpy(buf + len, conf->identifier, k);
+	len += k;
+    }
+
+    if (conf->radius_me.s_addr != 0) {
+	buf[len++] = RAD_NAS_IP_ADDRESS;
+	buf[len++] = sizeof(conf->radius_me) + 2;
+	memcpy(buf + len, &conf->radius_me, sizeof(conf->radius_me));
+	len += sizeof(conf->radius_me);
+    }
+
+    if (!u_addrempty(&conf->radius_mev6)) {
+	buf[len++] = RAD_NAS_IPV6_ADDRESS;
+	buf[len++] = sizeof(conf->radius_mev6.u.ip6) + 2;
+	memcpy(buf + len, &conf->radius_mev6.u.ip6,
+	    sizeof(conf->radius_mev6.u.ip6));
+	len += sizeof(conf->radius_mev6.u.ip6);
+    }
+
+    buf[len++] = RAD_SERVICE_TYPE;
+    buf[len++] = sizeof(val) + 2;
+    val = htonl(RAD_FRAMED);
+    memcpy(buf + len, &val, sizeof(val));
+    len += sizeof(val);
+
+    buf[len++] = RAD_FRAMED_PROTOCOL;
+    buf[len++] = sizeof(val) + 2;
+    val = htonl(RAD_PPP);
+    memcpy(buf + len, &val, sizeof(val));
+    len += sizeof(val);
+
+    return (len);
+}
+
+/*
+ * RadiusConfAttrs()
+ *
+ * Pre-encode static attributes of the configuration, so requests
+ * copy them instead of building each one. Called on every change
+ * of the fields they are made of.
+ */
+
+static void
+RadiusConfAttrs(RadConf conf)
+{
+    u_char	buf[RADIUS_ATTRS_MAX];
+    int		len;
+
+    Freee(conf->attrs);
+    len = RadiusEncodeAttrs(conf, buf);
+    conf->attrs = Mdup(MB_RADIUS, buf, len);
+    conf->attrs_len = len;
+}
+
+/*
+ * RadiusBuildTime()
+ *
+ * Account time spent building a request.
+ */
+
+static void
+RadiusBuildTime(short request_type, const struct timespec *start)
+{
+    struct timespec	now;
+    uint64_t		ns, max;
+    int			k;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+	now.tv_nsec - start->tv_nsec;
+    k = (request_type == RAD_ACCESS_REQUEST) ? RAD_BUILD_AUTH : RAD_BUILD_ACCT;
+    atomic_fetch_add_explicit(&gRadBuildNum[k], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gRadBuildNs[k], ns, memory_order_relaxed);
+    max = atomic_load_explicit(&gRadBuildMax[k], memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&gRadBuildMax[k],
+	    &max, ns, memory_order_relaxed, memory_order_relaxed))
+	;
 }
 
 int
 RadiusAuthenticate(AuthData auth) 
 {
+    struct timespec	start;
+    int			res;
+
     Log(LG_RADIUS, ("[%s] RADIUS: Authenticating user '%s'", 
 	auth->info.lnkname, auth->params.authname));
 
-    if ((RadiusStart(auth, RAD_ACCESS_REQUEST) == RAD_NACK) ||
-	(RadiusPutAuth(auth) == RAD_NACK) ||
-	(RadiusSendRequest(auth) == RAD_NACK)) {
+    auth->radius.tried = 0;
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((RadiusStart(auth, RAD_ACCESS_REQUEST) == RAD_NACK) ||
+	    (RadiusPutAuth(auth) == RAD_NACK))
+		return (-1);
+	RadiusBuildTime(RAD_ACCESS_REQUEST, &start);
+    } while ((res = RadiusSendRequest(auth)) == RAD_RETRY);
+    if (res == RAD_NACK)
 	    return (-1);
-    }
   
     return (0);
 }
@@ -175,16 +429,165 @@ RadiusAuthenticate(AuthData auth)
 int 
 RadiusAccount(AuthData auth) 
 {
+    struct timespec	start;
+    int			res;
+
     Log(auth->acct_type != AUTH_ACCT_UPDATE ? LG_RADIUS : LG_RADIUS2,
 	("[%s] RADIUS: Accounting user '%s' (Type: %d)",
 	auth->info.lnkname, auth->params.authname, auth->acct_type));
 
-    if ((RadiusStart(auth, RAD_ACCOUNTING_REQUEST) == RAD_NACK) ||
-	(RadiusPutAcct(auth) == RAD_NACK) ||
-	(RadiusSendRequest(auth) == RAD_NACK)) {
+    auth->radius.tried = 0;
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((RadiusStart(auth, RAD_ACCOUNTING_REQUEST) == RAD_NACK) ||
+	    (RadiusPutAcct(auth) == RAD_NACK))
+		return (-1);
+	RadiusBuildTime(RAD_ACCOUNTING_REQUEST, &start);
+    } while ((res = RadiusSendRequest(auth)) == RAD_RETRY);
+    if (res == RAD_NACK)
 	    return (-1);
+
+    return (0);
+}
+
+/*
+ * RadiusAccountBatch()
+ *
+ * Send several accounting requests at once, waiting for all of them
+ * in one poll() loop. A request not answered by its server is sent
+ * again to the next server not tried yet. Sets ok[] for requests
+ * answered by a server and returns their number.
+ * NOTE: thread-safety is needed here
+ */
+
+int
+RadiusAccountBatch(struct authdata **auths, int n, int *ok)
+{
+    struct pollfd	*fds;
+    struct timeval	*limit, now, tv;
+    AuthData		auth;
+    int			k, fd, res, pending = 0, acked = 0, ms;
+
+    fds = Malloc(MB_RADIUS, n * sizeof(*fds));
+    limit = Malloc(MB_RADIUS, n * sizeof(*limit));
+    gettimeofday(&now, NULL);
+
+    for (k = 0; k < n; k++) {
+	auth = auths[k];
+	ok[k] = 0;
+	fds[k].fd = -1;
+	fds[k].events = POLLIN;
+	Log(auth->acct_type != AUTH_ACCT_UPDATE ? LG_RADIUS : LG_RADIUS2,
+	    ("[%s] RADIUS: Accounting user '%s' (Type: %d, Delay: %ld)",
+	    auth->info.lnkname, auth->params.authname, auth->acct_type,
+	    (long)(now.tv_sec - auth->info.acct_time)));
+	auth->radius.tried = 0;
+	if (RadiusAccountBatchSend(auth, &now, &fd, &tv) != 0)
+	    continue;
+	fds[k].fd = fd;
+	timeradd(&now, &tv, &limit[k]);
+	pending++;
     }
 
+    while (pending > 0) {
+	/* Wait until the nearest retransmission */
+	ms = -1;
+	for (k = 0; k < n; k++) {
+	    if (fds[k].fd < 0)
+		continue;
+	    timersub(&limit[k], &now, &tv);
+	    if (tv.tv_sec < 0)
+		ms = 0;
+	    else if (ms < 0 || tv.tv_sec * 1000 + tv.tv_usec / 1000 < ms)
+		ms = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+	if (poll(fds, n, ms) == -1 && errno != EINTR) {
+	    Log(LG_ERR|LG_RADIUS, ("RADIUS: poll failed %s", strerror(errno)));
+	    break;
+	}
+	gettimeofday(&now, NULL);
+
+	for (k = 0; k < n; k++) {
+	    auth = auths[k];
+	    if (fds[k].fd < 0)
+		continue;
+	    if ((fds[k].revents & POLLIN) == 0 && timercmp(&now, &limit[k], <))
+		continue;
+	    res = rad_continue_send_request(auth->radius.handle,
+		(fds[k].revents & POLLIN) != 0, &fd, &tv);
+	    fds[k].revents = 0;
+	    if (res == 0) {
+		/* Retransmission to the same server */
+		fds[k].fd = fd;
+		timeradd(&now, &tv, &limit[k]);
+		continue;
+	    }
+	    fds[k].fd = -1;
+	    if (res == -1) {
+		Log(LG_RADIUS, ("[%s] RADIUS: rad_send_request for user '%s' failed: %s",
+		    auth->info.lnkname, auth->params.authname,
+		    rad_strerror(auth->radius.handle)));
+		RadiusServerDone(auth, 0);
+		/* Repeat the request to another server, if any */
+		RadiusClose(auth);
+		if (auth->radius.tried != 0 &&
+		    RadiusAccountBatchSend(auth, &now, &fd, &tv) == 0) {
+		    fds[k].fd = fd;
+		    timeradd(&now, &tv, &limit[k]);
+		    continue;
+		}
+	    }
+	    pending--;
+	    if (res == RAD_ACCOUNTING_RESPONSE) {
+		Log(auth->acct_type != AUTH_ACCT_UPDATE ? LG_RADIUS : LG_RADIUS2,
+		    ("[%s] RADIUS: Rec'd RAD_ACCOUNTING_RESPONSE for user '%s'",
+		    auth->info.lnkname, auth->params.authname));
+		RadiusServerDone(auth, 1);
+		ok[k] = 1;
+		acked++;
+	    } else if (res != -1) {
+		Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: rad_send_request: unexpected return value: %d",
+		    auth->info.lnkname, res));
+	    }
+	}
+    }
+
+    for (k = 0; k < n; k++)
+	RadiusClose(auths[k]);
+    Freee(limit);
+    Freee(fds);
+    return (acked);
+}
+
+/*
+ * RadiusAccountBatchSend()
+ *
+ * Build a batched accounting request for the next server not tried
+ * yet and send it for the first time.
+ */
+
+static int
+RadiusAccountBatchSend(AuthData auth, const struct timeval *now, int *fd,
+    struct timeval *tv)
+{
+    struct timespec	start;
+    int			res;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((RadiusStart(auth, RAD_ACCOUNTING_REQUEST) == RAD_NACK) ||
+	(RadiusPutAcct(auth) == RAD_NACK))
+	return (-1);
+    if (rad_put_int(auth->radius.handle, RAD_ACCT_DELAY_TIME,
+	now->tv_sec - auth->info.acct_time) == -1) {
+	RadiusLogError(auth, "Put RAD_ACCT_DELAY_TIME failed");
+	return (-1);
+    }
+    RadiusBuildTime(RAD_ACCOUNTING_REQUEST, &start);
+    if ((res = rad_init_send_request(auth->radius.handle, fd, tv)) != 0) {
+	Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: rad_init_send_request failed: %d %s",
+	    auth->info.lnkname, res, rad_strerror(auth->radius.handle)));
+	return (-1);
+    }
     return (0);
 }
 
@@ -202,11 +605,13 @@ void
 RadiusEapProxy(void *arg)
 {
     AuthData	auth = (AuthData)arg;
-    int		pos = 0, mlen = RAD_MAX_ATTR_LEN;
+    int		pos, mlen, res;
 
     Log(LG_RADIUS, ("[%s] RADIUS: EAP proxying user '%s'",
 	auth->info.lnkname, auth->params.authname));
 
+    auth->radius.tried = 0;
+  do {
     if (RadiusStart(auth, RAD_ACCESS_REQUEST) == RAD_NACK) {
 	auth->status = AUTH_STATUS_FAIL;
 	return;
@@ -220,6 +625,7 @@ RadiusEapProxy(void *arg)
 	return;
     }
 
+    mlen = RAD_MAX_ATTR_LEN;
     for (pos = 0; pos <= auth->params.eapmsg_len; pos += RAD_MAX_ATTR_LEN) {
 	char	chunk[RAD_MAX_ATTR_LEN];
 
@@ -235,8 +641,9 @@ RadiusEapProxy(void *arg)
     	    return;
 	}
     }
+  } while ((res = RadiusSendRequest(auth)) == RAD_RETRY);
 
-    if (RadiusSendRequest(auth) == RAD_NACK) {
+    if (res == RAD_NACK) {
 	auth->status = AUTH_STATUS_FAIL;
 	return;
     }
@@ -247,6 +654,7 @@ RadiusEapProxy(void *arg)
 void
 RadiusClose(AuthData auth) 
 {
+    RadiusServerDone(auth, -1);
     if (auth->radius.handle != NULL)
 	rad_close(auth->radius.handle);  
     auth->radius.handle = NULL;
@@ -256,11 +664,12 @@ int
 RadStat(Context ctx, int ac, const char *const av[], const void *arg)
 {
   Auth		const a = &ctx->lnk->lcp.auth;
-  RadConf	const conf = &a->conf.radius;
+  RadConf	const conf = &a->conf->radius;
   int		i;
   char		*buf;
   RadServe_Conf	server;
   char		buf1[64];
+  uint64_t	num, ns;
 
   (void)ac;
   (void)av;
@@ -276,6 +685,9 @@ RadStat(Context ctx, int ac, const char *const av[], const void *arg)
   Printf("\tMe (NAS-IP)  : %s\r\n", inet_ntoa(conf->radius_me));
   Printf("\tv6Me (NAS-IP): %s\r\n", u_addrtoa(&conf->radius_mev6, buf1, sizeof(buf1)));
   Printf("\tIdentifier   : %s\r\n", (conf->identifier ? conf->identifier : ""));
+  Printf("\tStrategy     : %s\r\n", gRadStrategies[conf->strategy]);
+  Printf("\tHold-down    : %d s after %d failures\r\n",
+    conf->holddown, conf->holddown_fails);
   
   if (conf->server != NULL) {
 
@@ -288,6 +700,8 @@ RadStat(Context ctx, int ac, const char *const av[], const void *arg)
       Printf("\tsecret     : *********\r\n");
       Printf("\tauth port  : %d\r\n", server->auth_port);
       Printf("\tacct port  : %d\r\n", server->acct_port);
+      RadiusHealthShow(ctx, "auth", server->hostname, server->auth_port);
+      RadiusHealthShow(ctx, "acct", server->hostname, server->acct_port);
       i++;
       server = server->next;
     }
@@ -310,46 +724,51 @@ RadStat(Context ctx, int ac, const char *const av[], const void *arg)
   Freee(buf);
   
   Printf("\tFilter Id      : %s\r\n", (a->params.filter_id ? a->params.filter_id : ""));
+
+  Printf("Request build time:\r\n");
+  Printf("\tStatic attrs   : %d bytes\r\n", conf->attrs_len);
+  for (i = RAD_BUILD_AUTH; i <= RAD_BUILD_ACCT; i++) {
+    num = atomic_load_explicit(&gRadBuildNum[i], memory_order_relaxed);
+    ns = atomic_load_explicit(&gRadBuildNs[i], memory_order_relaxed);
+    Printf("\t%s: %ju requests, avg %ju ns, max %ju ns\r\n",
+	(i == RAD_BUILD_AUTH) ? "Access        " : "Accounting    ",
+	(uintmax_t)num, (uintmax_t)(num ? ns / num : 0),
+	(uintmax_t)atomic_load_explicit(&gRadBuildMax[i], memory_order_relaxed));
+  }
+
+  AcctSpoolStat(ctx, 0, NULL, NULL);
   return (0);
 }
 
+/*
+ * RadiusAddServer()
+ *
+ * Add the server chosen by RadiusSelectServer() to the handle. Other
+ * servers are tried by repeating the request, see RadiusSendRequest().
+ */
+
 static int
 RadiusAddServer(AuthData auth, short request_type)
 {
   RadConf	const c = &auth->conf.radius;
   RadServe_Conf	s;
+  in_port_t	port;
 
   if (c->server == NULL)
     return (RAD_ACK);
 
-  s = c->server;
-  while (s) {
-
-    if (request_type == RAD_ACCESS_REQUEST) {
-      if (s->auth_port != 0) {
-	Log(LG_RADIUS2, ("[%s] RADIUS: Adding server %s %d", auth->info.lnkname, s->hostname, s->auth_port));
-        if (rad_add_server (auth->radius.handle, s->hostname,
-	    s->auth_port,
-	    s->sharedsecret,
-	    c->radius_timeout,
-	    c->radius_retries) == -1) {
-		RadiusLogError(auth, "Adding server error");
-		return (RAD_NACK);
-        }
-      }
-    } else if (s->acct_port != 0) {
-	Log(LG_RADIUS2, ("[%s] RADIUS: Adding server %s %d", auth->info.lnkname, s->hostname, s->acct_port));
-        if (rad_add_server (auth->radius.handle, s->hostname,
-	    s->acct_port,
-	    s->sharedsecret,
-	    c->radius_timeout,
-	    c->radius_retries) == -1) {
-		RadiusLogError(auth, "Adding server error");
-		return (RAD_NACK);
-        }
-    }
-
-    s = s->next;
+  if ((s = RadiusSelectServer(auth, request_type)) == NULL)
+    return (RAD_NACK);
+  port = (request_type == RAD_ACCESS_REQUEST) ? s->auth_port : s->acct_port;
+
+  Log(LG_RADIUS2, ("[%s] RADIUS: Adding server %s %d", auth->info.lnkname, s->hostname, port));
+  if (rad_add_server (auth->radius.handle, s->hostname,
+      port,
+      s->sharedsecret,
+      c->radius_timeout,
+      c->radius_retries) == -1) {
+	RadiusLogError(auth, "Adding server error");
+	return (RAD_NACK);
   }
 #ifdef HAVE_RAD_BIND
   if (c->src_addr.s_addr != INADDR_ANY)
@@ -358,12 +777,227 @@ RadiusAddServer(AuthData auth, short request_type)
 
   return (RAD_ACK);
 }
+
+/*
+ * RadiusSelectServer()
+ *
+ * Choose a server not tried yet by this request. Servers failed
+ * holddown_fails times in a row are skipped for holddown seconds,
+ * then a single request probes them. Continuation of a challenge
+ * goes to the server which sent it.
+ */
+
+static RadServe_Conf
+RadiusSelectServer(AuthData auth, short request_type)
+{
+  RadConf		const c = &auth->conf.radius;
+  RadServe_Conf		s, cand[32], helds = NULL;
+  struct radhealth	*h, *candh[32], *heldh = NULL;
+  int			candk[32], heldk = 0;
+  time_t		now = time(NULL);
+  in_port_t		port;
+  u_int			w, total, weight[32];
+  int			k, n = 0, i = 0;
+
+  MUTEX_LOCK(gRadHealthMutex);
+  for (s = c->server, k = 0; s != NULL && k < 32; s = s->next, k++) {
+    port = (request_type == RAD_ACCESS_REQUEST) ? s->auth_port : s->acct_port;
+    if (port == 0 || (auth->radius.tried & (1 << k)))
+      continue;
+    h = RadiusHealthGet(s->hostname, port, 1);
+    if (request_type == RAD_ACCESS_REQUEST && auth->params.state != NULL &&
+	auth->params.radserver == h) {
+      cand[0] = s;
+      candh[0] = h;
+      candk[0] = k;
+      n = 1;
+      break;
+    }
+    if (c->holddown > 0 && h->fails >= (u_int)c->holddown_fails &&
+	(now < h->holddown || h->outstanding > 0)) {
+      /* Remember the one coming back first */
+      if (heldh == NULL || h->holddown < heldh->holddown) {
+	helds = s;
+	heldh = h;
+	heldk = k;
+      }
+      continue;
+    }
+    cand[n] = s;
+    candh[n] = h;
+    candk[n] = k;
+    n++;
+  }
+  /* All servers left are held down, rather try one than fail */
+  if (n == 0 && heldh != NULL) {
+    Log(LG_RADIUS, ("[%s] RADIUS: All servers are held down, trying %s %d",
+      auth->info.lnkname, helds->hostname, (int)heldh->port));
+    cand[0] = helds;
+    candh[0] = heldh;
+    candk[0] = heldk;
+    n = 1;
+  }
+  if (n == 0) {
+    MUTEX_UNLOCK(gRadHealthMutex);
+    Log(LG_RADIUS2, ("[%s] RADIUS: No more servers to try",
+      auth->info.lnkname));
+    return (NULL);
+  }
+
+  if (n > 1) {
+    switch (c->strategy) {
+      case RADIUS_STRATEGY_ROUND_ROBIN:
+	i = gRadRoundRobin++ % n;
+	break;
+      case RADIUS_STRATEGY_LEAST_OUTSTANDING:
+	for (k = 1; k < n; k++) {
+	  if (candh[k]->outstanding < candh[i]->outstanding ||
+	      (candh[k]->outstanding == candh[i]->outstanding &&
+	      candh[k]->rtt < candh[i]->rtt))
+	    i = k;
+	}
+	break;
+      case RADIUS_STRATEGY_WEIGHTED:
+	/* Servers not answered yet get the weight of a 1ms one */
+	total = 0;
+	for (k = 0; k < n; k++) {
+	  weight[k] = 10000000 / (candh[k]->rtt > 100 ? candh[k]->rtt :
+	    (candh[k]->rtt > 0 ? 100 : 1000));
+	  total += weight[k];
+	}
+	w = random() % total;
+	for (i = 0; i < n - 1 && w >= weight[i]; i++)
+	  w -= weight[i];
+	break;
+      default:
+	break;
+    }
+  }
+
+  h = candh[i];
+  h->outstanding++;
+  h->requests++;
+  auth->radius.server = h;
+  auth->radius.tried |= (1 << candk[i]);
+  MUTEX_UNLOCK(gRadHealthMutex);
+  clock_gettime(CLOCK_MONOTONIC, &auth->radius.sent);
+  return (cand[i]);
+}
+
+/*
+ * RadiusHealthGet()
+ *
+ * Find health entry of a server port. Must be called locked.
+ */
+
+static struct radhealth *
+RadiusHealthGet(const char *hostname, in_port_t port, int create)
+{
+  struct radhealth	*h;
+
+  for (h = gRadHealth; h != NULL; h = h->next) {
+    if (h->port == port && strcmp(h->hostname, hostname) == 0)
+      return (h);
+  }
+  if (!create)
+    return (NULL);
+  h = Malloc(MB_RADIUS, sizeof(*h));
+  h->hostname = Mstrdup(MB_RADIUS, hostname);
+  h->port = port;
+  h->next = gRadHealth;
+  gRadHealth = h;
+  return (h);
+}
+
+/*
+ * RadiusServerDone()
+ *
+ * Account the result of a request to the server of the handle:
+ * positive if it answered, zero if it did not, negative if the
+ * request was abandoned before.
+ */
+
+static void
+RadiusServerDone(AuthData auth, int result)
+{
+  RadConf		const c = &auth->conf.radius;
+  struct radhealth	*const h = auth->radius.server;
+  struct timespec	now;
+  int			rtt, up = 0, down = 0;
+
+  if (h == NULL)
+    return;
+  auth->radius.server = NULL;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rtt = (now.tv_sec - auth->radius.sent.tv_sec) * 1000000 +
+    (now.tv_nsec - auth->radius.sent.tv_nsec) / 1000;
+
+  MUTEX_LOCK(gRadHealthMutex);
+  h->outstanding--;
+  if (result > 0) {
+    up = (c->holddown > 0 && h->fails >= (u_int)c->holddown_fails);
+    h->fails = 0;
+    if (h->rtt == 0)
+      h->rtt = rtt;
+    else
+      h->rtt += (rtt - (int)h->rtt) / 8;
+    if (h->rtt == 0)
+      h->rtt = 1;
+  } else if (result == 0) {
+    h->failures++;
+    h->fails++;
+    if (c->holddown > 0 && h->fails >= (u_int)c->holddown_fails) {
+      h->holddown = time(NULL) + c->holddown;
+      down = 1;
+    }
+  }
+  MUTEX_UNLOCK(gRadHealthMutex);
+
+  if (up) {
+    Log(LG_RADIUS, ("[%s] RADIUS: Server %s:%d is up",
+      auth->info.lnkname, h->hostname, h->port));
+  } else if (down) {
+    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Server %s:%d failed %u times, holding down for %d seconds",
+      auth->info.lnkname, h->hostname, h->port, h->fails, c->holddown));
+  }
+}
+
+/*
+ * RadiusHealthShow()
+ */
+
+static void
+RadiusHealthShow(Context ctx, const char *label, const char *hostname,
+	in_port_t port)
+{
+  struct radhealth	*h, t;
+  time_t		now = time(NULL);
+
+  if (port == 0)
+    return;
+  MUTEX_LOCK(gRadHealthMutex);
+  if ((h = RadiusHealthGet(hostname, port, 0)) != NULL)
+    t = *h;
+  MUTEX_UNLOCK(gRadHealthMutex);
+  if (h == NULL) {
+    Printf("\t%s    : not used yet\r\n", label);
+    return;
+  }
+  Printf("\t%s    : rtt %u.%03u ms, outstanding %u, requests %lu, failures %lu\r\n",
+    label, t.rtt / 1000, t.rtt % 1000, t.outstanding, t.requests, t.failures);
+  if (t.fails > 0) {
+    Printf("\t%s    : %u failures in a row", label, t.fails);
+    if (t.holddown > now)
+      Printf(", held down for %ld s", (long)(t.holddown - now));
+    Printf("\r\n");
+  }
+}
   
 /* Set menu options */
 static int
 RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg) 
 {
-  RadConf	const conf = &ctx->lnk->lcp.auth.conf.radius;
+  RadConf	conf;
   RadServe_Conf	server;
   RadServe_Conf	t_server;
   RadServe_Conf	next, prev;
@@ -374,6 +1008,7 @@ RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 
   if (ac == 0)
       return(-1);
+  conf = &AuthConfWrite(ctx->lnk)->radius;
 
     switch ((intptr_t)arg) {
 
@@ -448,6 +1083,10 @@ RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	if (conf->server != NULL)
 	    server->next = conf->server;
 	conf->server = server;
+	/* Spooled requests of earlier runs are sent with it */
+	if (acct_port != 0)
+	    AcctSpoolSetSecret(server->hostname, acct_port,
+		server->sharedsecret);
 
 	break;
 
@@ -465,11 +1104,13 @@ RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	    u_addrtoin_addr(&t, &conf->radius_me);
 	} else
 	    Error("Bad NAS address '%s'.", *av);
+	RadiusConfAttrs(conf);
 	break;
 
       case SET_MEV6:
         if (!ParseAddr(*av, &conf->radius_mev6, ALLOW_IPV6))
 	    Error("Bad NAS address '%s'.", *av);
+	RadiusConfAttrs(conf);
 	break;
 
       case SET_TIMEOUT:
@@ -506,9 +1147,33 @@ RadiusSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 		conf->identifier = NULL;
 	  else
 		conf->identifier = Mstrdup(MB_RADIUS, av[0]);
+	  RadiusConfAttrs(conf);
 	}
 	break;
 
+      case SET_STRATEGY:
+	for (val = 0; val < (int)RAD_STRATEGIES_NUM; val++) {
+	  if (strcasecmp(av[0], gRadStrategies[val]) == 0)
+	    break;
+	}
+	if (val == (int)RAD_STRATEGIES_NUM)
+	  Error("Unknown strategy '%s'.", av[0]);
+	conf->strategy = val;
+	break;
+
+      case SET_HOLDDOWN:
+	if (ac > 2)
+	  return(-1);
+	val = atoi(av[0]);
+	if (val < 0)
+	  Error("Hold-down must not be negative.");
+	count = RADIUS_HOLDDOWN_FAILS;
+	if (ac > 1 && (count = atoi(av[1])) <= 0)
+	  Error("Failures must be positive.");
+	conf->holddown = val;
+	conf->holddown_fails = count;
+	break;
+
     case SET_ENABLE:
       EnableCommand(ac, av, &conf->options, gConfList);
       break;
@@ -563,9 +1228,10 @@ static int
 RadiusStart(AuthData auth, short request_type)
 {
   RadConf 	const conf = &auth->conf.radius;  
+  u_char	buf[RADIUS_ATTRS_MAX];
   char		host[MAXHOSTNAMELEN];
-  int		porttype;
-  char		buf[48];
+  const u_char	*attrs;
+  int		porttype, len, k;
   char		*tmpval;
 
   if (RadiusOpen(auth, request_type) == RAD_NACK) 
@@ -577,45 +1243,38 @@ RadiusStart(AuthData auth, short request_type)
     return (RAD_NACK);
   }
 
-    if (conf->identifier) {
-	tmpval = conf->identifier;
+    /* Static attributes, encoded here only for spooled requests */
+    if ((attrs = conf->attrs) != NULL) {
+	len = conf->attrs_len;
     } else {
+	len = RadiusEncodeAttrs(conf, buf);
+	attrs = buf;
+    }
+    Log(LG_RADIUS2, ("[%s] RADIUS: Put %d bytes of static attributes",
+	auth->info.lnkname, len));
+    for (k = 0; k < len; k += attrs[k + 1]) {
+	if (rad_put_attr(auth->radius.handle, attrs[k], attrs + k + 2,
+		attrs[k + 1] - 2) == -1) {
+	    RadiusLogError(auth, "Put static attributes failed");
+	    return (RAD_NACK);
+	}
+    }
+    if (conf->identifier == NULL) {
+	/* The host name may change, so it is not pre-encoded */
 	if (gethostname(host, sizeof(host)) == -1) {
 	    Log(LG_ERR|LG_RADIUS,
 		("[%s] RADIUS: gethostname() for RAD_NAS_IDENTIFIER failed",
-    		auth->info.lnkname));
+		auth->info.lnkname));
+	    return (RAD_NACK);
+	}
+	host[sizeof(host) - 1] = 0;
+	Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_NAS_IDENTIFIER: %s",
+	    auth->info.lnkname, host));
+	if (rad_put_string(auth->radius.handle, RAD_NAS_IDENTIFIER, host) == -1) {
+	    RadiusLogError(auth, "Put RAD_NAS_IDENTIFIER failed");
 	    return (RAD_NACK);
 	}
-	tmpval = host;
-    }
-    Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_NAS_IDENTIFIER: %s", 
-	auth->info.lnkname, tmpval));
-    if (rad_put_string(auth->radius.handle, RAD_NAS_IDENTIFIER, tmpval) == -1)  {
-	RadiusLogError(auth, "Put RAD_NAS_IDENTIFIER failed");
-	return (RAD_NACK);
-    }
-  
-  if (conf->radius_me.s_addr != 0) {
-    Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_NAS_IP_ADDRESS: %s", 
-      auth->info.lnkname, inet_ntoa(conf->radius_me)));
-    if (rad_put_addr(auth->radius.handle, RAD_NAS_IP_ADDRESS, conf->radius_me) == -1) {
-	RadiusLogError(auth, "Put RAD_NAS_IP_ADDRESS failed");
-	return (RAD_NACK);
-    }
-  }
-
-  if (!u_addrempty(&conf->radius_mev6)) {
-    Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_NAS_IPV6_ADDRESS: %s", 
-      auth->info.lnkname, u_addrtoa(&conf->radius_mev6,buf,sizeof(buf))));
-#ifdef HAVE_RAD_ADDR6
-    if (rad_put_addr6(auth->radius.handle, RAD_NAS_IPV6_ADDRESS, conf->radius_mev6.u.ip6) == -1) {
-#else
-    if (rad_put_attr(auth->radius.handle, RAD_NAS_IPV6_ADDRESS, &conf->radius_mev6.u.ip6, sizeof(conf->radius_mev6.u.ip6)) == -1) {
-#endif
-	RadiusLogError(auth, "Put RAD_NAS_IPV6_ADDRESS failed");
-	return (RAD_NACK);
     }
-  }
 
   /* Insert the Message Authenticator RFC 3579
    * If using EAP this is mandatory
@@ -669,20 +1328,6 @@ RadiusStart(AuthData auth, short request_type)
 	return (RAD_NACK);
     }
 
-    Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_SERVICE_TYPE: RAD_FRAMED", 
-	auth->info.lnkname));
-    if (rad_put_int(auth->radius.handle, RAD_SERVICE_TYPE, RAD_FRAMED) == -1) {
-	RadiusLogError(auth, "Put RAD_SERVICE_TYPE failed");
-	return (RAD_NACK);
-    }
- 
-    Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_FRAMED_PROTOCOL: RAD_PPP", 
-	auth->info.lnkname));
-    if (rad_put_int(auth->radius.handle, RAD_FRAMED_PROTOCOL, RAD_PPP) == -1) {
-	RadiusLogError(auth, "Put RAD_FRAMED_PROTOCOL failed");
-	return (RAD_NACK);
-    }
-
     if (auth->params.state != NULL) {
 	tmpval = Bin2Hex(auth->params.state, auth->params.state_len);
 	Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_STATE: 0x%s", auth->info.lnkname, tmpval));
@@ -1168,8 +1813,8 @@ RadiusPutAcct(AuthData auth)
     }
 
     Log(LG_RADIUS2, ("[%s] RADIUS: Put RAD_ACCT_SESSION_TIME: %ld", 
-        auth->info.lnkname, (long int)(time(NULL) - auth->info.last_up)));
-    if (rad_put_int(auth->radius.handle, RAD_ACCT_SESSION_TIME, time(NULL) - auth->info.last_up) != 0) {
+        auth->info.lnkname, (long int)(auth->info.acct_time - auth->info.last_up)));
+    if (rad_put_int(auth->radius.handle, RAD_ACCT_SESSION_TIME, auth->info.acct_time - auth->info.last_up) != 0) {
         RadiusLogError(auth, "Put RAD_ACCT_SESSION_TIME failed");
         return (RAD_NACK);
     }
@@ -1331,6 +1976,11 @@ RadiusSendRequest(AuthData auth)
 	timeradd(&tv, &timelimit, &timelimit);
     }
 
+    /* Remember the server a challenge came from */
+    auth->params.radserver = (n == RAD_ACCESS_CHALLENGE) ?
+	auth->radius.server : NULL;
+    RadiusServerDone(auth, n > 0);
+
     switch (n) {
 
 	case RAD_ACCESS_ACCEPT:
@@ -1360,6 +2010,11 @@ RadiusSendRequest(AuthData auth)
     	    Log(LG_RADIUS, ("[%s] RADIUS: rad_send_request for user '%s' failed: %s",
     		auth->info.lnkname, auth->params.authname,
 		rad_strerror(auth->radius.handle)));
+	    if (auth->radius.tried != 0) {
+		/* Repeat the request to another server, if any */
+		RadiusClose(auth);
+		return (RAD_RETRY);
+	    }
     	    return (RAD_NACK);
       
 	default:
@@ -1371,638 +2026,706 @@ RadiusSendRequest(AuthData auth)
     return (RadiusGetParams(auth, n == RAD_ACCESS_CHALLENGE));
 }
 
-static int
-RadiusGetParams(AuthData auth, int eap_proxy)
+/*
+ * RadDecString()
+ *
+ * Copy string attribute value into the per reply buffer.
+ */
+
+static char *
+RadDecString(struct raddecode *rd, const void *data, size_t len)
 {
-  int		res, i, j;
-  size_t	len;
-  const void	*data;
-  u_int32_t	vendor;
-  char		*route;
-  char		*tmpval;
-  struct in_addr	ip;
-  struct in6_addr	ipv6;
-  char		buf[64];
-#if defined(USE_NG_BPF) || defined(USE_IPFW)
-  struct acl		**acls, *acls1;
-  char		*acl, *acl1, *acl2, *acl3;
-#endif
-  struct ifaceroute	*r, *r1;
-  struct u_range	range;
-#ifdef CCP_MPPC
-  u_char	*tmpkey;
-  size_t	tmpkey_len;
-#endif
+    if (len > RAD_MAX_ATTR_LEN)
+	len = RAD_MAX_ATTR_LEN;
+    memcpy(rd->str, data, len);
+    rd->str[len] = 0;
+    return (rd->str);
+}
 
-  Freee(auth->params.eapmsg);
-  auth->params.eapmsg = NULL;
-  
-  while ((res = rad_get_attr(auth->radius.handle, &data, &len)) > 0) {
+static int
+RadDecNone(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    (void)data;
+    (void)len;
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s", rd->auth->info.lnkname, d->name));
+    return (RAD_ACK);
+}
 
-    switch (res) {
+static int
+RadDecInfo(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    (void)len;
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get (%s: %d)",
+	rd->auth->info.lnkname, d->name, rad_cvt_int(data)));
+    return (RAD_ACK);
+}
 
-      case RAD_STATE:
-	tmpval = Bin2Hex(data, len);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_STATE: 0x%s", auth->info.lnkname, tmpval));
-	Freee(tmpval);
-	auth->params.state_len = len;
-	Freee(auth->params.state);
-	auth->params.state = Mdup(MB_AUTH, data, len);
-	continue;
+static int
+RadDecBinary(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    u_char	**const val = RAD_DEC_FIELD(rd, d, u_char *);
+    char	*tmpval;
 
-      case RAD_CLASS:
+    if (gLogOptions & LG_RADIUS2) {
 	tmpval = Bin2Hex(data, len);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_CLASS: 0x%s", auth->info.lnkname, tmpval));
+	Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: 0x%s",
+	    rd->auth->info.lnkname, d->name, tmpval));
 	Freee(tmpval);
-	auth->params.class_len = len;
-	Freee(auth->params.class);
-	auth->params.class = Mdup(MB_AUTH, data, len);
-	continue;
+    }
+    *(int *)(void *)((char *)rd->auth + d->aux) = len;
+    Freee(*val);
+    *val = Mdup(MB_AUTH, data, len);
+    return (RAD_ACK);
+}
 
-	/* libradius already checks the message-authenticator, so simply ignore it */
-      case RAD_MESSAGE_AUTHENTIC:
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MESSAGE_AUTHENTIC", auth->info.lnkname));
-	continue;
+static int
+RadDecEapMessage(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    char	*tbuf;
 
-      case RAD_EAP_MESSAGE:
-	if (auth->params.eapmsg != NULL) {
-	  char *tbuf;
-	  Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_EAP_MESSAGE: len %d of %d",
+    (void)d;
+    if (auth->params.eapmsg != NULL) {
+	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_EAP_MESSAGE: len %d of %d",
 	    auth->info.lnkname, (int)len, (int)(auth->params.eapmsg_len + len)));
-	  tbuf = Malloc(MB_AUTH, auth->params.eapmsg_len + len);
-	  memcpy(tbuf, auth->params.eapmsg, auth->params.eapmsg_len);
-	  memcpy(&tbuf[auth->params.eapmsg_len], data, len);
-	  auth->params.eapmsg_len += len;
-	  Freee(auth->params.eapmsg);
-	  auth->params.eapmsg = tbuf;
-	} else {
-	  Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_EAP_MESSAGE: len %d",
+	tbuf = Malloc(MB_AUTH, auth->params.eapmsg_len + len);
+	memcpy(tbuf, auth->params.eapmsg, auth->params.eapmsg_len);
+	memcpy(&tbuf[auth->params.eapmsg_len], data, len);
+	auth->params.eapmsg_len += len;
+	Freee(auth->params.eapmsg);
+	auth->params.eapmsg = tbuf;
+    } else {
+	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_EAP_MESSAGE: len %d",
 	    auth->info.lnkname, (int)len));
-	  auth->params.eapmsg = Mdup(MB_AUTH, data, len);
-	  auth->params.eapmsg_len = len;
-	}
-	continue;
+	auth->params.eapmsg = Mdup(MB_AUTH, data, len);
+	auth->params.eapmsg_len = len;
     }
+    return (RAD_ACK);
+}
 
-    if (!eap_proxy)
-      switch (res) {
-
-      case RAD_FRAMED_IP_ADDRESS:
-        ip = rad_cvt_addr(data);
-        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IP_ADDRESS: %s",
-          auth->info.lnkname, inet_ntoa(ip)));
-
-	if (ip.s_addr == INADDR_BROADCAST) {
-	  /* the peer can choose an address */
-	  Log(LG_RADIUS2, ("[%s]   the peer can choose an address", auth->info.lnkname));
-	  ip.s_addr=0;
-	  in_addrtou_range(&ip, 0, &auth->params.range);
-	  auth->params.range_valid = 1;
-	} else if (strcmp(inet_ntoa(ip), "255.255.255.254") == 0) {
-	  /* we should choose the ip */
-	  Log(LG_RADIUS2, ("[%s]   we should choose an address", auth->info.lnkname));
-	  auth->params.range_valid = 0;
-	} else {
-	  /* or use IP from Radius-server */
-	  in_addrtou_range(&ip, 32, &auth->params.range);
-	  auth->params.range_valid = 1;
-	}  
-        break;
+static int
+RadDecUint(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    u_int	*const val = RAD_DEC_FIELD(rd, d, u_int);
+
+    (void)len;
+    *val = rad_cvt_int(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %u",
+	rd->auth->info.lnkname, d->name, *val));
+    return (RAD_ACK);
+}
+
+static int
+RadDecAddr(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    struct in_addr	*const val = RAD_DEC_FIELD(rd, d, struct in_addr);
+
+    (void)len;
+    *val = rad_cvt_addr(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %s",
+	rd->auth->info.lnkname, d->name, inet_ntoa(*val)));
+    return (RAD_ACK);
+}
+
+/* String into a fixed size buffer of aux bytes */
+static int
+RadDecStrBuf(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    char	*const val = RAD_DEC_FIELD(rd, d, char);
+
+    strlcpy(val, RadDecString(rd, data, len), d->aux);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %s",
+	rd->auth->info.lnkname, d->name, val));
+    return (RAD_ACK);
+}
+
+/* Allocated string, empty value clears it */
+static int
+RadDecStrDup(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    char	**const val = RAD_DEC_FIELD(rd, d, char *);
+
+    Freee(*val);
+    *val = NULL;
+    if (len == 0)
+	return (RAD_ACK);
+    *val = Mstrdup(MB_AUTH, RadDecString(rd, data, len));
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %s",
+	rd->auth->info.lnkname, d->name, *val));
+    return (RAD_ACK);
+}
+
+static int
+RadDecFramedIp(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData		const auth = rd->auth;
+    struct in_addr	ip;
+
+    (void)d;
+    (void)len;
+    ip = rad_cvt_addr(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IP_ADDRESS: %s",
+	auth->info.lnkname, inet_ntoa(ip)));
+
+    if (ip.s_addr == INADDR_BROADCAST) {
+	/* the peer can choose an address */
+	Log(LG_RADIUS2, ("[%s]   the peer can choose an address", auth->info.lnkname));
+	ip.s_addr=0;
+	in_addrtou_range(&ip, 0, &auth->params.range);
+	auth->params.range_valid = 1;
+    } else if (ip.s_addr == htonl(0xfffffffe)) {
+	/* we should choose the ip */
+	Log(LG_RADIUS2, ("[%s]   we should choose an address", auth->info.lnkname));
+	auth->params.range_valid = 0;
+    } else {
+	/* or use IP from Radius-server */
+	in_addrtou_range(&ip, 32, &auth->params.range);
+	auth->params.range_valid = 1;
+    }
+    return (RAD_ACK);
+}
 
 #ifdef HAVE_RAD_ADDR6
-      case RAD_FRAMED_IPV6_ADDRESS:
-        ipv6 = rad_cvt_addr6(data);
-        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IPV6_ADDRESS: %s",
-          auth->info.lnkname, inet_ntop(AF_INET6, &ipv6, buf, sizeof(buf))));
-        in6_addrtou_range(&ipv6, 64, &auth->params.range);
-        auth->params.range_valid = 1;
-        break;
+static int
+RadDecFramedIpv6(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData		const auth = rd->auth;
+    struct in6_addr	ipv6;
+    char		buf[64];
+
+    (void)d;
+    (void)len;
+    ipv6 = rad_cvt_addr6(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IPV6_ADDRESS: %s",
+	auth->info.lnkname, inet_ntop(AF_INET6, &ipv6, buf, sizeof(buf))));
+    in6_addrtou_range(&ipv6, 64, &auth->params.range);
+    auth->params.range_valid = 1;
+    return (RAD_ACK);
+}
 #endif
 
-      case RAD_USER_NAME:
-	tmpval = rad_cvt_string(data, len);
-	/* copy it into the persistent data struct */
-	strlcpy(auth->params.authname, tmpval, sizeof(auth->params.authname));
-	free(tmpval);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_USER_NAME: %s",
-	  auth->info.lnkname, auth->params.authname));
-        break;
-
-      case RAD_FRAMED_IP_NETMASK:
-        ip = rad_cvt_addr(data);
-	auth->params.netmask = in_addrtowidth(&ip);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IP_NETMASK: %s (/%d)",
-	  auth->info.lnkname, inet_ntoa(ip), auth->params.netmask));
-	break;
-
-      case RAD_FRAMED_ROUTE:
-	route = rad_cvt_string(data, len);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_ROUTE: %s",
-	  auth->info.lnkname, route));
-	if (!ParseRange(route, &range, ALLOW_IPV4)) {
-	  Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Get RAD_FRAMED_ROUTE: Bad route \"%s\"",
-	    auth->info.lnkname, route));
-	  free(route);
-	  break;
-	}
-	r = Malloc(MB_AUTH, sizeof(struct ifaceroute));
-	r->dest = range;
-	r->ok = 0;
-	j = 0;
-	SLIST_FOREACH(r1, &auth->params.routes, next) {
-	  if (!u_rangecompare(&r->dest, &r1->dest)) {
-	    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Duplicate route %s",
-		auth->info.lnkname, route));
-	    j = 1;
-	  }
-	};
-	free(route);
-	if (j == 0) {
-	    SLIST_INSERT_HEAD(&auth->params.routes, r, next);
-	} else {
-	    Freee(r);
-	}
-	break;
+static int
+RadDecNetmask(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData		const auth = rd->auth;
+    struct in_addr	ip;
+
+    (void)d;
+    (void)len;
+    ip = rad_cvt_addr(data);
+    auth->params.netmask = in_addrtowidth(&ip);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IP_NETMASK: %s (/%d)",
+	auth->info.lnkname, inet_ntoa(ip), auth->params.netmask));
+    return (RAD_ACK);
+}
 
-      case RAD_FRAMED_IPV6_ROUTE:
-	route = rad_cvt_string(data, len);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_IPV6_ROUTE: %s",
-	  auth->info.lnkname, route));
-	if (!ParseRange(route, &range, ALLOW_IPV6)) {
-	  Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Get RAD_FRAMED_IPV6_ROUTE: Bad route \"%s\"", auth->info.lnkname, route));
-	  free(route);
-	  break;
-	}
-	r = Malloc(MB_AUTH, sizeof(struct ifaceroute));
-	r->dest = range;
-	r->ok = 0;
-	j = 0;
-	SLIST_FOREACH(r1, &auth->params.routes, next) {
-	  if (!u_rangecompare(&r->dest, &r1->dest)) {
+/* Framed-Route and Framed-IPv6-Route, aux is address family flag */
+static int
+RadDecRoute(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData		const auth = rd->auth;
+    struct ifaceroute	*r, *r1;
+    struct u_range	range;
+    char		*route;
+
+    route = RadDecString(rd, data, len);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %s",
+	auth->info.lnkname, d->name, route));
+    if (!ParseRange(route, &range, d->aux)) {
+	Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Get %s: Bad route \"%s\"",
+	    auth->info.lnkname, d->name, route));
+	return (RAD_ACK);
+    }
+    SLIST_FOREACH(r1, &auth->params.routes, next) {
+	if (!u_rangecompare(&range, &r1->dest)) {
 	    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Duplicate route %s",
 		auth->info.lnkname, route));
-	    j = 1;
-	  }
-	};
-	free(route);
-	if (j == 0) {
-	    SLIST_INSERT_HEAD(&auth->params.routes, r, next);
-	} else {
-	    Freee(r);
+	    return (RAD_ACK);
 	}
-	break;
-
-      case RAD_SESSION_TIMEOUT:
-        auth->params.session_timeout = rad_cvt_int(data);
-        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_SESSION_TIMEOUT: %u",
-          auth->info.lnkname, auth->params.session_timeout));
-        break;
-
-      case RAD_IDLE_TIMEOUT:
-        auth->params.idle_timeout = rad_cvt_int(data);
-        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_IDLE_TIMEOUT: %u",
-          auth->info.lnkname, auth->params.idle_timeout));
-        break;
-
-     case RAD_ACCT_INTERIM_INTERVAL:
-	auth->params.acct_update = rad_cvt_int(data);
-        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_ACCT_INTERIM_INTERVAL: %u",
-          auth->info.lnkname, auth->params.acct_update));
-	break;
+    }
+    r = Malloc(MB_AUTH, sizeof(struct ifaceroute));
+    r->dest = range;
+    r->ok = 0;
+    SLIST_INSERT_HEAD(&auth->params.routes, r, next);
+    return (RAD_ACK);
+}
 
-      case RAD_FRAMED_MTU:
-	i = rad_cvt_int(data);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_MTU: %u",
-	  auth->info.lnkname, i));
-	if (i < IFACE_MIN_MTU || i > IFACE_MAX_MTU) {
-	  Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Get RAD_FRAMED_MTU: invalid MTU: %u",
+static int
+RadDecMtu(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    int		i;
+
+    (void)d;
+    (void)len;
+    i = rad_cvt_int(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_MTU: %u",
+	auth->info.lnkname, i));
+    if (i < IFACE_MIN_MTU || i > IFACE_MAX_MTU) {
+	Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Get RAD_FRAMED_MTU: invalid MTU: %u",
 	    auth->info.lnkname, i));
-	  auth->params.mtu = 0;
-	  break;
-	}
-	auth->params.mtu = i;
-        break;
-
-      case RAD_FRAMED_COMPRESSION:
-        i = rad_cvt_int(data);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_COMPRESSION: %d",
-	  auth->info.lnkname, i));
-	if (i == RAD_COMP_VJ)
-	    auth->params.vjc_enable = 1;
-        break;
-
-      case RAD_FRAMED_PROTOCOL:
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get (RAD_FRAMED_PROTOCOL: %d)",
-	  auth->info.lnkname, rad_cvt_int(data)));
-        break;
-
-      case RAD_FRAMED_ROUTING:
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get (RAD_FRAMED_ROUTING: %d)",
-	  auth->info.lnkname, rad_cvt_int(data)));
-        break;
-
-      case RAD_FILTER_ID:
-	Freee(auth->params.filter_id);
-	auth->params.filter_id = NULL;
-	if (len == 0)
-	    break;
-	tmpval = rad_cvt_string(data, len);
-	auth->params.filter_id = Mdup(MB_AUTH, tmpval, len + 1);
-	free(tmpval);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FILTER_ID: %s",
-	  auth->info.lnkname, auth->params.filter_id));
-        break;
-
-      case RAD_SERVICE_TYPE:
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get (RAD_SERVICE_TYPE: %d)",
-	  auth->info.lnkname, rad_cvt_int(data)));
-        break;
-
-      case RAD_REPLY_MESSAGE:
-	Freee(auth->reply_message);
-	auth->reply_message = NULL;
-	if (len == 0)
-	    break;
-	tmpval = rad_cvt_string(data, len);
-	auth->reply_message = Mdup(MB_AUTH, tmpval, len + 1);
-	free(tmpval);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_REPLY_MESSAGE: %s",
-	  auth->info.lnkname, auth->reply_message));
-        break;
-
-      case RAD_FRAMED_POOL:
-	tmpval = rad_cvt_string(data, len);
-	/* copy it into the persistent data struct */
-	strlcpy(auth->params.ippool, tmpval, sizeof(auth->params.ippool));
-	free(tmpval);
-	Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_POOL: %s",
-	  auth->info.lnkname, auth->params.ippool));
-        break;
-
-      case RAD_VENDOR_SPECIFIC:
-	if ((res = rad_get_vendor_attr(&vendor, &data, &len)) == -1) {
-	  Log(LG_RADIUS, ("[%s] RADIUS: Get vendor attr failed: %s",
-	    auth->info.lnkname, rad_strerror(auth->radius.handle)));
-	  return RAD_NACK;
-	}
-
-	switch (vendor) {
+	auth->params.mtu = 0;
+	return (RAD_ACK);
+    }
+    auth->params.mtu = i;
+    return (RAD_ACK);
+}
 
-	  case RAD_VENDOR_MICROSOFT:
-	    switch (res) {
+static int
+RadDecCompression(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    int		i;
+
+    (void)d;
+    (void)len;
+    i = rad_cvt_int(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_FRAMED_COMPRESSION: %d",
+	rd->auth->info.lnkname, i));
+    if (i == RAD_COMP_VJ)
+	rd->auth->params.vjc_enable = 1;
+    return (RAD_ACK);
+}
 
-	      case RAD_MICROSOFT_MS_CHAP_ERROR:
-	    	Freee(auth->mschap_error);
-		auth->mschap_error = NULL;
-		if (len == 0)
-		    break;
+static int
+RadDecChapError(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    /* there is a nullbyte on the first pos, don't know why */
+    if (len > 0 && ((const char *)data)[0] == '\0') {
+	data = (const char *)data + 1;
+	len--;
+    }
+    return (RadDecStrDup(rd, d, data, len));
+}
 
-		/* there is a nullbyte on the first pos, don't know why */
-		if (((const char *)data)[0] == '\0') {
-		  data = (const char *)data + 1;
-		  len--;
-		}
-		tmpval = rad_cvt_string(data, len);
-		auth->mschap_error = Mdup(MB_AUTH, tmpval, len + 1);
-		free(tmpval);
-
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get MS-CHAP-Error: %s",
-		  auth->info.lnkname, auth->mschap_error));
-		break;
-
-	      /* this was taken from userland ppp */
-	      case RAD_MICROSOFT_MS_CHAP2_SUCCESS:
-	    	Freee(auth->mschapv2resp);
-		auth->mschapv2resp = NULL;
-		if (len == 0)
-		    break;
-		if (len < 3 || ((const char *)data)[1] != '=') {
-		  /*
-		   * Only point at the String field if we don't think the
-		   * peer has misformatted the response.
-		   */
-		  data = (const char *)data + 1;
-		  len--;
-		} else {
-		  Log(LG_RADIUS, ("[%s] RADIUS: Warning: The MS-CHAP2-Success attribute is mis-formatted. Compensating",
-		    auth->info.lnkname));
-		}
-		if ((tmpval = rad_cvt_string((const char *)data, len)) == NULL) {
-		    Log(LG_RADIUS, ("[%s] RADIUS: rad_cvt_string failed: %s",
-			auth->info.lnkname, rad_strerror(auth->radius.handle)));
-		    return RAD_NACK;
-		}
-		auth->mschapv2resp = Mdup(MB_AUTH, tmpval, len + 1);
-		free(tmpval);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_CHAP2_SUCCESS: %s",
-		  auth->info.lnkname, auth->mschapv2resp));
-		break;
-
-	      case RAD_MICROSOFT_MS_CHAP_DOMAIN:
-		Freee(auth->params.msdomain);
-		auth->params.msdomain = NULL;
-		if (len == 0)
-		    break;
-		tmpval = rad_cvt_string(data, len);
-		auth->params.msdomain = Mdup(MB_AUTH, tmpval, len + 1);
-		free(tmpval);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_CHAP_DOMAIN: %s",
-		  auth->info.lnkname, auth->params.msdomain));
-		break;
+/* this was taken from userland ppp */
+static int
+RadDecChap2Success(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    if (len == 0)
+	return (RadDecStrDup(rd, d, data, len));
+    if (len < 3 || ((const char *)data)[1] != '=') {
+	/*
+	 * Only point at the String field if we don't think the
+	 * peer has misformatted the response.
+	 */
+	data = (const char *)data + 1;
+	len--;
+    } else {
+	Log(LG_RADIUS, ("[%s] RADIUS: Warning: The MS-CHAP2-Success attribute is mis-formatted. Compensating",
+	    rd->auth->info.lnkname));
+    }
+    return (RadDecStrDup(rd, d, data, len));
+}
 
 #ifdef CCP_MPPC
-              /* MPPE Keys MS-CHAPv2 and EAP-TLS */
-	      case RAD_MICROSOFT_MS_MPPE_RECV_KEY:
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_MPPE_RECV_KEY",
-		  auth->info.lnkname));
-		tmpkey = rad_demangle_mppe_key(auth->radius.handle, data, len, &tmpkey_len);
-		if (!tmpkey) {
-		  RadiusLogError(auth, "rad_demangle_mppe_key failed");
-		  return RAD_NACK;
-		}
+/* MPPE Keys MS-CHAPv2 and EAP-TLS */
+static int
+RadDecMppeKey(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    u_char	*tmpkey;
+    size_t	tmpkey_len;
+
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s", auth->info.lnkname, d->name));
+    tmpkey = rad_demangle_mppe_key(auth->radius.handle, data, len, &tmpkey_len);
+    if (!tmpkey) {
+	RadiusLogError(auth, "rad_demangle_mppe_key failed");
+	return (RAD_NACK);
+    }
+    memcpy(RAD_DEC_FIELD(rd, d, u_char), tmpkey, MPPE_KEY_LEN);
+    free(tmpkey);
+    auth->params.msoft.has_keys = TRUE;
+    return (RAD_ACK);
+}
 
-		memcpy(auth->params.msoft.recv_key, tmpkey, MPPE_KEY_LEN);
-		free(tmpkey);
-		auth->params.msoft.has_keys = TRUE;
-		break;
-
-	      case RAD_MICROSOFT_MS_MPPE_SEND_KEY:
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_MPPE_SEND_KEY",
-		  auth->info.lnkname));
-		tmpkey = rad_demangle_mppe_key(auth->radius.handle, data, len, &tmpkey_len);
-		if (!tmpkey) {
-		  RadiusLogError(auth, "rad_demangle_mppe_key failed");
-		  return RAD_NACK;
-		}
-		memcpy(auth->params.msoft.xmit_key, tmpkey, MPPE_KEY_LEN);
-		free(tmpkey);
-		auth->params.msoft.has_keys = TRUE;
-		break;
-
-              /* MPPE Keys MS-CHAPv1 */
-	      case RAD_MICROSOFT_MS_CHAP_MPPE_KEYS:
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_CHAP_MPPE_KEYS",
-		  auth->info.lnkname));
-
-		if (len != 32) {
-		  Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Server returned garbage %d of expected %d Bytes",
-		    auth->info.lnkname, (int)len, 32));
-		  return RAD_NACK;
-		}
+/* MPPE Keys MS-CHAPv1 */
+static int
+RadDecMppeKeys(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    u_char	*tmpkey;
 
-		tmpkey = rad_demangle(auth->radius.handle, data, len);
-		if (tmpkey == NULL) {
-		  RadiusLogError(auth, "rad_demangle failed");
-		  return RAD_NACK;
-		}
-		memcpy(auth->params.msoft.lm_hash, tmpkey, sizeof(auth->params.msoft.lm_hash));
-		auth->params.msoft.has_lm_hash = TRUE;
-		memcpy(auth->params.msoft.nt_hash_hash, &tmpkey[8], sizeof(auth->params.msoft.nt_hash_hash));
-		auth->params.msoft.has_nt_hash = TRUE;
-		free(tmpkey);
-		break;
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s", auth->info.lnkname, d->name));
+    if (len != 32) {
+	Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Server returned garbage %d of expected %d Bytes",
+	    auth->info.lnkname, (int)len, 32));
+	return (RAD_NACK);
+    }
+    tmpkey = rad_demangle(auth->radius.handle, data, len);
+    if (tmpkey == NULL) {
+	RadiusLogError(auth, "rad_demangle failed");
+	return (RAD_NACK);
+    }
+    memcpy(auth->params.msoft.lm_hash, tmpkey, sizeof(auth->params.msoft.lm_hash));
+    auth->params.msoft.has_lm_hash = TRUE;
+    memcpy(auth->params.msoft.nt_hash_hash, &tmpkey[8], sizeof(auth->params.msoft.nt_hash_hash));
+    auth->params.msoft.has_nt_hash = TRUE;
+    free(tmpkey);
+    return (RAD_ACK);
+}
 #endif
 
-	      case RAD_MICROSOFT_MS_MPPE_ENCRYPTION_POLICY:
-		auth->params.msoft.policy = rad_cvt_int(data);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_MPPE_ENCRYPTION_POLICY: %d (%s)",
-		  auth->info.lnkname, auth->params.msoft.policy, AuthMPPEPolicyname(auth->params.msoft.policy)));
-		break;
-
-	      case RAD_MICROSOFT_MS_MPPE_ENCRYPTION_TYPES:
-	        {
-		    auth->params.msoft.types = rad_cvt_int(data);
-		    Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_MPPE_ENCRYPTION_TYPES: %d (%s)",
-			auth->info.lnkname, auth->params.msoft.types, 
-			AuthMPPETypesname(auth->params.msoft.types, buf, sizeof(buf))));
-		}
-		break;
-
-    	     case RAD_MICROSOFT_MS_PRIMARY_DNS_SERVER:
-    		auth->params.peer_dns[0] = rad_cvt_addr(data);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_PRIMARY_DNS_SERVER: %s",
-		    auth->info.lnkname, inet_ntoa(auth->params.peer_dns[0])));
-		break;
-
-    	     case RAD_MICROSOFT_MS_SECONDARY_DNS_SERVER:
-    		auth->params.peer_dns[1] = rad_cvt_addr(data);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_SECONDARY_DNS_SERVER: %s",
-		    auth->info.lnkname, inet_ntoa(auth->params.peer_dns[1])));
-		break;
-
-    	     case RAD_MICROSOFT_MS_PRIMARY_NBNS_SERVER:
-    		auth->params.peer_nbns[0] = rad_cvt_addr(data);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_PRIMARY_NBNS_SERVER: %s",
-		    auth->info.lnkname, inet_ntoa(auth->params.peer_nbns[0])));
-		break;
-
-    	     case RAD_MICROSOFT_MS_SECONDARY_NBNS_SERVER:
-    		auth->params.peer_nbns[1] = rad_cvt_addr(data);
-		Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MICROSOFT_MS_SECONDARY_NBNS_SERVER: %s",
-		    auth->info.lnkname, inet_ntoa(auth->params.peer_nbns[1])));
-		break;
-
-	      default:
-		Log(LG_RADIUS2, ("[%s] RADIUS: Dropping MICROSOFT vendor specific attribute: %d",
-		  auth->info.lnkname, res));
-		break;
-	    }
-	    break;
+static int
+RadDecMppePolicy(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+
+    (void)len;
+    auth->params.msoft.policy = rad_cvt_int(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %d (%s)",
+	auth->info.lnkname, d->name, auth->params.msoft.policy,
+	AuthMPPEPolicyname(auth->params.msoft.policy)));
+    return (RAD_ACK);
+}
+
+static int
+RadDecMppeTypes(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    char	buf[64];
+
+    (void)len;
+    auth->params.msoft.types = rad_cvt_int(data);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %d (%s)",
+	auth->info.lnkname, d->name, auth->params.msoft.types,
+	AuthMPPETypesname(auth->params.msoft.types, buf, sizeof(buf))));
+    return (RAD_ACK);
+}
 
-	  case RAD_VENDOR_MPD:
-
-	    if (res == RAD_MPD_DROP_USER) {
-	        auth->drop_user = rad_cvt_int(data);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_DROP_USER: %d",
-		    auth->info.lnkname, auth->drop_user));
-	        break;
-	    } else if (res == RAD_MPD_ACTION) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_ACTION: %s",
-	    	    auth->info.lnkname, tmpval));
-		strlcpy(auth->params.action, tmpval,
-		    sizeof(auth->params.action));
-		free(tmpval);
-		break;
-	    } else if (res == RAD_MPD_IFACE_NAME) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_IFACE_NAME: %s",
-	    	    auth->info.lnkname, tmpval));
-		strlcpy(auth->params.ifname, tmpval,
-		    sizeof(auth->params.ifname));
-		free(tmpval);
-		break;
-	    } else
+#if defined(USE_NG_BPF) || defined(USE_IPFW)
+/*
+ * RadDecAcl()
+ *
+ * ACL attributes, "[filter#|dir#]num[#name]=rule". Lists are kept
+ * sorted by number; the position of the last insertion into each list
+ * is remembered, so ACLs sent in ascending order are appended without
+ * walking the whole list.
+ */
+
+static int
+RadDecAcl(struct raddecode *rd, const struct radattrdec *d,
+	const void *data, size_t len)
+{
+    AuthData	const auth = rd->auth;
+    struct acl	**acls, **head, *acls1;
+    char	*acl1, *acl2, *acl3;
+    int		i, k;
+
+    acl1 = RadDecString(rd, data, len);
+    Log(LG_RADIUS2, ("[%s] RADIUS: Get %s: %s",
+	auth->info.lnkname, d->name, acl1));
+    head = RAD_DEC_FIELD(rd, d, struct acl *);
+
+    if (d->aux == RAD_ACL_FILTER) {
+	acl2 = strsep(&acl1, "#");
+	i = atoi(acl2);
+	if (i <= 0 || i > ACL_FILTERS) {
+	    Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Wrong filter number: %i",
+		auth->info.lnkname, i));
+	    return (RAD_ACK);
+	}
+	head += i - 1;
+    } else if (d->aux == RAD_ACL_LIMIT) {
+	acl2 = strsep(&acl1, "#");
+	if (strcasecmp(acl2, "in") == 0) {
+	    i = 0;
+	} else if (strcasecmp(acl2, "out") == 0) {
+	    i = 1;
+	} else {
+	    Log(LG_ERR|LG_ERR, ("[%s] RADIUS: Wrong limit direction: '%s'",
+		auth->info.lnkname, acl2));
+	    return (RAD_ACK);
+	}
+	head += i;
+    }
+
+    if (acl1 == NULL) {
+	Log(LG_ERR, ("[%s] RADIUS: Incorrect acl!", auth->info.lnkname));
+	return (RAD_ACK);
+    }
+    acl3 = acl1;
+    strsep(&acl3, "=");
+    acl2 = acl1;
+    strsep(&acl2, "#");
+    i = atoi(acl1);
+    if (i <= 0) {
+	Log(LG_ERR, ("[%s] RADIUS: Wrong acl number: %i",
+	    auth->info.lnkname, i));
+	return (RAD_ACK);
+    }
+    if ((acl3 == NULL) || (acl3[0] == 0)) {
+	Log(LG_ERR, ("[%s] RADIUS: Wrong acl", auth->info.lnkname));
+	return (RAD_ACK);
+    }
+    acls1 = Malloc(MB_AUTH, sizeof(struct acl) + strlen(acl3));
+    if (d->aux != RAD_ACL_TABLE_STATIC) {
+	acls1->number = i;
+	acls1->real_number = 0;
+    } else {
+	acls1->number = 0;
+	acls1->real_number = i;
+    }
+    if (acl2)
+	strlcpy(acls1->name, acl2, sizeof(acls1->name));
+    strcpy(acls1->rule, acl3);
+
+    /* Start from the last insertion if the new ACL can't go before it.
+       An equal number goes right before it, as it was placed before
+       all ACLs with its number. */
+    for (k = 0; k < rd->nhints && rd->hint[k].head != head; k++)
+	;
+    acls = head;
+    if (k < rd->nhints) {
+	if ((*rd->hint[k].pos)->number < acls1->number)
+	    acls = &(*rd->hint[k].pos)->next;
+	else if ((*rd->hint[k].pos)->number == acls1->number)
+	    acls = rd->hint[k].pos;
+    }
+    while ((*acls != NULL) && ((*acls)->number < acls1->number))
+	acls = &((*acls)->next);
+
+    if (*acls == NULL) {
+	acls1->next = NULL;
+    } else if (((*acls)->number == acls1->number) &&
+	    (d->aux != RAD_ACL_TABLE) &&
+	    (d->aux != RAD_ACL_TABLE_STATIC)) {
+	Log(LG_ERR, ("[%s] RADIUS: Duplicate acl", auth->info.lnkname));
+	Freee(acls1);
+	return (RAD_ACK);
+    } else {
+	acls1->next = *acls;
+    }
+    *acls = acls1;
+
+    if (k == rd->nhints && k < RAD_ACL_HINTS) {
+	rd->hint[k].head = head;
+	rd->nhints++;
+    }
+    if (k < RAD_ACL_HINTS)
+	rd->hint[k].pos = acls;
+    return (RAD_ACK);
+}
+#endif /* USE_NG_BPF or USE_IPFW */
+
+/*
+ * Reply attributes decoding table
+ */
+
+  #define RAD_DEC(vendor, type, func, field, aux, eap)	\
+	{ vendor, type, #type, func, RAD_DEC_OFF(field), aux, eap }
+  #define RAD_DEC_NOFIELD(vendor, type, func, eap)	\
+	{ vendor, type, #type, func, 0, 0, eap }
+
+  static const struct radattrdec	gRadAttrDec[] = {
+    RAD_DEC(0, RAD_STATE, RadDecBinary, params.state,
+	RAD_DEC_OFF(params.state_len), 1),
+    RAD_DEC(0, RAD_CLASS, RadDecBinary, params.class,
+	RAD_DEC_OFF(params.class_len), 1),
+    /* libradius already checks the message-authenticator, so simply ignore it */
+    RAD_DEC_NOFIELD(0, RAD_MESSAGE_AUTHENTIC, RadDecNone, 1),
+    RAD_DEC_NOFIELD(0, RAD_EAP_MESSAGE, RadDecEapMessage, 1),
+
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_IP_ADDRESS, RadDecFramedIp, 0),
+#ifdef HAVE_RAD_ADDR6
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_IPV6_ADDRESS, RadDecFramedIpv6, 0),
+#endif
+    RAD_DEC(0, RAD_USER_NAME, RadDecStrBuf, params.authname,
+	AUTH_MAX_AUTHNAME, 0),
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_IP_NETMASK, RadDecNetmask, 0),
+    RAD_DEC(0, RAD_FRAMED_ROUTE, RadDecRoute, params.routes,
+	ALLOW_IPV4, 0),
+    RAD_DEC(0, RAD_FRAMED_IPV6_ROUTE, RadDecRoute, params.routes,
+	ALLOW_IPV6, 0),
+    RAD_DEC(0, RAD_SESSION_TIMEOUT, RadDecUint, params.session_timeout, 0, 0),
+    RAD_DEC(0, RAD_IDLE_TIMEOUT, RadDecUint, params.idle_timeout, 0, 0),
+    RAD_DEC(0, RAD_ACCT_INTERIM_INTERVAL, RadDecUint, params.acct_update, 0, 0),
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_MTU, RadDecMtu, 0),
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_COMPRESSION, RadDecCompression, 0),
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_PROTOCOL, RadDecInfo, 0),
+    RAD_DEC_NOFIELD(0, RAD_FRAMED_ROUTING, RadDecInfo, 0),
+    RAD_DEC(0, RAD_FILTER_ID, RadDecStrDup, params.filter_id, 0, 0),
+    RAD_DEC_NOFIELD(0, RAD_SERVICE_TYPE, RadDecInfo, 0),
+    RAD_DEC(0, RAD_REPLY_MESSAGE, RadDecStrDup, reply_message, 0, 0),
+    RAD_DEC(0, RAD_FRAMED_POOL, RadDecStrBuf, params.ippool,
+	LINK_MAX_NAME, 0),
+
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_CHAP_ERROR,
+	RadDecChapError, mschap_error, 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_CHAP2_SUCCESS,
+	RadDecChap2Success, mschapv2resp, 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_CHAP_DOMAIN,
+	RadDecStrDup, params.msdomain, 0, 0),
+#ifdef CCP_MPPC
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_MPPE_RECV_KEY,
+	RadDecMppeKey, params.msoft.recv_key, 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_MPPE_SEND_KEY,
+	RadDecMppeKey, params.msoft.xmit_key, 0, 0),
+    RAD_DEC_NOFIELD(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_CHAP_MPPE_KEYS,
+	RadDecMppeKeys, 0),
+#endif
+    RAD_DEC_NOFIELD(RAD_VENDOR_MICROSOFT,
+	RAD_MICROSOFT_MS_MPPE_ENCRYPTION_POLICY, RadDecMppePolicy, 0),
+    RAD_DEC_NOFIELD(RAD_VENDOR_MICROSOFT,
+	RAD_MICROSOFT_MS_MPPE_ENCRYPTION_TYPES, RadDecMppeTypes, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_PRIMARY_DNS_SERVER,
+	RadDecAddr, params.peer_dns[0], 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_SECONDARY_DNS_SERVER,
+	RadDecAddr, params.peer_dns[1], 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_PRIMARY_NBNS_SERVER,
+	RadDecAddr, params.peer_nbns[0], 0, 0),
+    RAD_DEC(RAD_VENDOR_MICROSOFT, RAD_MICROSOFT_MS_SECONDARY_NBNS_SERVER,
+	RadDecAddr, params.peer_nbns[1], 0, 0),
+
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_DROP_USER, RadDecUint, drop_user, 0, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_ACTION, RadDecStrBuf, params.action,
+	sizeof(((struct authparams *)0)->action), 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_IFACE_NAME, RadDecStrBuf, params.ifname,
+	IFNAMSIZ, 0),
 #ifdef SIOCSIFDESCR
-	    if (res == RAD_MPD_IFACE_DESCR) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_IFACE_DESCR: %s",
-	    	    auth->info.lnkname, tmpval));
-		Freee(auth->params.ifdescr);
-		auth->params.ifdescr = Mdup(MB_AUTH, tmpval, len + 1);
-		free(tmpval);
-		break;
-	    } else
-#endif /* SIOCSIFDESCR */
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_IFACE_DESCR, RadDecStrDup,
+	params.ifdescr, 0, 0),
+#endif
 #ifdef SIOCAIFGROUP
-	    if (res == RAD_MPD_IFACE_GROUP) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_IFACE_GROUP: %s",
-	    	    auth->info.lnkname, tmpval));
-		strlcpy(auth->params.ifgroup, tmpval,
-		    sizeof(auth->params.ifgroup));
-		free(tmpval);
-		break;
-	    } else
-#endif /* SIOCAIFGROUP */
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_IFACE_GROUP, RadDecStrBuf,
+	params.ifgroup, IFNAMSIZ, 0),
+#endif
 #ifdef USE_IPFW
-	    if (res == RAD_MPD_RULE) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_RULE: %s",
-		auth->info.lnkname, acl));
-	      acls = &(auth->params.acl_rule);
-	    } else if (res == RAD_MPD_PIPE) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_PIPE: %s",
-	        auth->info.lnkname, acl));
-	      acls = &(auth->params.acl_pipe);
-	    } else if (res == RAD_MPD_QUEUE) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_QUEUE: %s",
-	        auth->info.lnkname, acl));
-	      acls = &(auth->params.acl_queue);
-	    } else if (res == RAD_MPD_TABLE) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_TABLE: %s",
-	        auth->info.lnkname, acl));
-	      acls = &(auth->params.acl_table);
-	    } else if (res == RAD_MPD_TABLE_STATIC) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_TABLE_STATIC: %s",
-	        auth->info.lnkname, acl));
-	      acls = &(auth->params.acl_table);
-	    } else
-#endif /* USE_IPFW */
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_RULE, RadDecAcl, params.acl_rule,
+	RAD_ACL_PLAIN, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_PIPE, RadDecAcl, params.acl_pipe,
+	RAD_ACL_PLAIN, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_QUEUE, RadDecAcl, params.acl_queue,
+	RAD_ACL_PLAIN, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_TABLE, RadDecAcl, params.acl_table,
+	RAD_ACL_TABLE, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_TABLE_STATIC, RadDecAcl,
+	params.acl_table, RAD_ACL_TABLE_STATIC, 0),
+#endif
 #ifdef USE_NG_BPF
-	    if (res == RAD_MPD_FILTER) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_FILTER: %s",
-	        auth->info.lnkname, acl));
-	      acl2 = strsep(&acl1, "#");
-	      i = atoi(acl2);
-	      if (i <= 0 || i > ACL_FILTERS) {
-	        Log(LG_ERR|LG_RADIUS, ("[%s] RADIUS: Wrong filter number: %i",
-		  auth->info.lnkname, i));
-	        free(acl);
-	        break;
-	      }
-	      acls = &(auth->params.acl_filters[i - 1]);
-	    } else if (res == RAD_MPD_LIMIT) {
-	      acl1 = acl = rad_cvt_string(data, len);
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_LIMIT: %s",
-	        auth->info.lnkname, acl));
-	      acl2 = strsep(&acl1, "#");
-	      if (strcasecmp(acl2, "in") == 0) {
-	        i = 0;
-	      } else if (strcasecmp(acl2, "out") == 0) {
-	        i = 1;
-	      } else {
-	        Log(LG_ERR|LG_ERR, ("[%s] RADIUS: Wrong limit direction: '%s'",
-		  auth->info.lnkname, acl2));
-	        free(acl);
-	        break;
-	      }
-	      acls = &(auth->params.acl_limits[i]);
-	    } else if (res == RAD_MPD_INPUT_ACCT) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_INPUT_ACCT: %s",
-	    	    auth->info.lnkname, tmpval));
-		strlcpy(auth->params.std_acct[0], tmpval,
-		    sizeof(auth->params.std_acct[0]));
-		free(tmpval);
-		break;
-	    } else if (res == RAD_MPD_OUTPUT_ACCT) {
-		tmpval = rad_cvt_string(data, len);
-	        Log(LG_RADIUS2, ("[%s] RADIUS: Get RAD_MPD_OUTPUT_ACCT: %s",
-	    	    auth->info.lnkname, tmpval));
-		strlcpy(auth->params.std_acct[1], tmpval,
-		    sizeof(auth->params.std_acct[1]));
-		free(tmpval);
-		break;
-	    } else
-#endif /* USE_NG_BPF */
-	    {
-	      Log(LG_RADIUS2, ("[%s] RADIUS: Dropping MPD vendor specific attribute: %d",
-		auth->info.lnkname, res));
-	      break;
-	    }
-#if defined(USE_NG_BPF) || defined(USE_IPFW)
-	    if (acl1 == NULL) {
-	      Log(LG_ERR, ("[%s] RADIUS: Incorrect acl!", auth->info.lnkname));
-	      free(acl);
-	      break;
-	    }
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_FILTER, RadDecAcl, params.acl_filters,
+	RAD_ACL_FILTER, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_LIMIT, RadDecAcl, params.acl_limits,
+	RAD_ACL_LIMIT, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_INPUT_ACCT, RadDecStrBuf,
+	params.std_acct[0], ACL_NAME_LEN, 0),
+    RAD_DEC(RAD_VENDOR_MPD, RAD_MPD_OUTPUT_ACCT, RadDecStrBuf,
+	params.std_acct[1], ACL_NAME_LEN, 0),
+#endif
+  };
 
-	    acl3 = acl1;
-	    strsep(&acl3, "=");
-	    acl2 = acl1;
-	    strsep(&acl2, "#");
-	    i = atoi(acl1);
-	    if (i <= 0) {
-	      Log(LG_ERR, ("[%s] RADIUS: Wrong acl number: %i",
-		auth->info.lnkname, i));
-	      free(acl);
-	      break;
-	    }
-	    if ((acl3 == NULL) || (acl3[0] == 0)) {
-	      Log(LG_ERR, ("[%s] RADIUS: Wrong acl", auth->info.lnkname));
-	      free(acl);
-	      break;
-	    }
-	    acls1 = Malloc(MB_AUTH, sizeof(struct acl) + strlen(acl3));
-	    if (res != RAD_MPD_TABLE_STATIC) {
-		    acls1->number = i;
-		    acls1->real_number = 0;
-	    } else {
-		    acls1->number = 0;
-		    acls1->real_number = i;
-	    }
-	    if (acl2)
-		strlcpy(acls1->name, acl2, sizeof(acls1->name));
-	    strcpy(acls1->rule, acl3);
-	    while ((*acls != NULL) && ((*acls)->number < acls1->number))
-	      acls = &((*acls)->next);
-
-	    if (*acls == NULL) {
-	      acls1->next = NULL;
-	    } else if (((*acls)->number == acls1->number) &&
-		(res != RAD_MPD_TABLE) &&
-		(res != RAD_MPD_TABLE_STATIC)) {
-	      Log(LG_ERR, ("[%s] RADIUS: Duplicate acl", auth->info.lnkname));
-	      Freee(acls1);
-	      free(acl);
-	      break;
-	    } else {
-	      acls1->next = *acls;
-	    }
-	    *acls = acls1;
+  #define RAD_DEC_NUM	(sizeof(gRadAttrDec) / sizeof(*gRadAttrDec))
 
-	    free(acl);
-	    break;
-#endif /* USE_NG_BPF or USE_IPFW */
+  /* Decoders indexed by vendor and attribute type */
+  static const struct radattrdec	*gRadAttrIndex[RAD_DEC_VENDORS][256];
+  static pthread_once_t		gRadAttrOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * RadDecVendor()
+ */
+
+static int
+RadDecVendor(u_int32_t vendor)
+{
+    switch (vendor) {
+	case 0:
+	    return (RAD_DEC_STD);
+	case RAD_VENDOR_MICROSOFT:
+	    return (RAD_DEC_MICROSOFT);
+	case RAD_VENDOR_MPD:
+	    return (RAD_DEC_MPD);
+	default:
+	    return (-1);
+    }
+}
+
+/*
+ * RadDecInit()
+ */
+
+static void
+RadDecInit(void)
+{
+    const struct radattrdec	*d;
+
+    for (d = gRadAttrDec; d < gRadAttrDec + RAD_DEC_NUM; d++)
+	gRadAttrIndex[RadDecVendor(d->vendor)][d->type] = d;
+}
+
+/*
+ * RadiusGetParams()
+ *
+ * Decode reply attributes with the gRadAttrDec table.
+ */
 
-	  default:
+static int
+RadiusGetParams(AuthData auth, int eap_proxy)
+{
+  struct raddecode		rd;
+  const struct radattrdec	*d;
+  int		res, v, j;
+  size_t	len;
+  const void	*data;
+  u_int32_t	vendor;
+  struct ifaceroute	*r, *r1;
+
+  Freee(auth->params.eapmsg);
+  auth->params.eapmsg = NULL;
+
+  pthread_once(&gRadAttrOnce, RadDecInit);
+  rd.auth = auth;
+#if defined(USE_NG_BPF) || defined(USE_IPFW)
+  rd.nhints = 0;
+#endif
+
+  while ((res = rad_get_attr(auth->radius.handle, &data, &len)) > 0) {
+
+    vendor = 0;
+    if (res == RAD_VENDOR_SPECIFIC) {
+	if (eap_proxy)
+	    continue;
+	if ((res = rad_get_vendor_attr(&vendor, &data, &len)) == -1) {
+	    Log(LG_RADIUS, ("[%s] RADIUS: Get vendor attr failed: %s",
+		auth->info.lnkname, rad_strerror(auth->radius.handle)));
+	    return RAD_NACK;
+	}
+    }
+    if ((v = RadDecVendor(vendor)) < 0 || res < 0 || res > 255 ||
+	(d = gRadAttrIndex[v][res]) == NULL) {
+	if (eap_proxy)
+	    continue;
+	if (vendor == 0) {
+	    Log(LG_RADIUS2, ("[%s] RADIUS: Dropping attribute: %d",
+		auth->info.lnkname, res));
+	} else {
 	    Log(LG_RADIUS2, ("[%s] RADIUS: Dropping vendor %d attribute: %d",
-	      auth->info.lnkname, vendor, res));
-	    break;
+		auth->info.lnkname, vendor, res));
 	}
-	break;
-
-      default:
-	Log(LG_RADIUS2, ("[%s] RADIUS: Dropping attribute: %d",
-	  auth->info.lnkname, res));
-	break;
+	continue;
     }
+    if (eap_proxy && !d->eap)
+	continue;
+    if ((*d->func)(&rd, d, data, len) == RAD_NACK)
+	return (RAD_NACK);
   }
 
     if (auth->acct_type == 0) {
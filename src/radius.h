@@ -26,6 +26,9 @@
 #define RADIUS_PAP		2
 #define RADIUS_EAP		3
 #define RADIUS_MAX_SERVERS	10
+#define RADIUS_ATTRS_MAX	512	/* Pre-encoded static attributes */
+#define RADIUS_HOLDDOWN		30	/* Seconds a dead server is skipped */
+#define RADIUS_HOLDDOWN_FAILS	3	/* Failures in a row to hold it down */
 
 #ifndef RAD_UPDATE
 #define RAD_UPDATE		3
@@ -128,6 +131,14 @@ enum {
 	RADIUS_CONF_MESSAGE_AUTHENTIC
 };
 
+/* Server selection strategies */
+enum {
+	RADIUS_STRATEGY_FAILOVER,	/* Configured order */
+	RADIUS_STRATEGY_ROUND_ROBIN,
+	RADIUS_STRATEGY_LEAST_OUTSTANDING,
+	RADIUS_STRATEGY_WEIGHTED	/* Inverse to response time */
+};
+
 extern const struct cmdtab RadiusSetCmds[];
 extern const struct cmdtab RadiusUnSetCmds[];
 
@@ -141,6 +152,19 @@ struct radiusserver_conf {
 };
 typedef struct radiusserver_conf *RadServe_Conf;
 
+/* Health of a server port, shared by all requests */
+struct radhealth {
+	char	*hostname;
+	in_port_t port;
+	u_int	outstanding;		/* Requests in flight */
+	u_int	fails;			/* Failures in a row */
+	u_int	rtt;			/* Response time EWMA, microseconds */
+	time_t	holddown;		/* Skipped until */
+	u_long	requests;
+	u_long	failures;
+	struct	radhealth *next;
+};
+
 struct radiusconf {
 	int	radius_timeout;
 	int	radius_retries;
@@ -153,6 +177,11 @@ struct radiusconf {
 	char	*file;
 	struct	radiusserver_conf *server;
 	struct	optinfo options;		/* Configured options */
+	u_char	*attrs;			/* Pre-encoded static attributes */
+	int	attrs_len;
+	int	strategy;		/* Server selection strategy */
+	int	holddown;		/* Dead server hold-down, seconds */
+	int	holddown_fails;
 };
 typedef struct radiusconf *RadConf;
 
@@ -183,8 +212,11 @@ struct authdata;
  */
 
 extern void RadiusInit(Link l);
+extern void RadiusConfDup(RadConf conf);
+extern void RadiusConfFree(RadConf conf);
 extern int RadiusAuthenticate(struct authdata *auth);
 extern int RadiusAccount(struct authdata *auth);
+extern int RadiusAccountBatch(struct authdata **auths, int n, int *ok);
 extern void RadiusClose(struct authdata *auth);
 extern void RadiusEapProxy(void *arg);
 extern int RadStat(Context ctx, int ac, const char *const av[], const void *arg);
@@ -10,6 +10,7 @@
 #include "ppp.h"
 #include "radsrv.h"
 #include "util.h"
+#include "console.h"
 
 #include <stdint.h>
 #include <radlib.h>
@@ -28,7 +29,66 @@
     SET_SELF,
     SET_PEER,
     SET_DISABLE,
-    SET_ENABLE
+    SET_ENABLE,
+    SET_WORKERS
+  };
+
+  struct radsrvworker;
+
+  /* Request parsed by a receiver, with what to do to the sessions */
+  struct radsrvreq {
+    int			result;		/* Request code */
+    int			found;		/* Sessions affected */
+    int			err;		/* Error-Cause if none */
+    struct in_addr	from;		/* Client address */
+    struct timespec	start;		/* When received */
+    char		*username, *called, *calling, *sesid;
+    char		*msesid, *link, *bundle, *iface;
+    int			nasport, ifindex;
+    u_int		session_timeout, idle_timeout, acct_update;
+    struct in_addr	ip;
+    u_char		*state, *rad_class;
+    int			state_len, class_len;
+    int			authentic;
+#ifdef USE_IPFW
+    struct acl		*acl_rule;	/* ipfw rules */
+    struct acl		*acl_pipe;	/* ipfw pipes */
+    struct acl		*acl_queue;	/* ipfw queues */
+    struct acl		*acl_table;	/* ipfw tables */
+#endif
+#ifdef USE_NG_BPF
+    struct acl		*acl_filters[ACL_FILTERS]; /* mpd's internal bpf filters */
+    struct acl		*acl_limits[ACL_DIRS];	/* traffic limits based on mpd's filters */
+    char 		std_acct[ACL_DIRS][ACL_NAME_LEN]; /* Names of ACL returned in standard accounting */
+#endif
+    u_char		done;		/* Applied by the event loop */
+    struct radsrvworker	*w;
+    STAILQ_ENTRY(radsrvreq) next;
+  };
+
+  /* Receive socket served by its own thread */
+  struct radsrvworker {
+    pthread_t		tid;
+    int			fd;
+    struct rad_handle	*handle;
+    pthread_cond_t	cond;		/* Request applied */
+    struct optinfo	options;	/* Server config when started */
+    struct in_addr	addr;
+  };
+
+  /* Per client counters */
+  struct radsrvstat {
+    struct in_addr	addr;
+    u_long		disconnect;
+    u_long		coa;
+    u_long		acks;
+    u_long		naks;
+    u_long		errors;		/* Unsupported requests */
+    uint64_t		latency;	/* Microseconds, total */
+    u_int		latency_max;
+    time_t		sec;		/* Second of cur */
+    u_int		cur, last, peak;	/* Requests per second */
+    struct radsrvstat	*next;
   };
 
 
@@ -37,6 +97,20 @@
  */
 
   static int	RadsrvSetCommand(Context ctx, int ac, const char *const av[], const void *arg);
+  static void	RadsrvEvent(int type, void *cookie);
+  static int	RadsrvReceive(const struct optinfo *options,
+		    struct in_addr addr, struct rad_handle *h, int fd,
+		    struct radsrvreq *r);
+  static void	RadsrvApply(struct radsrvreq *r);
+  static void	RadsrvRespond(struct rad_handle *h, struct radsrvreq *r);
+  static void	RadsrvReqFree(struct radsrvreq *r);
+  static int	RadsrvSocket(Radsrv w, int reuse);
+  static void	RadsrvAddClients(Radsrv w, struct rad_handle *h);
+  static int	RadsrvStartWorkers(Radsrv w);
+  static void	RadsrvStopWorkers(void);
+  static void	*RadsrvWorkerMain(void *arg);
+  static void	RadsrvDone(int type, void *cookie);
+  static struct radsrvstat	*RadsrvClientStat(struct in_addr addr);
 
 /*
  * GLOBAL VARIABLES
@@ -55,6 +129,8 @@
   	RadsrvSetCommand, NULL, 2, (void *) SET_ENABLE },
     { "disable [opt ...]",	"Disable radsrv option" ,
   	RadsrvSetCommand, NULL, 2, (void *) SET_DISABLE },
+    { "workers {num}",		"Set number of receive sockets and threads" ,
+  	RadsrvSetCommand, NULL, 2, (void *) SET_WORKERS },
     { NULL, NULL, NULL, NULL, 0, NULL },
   };
 
@@ -69,6 +145,18 @@
     { 0,	0,		NULL	},
   };
 
+  static pthread_mutex_t	gRadsrvMutex;
+  static STAILQ_HEAD(, radsrvreq) gRadsrvQueue = STAILQ_HEAD_INITIALIZER(gRadsrvQueue);
+  static struct radsrvworker	*gRadsrvWorkers;
+  static int			gRadsrvNum;	/* Running workers */
+  static u_char			gRadsrvStop;
+  static int			gRadsrvPipe[2] = { -1, -1 };	/* Requests queued */
+  static int			gRadsrvStopPipe[2] = { -1, -1 };
+  static EventRef		gRadsrvEvent;
+  static struct radsrvstat	*gRadsrvStats;
+  static int			gRadsrvStatsNum;
+  static u_long			gRadsrvRecvErrors;
+
 /*
  * RadsrvInit()
  */
@@ -85,105 +173,152 @@ RadsrvInit(Radsrv w)
     ParseAddr(DEFAULT_RADSRV_IP, &w->addr, ALLOW_IPV4);
     w->port = DEFAULT_RADSRV_PORT;
 
+    if (pthread_mutex_init(&gRadsrvMutex, NULL) != 0) {
+	Log(LG_ERR, ("radsrv: can't create mutex"));
+	return (-1);
+    }
+
     return (0);
 }
 
+/*
+ * RadsrvEvent()
+ *
+ * Serve a request inline in the event loop.
+ */
+
 static void
 RadsrvEvent(int type, void *cookie)
 {
-    Radsrv	w = (Radsrv)cookie;
+    Radsrv		w = (Radsrv)cookie;
+    struct radsrvreq	r;
+
+    (void)type;
+    if (RadsrvReceive(&w->options, w->addr.u.ip4, w->handle, w->fd,
+	    &r) == 0) {
+	RadsrvApply(&r);
+	RadsrvRespond(w->handle, &r);
+    }
+    RadsrvReqFree(&r);
+}
+
+/*
+ * RadsrvReceive()
+ *
+ * Receive, parse and validate a request. Does not touch the sessions
+ * nor the server config, so it is safe to call from a worker thread.
+ * Returns 0 if the request is to be applied, -1 if it has been answered
+ * or dropped already.
+ */
+
+static int
+RadsrvReceive(const struct optinfo *options, struct in_addr addr,
+    struct rad_handle *h, int fd, struct radsrvreq *r)
+{
     const void	*data;
     size_t	len;
-    int		res, result, found, err, anysesid, l;
-    Bund	B;
-    Link  	L;
-    char        *tmpval;
-    char	*username = NULL, *called = NULL, *calling = NULL, *sesid = NULL;
-    char	*msesid = NULL, *link = NULL, *bundle = NULL, *iface = NULL;
-    int		nasport = -1, serv_type = 0, ifindex = -1, i;
-    u_int	session_timeout = UINT_MAX, idle_timeout = UINT_MAX;
-    u_int	acct_update = UINT_MAX;
-    struct in_addr ip = { INADDR_BROADCAST };
+    int		res, anysesid;
+    int		serv_type = 0;
     struct in_addr nas_ip = { INADDR_BROADCAST };
+    struct sockaddr_in from;
+    socklen_t	fromlen = sizeof(from);
+    struct radsrvstat *s;
+    char        *tmpval;
     char	buf[64];
     u_int32_t	vendor;
-    u_char	*state = NULL, *rad_class = NULL;
-    int		state_len = 0;
-    int		class_len = 0;
-    int		authentic = 0;
 #if defined(USE_NG_BPF) || defined(USE_IPFW)
     struct acl	**acls, *acls1;
     char	*acl, *acl1, *acl2, *acl3;
+    int		i;
 #endif
-#ifdef USE_IPFW
-    struct acl		*acl_rule = NULL;	/* ipfw rules */
-    struct acl		*acl_pipe = NULL;	/* ipfw pipes */
-    struct acl		*acl_queue = NULL;	/* ipfw queues */
-    struct acl		*acl_table = NULL;	/* ipfw tables */
-#endif
-#ifdef USE_NG_BPF
-    struct acl		*acl_filters[ACL_FILTERS]; /* mpd's internal bpf filters */
-    struct acl		*acl_limits[ACL_DIRS];	/* traffic limits based on mpd's filters */
-    char 		std_acct[ACL_DIRS][ACL_NAME_LEN]; /* Names of ACL returned in standard accounting */
 
-    (void)type;
-    bzero(acl_filters, sizeof(acl_filters));
-    bzero(acl_limits, sizeof(acl_limits));
-    bzero(std_acct, sizeof(std_acct));
-#endif
-    result = rad_receive_request(w->handle);
-    if (result < 0) {
-	Log(LG_ERR, ("radsrv: request receive error: %d", result));
-	return;
+    memset(r, 0, sizeof(*r));
+    r->nasport = -1;
+    r->ifindex = -1;
+    r->session_timeout = UINT_MAX;
+    r->idle_timeout = UINT_MAX;
+    r->acct_update = UINT_MAX;
+    r->ip.s_addr = INADDR_BROADCAST;
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+
+    /* libradius does not tell who sent the request */
+    memset(&from, 0, sizeof(from));
+    (void)recvfrom(fd, buf, 1, MSG_PEEK, (struct sockaddr *)&from, &fromlen);
+    r->from = from.sin_addr;
+
+    r->result = rad_receive_request(h);
+    if (r->result < 0) {
+	Log(LG_ERR, ("radsrv: request receive error: %d", r->result));
+	MUTEX_LOCK(gRadsrvMutex);
+	gRadsrvRecvErrors++;
+	MUTEX_UNLOCK(gRadsrvMutex);
+	return (-1);
+    }
+
+    MUTEX_LOCK(gRadsrvMutex);
+    if ((s = RadsrvClientStat(r->from)) != NULL) {
+	if (r->result == RAD_DISCONNECT_REQUEST)
+	    s->disconnect++;
+	else if (r->result == RAD_COA_REQUEST)
+	    s->coa++;
+	else
+	    s->errors++;
+	if (s->sec != r->start.tv_sec) {
+	    s->last = (s->sec + 1 == r->start.tv_sec) ? s->cur : 0;
+	    s->sec = r->start.tv_sec;
+	    s->cur = 0;
+	}
+	if (++s->cur > s->peak)
+	    s->peak = s->cur;
     }
-    switch (result) {
+    MUTEX_UNLOCK(gRadsrvMutex);
+
+    switch (r->result) {
 	case RAD_DISCONNECT_REQUEST:
-	    if (!Enabled(&w->options, RADSRV_DISCONNECT)) {
+	    if (!Enabled(options, RADSRV_DISCONNECT)) {
 		Log(LG_ERR, ("radsrv: DISCONNECT request, support disabled"));
-		rad_create_response(w->handle, RAD_DISCONNECT_NAK);
-		rad_put_int(w->handle, RAD_ERROR_CAUSE, 501);
-		rad_send_response(w->handle);
-		return;
+		r->err = 501;
+		RadsrvRespond(h, r);
+		return (-1);
 	    }
 	    Log(LG_ERR, ("radsrv: DISCONNECT request"));
 	    break;
 	case RAD_COA_REQUEST:
-	    if (!Enabled(&w->options, RADSRV_COA)) {
+	    if (!Enabled(options, RADSRV_COA)) {
 		Log(LG_ERR, ("radsrv: CoA request, support disabled"));
-		rad_create_response(w->handle, RAD_COA_NAK);
-		rad_put_int(w->handle, RAD_ERROR_CAUSE, 501);
-		rad_send_response(w->handle);
-		return;
+		r->err = 501;
+		RadsrvRespond(h, r);
+		return (-1);
 	    }
 	    Log(LG_ERR, ("radsrv: CoA request"));
 	    break;
 	default:
-	    Log(LG_ERR, ("radsrv: unsupported request: %d", result));
-	    return;
+	    Log(LG_ERR, ("radsrv: unsupported request: %d", r->result));
+	    return (-1);
     }
     anysesid = 0;
-    while ((res = rad_get_attr(w->handle, &data, &len)) > 0) {
+    while ((res = rad_get_attr(h, &data, &len)) > 0) {
 	switch (res) {
 	    case RAD_USER_NAME:
 		anysesid = 1;
-		if (username)
-		    free(username);
-		username = rad_cvt_string(data, len);
-		Log(LG_RADIUS2, ("radsrv: Got RAD_USER_NAME: %s", username));
+		if (r->username)
+		    free(r->username);
+		r->username = rad_cvt_string(data, len);
+		Log(LG_RADIUS2, ("radsrv: Got RAD_USER_NAME: %s", r->username));
 		break;
 	    case RAD_CLASS:
 		tmpval = Bin2Hex(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_CLASS: %s", tmpval));
 		Freee(tmpval);
-		class_len = len;
-		if (rad_class != NULL)
-		    Freee(rad_class);
-		rad_class = Mdup(MB_AUTH, data, len);
+		r->class_len = len;
+		if (r->rad_class != NULL)
+		    Freee(r->rad_class);
+		r->rad_class = Mdup(MB_AUTH, data, len);
 		break;
 	    case RAD_NAS_IP_ADDRESS:
 		nas_ip = rad_cvt_addr(data);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_NAS_IP_ADDRESS: %s",
-		    inet_ntoa(nas_ip)));
+		    inet_ntop(AF_INET, &nas_ip, buf, sizeof(buf))));
 		break;
 	    case RAD_SERVICE_TYPE:
 		serv_type = rad_cvt_int(data);
@@ -194,112 +329,112 @@ RadsrvEvent(int type, void *cookie)
 		tmpval = Bin2Hex(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_STATE: 0x%s", tmpval));
 		Freee(tmpval);
-		state_len = len;
-		if (state != NULL)
-		    Freee(state);
-		state = Mdup(MB_RADSRV, data, len);
+		r->state_len = len;
+		if (r->state != NULL)
+		    Freee(r->state);
+		r->state = Mdup(MB_RADSRV, data, len);
 		break;
 	    case RAD_CALLED_STATION_ID:
 		anysesid = 1;
-		if (called)
-		    free(called);
-		called = rad_cvt_string(data, len);
+		if (r->called)
+		    free(r->called);
+		r->called = rad_cvt_string(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_CALLED_STATION_ID: %s",
-		    called));
+		    r->called));
 		break;
 	    case RAD_CALLING_STATION_ID:
 		anysesid = 1;
-		if (calling)
-		    free(calling);
-		calling = rad_cvt_string(data, len);
+		if (r->calling)
+		    free(r->calling);
+		r->calling = rad_cvt_string(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_CALLING_STATION_ID: %s",
-		    calling));
+		    r->calling));
 		break;
 	    case RAD_ACCT_SESSION_ID:
 		anysesid = 1;
-		if (sesid)
-		    free(sesid);
-		sesid = rad_cvt_string(data, len);
+		if (r->sesid)
+		    free(r->sesid);
+		r->sesid = rad_cvt_string(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_ACCT_SESSION_ID: %s",
-		    sesid));
+		    r->sesid));
 		break;
 	    case RAD_ACCT_MULTI_SESSION_ID:
 		anysesid = 1;
-		if (msesid)
-		    free(msesid);
-		msesid = rad_cvt_string(data, len);
+		if (r->msesid)
+		    free(r->msesid);
+		r->msesid = rad_cvt_string(data, len);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_ACCT_MULTI_SESSION_ID: %s",
-		    msesid));
+		    r->msesid));
 		break;
 	    case RAD_FRAMED_IP_ADDRESS:
 		anysesid = 1;
-		ip = rad_cvt_addr(data);
+		r->ip = rad_cvt_addr(data);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_FRAMED_IP_ADDRESS: %s",
-		    inet_ntoa(ip)));
-		if (ip.s_addr == INADDR_BROADCAST)
+		    inet_ntop(AF_INET, &r->ip, buf, sizeof(buf))));
+		if (r->ip.s_addr == INADDR_BROADCAST)
 		    Log(LG_ERR, ("radsrv: incorrect Framed-IP-Address"));
 		break;
 	    case RAD_NAS_PORT:
 		anysesid = 1;
-		nasport = rad_cvt_int(data);
+		r->nasport = rad_cvt_int(data);
 		Log(LG_RADIUS2, ("radsrv: Got RAD_NAS_PORT: %d",
-		    nasport));
+		    r->nasport));
 		break;
 	    case RAD_SESSION_TIMEOUT:
-	        session_timeout = rad_cvt_int(data);
+	        r->session_timeout = rad_cvt_int(data);
 	        Log(LG_RADIUS2, ("radsrv: Got RAD_SESSION_TIMEOUT: %u",
-	    	    session_timeout));
+	    	    r->session_timeout));
 	        break;
 	    case RAD_IDLE_TIMEOUT:
-	        idle_timeout = rad_cvt_int(data);
+	        r->idle_timeout = rad_cvt_int(data);
 	        Log(LG_RADIUS2, ("radsrv: Got RAD_IDLE_TIMEOUT: %u",
-	            idle_timeout));
+	            r->idle_timeout));
 	        break;
 	    case RAD_ACCT_INTERIM_INTERVAL:
-		acct_update = rad_cvt_int(data);
+		r->acct_update = rad_cvt_int(data);
 	        Log(LG_RADIUS2, ("radsrv: Got RAD_ACCT_INTERIM_INTERVAL: %u",
-	    	    acct_update));
+	    	    r->acct_update));
 		break;
 	    case RAD_MESSAGE_AUTHENTIC:
 		Log(LG_RADIUS2, ("radsrv: Got RAD_MESSAGE_AUTHENTIC"));
-		authentic = 1;
+		r->authentic = 1;
 		break;
 	    case RAD_VENDOR_SPECIFIC:
 		if ((res = rad_get_vendor_attr(&vendor, &data, &len)) == -1) {
 		    Log(LG_RADIUS, ("radsrv: Get vendor attr failed: %s",
-			rad_strerror(w->handle)));
+			rad_strerror(h)));
 		    break;
 		}
 		switch (vendor) {
 		    case RAD_VENDOR_MPD:
 			if (res == RAD_MPD_LINK) {
-			    if (link)
-				free(link);
-			    link = rad_cvt_string(data, len);
+			    if (r->link)
+				free(r->link);
+			    r->link = rad_cvt_string(data, len);
 	    		    Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_LINK: %s",
-				link));
+				r->link));
 			    anysesid = 1;
 			    break;
 			} else if (res == RAD_MPD_BUNDLE) {
-			    if (bundle)
-				free(bundle);
-			    bundle = rad_cvt_string(data, len);
+			    if (r->bundle)
+				free(r->bundle);
+			    r->bundle = rad_cvt_string(data, len);
 	    		    Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_BINDLE: %s",
-				bundle));
+				r->bundle));
 			    anysesid = 1;
 			    break;
 			} else if (res == RAD_MPD_IFACE) {
-			    if (iface)
-				free(iface);
-			    iface = rad_cvt_string(data, len);
+			    if (r->iface)
+				free(r->iface);
+			    r->iface = rad_cvt_string(data, len);
 	    		    Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_IFACE: %s",
-				iface));
+				r->iface));
 			    anysesid = 1;
 			    break;
 			} else if (res == RAD_MPD_IFACE_INDEX) {
-			    ifindex = rad_cvt_int(data);
+			    r->ifindex = rad_cvt_int(data);
 	    		    Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_IFACE_INDEX: %d",
-				ifindex));
+				r->ifindex));
 			    anysesid = 1;
 			    break;
 			} else 
@@ -308,27 +443,27 @@ RadsrvEvent(int type, void *cookie)
     			  acl1 = acl = rad_cvt_string(data, len);
 		    	  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_RULE: %s",
 			    acl));
-		    	  acls = &acl_rule;
+		    	  acls = &r->acl_rule;
 			} else if (res == RAD_MPD_PIPE) {
 			  acl1 = acl = rad_cvt_string(data, len);
 		          Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_PIPE: %s",
 			    acl));
-		          acls = &acl_pipe;
+		          acls = &r->acl_pipe;
 		        } else if (res == RAD_MPD_QUEUE) {
 			  acl1 = acl = rad_cvt_string(data, len);
 			  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_QUEUE: %s",
 			    acl));
-			  acls = &acl_queue;
+			  acls = &r->acl_queue;
 			} else if (res == RAD_MPD_TABLE) {
 			  acl1 = acl = rad_cvt_string(data, len);
 			  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_TABLE: %s",
 			    acl));
-			  acls = &acl_table;
+			  acls = &r->acl_table;
 			} else if (res == RAD_MPD_TABLE_STATIC) {
 			  acl1 = acl = rad_cvt_string(data, len);
 			  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_TABLE_STATIC: %s",
 			    acl));
-			  acls = &acl_table;
+			  acls = &r->acl_table;
 			} else
 #endif /* USE_IPFW */
 #ifdef USE_NG_BPF
@@ -343,7 +478,7 @@ RadsrvEvent(int type, void *cookie)
 		            free(acl);
 	    		    break;
 			  }
-			  acls = &(acl_filters[i - 1]);
+			  acls = &(r->acl_filters[i - 1]);
 			} else if (res == RAD_MPD_LIMIT) {
 			  acl1 = acl = rad_cvt_string(data, len);
 		          Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_LIMIT: %s",
@@ -359,19 +494,19 @@ RadsrvEvent(int type, void *cookie)
 		            free(acl);
 			    break;
 		          }
-		          acls = &(acl_limits[i]);
+		          acls = &(r->acl_limits[i]);
 		        } else if (res == RAD_MPD_INPUT_ACCT) {
 			  tmpval = rad_cvt_string(data, len);
 	    		  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_INPUT_ACCT: %s",
 	    		    tmpval));
-			  strlcpy(std_acct[0], tmpval, sizeof(std_acct[0]));
+			  strlcpy(r->std_acct[0], tmpval, sizeof(r->std_acct[0]));
 			  free(tmpval);
 			  break;
 			} else if (res == RAD_MPD_OUTPUT_ACCT) {
 			  tmpval = rad_cvt_string(data, len);
 	    		  Log(LG_RADIUS2, ("radsrv: Get RAD_MPD_OUTPUT_ACCT: %s",
 	    		    tmpval));
-			  strlcpy(std_acct[1], tmpval, sizeof(std_acct[1]));
+			  strlcpy(r->std_acct[1], tmpval, sizeof(r->std_acct[1]));
 			  free(tmpval);
 			  break;
 			} else
@@ -446,71 +581,82 @@ RadsrvEvent(int type, void *cookie)
 		break;
 	}
     }
-    err = 0;
-    if (w->addr.u.ip4.s_addr != 0 && nas_ip.s_addr != INADDR_BROADCAST
-    && w->addr.u.ip4.s_addr != nas_ip.s_addr) {
+    if (addr.s_addr != 0 && nas_ip.s_addr != INADDR_BROADCAST
+    && addr.s_addr != nas_ip.s_addr) {
         Log(LG_ERR, ("radsrv: incorrect NAS-IP-Address"));
-	err = 403;
+	r->err = 403;
     } else if (anysesid == 0) {
         Log(LG_ERR, ("radsrv: request without session identification"));
-	err = 402;
+	r->err = 402;
     } else if (serv_type != 0) {
         Log(LG_ERR, ("radsrv: Service-Type attribute not supported"));
-	err = 405;
+	r->err = 405;
     }
-    if (err) {
-	if (result == RAD_DISCONNECT_REQUEST)
-	    rad_create_response(w->handle, RAD_DISCONNECT_NAK);
-	else
-	    rad_create_response(w->handle, RAD_COA_NAK);
-        rad_put_int(w->handle, RAD_ERROR_CAUSE, err);
-	if (state != NULL)
-	    rad_put_attr(w->handle, RAD_STATE, state, state_len);
-	if (authentic)
-	    rad_put_message_authentic(w->handle);
-	rad_send_response(w->handle);
-	goto cleanup;
+    if (r->err) {
+	RadsrvRespond(h, r);
+	return (-1);
     }
-    found = 0;
-    err = 503;
+    return (0);
+}
+
+/*
+ * RadsrvApply()
+ *
+ * Find the sessions of a parsed request and disconnect or change
+ * them. Must be called from the event loop.
+ */
+
+static void
+RadsrvApply(struct radsrvreq *r)
+{
+    int		l;
+    Bund	B;
+    Link  	L;
+    char	buf[64];
+#ifdef USE_NG_BPF
+    int		i;
+#endif
+
+    r->found = 0;
+    r->err = 503;
     for (l = 0; l < gNumLinks; l++) {
 	if ((L = gLinks[l]) != NULL) {
 	    B = L->bund;
-	    if (nasport != -1 && nasport != l)
+	    if (r->nasport != -1 && r->nasport != l)
 		continue;
-	    if (sesid && strcmp(sesid, L->session_id))
+	    if (r->sesid && strcmp(r->sesid, L->session_id))
 		continue;
-	    if (link && strcmp(link, L->name))
+	    if (r->link && strcmp(r->link, L->name))
 		continue;
-	    if (msesid && strcmp(msesid, L->msession_id))
+	    if (r->msesid && strcmp(r->msesid, L->msession_id))
 		continue;
-	    if (username && strcmp(username, L->lcp.auth.params.authname))
+	    if (r->username && strcmp(r->username, L->lcp.auth.params.authname))
 		continue;
-	    if (called && !PhysGetCalledNum(L, buf, sizeof(buf)) &&
-		    strcmp(called, buf))
+	    if (r->called && !PhysGetCalledNum(L, buf, sizeof(buf)) &&
+		    strcmp(r->called, buf))
 		continue;
-	    if (calling && !PhysGetCallingNum(L, buf, sizeof(buf)) &&
-		    strcmp(calling, buf))
+	    if (r->calling && !PhysGetCallingNum(L, buf, sizeof(buf)) &&
+		    strcmp(r->calling, buf))
 		continue;
-	    if (bundle && (!B || strcmp(bundle, B->name)))
+	    if (r->bundle && (!B || strcmp(r->bundle, B->name)))
 		continue;
-	    if (iface && (!B || strcmp(iface, B->iface.ifname)))
+	    if (r->iface && (!B || strcmp(r->iface, B->iface.ifname)))
 		continue;
-	    if (ifindex >= 0 && (!B || (uint)ifindex != B->iface.ifindex))
+	    if (r->ifindex >= 0 && (!B || (uint)r->ifindex != B->iface.ifindex))
 		continue;
-	    if (ip.s_addr != INADDR_BROADCAST && (!B ||
-		    ip.s_addr != B->iface.peer_addr.u.ip4.s_addr))
+	    if (r->ip.s_addr != INADDR_BROADCAST && (!B ||
+		    r->ip.s_addr != B->iface.peer_addr.u.ip4.s_addr))
 		continue;
 		
 	    Log(LG_RADIUS2, ("radsrv: Matched link: %s", L->name));
 	    if (L->tmpl) {
 		Log(LG_ERR, ("radsrv: Impossible to affect template"));
-		err = 504;
+		r->err = 504;
 		continue;
 	    }
-	    found++;
+	    r->found++;
 	
-	    if (result == RAD_DISCONNECT_REQUEST) {
+	    if (r->result == RAD_DISCONNECT_REQUEST) {
 		RecordLinkUpDownReason(NULL, L, 0, STR_MANUALLY, NULL);
 		LinkClose(L);
 	    } else { /* CoA */
@@ -530,37 +676,37 @@ RadsrvEvent(int type, void *cookie)
 	        L->lcp.auth.params.acl_pipe = NULL;
 	        L->lcp.auth.params.acl_queue = NULL;
 	        L->lcp.auth.params.acl_table = NULL;
-	        ACLCopy(acl_rule, &L->lcp.auth.params.acl_rule);
-	        ACLCopy(acl_pipe, &L->lcp.auth.params.acl_pipe);
-	        ACLCopy(acl_queue, &L->lcp.auth.params.acl_queue);
-	        ACLCopy(acl_table, &L->lcp.auth.params.acl_table);
+	        ACLCopy(r->acl_rule, &L->lcp.auth.params.acl_rule);
+	        ACLCopy(r->acl_pipe, &L->lcp.auth.params.acl_pipe);
+	        ACLCopy(r->acl_queue, &L->lcp.auth.params.acl_queue);
+	        ACLCopy(r->acl_table, &L->lcp.auth.params.acl_table);
 #endif /* USE_IPFW */
-		if (rad_class != NULL) {
+		if (r->rad_class != NULL) {
 		    if (L->lcp.auth.params.class != NULL)
 			Freee(L->lcp.auth.params.class);
-		    L->lcp.auth.params.class = Mdup(MB_AUTH, rad_class, class_len);
-		    L->lcp.auth.params.class_len = class_len;
+		    L->lcp.auth.params.class = Mdup(MB_AUTH, r->rad_class, r->class_len);
+		    L->lcp.auth.params.class_len = r->class_len;
 		}
 #ifdef USE_NG_BPF
 	        for (i = 0; i < ACL_FILTERS; i++) {
 	    	    ACLDestroy(L->lcp.auth.params.acl_filters[i]);
 	    	    L->lcp.auth.params.acl_filters[i] = NULL;
-	    	    ACLCopy(acl_filters[i], &L->lcp.auth.params.acl_filters[i]);
+	    	    ACLCopy(r->acl_filters[i], &L->lcp.auth.params.acl_filters[i]);
 		}
 	        for (i = 0; i < ACL_DIRS; i++) {
 	    	    ACLDestroy(L->lcp.auth.params.acl_limits[i]);
 	    	    L->lcp.auth.params.acl_limits[i] = NULL;
-	    	    ACLCopy(acl_limits[i], &L->lcp.auth.params.acl_limits[i]);
+	    	    ACLCopy(r->acl_limits[i], &L->lcp.auth.params.acl_limits[i]);
 		}
-		strcpy(L->lcp.auth.params.std_acct[0], std_acct[0]);
-		strcpy(L->lcp.auth.params.std_acct[1], std_acct[1]);
+		strcpy(L->lcp.auth.params.std_acct[0], r->std_acct[0]);
+		strcpy(L->lcp.auth.params.std_acct[1], r->std_acct[1]);
 #endif
-		if (session_timeout != UINT_MAX)
-		    L->lcp.auth.params.session_timeout = session_timeout;
-		if (idle_timeout != UINT_MAX)
-		    L->lcp.auth.params.idle_timeout = idle_timeout;
-		if (acct_update != UINT_MAX) {
-		    L->lcp.auth.params.acct_update = acct_update;
+		if (r->session_timeout != UINT_MAX)
+		    L->lcp.auth.params.session_timeout = r->session_timeout;
+		if (r->idle_timeout != UINT_MAX)
+		    L->lcp.auth.params.idle_timeout = r->idle_timeout;
+		if (r->acct_update != UINT_MAX) {
+		    L->lcp.auth.params.acct_update = r->acct_update;
 		    /* Stop accounting update timer if running. */
 		    TimerStop(&L->lcp.auth.acct_timer);
 		    if (B) {
@@ -569,11 +715,11 @@ RadsrvEvent(int type, void *cookie)
 			if (L->lcp.auth.params.acct_update > 0)
 		    	    updateInterval = L->lcp.auth.params.acct_update;
 			else
-		    	    updateInterval = L->lcp.auth.conf.acct_update;
+		    	    updateInterval = L->lcp.auth.conf->acct_update;
 			if (updateInterval > 0) {
 	    		    TimerInit(&L->lcp.auth.acct_timer, "AuthAccountTimer",
 				updateInterval * SECONDS, AuthAccountTimeout, L);
-			    TimerStartRecurring(&L->lcp.auth.acct_timer);
+			    TimerStartSpread(&L->lcp.auth.acct_timer);
 			}
 		    }
 		}
@@ -586,124 +732,423 @@ RadsrvEvent(int type, void *cookie)
 			IfaceIpv6IfaceUp(B, 1);
 		    IfaceUp(B, 1);
 		}
+		ConsoleEvent(CONS_EV_COA, L, NULL, "applied");
 	    }
 	}
     }
-    if (result == RAD_DISCONNECT_REQUEST) {
-	if (found) {
-	    rad_create_response(w->handle, RAD_DISCONNECT_ACK);
+}
+
+/*
+ * RadsrvRespond()
+ *
+ * Send ACK if any session was affected, NAK with the error cause
+ * otherwise.
+ */
+
+static void
+RadsrvRespond(struct rad_handle *h, struct radsrvreq *r)
+{
+    struct radsrvstat	*s;
+    struct timespec	now;
+    u_int		lat;
+
+    if (r->result == RAD_DISCONNECT_REQUEST) {
+	if (r->found) {
+	    rad_create_response(h, RAD_DISCONNECT_ACK);
 	} else {
-	    rad_create_response(w->handle, RAD_DISCONNECT_NAK);
-	    rad_put_int(w->handle, RAD_ERROR_CAUSE, err);
+	    rad_create_response(h, RAD_DISCONNECT_NAK);
+	    rad_put_int(h, RAD_ERROR_CAUSE, r->err);
 	}
     } else {
-	if (found) {
-	    rad_create_response(w->handle, RAD_COA_ACK);
+	if (r->found) {
+	    rad_create_response(h, RAD_COA_ACK);
 	} else {
-	    rad_create_response(w->handle, RAD_COA_NAK);
-	    rad_put_int(w->handle, RAD_ERROR_CAUSE, err);
+	    rad_create_response(h, RAD_COA_NAK);
+	    rad_put_int(h, RAD_ERROR_CAUSE, r->err);
 	}
     }
-    if (state != NULL)
-        rad_put_attr(w->handle, RAD_STATE, state, state_len);
-    if (authentic)
-	rad_put_message_authentic(w->handle);
-    rad_send_response(w->handle);
-
-cleanup:
-    if (username)
-	free(username);
-    if (rad_class != NULL)
-	Freee(rad_class);
-    if (called)
-	free(called);
-    if (calling)
-	free(calling);
-    if (sesid)
-	free(sesid);
-    if (msesid)
-	free(msesid);
-    if (link)
-	free(link);
-    if (bundle)
-	free(bundle);
-    if (iface)
-	free(iface);
-    if (state != NULL)
-	Freee(state);
+    if (r->state != NULL)
+        rad_put_attr(h, RAD_STATE, r->state, r->state_len);
+    if (r->authentic)
+	rad_put_message_authentic(h);
+    rad_send_response(h);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lat = (now.tv_sec - r->start.tv_sec) * 1000000 +
+	(now.tv_nsec - r->start.tv_nsec) / 1000;
+    MUTEX_LOCK(gRadsrvMutex);
+    if ((s = RadsrvClientStat(r->from)) != NULL) {
+	if (r->found)
+	    s->acks++;
+	else
+	    s->naks++;
+	s->latency += lat;
+	if (lat > s->latency_max)
+	    s->latency_max = lat;
+    }
+    MUTEX_UNLOCK(gRadsrvMutex);
+}
+
+/*
+ * RadsrvReqFree()
+ */
+
+static void
+RadsrvReqFree(struct radsrvreq *r)
+{
+#ifdef USE_NG_BPF
+    int		i;
+#endif
+
+    if (r->username)
+	free(r->username);
+    if (r->rad_class != NULL)
+	Freee(r->rad_class);
+    if (r->called)
+	free(r->called);
+    if (r->calling)
+	free(r->calling);
+    if (r->sesid)
+	free(r->sesid);
+    if (r->msesid)
+	free(r->msesid);
+    if (r->link)
+	free(r->link);
+    if (r->bundle)
+	free(r->bundle);
+    if (r->iface)
+	free(r->iface);
+    if (r->state != NULL)
+	Freee(r->state);
 #ifdef USE_IPFW
-    ACLDestroy(acl_rule);
-    ACLDestroy(acl_pipe);
-    ACLDestroy(acl_queue);
-    ACLDestroy(acl_table);
+    ACLDestroy(r->acl_rule);
+    ACLDestroy(r->acl_pipe);
+    ACLDestroy(r->acl_queue);
+    ACLDestroy(r->acl_table);
 #endif /* USE_IPFW */
 #ifdef USE_NG_BPF
     for (i = 0; i < ACL_FILTERS; i++)
-	ACLDestroy(acl_filters[i]);
+	ACLDestroy(r->acl_filters[i]);
     for (i = 0; i < ACL_DIRS; i++)
-	ACLDestroy(acl_limits[i]);
+	ACLDestroy(r->acl_limits[i]);
 #endif /* USE_NG_BPF */
 }
 
 /*
- * RadsrvOpen()
+ * RadsrvClientStat()
+ *
+ * Find counters of a client. Must be called locked.
  */
 
-int
-RadsrvOpen(Radsrv w)
+static struct radsrvstat *
+RadsrvClientStat(struct in_addr addr)
 {
-    char		addrstr[INET6_ADDRSTRLEN];
-    struct sockaddr_in sin;
-    struct radiusclient_conf *s;
+    struct radsrvstat	*s;
 
-    if (w->handle) {
-	Log(LG_ERR, ("radsrv: radsrv already running"));
-	return (-1);
+    for (s = gRadsrvStats; s != NULL; s = s->next) {
+	if (s->addr.s_addr == addr.s_addr)
+	    return (s);
     }
+    if (gRadsrvStatsNum >= RADSRV_MAX_STATS)
+	return (NULL);
+    s = Malloc(MB_RADSRV, sizeof(*s));
+    s->addr = addr;
+    s->next = gRadsrvStats;
+    gRadsrvStats = s;
+    gRadsrvStatsNum++;
+    return (s);
+}
 
-    if ((w->fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+/*
+ * RadsrvSocket()
+ */
+
+static int
+RadsrvSocket(Radsrv w, int reuse)
+{
+    struct sockaddr_in sin;
+    int		fd;
+#ifdef SO_REUSEPORT_LB
+    int		opt = 1;
+#endif
+
+    if ((fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
 	Perror("%s: Cannot create socket", __FUNCTION__);
 	return (-1);
     }
+    (void)fcntl(fd, F_SETFD, 1);
+#ifdef SO_REUSEPORT_LB
+    /* Let the kernel balance requests among the sockets */
+    if (reuse && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &opt,
+	    sizeof(opt)) == -1) {
+	Perror("%s: can't setsockopt socket", __FUNCTION__);
+	close(fd);
+	return (-1);
+    }
+#else
+    /* Only one worker, see SET_WORKERS */
+    (void)reuse;
+#endif
     memset(&sin, 0, sizeof sin);
     sin.sin_len = sizeof sin;
     sin.sin_family = AF_INET;
     sin.sin_addr = w->addr.u.ip4;
     sin.sin_port = htons(w->port);
-    if (bind(w->fd, (const struct sockaddr *)&sin,
+    if (bind(fd, (const struct sockaddr *)&sin,
 	    sizeof sin) == -1) {
 	Log(LG_ERR, ("%s: bind: %s", __FUNCTION__, strerror(errno)));
-	close(w->fd);
-	w->fd = -1;
+	close(fd);
 	return (-1);
     }
+    return (fd);
+}
 
-    if (!(w->handle = rad_server_open(w->fd))) {
-	Log(LG_ERR, ("%s: rad_server_open error", __FUNCTION__));
-	close(w->fd);
-	w->fd = -1;
-	return(-1);
-    }
+/*
+ * RadsrvAddClients()
+ */
 
-    EventRegister(&w->event, EVENT_READ, w->fd,
-	EVENT_RECURRING, RadsrvEvent, w);
+static void
+RadsrvAddClients(Radsrv w, struct rad_handle *h)
+{
+    struct radiusclient_conf *s;
 
     s = w->clients;
     while (s) {
 	Log(LG_RADIUS2, ("radsrv: Adding client %s", s->hostname));
-	if (rad_add_server (w->handle, s->hostname,
+	if (rad_add_server (h, s->hostname,
 		0, s->sharedsecret, 0, 0) == -1) {
 		Log(LG_RADIUS, ("radsrv: Adding client error: %s",
-		    rad_strerror(w->handle)));
+		    rad_strerror(h)));
 	}
 	s = s->next;
     }
+}
+
+/*
+ * RadsrvOpen()
+ */
+
+int
+RadsrvOpen(Radsrv w)
+{
+    char		addrstr[INET6_ADDRSTRLEN];
+
+    if (w->handle || gRadsrvNum > 0) {
+	Log(LG_ERR, ("radsrv: radsrv already running"));
+	return (-1);
+    }
+
+    if (w->workers > 0)
+	return (RadsrvStartWorkers(w));
+
+    if ((w->fd = RadsrvSocket(w, 0)) == -1)
+	return (-1);
+
+    if (!(w->handle = rad_server_open(w->fd))) {
+	Log(LG_ERR, ("%s: rad_server_open error", __FUNCTION__));
+	close(w->fd);
+	w->fd = -1;
+	return(-1);
+    }
+
+    EventRegister(&w->event, EVENT_READ, w->fd,
+	EVENT_RECURRING, RadsrvEvent, w);
+
+    RadsrvAddClients(w, w->handle);
 
     Log(LG_ERR, ("radsrv: listening on %s %d",
 	u_addrtoa(&w->addr,addrstr,sizeof(addrstr)), w->port));
     return (0);
 }
 
+/*
+ * RadsrvStartWorkers()
+ *
+ * Open a socket per worker thread. Threads receive and parse requests
+ * and queue them to the event loop, which owns the sessions.
+ */
+
+static int
+RadsrvStartWorkers(Radsrv w)
+{
+    struct radsrvworker	*k;
+    char		addrstr[INET6_ADDRSTRLEN];
+    int			n, j, ret;
+
+    if (pipe(gRadsrvPipe) < 0 || pipe(gRadsrvStopPipe) < 0) {
+	Perror("radsrv: can't create pipe");
+	RadsrvStopWorkers();
+	return (-1);
+    }
+    for (j = 0; j < 2; j++) {
+	(void)fcntl(gRadsrvPipe[j], F_SETFD, 1);
+	(void)fcntl(gRadsrvPipe[j], F_SETFL, O_NONBLOCK);
+	(void)fcntl(gRadsrvStopPipe[j], F_SETFD, 1);
+    }
+    if (EventRegister(&gRadsrvEvent, EVENT_READ, gRadsrvPipe[0],
+	    EVENT_RECURRING, RadsrvDone, NULL) < 0) {
+	RadsrvStopWorkers();
+	return (-1);
+    }
+    gRadsrvStop = 0;
+
+    gRadsrvWorkers = Malloc(MB_RADSRV, w->workers * sizeof(*gRadsrvWorkers));
+    for (n = 0; n < w->workers; n++) {
+	k = &gRadsrvWorkers[n];
+	if ((k->fd = RadsrvSocket(w, 1)) == -1)
+	    break;
+	if (!(k->handle = rad_server_open(k->fd))) {
+	    Log(LG_ERR, ("%s: rad_server_open error", __FUNCTION__));
+	    close(k->fd);
+	    break;
+	}
+	RadsrvAddClients(w, k->handle);
+	/* Workers must not read the config changed by commands */
+	k->options = w->options;
+	k->addr = w->addr.u.ip4;
+	if (pthread_cond_init(&k->cond, NULL) != 0) {
+	    rad_close(k->handle);
+	    break;
+	}
+	if ((ret = pthread_create(&k->tid, NULL, RadsrvWorkerMain, k)) != 0) {
+	    Log(LG_ERR, ("radsrv: can't create worker thread %d", ret));
+	    pthread_cond_destroy(&k->cond);
+	    rad_close(k->handle);
+	    break;
+	}
+    }
+    gRadsrvNum = n;
+    if (n == 0) {
+	RadsrvStopWorkers();
+	return (-1);
+    }
+
+    Log(LG_ERR, ("radsrv: listening on %s %d with %d workers",
+	u_addrtoa(&w->addr,addrstr,sizeof(addrstr)), w->port, n));
+    return (0);
+}
+
+/*
+ * RadsrvStopWorkers()
+ *
+ * Apply requests already queued, then let the workers exit.
+ */
+
+static void
+RadsrvStopWorkers(void)
+{
+    struct radsrvworker	*k;
+    int			n, j;
+
+    MUTEX_LOCK(gRadsrvMutex);
+    gRadsrvStop = 1;
+    MUTEX_UNLOCK(gRadsrvMutex);
+    if (gRadsrvStopPipe[1] >= 0)
+	(void)write(gRadsrvStopPipe[1], "", 1);
+    if (gRadsrvPipe[0] >= 0)
+	RadsrvDone(0, NULL);
+
+    for (n = 0; n < gRadsrvNum; n++) {
+	k = &gRadsrvWorkers[n];
+	pthread_join(k->tid, NULL);
+	pthread_cond_destroy(&k->cond);
+	rad_close(k->handle);
+    }
+    Freee(gRadsrvWorkers);
+    gRadsrvWorkers = NULL;
+    gRadsrvNum = 0;
+
+    EventUnRegister(&gRadsrvEvent);
+    for (j = 0; j < 2; j++) {
+	if (gRadsrvPipe[j] >= 0)
+	    close(gRadsrvPipe[j]);
+	if (gRadsrvStopPipe[j] >= 0)
+	    close(gRadsrvStopPipe[j]);
+	gRadsrvPipe[j] = gRadsrvStopPipe[j] = -1;
+    }
+}
+
+/*
+ * RadsrvWorkerMain()
+ */
+
+static void *
+RadsrvWorkerMain(void *arg)
+{
+    struct radsrvworker	*k = arg;
+    struct radsrvreq	r;
+    struct pollfd	pfd[2];
+    int			empty;
+
+    pfd[0].fd = k->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = gRadsrvStopPipe[0];
+    pfd[1].events = POLLIN;
+    for (;;) {
+	if (poll(pfd, 2, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    Perror("radsrv: poll");
+	    break;
+	}
+	if (pfd[1].revents != 0)
+	    break;
+	if ((pfd[0].revents & POLLIN) == 0)
+	    continue;
+
+	if (RadsrvReceive(&k->options, k->addr, k->handle, k->fd, &r) == 0) {
+	    /* Sessions belong to the event loop, wait for it */
+	    r.w = k;
+	    MUTEX_LOCK(gRadsrvMutex);
+	    if (gRadsrvStop) {
+		r.err = 506;
+	    } else {
+		empty = STAILQ_EMPTY(&gRadsrvQueue);
+		STAILQ_INSERT_TAIL(&gRadsrvQueue, &r, next);
+		if (empty)
+		    (void)write(gRadsrvPipe[1], "", 1);
+		while (!r.done)
+		    pthread_cond_wait(&k->cond, &gRadsrvMutex);
+	    }
+	    MUTEX_UNLOCK(gRadsrvMutex);
+	    RadsrvRespond(k->handle, &r);
+	}
+	RadsrvReqFree(&r);
+    }
+    return (NULL);
+}
+
+/*
+ * RadsrvDone()
+ *
+ * Apply requests queued by workers and wake them up to respond.
+ */
+
+static void
+RadsrvDone(int type, void *cookie)
+{
+    STAILQ_HEAD(, radsrvreq)	queue = STAILQ_HEAD_INITIALIZER(queue);
+    struct radsrvreq		*r;
+    char			buf[64];
+
+    (void)type;
+    (void)cookie;
+    while (read(gRadsrvPipe[0], buf, sizeof(buf)) > 0)
+	;
+    MUTEX_LOCK(gRadsrvMutex);
+    STAILQ_CONCAT(&queue, &gRadsrvQueue);
+    MUTEX_UNLOCK(gRadsrvMutex);
+
+    while ((r = STAILQ_FIRST(&queue)) != NULL) {
+	STAILQ_REMOVE_HEAD(&queue, next);
+	RadsrvApply(r);
+	MUTEX_LOCK(gRadsrvMutex);
+	r->done = 1;
+	pthread_cond_signal(&r->w->cond);
+	MUTEX_UNLOCK(gRadsrvMutex);
+    }
+}
+
 /*
  * RadsrvClose()
  */
@@ -712,13 +1157,17 @@ int
 RadsrvClose(Radsrv w)
 {
 
-    if (!w->handle) {
+    if (!w->handle && gRadsrvNum == 0) {
 	Log(LG_ERR, ("radsrv: radsrv is not running"));
 	return (-1);
     }
-    EventUnRegister(&w->event);
-    rad_close(w->handle);
-    w->handle = NULL;
+    if (gRadsrvNum > 0) {
+	RadsrvStopWorkers();
+    } else {
+	EventUnRegister(&w->event);
+	rad_close(w->handle);
+	w->handle = NULL;
+    }
 
     Log(LG_ERR, ("radsrv: stop listening"));
     return (0);
@@ -734,13 +1183,18 @@ RadsrvStat(Context ctx, int ac, const char *const av[], const void *arg)
     Radsrv	w = &gRadsrv;
     char	addrstr[64];
     struct radiusclient_conf *client;
+    struct radsrvstat *s, t;
+    struct timespec now;
+    u_long	errors;
 
     (void)ac;
     (void)av;
     (void)arg;
 
     Printf("Radsrv configuration:\r\n");
-    Printf("\tState         : %s\r\n", w->handle ? "OPENED" : "CLOSED");
+    Printf("\tState         : %s\r\n",
+	(w->handle || gRadsrvNum > 0) ? "OPENED" : "CLOSED");
+    Printf("\tWorkers       : %d (%d running)\r\n", w->workers, gRadsrvNum);
     Printf("\tSelf          : %s %d\r\n",
 	u_addrtoa(&w->addr,addrstr,sizeof(addrstr)), w->port);
     Printf("\tPeer:\r\n");
@@ -752,6 +1206,29 @@ RadsrvStat(Context ctx, int ac, const char *const av[], const void *arg)
     Printf("Radsrv options:\r\n");
     OptStat(ctx, &w->options, gConfList);
 
+    MUTEX_LOCK(gRadsrvMutex);
+    errors = gRadsrvRecvErrors;
+    s = gRadsrvStats;
+    MUTEX_UNLOCK(gRadsrvMutex);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    Printf("Radsrv clients:\r\n");
+    Printf("\tReceive errors: %lu\r\n", errors);
+    Printf("\tClient           Disconnect        CoA        ACK        NAK"
+	"  Unsupported  Rate/s  Peak/s  Avg ms  Max ms\r\n");
+    /* Entries are never freed and only added at the head */
+    while (s != NULL) {
+	MUTEX_LOCK(gRadsrvMutex);
+	t = *s;
+	MUTEX_UNLOCK(gRadsrvMutex);
+	Printf("\t%-15s %11lu %10lu %10lu %10lu %12lu %7u %7u %7.3f %7.3f\r\n",
+	    inet_ntoa(t.addr), t.disconnect, t.coa, t.acks, t.naks, t.errors,
+	    (now.tv_sec == t.sec) ? t.last :
+	    ((now.tv_sec == t.sec + 1) ? t.cur : 0), t.peak,
+	    (t.acks + t.naks) ? (double)t.latency / (t.acks + t.naks) / 1000 : 0.0,
+	    (double)t.latency_max / 1000);
+	s = t.next;
+    }
+
     return (0);
 }
 
@@ -824,6 +1301,20 @@ RadsrvSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
 	w->clients = peer;
 	break;
 
+    case SET_WORKERS:
+	if (ac != 1)
+	  return(-1);
+	count = atoi(av[0]);
+	if (count < 0 || count > RADSRV_MAX_WORKERS)
+	    Error("Workers must be from 0 to %d.", RADSRV_MAX_WORKERS);
+#ifndef SO_REUSEPORT_LB
+	/* Plain SO_REUSEPORT does not spread unicast datagrams */
+	if (count > 1)
+	    Error("More than one worker needs SO_REUSEPORT_LB.");
+#endif
+	w->workers = count;
+	break;
+
     default:
       return(-1);
 
@@ -16,6 +16,8 @@
  */
 
 #define RADSRV_MAX_SERVERS	10
+#define RADSRV_MAX_WORKERS	32
+#define RADSRV_MAX_STATS	64	/* Clients with counters */
 
  /* Configuration options */
 enum {
@@ -38,6 +40,7 @@ struct radsrv {
 	struct rad_handle *handle;
 	struct radiusclient_conf *clients;
 	EventRef event;			/* connect-event */
+	int	workers;		/* Receive sockets and threads */
 };
 
 typedef struct radsrv *Radsrv;
@@ -0,0 +1,423 @@
+
+/*
+ * stats.c
+ *
+ * Central collector of ng_ppp link and bundle counters.
+ *
+ * Instead of every bundle, echo timer and accounting update querying
+ * the kernel on its own, counters of all sessions are refreshed here
+ * in rate-limited asynchronous sweeps. Results are cached in the link
+ * and bundle structures (found through gLinks[] and gBundles[]) along
+ * with the time they were fetched, so consumers can use them as long
+ * as they are fresh enough.
+ *
+ * Optionally the same data is exported into a memory mapped file
+ * (see statshm.h) for external collectors.
+ */
+
+#include "ppp.h"
+#include "bund.h"
+#include "link.h"
+#include "ngfunc.h"
+#include "stats.h"
+#include "util.h"
+
+#include <sys/mman.h>
+#include <stdatomic.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define STATS_TICK		1	/* Seconds between sweep steps */
+
+/*
+ * INTERNAL FUNCTIONS
+ */
+
+  static void	StatsSweep(void *arg);
+  static void	StatsExportGlobal(void);
+  static void	StatsExportClear(int id);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gStatsInterval = STATS_DEFAULT_INTERVAL;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  static struct pppTimer	gStatsTimer;
+  static int			gStatsBundNext;
+  static int			gStatsLinkNext;
+  static time_t			gStatsStarted;
+  static uint64_t		gStatsSweeps;
+
+  static struct statsevent	*gStatsEvents;
+  static uint64_t		gStatsEventSeq;
+
+  static struct statshm_header	*gStatsShm;
+  static size_t			gStatsShmSize;
+  static char			gStatsShmPath[PATH_MAX];
+
+/*
+ * StatsInit()
+ */
+
+void
+StatsInit(void)
+{
+    gStatsStarted = time(NULL);
+    gStatsEvents = Malloc(MB_STATS, STATS_EVENTS_MAX * sizeof(*gStatsEvents));
+    TimerInit(&gStatsTimer, "StatsSweep", STATS_TICK * SECONDS,
+	StatsSweep, NULL);
+    if (gStatsInterval > 0)
+	TimerStartRecurring(&gStatsTimer);
+}
+
+/*
+ * StatsSetInterval()
+ *
+ * Change the sweep period.
+ */
+
+void
+StatsSetInterval(int interval)
+{
+    gStatsInterval = interval;
+    TimerStop(&gStatsTimer);
+    if (gStatsInterval > 0)
+	TimerStartRecurring(&gStatsTimer);
+}
+
+/*
+ * StatsSweep()
+ *
+ * Every tick visit the next 1/gStatsInterval part of the bundle and link
+ * arrays, so each active session is refreshed once per interval and the
+ * load is spread evenly. Queries are sent asynchronously and limited by
+ * the number of replies still outstanding.
+ */
+
+static void
+StatsSweep(void *arg)
+{
+    int		budget, bstep, lstep, id, k;
+    Bund	b;
+    Link	l;
+
+    (void)arg;
+
+    budget = STATS_MAX_INFLIGHT - NgFuncAsyncPending();
+    bstep = (gNumBundles + gStatsInterval - 1) / gStatsInterval;
+    lstep = (gNumLinks + gStatsInterval - 1) / gStatsInterval;
+
+    for (k = 0; k < bstep && budget > 0; k++) {
+	if (gStatsBundNext >= gNumBundles)
+	    gStatsBundNext = 0;
+	b = gBundles[gStatsBundNext++];
+	if (b == NULL || b->tmpl || b->dead || b->n_up == 0)
+	    continue;
+	if (BundUpdateStatsAsync(b) == 0)
+	    budget--;
+    }
+
+    for (k = 0; k < lstep; k++) {
+	if (gStatsLinkNext >= gNumLinks)
+	    gStatsLinkNext = 0;
+	id = gStatsLinkNext++;
+	l = gLinks[id];
+	if (l == NULL || l->tmpl || l->dead) {
+	    StatsExportClear(id);
+	    continue;
+	}
+	/* Export state now, counters are exported when they arrive */
+	StatsExportLink(l);
+	if (budget > 0 && l->bund != NULL && l->joined_bund &&
+	  LinkUpdateStatsAsync(l, NULL) == 0)
+	    budget--;
+    }
+
+    gStatsSweeps++;
+    StatsExportGlobal();
+}
+
+/*
+ * StatsExportOpen()
+ *
+ * Create the memory mapped statistics file for up to max links.
+ * A NULL path just removes the current one.
+ */
+
+int
+StatsExportOpen(const char *path, int max)
+{
+    struct statshm_header	*h;
+    size_t			size;
+    int				fd;
+
+    StatsExportClose();
+    if (path == NULL)
+	return (0);
+
+    size = STATSHM_SIZE(max);
+    /* Readers still mapping an old file must not see it reused */
+    (void)unlink(path);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+	Perror("%s: can't create %s", __FUNCTION__, path);
+	return (-1);
+    }
+    if (ftruncate(fd, size) < 0) {
+	Perror("%s: can't resize %s", __FUNCTION__, path);
+	close(fd);
+	(void)unlink(path);
+	return (-1);
+    }
+    h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+	Perror("%s: can't map %s", __FUNCTION__, path);
+	(void)unlink(path);
+	return (-1);
+    }
+
+    /* The file is zero filled, so every record starts unused */
+    h->version = STATSHM_VERSION;
+    h->header_size = sizeof(struct statshm_header);
+    h->record_size = sizeof(struct statshm_session);
+    h->max_sessions = max;
+    h->global.pid = gPid;
+    h->global.started = gStatsStarted;
+    atomic_thread_fence(memory_order_release);
+    h->magic = STATSHM_MAGIC;
+
+    gStatsShm = h;
+    gStatsShmSize = size;
+    strlcpy(gStatsShmPath, path, sizeof(gStatsShmPath));
+    StatsExportGlobal();
+    Log(LG_ALWAYS, ("Exporting statistics of %d links into %s", max, path));
+    return (0);
+}
+
+/*
+ * StatsExportClose()
+ *
+ * Tell readers we are gone and unmap the statistics file.
+ */
+
+void
+StatsExportClose(void)
+{
+    struct statshm_global	*g;
+
+    if (gStatsShm == NULL)
+	return;
+    g = &gStatsShm->global;
+    g->seq++;
+    atomic_thread_fence(memory_order_release);
+    g->pid = 0;
+    atomic_thread_fence(memory_order_release);
+    g->seq++;
+    munmap(gStatsShm, gStatsShmSize);
+    gStatsShm = NULL;
+    gStatsShmSize = 0;
+}
+
+/*
+ * StatsExportShow()
+ *
+ * Describe the statistics file for "show globals".
+ */
+
+const char *
+StatsExportShow(char *buf, size_t len)
+{
+    if (gStatsShm == NULL)
+	strlcpy(buf, "none", len);
+    else
+	snprintf(buf, len, "%s %u", gStatsShmPath, gStatsShm->max_sessions);
+    return (buf);
+}
+
+/*
+ * StatsExportGlobal()
+ */
+
+static void
+StatsExportGlobal(void)
+{
+    struct statshm_global	*g;
+
+    if (gStatsShm == NULL)
+	return;
+    g = &gStatsShm->global;
+    g->seq++;
+    atomic_thread_fence(memory_order_release);
+    g->updated = time(NULL);
+    g->sweeps = gStatsSweeps;
+    g->links = gNumLinks;
+    g->bundles = gNumBundles;
+    g->children = gChildren;
+    g->overflow = gNumLinks > (int)gStatsShm->max_sessions ?
+	gNumLinks - gStatsShm->max_sessions : 0;
+    atomic_thread_fence(memory_order_release);
+    g->seq++;
+}
+
+/*
+ * StatsExportLink()
+ *
+ * Write the record of a link into the statistics file.
+ */
+
+void
+StatsExportLink(Link l)
+{
+    struct statshm_session	*s;
+
+    if (gStatsShm == NULL || l->id < 0 ||
+      (u_int)l->id >= gStatsShm->max_sessions)
+	return;
+    s = STATSHM_SESSION(gStatsShm, l->id);
+    s->seq++;
+    atomic_thread_fence(memory_order_release);
+    StatsFillSession(l, s);
+    atomic_thread_fence(memory_order_release);
+    s->seq++;
+}
+
+/*
+ * StatsFillSession()
+ *
+ * Describe a link with a statistics record; the sequence counter
+ * is left untouched.
+ */
+
+void
+StatsFillSession(Link l, struct statshm_session *s)
+{
+    Bund	b = l->bund;
+
+    s->flags = STATSHM_F_USED;
+    if (l->state == PHYS_STATE_UP)
+	s->flags |= STATSHM_F_UP;
+    s->link_id = l->id;
+    s->up_since = l->last_up;
+    s->updated = l->statsTime;
+    s->lcp_state = l->lcp.fsm.state;
+    s->phys_state = l->state;
+    strlcpy(s->link, l->name, sizeof(s->link));
+    strlcpy(s->type, l->type ? l->type->name : "", sizeof(s->type));
+    strlcpy(s->session_id, l->session_id, sizeof(s->session_id));
+    strlcpy(s->authname, l->lcp.auth.params.authname, sizeof(s->authname));
+    if (l->state != PHYS_STATE_DOWN) {
+	PhysGetPeerAddr(l, s->peer_addr, sizeof(s->peer_addr));
+	PhysGetCallingNum(l, s->calling_num, sizeof(s->calling_num));
+    } else {
+	s->peer_addr[0] = 0;
+	s->calling_num[0] = 0;
+    }
+    if (b != NULL && l->joined_bund) {
+	s->flags |= STATSHM_F_BUND;
+	s->bund_id = b->id;
+	s->ipcp_addr = b->ipcp.peer_addr.s_addr;
+	strlcpy(s->bund, b->name, sizeof(s->bund));
+	strlcpy(s->iface, b->iface.ifname, sizeof(s->iface));
+    } else {
+	s->bund_id = 0;
+	s->ipcp_addr = 0;
+	s->bund[0] = 0;
+	s->iface[0] = 0;
+    }
+    s->recvOctets = l->stats.recvOctets;
+    s->recvFrames = l->stats.recvFrames;
+    s->xmitOctets = l->stats.xmitOctets;
+    s->xmitFrames = l->stats.xmitFrames;
+    s->badProtos = l->stats.badProtos;
+    s->runts = l->stats.runts;
+    s->dupFragments = l->stats.dupFragments;
+    s->dropFragments = l->stats.dropFragments;
+}
+
+/*
+ * StatsSessionEvent()
+ *
+ * Record a session going up or down in the event journal.
+ */
+
+void
+StatsSessionEvent(Link l, int type)
+{
+    struct statsevent	*ev;
+
+    if (gStatsEvents == NULL)
+	return;
+    ev = &gStatsEvents[gStatsEventSeq % STATS_EVENTS_MAX];
+    ev->seq = ++gStatsEventSeq;
+    ev->when = time(NULL);
+    ev->type = type;
+    ev->sess.seq = 0;
+    StatsFillSession(l, &ev->sess);
+}
+
+/*
+ * StatsEventSeq()
+ *
+ * Sequence number of the last recorded event.
+ */
+
+uint64_t
+StatsEventSeq(void)
+{
+    return (gStatsEventSeq);
+}
+
+/*
+ * StatsEventsGet()
+ *
+ * Copy up to max events following sequence number since.
+ * Returns the number of events, or -1 if some of the requested
+ * events have already been overwritten.
+ */
+
+int
+StatsEventsGet(uint64_t since, struct statsevent *ev, int max)
+{
+    int		n = 0;
+
+    if (since > gStatsEventSeq)
+	since = gStatsEventSeq;
+    if (gStatsEventSeq - since > STATS_EVENTS_MAX)
+	return (-1);
+    while (since < gStatsEventSeq && n < max) {
+	ev[n++] = gStatsEvents[since % STATS_EVENTS_MAX];
+	since++;
+    }
+    return (n);
+}
+
+/*
+ * StatsExportClear()
+ *
+ * Mark the record of a removed link as unused.
+ */
+
+static void
+StatsExportClear(int id)
+{
+    struct statshm_session	*s;
+
+    if (gStatsShm == NULL || (u_int)id >= gStatsShm->max_sessions)
+	return;
+    s = STATSHM_SESSION(gStatsShm, id);
+    if (s->flags == 0)
+	return;
+    s->seq++;
+    atomic_thread_fence(memory_order_release);
+    s->flags = 0;
+    atomic_thread_fence(memory_order_release);
+    s->seq++;
+}
+
@@ -0,0 +1,64 @@
+
+/*
+ * stats.h
+ *
+ * Central collector of ng_ppp link and bundle counters.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <time.h>
+#include "statshm.h"
+
+/*
+ * DEFINITIONS
+ */
+
+  #define STATS_DEFAULT_INTERVAL	10	/* Seconds between sweeps */
+  #define STATS_MAX_INFLIGHT		256	/* Outstanding ng_ppp queries */
+  #define STATS_EXPORT_DEFAULT		4096	/* Links in the export file */
+  #define STATS_EVENTS_MAX		4096	/* Session events kept */
+
+  /* Session events */
+  enum {
+    STATS_EVENT_UP = 1,
+    STATS_EVENT_DOWN
+  };
+
+  struct statsevent {
+    uint64_t			seq;	/* Event sequence number */
+    time_t			when;	/* Event time */
+    int				type;	/* STATS_EVENT_* */
+    struct statshm_session	sess;	/* Session at the time of event */
+  };
+
+  /* Counters fetched at time t are recent enough to be used as is */
+  #define StatsFresh(t)		(gStatsInterval > 0 &&			\
+				    time(NULL) - (t) <= gStatsInterval)
+
+/*
+ * VARIABLES
+ */
+
+  extern int	gStatsInterval;
+
+/*
+ * FUNCTIONS
+ */
+
+  extern void	StatsInit(void);
+  extern void	StatsSetInterval(int interval);
+
+  extern int	StatsExportOpen(const char *path, int max);
+  extern void	StatsExportClose(void);
+  extern void	StatsExportLink(Link l);
+  extern const char	*StatsExportShow(char *buf, size_t len);
+
+  extern void	StatsFillSession(Link l, struct statshm_session *s);
+  extern void	StatsSessionEvent(Link l, int type);
+  extern uint64_t	StatsEventSeq(void);
+  extern int	StatsEventsGet(uint64_t since, struct statsevent *ev, int max);
+
+#endif
+
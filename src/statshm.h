@@ -0,0 +1,112 @@
+
+/*
+ * statshm.h
+ *
+ * Layout of the memory mapped statistics file exported by mpd and the
+ * reader interface for external collectors. This file is shared between
+ * the daemon and readers, so it must not depend on other mpd headers.
+ *
+ * The file starts with a header, followed by max_sessions fixed size
+ * session records indexed by link number. Global counters and every
+ * record are protected by their own sequence counter: the daemon makes
+ * it odd while updating and even when done, so a reader copies the data
+ * and retries if the counter was odd or changed meanwhile.
+ */
+
+#ifndef _STATSHM_H_
+#define _STATSHM_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * DEFINITIONS
+ */
+
+  #define STATSHM_MAGIC		0x6d706473	/* "mpds" */
+  #define STATSHM_VERSION	1
+
+  #define STATSHM_NAME_LEN	32
+  #define STATSHM_USER_LEN	64
+  #define STATSHM_ADDR_LEN	64
+
+  /* Session record flags */
+  #define STATSHM_F_USED	0x0001		/* Record describes a link */
+  #define STATSHM_F_UP		0x0002		/* Link is up */
+  #define STATSHM_F_BUND	0x0004		/* Link is joined to a bundle */
+
+  struct statshm_global {
+    uint32_t	seq;			/* Sequence counter */
+    uint32_t	pid;			/* Daemon PID, 0 after exit */
+    int64_t	started;		/* Daemon start time */
+    int64_t	updated;		/* Last sweep time */
+    uint64_t	sweeps;			/* Collector sweep steps */
+    uint32_t	links;			/* Size of the link array */
+    uint32_t	bundles;		/* Size of the bundle array */
+    uint32_t	children;		/* Links created from templates */
+    uint32_t	overflow;		/* Links not fitting into the file */
+  };
+
+  struct statshm_session {
+    uint32_t	seq;			/* Sequence counter */
+    uint32_t	flags;			/* STATSHM_F_* */
+    uint32_t	link_id;		/* Link number */
+    uint32_t	bund_id;		/* Bundle number if joined */
+    int64_t	up_since;		/* Time link got up */
+    int64_t	updated;		/* When counters were fetched */
+    uint8_t	lcp_state;		/* LCP FSM state */
+    uint8_t	phys_state;		/* Device state */
+    uint8_t	pad[2];
+    uint32_t	ipcp_addr;		/* Peer IPv4 address, network order */
+    char	link[STATSHM_NAME_LEN];
+    char	bund[STATSHM_NAME_LEN];
+    char	iface[STATSHM_NAME_LEN];
+    char	type[STATSHM_NAME_LEN];	/* Device type */
+    char	session_id[STATSHM_NAME_LEN];
+    char	authname[STATSHM_USER_LEN];
+    char	peer_addr[STATSHM_ADDR_LEN];
+    char	calling_num[STATSHM_ADDR_LEN];
+    uint64_t	recvOctets;
+    uint64_t	recvFrames;
+    uint64_t	xmitOctets;
+    uint64_t	xmitFrames;
+    uint64_t	badProtos;
+    uint64_t	runts;
+    uint64_t	dupFragments;
+    uint64_t	dropFragments;
+  };
+
+  struct statshm_header {
+    uint32_t	magic;			/* STATSHM_MAGIC */
+    uint32_t	version;		/* STATSHM_VERSION */
+    uint32_t	header_size;		/* sizeof(struct statshm_header) */
+    uint32_t	record_size;		/* sizeof(struct statshm_session) */
+    uint32_t	max_sessions;		/* Number of session records */
+    uint32_t	pad;
+    struct statshm_global	global;
+  };
+
+  #define STATSHM_SIZE(n)	(sizeof(struct statshm_header) +	\
+				    (size_t)(n) * sizeof(struct statshm_session))
+  #define STATSHM_SESSION(h, i)	((struct statshm_session *)		\
+				    ((char *)(h) + (h)->header_size) + (i))
+
+  /* Reader side mapping */
+  struct statshm_map {
+    const struct statshm_header	*hdr;
+    size_t			size;
+  };
+
+/*
+ * FUNCTIONS
+ */
+
+  extern int	StatShmOpen(const char *path, struct statshm_map *m);
+  extern void	StatShmClose(struct statshm_map *m);
+  extern int	StatShmReadGlobal(const struct statshm_map *m,
+			struct statshm_global *g);
+  extern int	StatShmReadSession(const struct statshm_map *m, u_int idx,
+			struct statshm_session *s);
+
+#endif
+
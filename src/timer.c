@@ -9,11 +9,39 @@
 
 #include "ppp.h"
 
+/*
+ * DEFINITIONS
+ */
+
+  /* Spread timer states */
+  #define TIMER_SPREAD_PHASE	1	/* Waiting for the phase offset */
+  #define TIMER_SPREAD_RUN	2	/* Recurring with the period */
+
 /*
  * INTERNAL FUNCTIONS
  */
 
   static void	TimerExpires(int type, void *cookie);
+  static time_t	TimerSpreadNow(void);
+  static u_int	TimerSpreadLoad(time_t due);
+  static void	TimerSpreadCount(PppTimer timer, time_t due);
+  static void	TimerSpreadUncount(PppTimer timer);
+
+/*
+ * GLOBAL VARIABLES
+ */
+
+  int		gTimerSpread = TIMER_SPREAD_DEFAULT;
+
+/*
+ * INTERNAL VARIABLES
+ */
+
+  /* Spread timers due in each second, slots are reused every
+     TIMER_SPREAD_SLOTS seconds and tagged with the second they count */
+  static u_int	gTimerSpreadDue[TIMER_SPREAD_SLOTS];
+  static time_t	gTimerSpreadSec[TIMER_SPREAD_SLOTS];
+  static u_int	gTimerSpreadNum;
 
 /*
  * TimerInit()
@@ -42,6 +70,7 @@ TimerStart2(PppTimer timer, const char *file, int line)
     assert(timer->func);
     if (EventIsRegistered(&timer->event))
 	EventUnRegister(&timer->event);
+    TimerSpreadUncount(timer);
 
     Log(LG_EVENTS, ("EVENT: Starting timer \"%s\" %s() for %d ms at %s:%d",
 	timer->desc, timer->dbg, timer->load, file, line));
@@ -63,12 +92,60 @@ TimerStartRecurring2(PppTimer timer, const char *file, int line)
 	timer->desc, timer->dbg, timer->load, file, line));
     if (EventIsRegistered(&timer->event))
 	EventUnRegister(&timer->event);
+    TimerSpreadUncount(timer);
 
     /* Register timeout event */
     EventRegister(&timer->event, EVENT_TIMEOUT,
 	timer->load, EVENT_RECURRING, TimerExpires, timer);
 }
 
+/*
+ * TimerStartSpread()
+ *
+ * Start a recurring timer with a phase offset, so that timers of
+ * sessions started at the same time do not expire in lockstep.
+ * The first expiry comes within the last gTimerSpread percent of
+ * the period, at the second with the fewest spread timers due out
+ * of a few random choices; later ones follow with the period.
+ */
+
+void
+TimerStartSpread2(PppTimer timer, const char *file, int line)
+{
+    u_int	range, delay, best, load, bestload;
+    time_t	now;
+    int		k;
+
+    assert(timer->func);
+    range = (u_int)((uint64_t)timer->load * gTimerSpread / 100);
+    if (range < SECONDS || timer->load >= TIMER_SPREAD_SLOTS * SECONDS) {
+	TimerStartRecurring2(timer, file, line);
+	return;
+    }
+    if (EventIsRegistered(&timer->event))
+	EventUnRegister(&timer->event);
+    TimerSpreadUncount(timer);
+
+    now = TimerSpreadNow();
+    best = timer->load;
+    bestload = UINT_MAX;
+    for (k = 0; k < TIMER_SPREAD_CHOICES && bestload > 0; k++) {
+	delay = timer->load - random() % range;
+	load = TimerSpreadLoad(now + delay / SECONDS);
+	if (load < bestload) {
+	    best = delay;
+	    bestload = load;
+	}
+    }
+
+    Log(LG_EVENTS, ("EVENT: Starting spread timer \"%s\" %s() for %d ms after %u ms at %s:%d",
+	timer->desc, timer->dbg, timer->load, best, file, line));
+    timer->spread = TIMER_SPREAD_PHASE;
+    TimerSpreadCount(timer, now + best / SECONDS);
+    EventRegister(&timer->event, EVENT_TIMEOUT,
+	best, 0, TimerExpires, timer);
+}
+
 /*
  * TimerStop()
  */
@@ -82,6 +159,7 @@ TimerStop2(PppTimer timer, const char *file, int line)
 	    timer->desc, timer->dbg, file, line));
 	EventUnRegister(&timer->event);
     }
+    TimerSpreadUncount(timer);
 }
 
 /*
@@ -97,6 +175,16 @@ TimerExpires(int type, void *cookie)
 
     (void)type;
     Log(LG_EVENTS, ("EVENT: Processing timer \"%s\" %s()", desc, dbg));
+    if (timer->spread != 0) {
+	TimerSpreadUncount(timer);
+	/* The phase is over, continue with the period */
+	if (!EventIsRegistered(&timer->event)) {
+	    EventRegister(&timer->event, EVENT_TIMEOUT,
+		timer->load, EVENT_RECURRING, TimerExpires, timer);
+	}
+	timer->spread = TIMER_SPREAD_RUN;
+	TimerSpreadCount(timer, TimerSpreadNow() + timer->load / SECONDS);
+    }
     (*timer->func)(timer->arg);
     Log(LG_EVENTS, ("EVENT: Processing timer \"%s\" %s() done", desc, dbg));
 }
@@ -125,3 +213,94 @@ TimerStarted(PppTimer t)
   return (EventIsRegistered(&t->event));
 }
 
+/*
+ * TimerSpreadNow()
+ */
+
+static time_t
+TimerSpreadNow(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec);
+}
+
+/*
+ * TimerSpreadLoad()
+ *
+ * Number of spread timers due in the given second.
+ */
+
+static u_int
+TimerSpreadLoad(time_t due)
+{
+    int		slot = due % TIMER_SPREAD_SLOTS;
+
+    return (gTimerSpreadSec[slot] == due ? gTimerSpreadDue[slot] : 0);
+}
+
+/*
+ * TimerSpreadCount()
+ */
+
+static void
+TimerSpreadCount(PppTimer timer, time_t due)
+{
+    int		slot = due % TIMER_SPREAD_SLOTS;
+
+    if (gTimerSpreadSec[slot] != due) {
+	gTimerSpreadSec[slot] = due;
+	gTimerSpreadDue[slot] = 0;
+    }
+    gTimerSpreadDue[slot]++;
+    gTimerSpreadNum++;
+    timer->due = due;
+}
+
+/*
+ * TimerSpreadUncount()
+ */
+
+static void
+TimerSpreadUncount(PppTimer timer)
+{
+    int		slot;
+
+    if (timer->spread == 0)
+	return;
+    slot = timer->due % TIMER_SPREAD_SLOTS;
+    if (gTimerSpreadSec[slot] == timer->due && gTimerSpreadDue[slot] > 0)
+	gTimerSpreadDue[slot]--;
+    if (gTimerSpreadNum > 0)
+	gTimerSpreadNum--;
+    timer->spread = 0;
+}
+
+/*
+ * TimerSpreadDump()
+ *
+ * Histogram of spread timers due in the next minute.
+ */
+
+void
+TimerSpreadDump(Context ctx)
+{
+    time_t	now = TimerSpreadNow();
+    u_int	load, max = 0, total = 0;
+    int		k;
+
+    Printf("Spread timers: %u running, phase within %d%% of the period\r\n",
+	gTimerSpreadNum, gTimerSpread);
+    Printf("Due in the next 60 seconds:");
+    for (k = 0; k < 60; k++) {
+	load = TimerSpreadLoad(now + k);
+	if (k % 10 == 0)
+	    Printf("\r\n\t+%02ds:", k);
+	Printf(" %5u", load);
+	total += load;
+	if (load > max)
+	    max = load;
+    }
+    Printf("\r\n\tTotal %u, max %u per second\r\n", total, max);
+}
@@ -20,6 +20,10 @@
 #define TICKSPERSEC	1000		/* Microsecond granularity */
 #define SECONDS	TICKSPERSEC		/* Timers count in usec */
 
+#define TIMER_SPREAD_SLOTS	3600	/* Seconds of due timers histogram */
+#define TIMER_SPREAD_CHOICES	8	/* Phases tried per timer */
+#define TIMER_SPREAD_DEFAULT	100	/* Percent of the period */
+
 struct pppTimer;
 typedef struct pppTimer *PppTimer;
 
@@ -30,8 +34,16 @@ struct pppTimer {
 	void *arg;			/* Arg passed to timeout function */
 	const char *desc;
 	const char *dbg;
+	u_char	spread;			/* Phase spreading state */
+	time_t	due;			/* Next expiry of a spread timer */
 };
 
+/*
+ * VARIABLES
+ */
+
+extern int gTimerSpread;
+
 /*
  * FUNCTIONS
  */
@@ -50,10 +62,15 @@ TimerInit2(PppTimer timer, const char *desc,
 	    TimerStartRecurring2(t, __FILE__, __LINE__)
 	extern void TimerStartRecurring2(PppTimer t, const char *file, int line);
 
+#define	TimerStartSpread(t)	\
+	    TimerStartSpread2(t, __FILE__, __LINE__)
+	extern void TimerStartSpread2(PppTimer t, const char *file, int line);
+
 #define	TimerStop(t)	\
 	    TimerStop2(t, __FILE__, __LINE__)
 	extern void TimerStop2(PppTimer t, const char *file, int line);
 	extern int TimerRemain(PppTimer t);
 	extern int TimerStarted(PppTimer t);
+	extern void TimerSpreadDump(Context ctx);
 
 #endif
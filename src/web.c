@@ -8,6 +8,7 @@
 #include "ppp.h"
 #include "web.h"
 #include "util.h"
+#include "stats.h"
 
 
 /*
@@ -20,9 +21,17 @@
     SET_CLOSE,
     SET_SELF,
     SET_DISABLE,
-    SET_ENABLE
+    SET_ENABLE,
+    SET_MAX_CONN,
+    SET_WORKERS,
+    SET_KEEPALIVE
   };
 
+  /* JSON session API paging */
+  #define WEB_JSON_PAGE_DEFAULT	100
+  #define WEB_JSON_PAGE_MAX	1000
+  #define WEB_JSON_SCAN_MAX	4096	/* Link slots examined per page */
+
 
 /*
  * INTERNAL FUNCTIONS
@@ -44,6 +53,11 @@
   static void	WebRunCmd(FILE *f, const char *query, int priv);
   static void	WebShowHTMLSummary(FILE *f, int priv);
   static void	WebShowJSONSummary(FILE *f, int priv);
+  static void	WebShowJSONSessions(FILE *f, struct http_request *req);
+  static void	WebShowJSONEvents(FILE *f, struct http_request *req);
+  static void	WebJSONSession(FILE *f, const struct statshm_session *s);
+  static void	WebJSONString(FILE *f, const char *name, const char *s);
+  static void	WebServletRunCleanup(void *cookie);
 
 /*
  * GLOBAL VARIABLES
@@ -56,6 +70,12 @@
   	WebSetCommand, NULL, 2, (void *) SET_CLOSE },
     { "self {ip} [{port}]",	"Set web ip and port" ,
   	WebSetCommand, NULL, 2, (void *) SET_SELF },
+    { "max-conn {num}",		"Set max number of connections" ,
+  	WebSetCommand, NULL, 2, (void *) SET_MAX_CONN },
+    { "workers {num}",		"Set number of worker threads" ,
+  	WebSetCommand, NULL, 2, (void *) SET_WORKERS },
+    { "keep-alive {seconds}",	"Set idle keep-alive timeout" ,
+  	WebSetCommand, NULL, 2, (void *) SET_KEEPALIVE },
     { "enable [opt ...]",	"Enable web option" ,
   	WebSetCommand, NULL, 2, (void *) SET_ENABLE },
     { "disable [opt ...]",	"Disable web option" ,
@@ -89,6 +109,9 @@ WebInit(Web w)
   
   ParseAddr(DEFAULT_WEB_IP, &w->addr, ALLOW_IPV4|ALLOW_IPV6);
   w->port = DEFAULT_WEB_PORT;
+  w->max_conn = WEB_DEFAULT_MAX_CONN;
+  w->workers = WEB_DEFAULT_WORKERS;
+  w->keepalive = WEB_DEFAULT_KEEPALIVE;
 
   return 0;
 }
@@ -118,6 +141,7 @@ WebOpen(Web w)
     Log(LG_ERR, ("%s: error http_server_start: %d", __FUNCTION__, errno));
     return(-1);
   }
+  http_server_set_limits(w->srv, w->max_conn, w->workers, w->keepalive);
 
   w->srvlet.arg=NULL;
   w->srvlet.hook=NULL;
@@ -170,10 +194,28 @@ WebStat(Context ctx, int ac, const char *const av[], const void *arg)
   Printf("\tState         : %s\r\n", w->srv ? "OPENED" : "CLOSED");
   Printf("\tIP-Address    : %s\r\n", u_addrtoa(&w->addr,addrstr,sizeof(addrstr)));
   Printf("\tPort          : %d\r\n", w->port);
+  Printf("\tMax conn.     : %d\r\n", w->max_conn);
+  Printf("\tWorkers       : %d\r\n", w->workers);
+  Printf("\tKeep-alive    : %d seconds\r\n", w->keepalive);
 
   Printf("Web options:\r\n");
   OptStat(ctx, &w->options, gConfList);
 
+  if (w->srv) {
+    struct http_server_stats	st;
+
+    http_server_get_stats(w->srv, &st);
+    Printf("Web server statistics:\r\n");
+    Printf("\tConnections   : %u (%u idle)\r\n", st.conn_active, st.conn_idle);
+    Printf("\tWorkers busy  : %u of %u\r\n", st.workers_busy, st.workers);
+    Printf("\tAccepted      : %llu\r\n", (unsigned long long)st.conn_total);
+    Printf("\tRequests      : %llu (%llu on kept alive connections)\r\n",
+	(unsigned long long)st.requests, (unsigned long long)st.requests_reused);
+    Printf("\tRequest time  : %llu us avg, %llu us max\r\n",
+	(unsigned long long)(st.requests ? st.req_time_total / st.requests : 0),
+	(unsigned long long)st.req_time_max);
+  }
+
   return 0;
 }
 
@@ -241,6 +283,7 @@ WebShowHTMLSummary(FILE *f, int priv)
   Link  	L;
   Rep		R;
   char		buf[64],buf2[64];
+  char		abuf[INET_ADDRSTRLEN];
 
   fprintf(f, "<h2>Current status summary</h2>\n");
   fprintf(f, "<table>\n");
@@ -345,7 +388,8 @@ WebShowHTMLSummary(FILE *f, int priv)
 		    PhysGetPeerAddr(L, buf, sizeof(buf));
 		    fprintf(f, "<td>%s</td>\n", buf);
 		    if (L->bund != NULL)
-			fprintf(f, "<td>%s</td>\n", inet_ntoa(L->bund->ipcp.peer_addr));
+			fprintf(f, "<td>%s</td>\n",
+			    inet_ntop(AF_INET, &L->bund->ipcp.peer_addr, abuf, sizeof(abuf)));
 		    else
 			fprintf(f, "<td>&#160;</td>\n");
 		    PhysGetCallingNum(L, buf, sizeof(buf));
@@ -409,7 +453,8 @@ WebShowHTMLSummary(FILE *f, int priv)
 		    PhysGetPeerAddr(L, buf, sizeof(buf));
 		    fprintf(f, "<td>%s</td>\n", buf);
 		    if (L->bund != NULL)
-			fprintf(f, "<td>%s</td>\n", inet_ntoa(L->bund->ipcp.peer_addr));
+			fprintf(f, "<td>%s</td>\n",
+			    inet_ntop(AF_INET, &L->bund->ipcp.peer_addr, abuf, sizeof(abuf)));
 		    else
 			fprintf(f, "<td>&#160;</td>\n");
 		    PhysGetCallingNum(L, buf, sizeof(buf));
@@ -449,6 +494,7 @@ WebShowJSONSummary(FILE *f, int priv)
   Link  	L;
   Rep		R;
   char		buf[64],buf2[64];
+  char		abuf[INET_ADDRSTRLEN];
 
   (void)priv;
   int first_l = 1;
@@ -528,7 +574,8 @@ WebShowJSONSummary(FILE *f, int priv)
 		    fprintf(f, "\"peer_ip\": \"%s\",\n", buf);
 
 		    if (L->bund != NULL)
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", inet_ntoa(L->bund->ipcp.peer_addr));
+			fprintf(f, "\"ipcp_ip\": \"%s\",\n",
+			    inet_ntop(AF_INET, &L->bund->ipcp.peer_addr, abuf, sizeof(abuf)));
 		    else
 			fprintf(f, "\"ipcp_ip\": \"%s\",\n", "");
 
@@ -584,7 +631,8 @@ WebShowJSONSummary(FILE *f, int priv)
 		    fprintf(f, "\"peer_ip\": \"%s\",\n", buf);
 
 		    if (L->bund != NULL)
-			fprintf(f, "\"ipcp_ip\": \"%s\",\n", inet_ntoa(L->bund->ipcp.peer_addr));
+			fprintf(f, "\"ipcp_ip\": \"%s\",\n",
+			    inet_ntop(AF_INET, &L->bund->ipcp.peer_addr, abuf, sizeof(abuf)));
 		    else
 			fprintf(f, "\"ipcp_ip\": \"%s\",\n", "");
 
@@ -731,6 +779,193 @@ done:
     RESETREF(cs->context.rep, NULL);
 }
 
+/*
+ * WebShowJSONSessions()
+ *
+ * One page of sessions starting from link number "cursor", optionally
+ * filtered by "state" (up/down/all), "user" and "iface". The giant lock is
+ * held only while the page is copied, and at most WEB_JSON_SCAN_MAX
+ * link slots are examined, so a sparse match just returns a short page
+ * with the cursor to continue from.
+ */
+
+static void
+WebShowJSONSessions(FILE *f, struct http_request *req)
+{
+    struct statshm_session	*sess;
+    const char		*state, *user, *iface, *v;
+    int			cursor = 0, limit = WEB_JSON_PAGE_DEFAULT;
+    int			n = 0, k, end, more;
+    uint64_t		seq;
+    Link		L;
+
+    if ((v = http_request_get_value(req, "cursor", 0)) != NULL)
+	cursor = atoi(v);
+    if ((v = http_request_get_value(req, "limit", 0)) != NULL)
+	limit = atoi(v);
+    if (cursor < 0)
+	cursor = 0;
+    if (limit < 1)
+	limit = WEB_JSON_PAGE_DEFAULT;
+    else if (limit > WEB_JSON_PAGE_MAX)
+	limit = WEB_JSON_PAGE_MAX;
+    state = http_request_get_value(req, "state", 0);
+    user = http_request_get_value(req, "user", 0);
+    iface = http_request_get_value(req, "iface", 0);
+
+    sess = Malloc(MB_WEB, limit * sizeof(*sess));
+
+    pthread_cleanup_push(WebServletRunCleanup, NULL);
+    GIANT_MUTEX_LOCK();
+    seq = StatsEventSeq();
+    end = cursor + WEB_JSON_SCAN_MAX;
+    if (end > gNumLinks)
+	end = gNumLinks;
+    for (k = cursor; k < end && n < limit; k++) {
+	if ((L = gLinks[k]) == NULL || L->tmpl || L->dead)
+	    continue;
+	if (state != NULL && strcmp(state, "all") != 0 &&
+	  (strcmp(state, "up") == 0) != (L->state == PHYS_STATE_UP))
+	    continue;
+	if (user != NULL && strcmp(user, L->lcp.auth.params.authname) != 0)
+	    continue;
+	if (iface != NULL && (L->bund == NULL ||
+	  strcmp(iface, L->bund->iface.ifname) != 0))
+	    continue;
+	StatsFillSession(L, &sess[n++]);
+    }
+    more = (k < gNumLinks);
+    GIANT_MUTEX_UNLOCK();
+    pthread_cleanup_pop(0);
+
+    fprintf(f, "{\n\"seq\": %ju,\n", (uintmax_t)seq);
+    if (more)
+	fprintf(f, "\"next\": %d,\n", k);
+    else
+	fprintf(f, "\"next\": null,\n");
+    fprintf(f, "\"sessions\":[\n");
+    for (k = 0; k < n; k++) {
+	if (k > 0)
+	    fprintf(f, ",\n");
+	WebJSONSession(f, &sess[k]);
+    }
+    fprintf(f, "]\n}\n");
+    Freee(sess);
+}
+
+/*
+ * WebShowJSONEvents()
+ *
+ * Session up/down events following sequence number "since". If some
+ * of them are already lost, "reset" tells the client to fetch the
+ * session list again.
+ */
+
+static void
+WebShowJSONEvents(FILE *f, struct http_request *req)
+{
+    struct statsevent	*ev;
+    const char		*v;
+    uint64_t		since = 0, seq;
+    int			limit = WEB_JSON_PAGE_DEFAULT;
+    int			n, k;
+
+    if ((v = http_request_get_value(req, "since", 0)) != NULL)
+	since = strtoull(v, NULL, 10);
+    if ((v = http_request_get_value(req, "limit", 0)) != NULL)
+	limit = atoi(v);
+    if (limit < 1)
+	limit = WEB_JSON_PAGE_DEFAULT;
+    else if (limit > WEB_JSON_PAGE_MAX)
+	limit = WEB_JSON_PAGE_MAX;
+
+    ev = Malloc(MB_WEB, limit * sizeof(*ev));
+
+    pthread_cleanup_push(WebServletRunCleanup, NULL);
+    GIANT_MUTEX_LOCK();
+    seq = StatsEventSeq();
+    n = StatsEventsGet(since, ev, limit);
+    GIANT_MUTEX_UNLOCK();
+    pthread_cleanup_pop(0);
+
+    if (n < 0) {
+	fprintf(f, "{\n\"seq\": %ju,\n\"reset\": true,\n\"events\":[]\n}\n",
+	    (uintmax_t)seq);
+	Freee(ev);
+	return;
+    }
+    fprintf(f, "{\n\"seq\": %ju,\n\"reset\": false,\n\"more\": %s,\n",
+	(uintmax_t)(n > 0 ? ev[n - 1].seq : (since < seq ? since : seq)),
+	(n > 0 && ev[n - 1].seq < seq) ? "true" : "false");
+    fprintf(f, "\"events\":[\n");
+    for (k = 0; k < n; k++) {
+	if (k > 0)
+	    fprintf(f, ",\n");
+	fprintf(f, "{\n\"seq\": %ju,\n\"time\": %jd,\n\"event\": \"%s\",\n"
+	    "\"session\": ", (uintmax_t)ev[k].seq, (intmax_t)ev[k].when,
+	    ev[k].type == STATS_EVENT_UP ? "up" : "down");
+	WebJSONSession(f, &ev[k].sess);
+	fprintf(f, "}");
+    }
+    fprintf(f, "]\n}\n");
+    Freee(ev);
+}
+
+/*
+ * WebJSONSession()
+ */
+
+static void
+WebJSONSession(FILE *f, const struct statshm_session *s)
+{
+    struct in_addr	a;
+    char		abuf[INET_ADDRSTRLEN];
+
+    fprintf(f, "{\n");
+    fprintf(f, "\"id\": %u,\n", s->link_id);
+    WebJSONString(f, "link", s->link);
+    WebJSONString(f, "bundle", s->bund);
+    WebJSONString(f, "iface", s->iface);
+    WebJSONString(f, "type", s->type);
+    WebJSONString(f, "auth", s->authname);
+    WebJSONString(f, "session_id", s->session_id);
+    fprintf(f, "\"lcp\": \"%s\",\n", FsmStateName(s->lcp_state));
+    fprintf(f, "\"state\": \"%s\",\n", gPhysStateNames[s->phys_state]);
+    WebJSONString(f, "peer_ip", s->peer_addr);
+    WebJSONString(f, "calling_num", s->calling_num);
+    a.s_addr = s->ipcp_addr;
+    fprintf(f, "\"ipcp_ip\": \"%s\",\n", s->ipcp_addr ?
+	inet_ntop(AF_INET, &a, abuf, sizeof(abuf)) : "");
+    fprintf(f, "\"up_since\": %jd,\n", (intmax_t)s->up_since);
+    fprintf(f, "\"updated\": %jd,\n", (intmax_t)s->updated);
+    fprintf(f, "\"in_octets\": %ju,\n", (uintmax_t)s->recvOctets);
+    fprintf(f, "\"in_frames\": %ju,\n", (uintmax_t)s->recvFrames);
+    fprintf(f, "\"out_octets\": %ju,\n", (uintmax_t)s->xmitOctets);
+    fprintf(f, "\"out_frames\": %ju\n", (uintmax_t)s->xmitFrames);
+    fprintf(f, "}");
+}
+
+/*
+ * WebJSONString()
+ *
+ * Print a "name": "value" pair, escaping the value.
+ */
+
+static void
+WebJSONString(FILE *f, const char *name, const char *s)
+{
+    fprintf(f, "\"%s\": \"", name);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(f, "\\%c", *s);
+	else if ((u_char)*s < 0x20)
+	    fprintf(f, "\\u%04x", (u_char)*s);
+	else
+	    putc(*s, f);
+    }
+    fprintf(f, "\",\n");
+}
+
 static void
 WebServletRunCleanup(void *cookie) NO_THREAD_SAFETY_ANALYSIS
 {
@@ -783,6 +1018,16 @@ WebServletRun(struct http_servlet *servlet,
     if (!strcmp(path,"/mpd.css")) {
 	http_response_set_header(resp, 0, "Content-Type", "text/css");
 	WebShowCSS(f);
+    } else if (!strcmp(path,"/json/sessions") || !strcmp(path,"/json/events")) {
+	http_response_set_header(resp, 0, "Content-Type", "application/json");
+	http_response_set_header(resp, 1, "Pragma", "no-cache");
+	http_response_set_header(resp, 1, "Cache-Control", "no-cache, must-revalidate");
+
+	if (!strcmp(path,"/json/sessions"))
+	    WebShowJSONSessions(f, req);
+	else
+	    WebShowJSONEvents(f, req);
+
     } else if (!strcmp(path,"/bincmd") || !strcmp(path,"/json")) {
 	http_response_set_header(resp, 0, "Content-Type", "text/plain");
 	http_response_set_header(resp, 1, "Pragma", "no-cache");
@@ -854,7 +1099,7 @@ static int
 WebSetCommand(Context ctx, int ac, const char *const av[], const void *arg) 
 {
   Web	 		w = &gWeb;
-  int			port;
+  int			port, val;
 
   switch ((intptr_t)arg) {
 
@@ -889,6 +1134,30 @@ WebSetCommand(Context ctx, int ac, const char *const av[], const void *arg)
       }
       break;
 
+    case SET_MAX_CONN:
+    case SET_WORKERS:
+    case SET_KEEPALIVE:
+      if (ac != 1)
+	return(-1);
+
+      val = atoi(av[0]);
+      if ((intptr_t)arg == SET_MAX_CONN) {
+	if (val < 1 || val > 65536)
+	    Error("Incorrect connections limit");
+	w->max_conn = val;
+      } else if ((intptr_t)arg == SET_WORKERS) {
+	if (val < 1 || val > 64)
+	    Error("Incorrect number of workers");
+	w->workers = val;
+      } else {
+	if (val < 1 || val > 3600)
+	    Error("Incorrect keep-alive timeout");
+	w->keepalive = val;
+      }
+      if (w->srv)
+	http_server_set_limits(w->srv, w->max_conn, w->workers, w->keepalive);
+      break;
+
     default:
       return(-1);
 
@@ -31,10 +31,17 @@ enum {
 	WEB_AUTH			/* enable auth */
 };
 
+#define WEB_DEFAULT_MAX_CONN	1024
+#define WEB_DEFAULT_WORKERS	4
+#define WEB_DEFAULT_KEEPALIVE	15
+
 struct web {
 	struct optinfo options;
 	struct u_addr addr;
 	in_port_t port;
+	int max_conn;			/* connection limit */
+	int workers;			/* request worker threads */
+	int keepalive;			/* idle keep-alive timeout */
 	struct http_server *srv;
 	struct http_servlet srvlet;
 	EventRef event;			/* connect-event */